@@ -25,9 +25,11 @@ BINDIR = $(PRJDIR)/bin
 
 RELFLAGS = -Wall
 DBGFLAGS = 
+# add -mssse3 (or -march=native on x86) to unpack 11 bits LIs 8 at a time, see rlc_unpack_li()
 OPTFLAGS = -g
+DEFS = 
 
-CPPFLAGS = $(DBGFLAGS) $(OPTFLAGS) $(RELFLAGS) -I$(INCL)
+CPPFLAGS = $(DBGFLAGS) $(OPTFLAGS) $(RELFLAGS) $(DEFS) -I$(INCL)
 CFLAGS   := $(CPPFLAGS)
 AFLAGS   := rcv
 LDFLAGS  = -L$(LIBDIR)
@@ -28,19 +28,19 @@
 
 #define MAC_LCID_MAX 0x0A+1
 
-#pragma pack(1)
+/* MAC subheader of 36.321: R/R/E/LCID, then F/L of 7 or 15 bits */
+#define MAC_SUBHEAD_E 0x20
+#define MAC_SUBHEAD_F 0x80
+#define MAC_SUBHEAD_LCID 0x1F
+#define MAC_SUBHEAD_MAX (RLC_LCP_PDU_MAX + 3)	/* MAC SDUs and padding */
 
+/* parsed MAC subheader */
 typedef struct mac_pdu_subhead
 {
-	u32 r:2;
-	u32 e:1;
-	u32 lc_id:5;
-	u32 f:1;
-	u32 l:15;
+	u32 lc_id;
+	u32 l;
 }mac_pdu_subhead_t;
 
-#pragma pack()
-
 /* TBS table defined in 36.213 */
 #define NB_PRB 110
 #define MAC_TBS_MAX_SIZE (75376/8)
@@ -78,8 +78,13 @@ static int mac_tbs_table[] =
 
 
 
-rlc_entity_general_t g_rlc_entity_nb[MAC_LCID_MAX];
-rlc_entity_general_t g_rlc_entity_ue[MAC_LCID_MAX];
+/* one UE in one cell, eNB and UE side entities are in their own registry */
+#define EXAMPLE_CELL 0
+#define EXAMPLE_RNTI 0x3D
+
+rlc_registry_t *g_rlc_reg_nb;
+rlc_registry_t *g_rlc_reg_ue;
+rlc_lcp_ue_t g_lcp_ue;				/* logical channels of the UE on eNB side */
 
 
 void *mac_alloc_buf(u32 size)
@@ -150,162 +155,102 @@ int mac_get_tbs(u32 sdu_size)
 }
 
 /* build MAC pdu: 
- * only one rlc_entity considered
+ * logical channels of the UE share the TBS by LCP of lib-RLC
  * no other control elements except padding control element */
 #define RESERVE_SPACE 100
-int mac_build_pdu(u32 lc_id, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *pdu_type)
+int mac_build_pdu(rlc_lcp_ue_t *ue, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *n_held)
 {
-	rlc_entity_um_t *rlc_um;
-	rlc_entity_um_tx_t *rlc_umtx = NULL;
-	rlc_entity_am_t *rlc_am;
-	rlc_entity_am_tx_t *rlc_amtx = NULL;
-	u8 *pdu, *cookie;
-	mac_pdu_subhead_t *mac_subhead = NULL;
+	rlc_mac_pdu_desc_t desc;
+	u8 *pdu, *payload, *cookie;
 	u32 headsize, offset = 0;
-	u32 padding = 0;
-	
-	u32 final_rlc_pdu_size = 0, rlc_pdu_size = 0, mac_tbs;
-	rlc_entity_common_head_t *rlc_entity;
+	u32 padding, pad_after, i, last;
+	u32 pending, mac_tbs;
 
 	*mac_pdu_size = 0;
 	
-	assert(lc_id < MAC_LCID_MAX);
-	rlc_entity = (rlc_entity_common_head_t *)&g_rlc_entity_nb[lc_id];
-	
-	if(rlc_entity->type == RLC_ENTITY_TYPE_UM)
-	{
-		rlc_um = (rlc_entity_um_t *)rlc_entity;
-		rlc_umtx = &(rlc_um->umtx);
-		
-		/* get all RLC sdu size in RLC SDU queue */
-		rlc_pdu_size = rlc_um_tx_estimate_pdu_size(rlc_umtx);
-	}
-	else if(rlc_entity->type == RLC_ENTITY_TYPE_AM)
-	{
-		rlc_am = (rlc_entity_am_t *)rlc_entity;
-		rlc_amtx = &(rlc_am->amtx);
-		
-		/* get all RLC sdu size in RLC SDU queue */
-		rlc_pdu_size = rlc_am_tx_estimate_pdu_size(rlc_amtx, NULL);
-	}
-	else
-		return 0;
-		
-	if(rlc_pdu_size == 0)
+	/* get all RLC sdu size of the UE */
+	pending = rlc_lcp_pending_bytes(ue);
+	if(pending == 0)
 		return 0;
 		
 	/* get TBS: TBS is determinated by MAC UL or DL scheduler respectively */
-	mac_tbs = mac_get_tbs(rlc_pdu_size);
-	if(mac_tbs < 3)		/* at least: a subhead + a rlc status pdu */
-		return 0;
+	mac_tbs = mac_get_tbs(pending);
 	
-	/* truncate rlc_pdu_size */
-	if(rlc_pdu_size >= mac_tbs - 1)
-		rlc_pdu_size = mac_tbs - 1;
-		
 	/* get buffer: reserve space (100 bytes) is reserved for mac subhead, control element, etc. */
 	cookie = (u8 *)mac_alloc_buf(mac_tbs+RESERVE_SPACE);
 	assert(cookie);
+	payload = cookie + RESERVE_SPACE;
 	
-	/* To avoid copying RLC PDU to MAC buffer, we firstly build RLC PDU,
-	   because the real built size may less than the estimated rlc_pdu_size, 
-	   even that is quite less possible.
+	/* To avoid copying RLC PDU to MAC buffer, we firstly build RLC PDUs,
+	   then MAC subheads are put in front of them.
 	 */
-	if(rlc_entity->type == RLC_ENTITY_TYPE_UM)
+	if(rlc_lcp_build_pdu(ue, rlc_get_time(), payload, mac_tbs, cookie, &desc) == 0)
 	{
-		final_rlc_pdu_size = rlc_um_tx_build_pdu(rlc_umtx, cookie+RESERVE_SPACE, rlc_pdu_size);
-		if(final_rlc_pdu_size == 0)
-		{
-			free(cookie);
-			return 0;
-		}
-	}
-	else if(rlc_entity->type == RLC_ENTITY_TYPE_AM)
-	{
-		final_rlc_pdu_size = rlc_am_tx_build_pdu(rlc_amtx, cookie+RESERVE_SPACE, rlc_pdu_size, cookie, pdu_type);
-		if(final_rlc_pdu_size == 0)
-		{
-			free(cookie);
-			return 0;
-		}
+		free(cookie);
+		return 0;
 	}
 	
-	rlc_pdu_size = final_rlc_pdu_size;
-	
-	/* has padding? */
-	if(rlc_pdu_size < mac_tbs - 1)
-	{
-		if(rlc_pdu_size + 1 >= mac_tbs - 2)
-		{
-			padding = 1;	/* padding before */
-			headsize = mac_tbs - rlc_pdu_size;
-		}
-		else
-		{
-			padding = 2;	/* padding after */
-			headsize = 3 + (rlc_pdu_size>=128);
-		}
-	}
+	/* the last subhead has no L field, unless padding follows */
+	headsize = desc.head_size - desc.pdu[desc.n_pdu-1].head_len + 1;
+	padding = mac_tbs - headsize - desc.payload_size;
+	pad_after = (padding >= 3);
+	if(pad_after)
+		headsize = desc.head_size + 1;
 	else
-		headsize = 1;
+		headsize += padding;	/* padding subheads before */
 	
 	/* now fix the start point of MAC PDU */
 	assert(headsize < RESERVE_SPACE);
-	pdu = cookie+RESERVE_SPACE-headsize;
+	pdu = payload - headsize;
 	
 	/* padding before */
-	if(padding == 1)
-	{
-		while(rlc_pdu_size + 1 + offset < mac_tbs)
-		{
-			mac_subhead = (mac_pdu_subhead_t *)(pdu + offset);
-			mac_subhead->r = 0;
-			mac_subhead->e = 0;
-			mac_subhead->lc_id = MAC_UL_LCID_PADDING;
-			offset ++;
-		}
-	}
+	for(i=0; !pad_after && i<padding; i++)
+		pdu[offset++] = MAC_SUBHEAD_E | MAC_UL_LCID_PADDING;
 	
 	/* build normal subhead */
-	mac_subhead = (mac_pdu_subhead_t *)(pdu + offset);
-	mac_subhead->r = 0;
-	mac_subhead->e = (padding == 2);
-	mac_subhead->lc_id = lc_id;
-	if(mac_subhead->e)
+	for(i=0; i<desc.n_pdu; i++)
 	{
-		if(rlc_pdu_size < 128)
-		{
-			*(pdu + offset + 1) = rlc_pdu_size;
-			offset += 2;
-		}
+		last = (i == desc.n_pdu-1) && !pad_after;
+		pdu[offset++] = (last?0:MAC_SUBHEAD_E) | desc.pdu[i].lcid;
+		if(last)
+			break;
+		
+		if(desc.pdu[i].head_len == 2)
+			pdu[offset++] = desc.pdu[i].length;
 		else
 		{
-			mac_subhead->f = 1;
-			mac_subhead->l = rlc_pdu_size;
-			offset += 3;
+			pdu[offset++] = MAC_SUBHEAD_F | (desc.pdu[i].length >> 8);
+			pdu[offset++] = desc.pdu[i].length & 0xFF;
 		}
 	}
-	else
-		offset ++;		//no padding 
 	
 	/* padding after */
-	if(padding == 2)
+	if(pad_after)
 	{
-		mac_subhead = (mac_pdu_subhead_t *)(pdu + offset);
-		mac_subhead->r = 0;
-		mac_subhead->e = 0;
-		mac_subhead->lc_id = MAC_UL_LCID_PADDING;
-		offset ++;
+		pdu[offset++] = MAC_UL_LCID_PADDING;
+		memset(payload + desc.payload_size, 0, mac_tbs - headsize - desc.payload_size);
 	}
+	assert(offset == headsize);
 	
 	*mac_pdu = pdu;
 	*mac_pdu_size = mac_tbs;
 	*buf = cookie;
+	*n_held = desc.n_held;
 	
 	return 1;
 }
 
-/* process MAC PDU (UE side) */
+u8 *copy_pdu_to_rx(u8 *pdu_src, u32 len)
+{
+	u8 *pdu_dst;
+
+	pdu_dst = mac_alloc_buf(len);
+	memcpy(pdu_dst, pdu_src, len);
+
+	return pdu_dst;
+}
+
+/* process MAC PDU (UE side), each RLC PDU is copied out as it's freed by RLC */
 int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 {
 	u32 lc_id;
@@ -314,17 +259,17 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 	u32 n_sdu = 0;
 	int left_len = pdu_len;
 	u8 *mac_sdu = NULL;
-	mac_pdu_subhead_t *subhead_ptr = (mac_pdu_subhead_t *)mac_pdu;
-	mac_pdu_subhead_t subhead[32];
+	u8 *subhead_ptr = mac_pdu;
+	mac_pdu_subhead_t subhead[MAC_SUBHEAD_MAX];
 
 	/* parse subhead */
-	while(left_len > 0)
+	while(left_len > 0 && n_sdu < MAC_SUBHEAD_MAX)
 	{
-		if(subhead_ptr->e == 0)
+		subhead[n_sdu].lc_id = subhead_ptr[0] & MAC_SUBHEAD_LCID;
+		if((subhead_ptr[0] & MAC_SUBHEAD_E) == 0)
 		{
-			subhead[n_sdu].lc_id = subhead_ptr->lc_id;
 			subhead[n_sdu].l = left_len-1;
-			mac_sdu = (u8 *)subhead_ptr + 1;			//this first SDU pointer
+			mac_sdu = subhead_ptr + 1;			//this first SDU pointer
 			n_sdu ++;
 			left_len = 0;
 			break;
@@ -332,8 +277,7 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 		else
 		{
 			int head_len = 1;
-			subhead[n_sdu].lc_id = subhead_ptr->lc_id;
-			switch(subhead_ptr->lc_id)
+			switch(subhead[n_sdu].lc_id)
 			{
 				case MAC_DL_LCID_UCRI:
 					subhead[n_sdu].l = 6;
@@ -346,20 +290,20 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 					subhead[n_sdu].l = 0;
 					break;
 				default:
-					if(subhead_ptr->f)
+					if(subhead_ptr[1] & MAC_SUBHEAD_F)
 					{
 						head_len = 3;
-						subhead[n_sdu].l = subhead_ptr->l;
+						subhead[n_sdu].l = ((subhead_ptr[1] & 0x7F) << 8) | subhead_ptr[2];
 					}
 					else
 					{
 						head_len = 2;
-						subhead[n_sdu].l = (subhead_ptr->l >> 8);
+						subhead[n_sdu].l = subhead_ptr[1];
 					}
 					break;
 			}
 			left_len -= head_len + subhead[n_sdu].l;
-			subhead_ptr = (mac_pdu_subhead_t *)((u8 *)subhead_ptr + head_len);
+			subhead_ptr += head_len;
 			n_sdu ++;
 		}
 	}
@@ -367,6 +311,7 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 	if(mac_sdu == NULL || n_sdu == 0 || left_len != 0)
 	{
 		ZLOG_ERR("mac_sdu=0x%p n_sdu=%u left_len=%d.\n", mac_sdu, n_sdu, left_len);
+		free(mac_pdu);
 		return -1;
 	}
 	
@@ -393,14 +338,20 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 				assert(l > 0);
 				assert(lc_id < MAC_LCID_MAX);
 								
-				rlc_entity_common_head_t *rlc_entity = (rlc_entity_common_head_t *)&(g_rlc_entity_ue[lc_id]);
+				rlc_entity_common_head_t *rlc_entity = rlc_registry_find(g_rlc_reg_ue, EXAMPLE_CELL, EXAMPLE_RNTI, lc_id);
+				u8 *rlc_pdu = copy_pdu_to_rx(mac_sdu, l);
 
 				/* process RLC PDU */
-				if(rlc_entity->type == RLC_ENTITY_TYPE_UM)
+				if(rlc_entity == NULL)
+				{
+					ZLOG_WARN("no RLC entity: lcid=%u\n", lc_id);
+					free(rlc_pdu);
+				}
+				else if(rlc_entity->type == RLC_ENTITY_TYPE_UM)
 				{
 					rlc_entity_um_t *rlc_entity_um = (rlc_entity_um_t *)rlc_entity;
 											
-					if(rlc_um_rx_process_pdu(&rlc_entity_um->umrx, mac_sdu, l, mac_pdu) != 0)
+					if(rlc_um_rx_process_pdu(&rlc_entity_um->umrx, rlc_pdu, l, rlc_pdu) != 0)
 					{
 						ZLOG_WARN("rlc_um_rx_process_pdu() failure.\n");
 					}
@@ -409,13 +360,16 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 				{
 					rlc_entity_am_t *rlc_entity_am = (rlc_entity_am_t *)rlc_entity;
 					
-					if(rlc_am_rx_process_pdu(&rlc_entity_am->amrx, mac_sdu, l, mac_pdu) != 0)
+					if(rlc_am_rx_process_pdu(&rlc_entity_am->amrx, rlc_pdu, l, rlc_pdu) != 0)
 					{
 						ZLOG_WARN("rlc_am_rx_process_pdu() failure.\n");
 					}
 				}
 				else
+				{
 					ZLOG_WARN("unknown RLC type: %d\n", rlc_entity->type);
+					free(rlc_pdu);
+				}
 
 				break;
 			}
@@ -425,24 +379,15 @@ int mac_process_pdu(u8 *mac_pdu, u32 pdu_len)
 		mac_sdu += l;
 	}
 	
+	free(mac_pdu);
 	return ret;
 }
 
-u8 *copy_pdu_to_rx(u8 *pdu_src, u32 len)
-{
-	u8 *pdu_dst;
-
-	pdu_dst = mac_alloc_buf(len);
-	memcpy(pdu_dst, pdu_src, len);
-
-	return pdu_dst;
-}
-
 int main(int argc, char *argv[])
 {
 	u32 tti, n_tti = 10;
 	u32 i;
-	u32 pdu_type;
+	u32 pdu_type, n_held;
 	u32 sdu_size;
 	u32 mac_pdu_size;
 	u8 *sdu_ptr, *buffer, *mac_pdu, *new_mac_pdu;
@@ -452,24 +397,37 @@ int main(int argc, char *argv[])
 	/* global init */
 	rlc_init();
 	
+	g_rlc_reg_nb = rlc_registry_create(0, 4, 4);
+	g_rlc_reg_ue = rlc_registry_create(0, 4, 4);
+	assert(g_rlc_reg_nb && g_rlc_reg_ue);
+	
 	/********************************************************************
 	 * 1)UM example 
 	 ********************************************************************/
+	rlc_entity_um_t *nb_um, *ue_um;
 	rlc_entity_um_tx_t *rlc_umtx;
 	
 	/* init rlc entity */
-	rlc_um_init(&(g_rlc_entity_nb[1].rlc_um), 10/*sn_bits*/, 512/*UM_Window_Size*/, 5/*t_Reordering*/,
+	nb_um = rlc_registry_add(g_rlc_reg_nb, EXAMPLE_CELL, EXAMPLE_RNTI, 1, RLC_ENTITY_TYPE_UM);
+	ue_um = rlc_registry_add(g_rlc_reg_ue, EXAMPLE_CELL, EXAMPLE_RNTI, 1, RLC_ENTITY_TYPE_UM);
+	assert(nb_um && ue_um);
+
+	rlc_um_init(nb_um, 10/*sn_bits*/, 512/*UM_Window_Size*/, 5/*t_Reordering*/,
 			mac_free_pdu, mac_free_sdu);
 
-	rlc_um_init(&(g_rlc_entity_ue[1].rlc_um), 10/*sn_bits*/, 512/*UM_Window_Size*/, 5/*t_Reordering*/,
+	rlc_um_init(ue_um, 10/*sn_bits*/, 512/*UM_Window_Size*/, 5/*t_Reordering*/,
 			mac_free_pdu, mac_free_sdu);
 	
+	/* MAC of eNB shares TBS among logical channels of the UE */
+	rlc_lcp_init(&g_lcp_ue, EXAMPLE_CELL, EXAMPLE_RNTI, rlc_get_time());
+	rlc_lcp_add_lch(&g_lcp_ue, g_rlc_reg_nb, 1, 6/*priority*/, 8/*PBR: 64kbps*/, 100/*BSD: 100ms*/);
+	
 	/* more: 
 	   User can call rlc_um_set_deliv_func() here, so user can process sdu later.
 	   User can also set logical channal ID and private data in RLC entity here.
 	 */
 
-	rlc_umtx = &(g_rlc_entity_nb[1].rlc_um.umtx);
+	rlc_umtx = &(nb_um->umtx);
 	
 	for(tti=0; tti < n_tti; tti++)
 	{
@@ -482,12 +440,12 @@ int main(int argc, char *argv[])
 		{
 			sdu_size = (rand() % 400) + 1;
 			sdu_ptr = rlc_create_sdu(sdu_size, 1);
-			rlc_um_tx_sdu_enqueue(rlc_umtx, sdu_ptr, sdu_size, NULL);
+			rlc_um_tx_sdu_enqueue(rlc_umtx, sdu_ptr, sdu_size, NULL, NULL);
 		}
 		
 		/* build MAC pdu */
-		/* u32 lc_id, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *pdu_type */
-		if(mac_build_pdu(1, &mac_pdu, &mac_pdu_size, &buffer, NULL) == 0)
+		/* rlc_lcp_ue_t *ue, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *n_held */
+		if(mac_build_pdu(&g_lcp_ue, &mac_pdu, &mac_pdu_size, &buffer, &n_held) == 0)
 		{
 			ZLOG_ERR("failed to build MAC PDU\n");
 			continue;
@@ -512,10 +470,15 @@ int main(int argc, char *argv[])
 	/********************************************************************
 	 * 2)AM example 
 	 ********************************************************************/
+	rlc_entity_am_t *nb_am, *ue_am;
 	rlc_entity_am_tx_t *rlc_amtx;
 	
 	/* init rlc entity */
-	rlc_am_init(&(g_rlc_entity_nb[3].rlc_am), 
+	nb_am = rlc_registry_add(g_rlc_reg_nb, EXAMPLE_CELL, EXAMPLE_RNTI, 3, RLC_ENTITY_TYPE_AM);
+	ue_am = rlc_registry_add(g_rlc_reg_ue, EXAMPLE_CELL, EXAMPLE_RNTI, 3, RLC_ENTITY_TYPE_AM);
+	assert(nb_am && ue_am);
+
+	rlc_am_init(nb_am, 
 					3 /*t_Reordering*/, 
 					4 /* t_StatusPdu */,
 					3 /*t_StatusProhibit*/, 
@@ -526,7 +489,7 @@ int main(int argc, char *argv[])
 					mac_free_pdu /*void (*free_pdu)(void *, void *)*/,	
 					mac_free_sdu /*void (*free_sdu)(void *, void *)*/);
 	
-	rlc_am_init(&(g_rlc_entity_ue[3].rlc_am), 
+	rlc_am_init(ue_am, 
 					3 /*t_Reordering*/, 
 					4 /* t_StatusPdu */,
 					3 /*t_StatusProhibit*/, 
@@ -538,8 +501,10 @@ int main(int argc, char *argv[])
 					mac_free_sdu /*void (*free_sdu)(void *, void *)*/);
 
 	/* more: user can call rlc_am_set_deliv_func() here, so user can process sdu later */
+	
+	rlc_lcp_add_lch(&g_lcp_ue, g_rlc_reg_nb, 3, 7/*priority*/, RLC_LCP_PBR_INFINITY, 0/*BSD*/);
 
-	rlc_amtx = &(g_rlc_entity_nb[3].rlc_am.amtx);
+	rlc_amtx = &(nb_am->amtx);
 	for(tti=0; tti < n_tti; tti++)
 	{
 		ZLOG_DEBUG("TTI=%d *************************************\n", tti);
@@ -551,12 +516,12 @@ int main(int argc, char *argv[])
 		{
 			sdu_size = (rand() % 400) + 1;
 			sdu_ptr = rlc_create_sdu(sdu_size, 1);
-			rlc_am_tx_sdu_enqueue(rlc_amtx, sdu_ptr, sdu_size, NULL);
+			rlc_am_tx_sdu_enqueue(rlc_amtx, sdu_ptr, sdu_size, NULL, NULL);
 		}
 		
 		/* build MAC pdu */
-		/* u32 lc_id, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *pdu_type */
-		if(mac_build_pdu(3, &mac_pdu, &mac_pdu_size, &buffer, &pdu_type) == 0)
+		/* rlc_lcp_ue_t *ue, u8 **mac_pdu, u32 *mac_pdu_size, u8 **buf, u32 *n_held */
+		if(mac_build_pdu(&g_lcp_ue, &mac_pdu, &mac_pdu_size, &buffer, &n_held) == 0)
 		{
 			ZLOG_ERR("failed to build MAC PDU\n");
 			continue;
@@ -571,9 +536,11 @@ int main(int argc, char *argv[])
 		new_mac_pdu = malloc(mac_pdu_size);
 		assert(new_mac_pdu);
 		memcpy(new_mac_pdu, mac_pdu, mac_pdu_size);
-		/* It is up to user to free status/ReTx PDU for RLC AM */
-		if(pdu_type != RLC_AM_FRESH_PDU)
-			free(mac_pdu);
+		/* It is up to user to free status/ReTx PDU for RLC AM, each fresh PDU frees 
+		   buffer once: one AM channel here, MAC with more counts references by n_held */
+		assert(n_held <= 1);
+		if(n_held == 0)
+			free(buffer);
 		
 		/* process pdu */
 		mac_process_pdu(new_mac_pdu, mac_pdu_size);
@@ -593,10 +560,10 @@ int main(int argc, char *argv[])
 	
 	rlc_entity_am_tx_t *nbrlc_amtx, *uerlc_amtx;
 	rlc_entity_am_rx_t *nbrlc_amrx, *uerlc_amrx;
-	nbrlc_amtx = &(g_rlc_entity_nb[3].rlc_am.amtx);
-	uerlc_amtx = &(g_rlc_entity_ue[3].rlc_am.amtx);
-	nbrlc_amrx = &(g_rlc_entity_nb[3].rlc_am.amrx);
-	uerlc_amrx = &(g_rlc_entity_ue[3].rlc_am.amrx);
+	nbrlc_amtx = &(nb_am->amtx);
+	uerlc_amtx = &(ue_am->amtx);
+	nbrlc_amrx = &(nb_am->amrx);
+	uerlc_amrx = &(ue_am->amrx);
 	
 	for(tti=0; tti < n_tti; tti++)
 	{
@@ -609,7 +576,7 @@ int main(int argc, char *argv[])
 		{
 			sdu_size = (rand() % 400) + 1;
 			sdu_ptr = rlc_create_sdu(sdu_size, 1);
-			rlc_am_tx_sdu_enqueue(nbrlc_amtx, sdu_ptr, sdu_size, NULL);
+			rlc_am_tx_sdu_enqueue(nbrlc_amtx, sdu_ptr, sdu_size, NULL, NULL);
 		}
 		
 		/* get all RLC sdu size in RLC SDU queue */
@@ -633,10 +600,7 @@ int main(int argc, char *argv[])
 			/* chance to drop pdu */
 			if((rand()%100) < 10)
 			{
-				rlc_am_pdu_head_t *pdu_hdr;
-				
-				pdu_hdr = (rlc_am_pdu_head_t *)pdu;
-				ZLOG_INFO("pdu is dropped, sn=%u size=%u\n", pdu_hdr->sn, pdu_len);
+				ZLOG_INFO("pdu is dropped, sn=%u size=%u\n", rlc_am_head_get_sn(pdu), pdu_len);
 				if(pdu_type != RLC_AM_FRESH_PDU)
 					mac_free_pdu(pdu, pdu);
 				continue;
@@ -673,6 +637,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* release entities, buffered SDUs and PDUs are freed */
+	rlc_lcp_remove_lch(&g_lcp_ue, 1);
+	rlc_lcp_remove_lch(&g_lcp_ue, 3);
+	rlc_registry_remove(g_rlc_reg_nb, EXAMPLE_CELL, EXAMPLE_RNTI, 1);
+	rlc_registry_remove(g_rlc_reg_ue, EXAMPLE_CELL, EXAMPLE_RNTI, 1);
+	rlc_registry_remove(g_rlc_reg_nb, EXAMPLE_CELL, EXAMPLE_RNTI, 3);
+	rlc_registry_remove(g_rlc_reg_ue, EXAMPLE_CELL, EXAMPLE_RNTI, 3);
+	rlc_registry_destroy(g_rlc_reg_nb);
+	rlc_registry_destroy(g_rlc_reg_ue);
+
 	return 0;
 }
 
@@ -47,6 +47,8 @@ void fastalloc_destroy(fastalloc_t *base)
 	{
 		if(base->bufptr)
 			free(base->bufptr);
+		if(base->elemt_stack)
+			free(base->elemt_stack);
 		
 #if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
 		if(base->elemt_info)
@@ -83,7 +85,7 @@ fastalloc_t *fastalloc_create(u32 elemt_size, u32 elemt_num, u32 alignment_bits,
 {
 	fastalloc_t *base;
 	int i;
-	u32 data_addr;
+	u8 *data_addr;
 	u32 byte_alignment;
 	
 	/* process parameter */
@@ -125,9 +127,8 @@ fastalloc_t *fastalloc_create(u32 elemt_size, u32 elemt_num, u32 alignment_bits,
 		return NULL;
 	}
 	
-	data_addr = (u32)(base->bufptr + byte_alignment);
-	data_addr = data_addr & (~byte_alignment);
-	base->elemt_base = (u8 *)data_addr;
+	data_addr = (u8 *)(((size_t)base->bufptr + byte_alignment) & ~(size_t)byte_alignment);
+	base->elemt_base = data_addr;
 	base->sp = elemt_num - 1;
 	for(i=0; i<elemt_num; i++)
 	{
@@ -190,7 +191,7 @@ void *fastalloc_alloc(fastalloc_t *base)
 	if(base->sp)
 	{
 		base->sp --;
-		data = (void *)base->elemt_stack[base->sp];
+		data = base->elemt_stack[base->sp];
 		base->alloc_cnt ++;
 		
 #if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
@@ -220,6 +221,69 @@ void *fastalloc_alloc(fastalloc_t *base)
 	return data;
 }
 
+/***********************************************************************************/
+/* Function : fastalloc_alloc_bulk                                                 */
+/***********************************************************************************/
+/* Description : - Allocate several buffers from pool at one time                  */
+/*               - Nothing is allocated if pool hasn't enough buffers              */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   base               | i  | pointer to buffer pool                              */
+/*   data               | o  | array to store pointers of buffer                   */
+/*   n                  | i  | number of buffer                                    */
+/*   Return             |    | number of allocated buffer                          */
+/***********************************************************************************/
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+u32 fastalloc_alloc_bulk(fastalloc_t *base, void **data, u32 n, char *filename, u32 lineno)
+#else
+u32 fastalloc_alloc_bulk(fastalloc_t *base, void **data, u32 n)
+#endif
+{
+	u32 i;
+	
+	if(base == NULL || data == NULL)
+		return 0;
+	
+	/* sp always points to next empty element */
+	if(base->sp < n)
+		return 0;
+	
+	for(i=0; i<n; i++)
+	{
+		base->sp --;
+		data[i] = base->elemt_stack[base->sp];
+		
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+		u32 elemt_index;
+		
+		elemt_index = ((u8 *)data[i] - base->elemt_base)/base->elemt_size;
+		if((base->elemt_info[elemt_index].flags & 0x01) == 0x01)
+		{
+			ZLOG_ERR("data has been allocated: %p\n", data[i]);
+			base->alloc_cnt += i;
+			return i;
+		}
+		base->elemt_info[elemt_index].flags |= 0x01;		//mark as allocated
+		base->elemt_info[elemt_index].owner = 0;
+		base->elemt_info[elemt_index].lineno = lineno;
+		base->elemt_info[elemt_index].filename = filename;
+#endif
+
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_HISTORY
+		base->history[base->history_index].flags = FASTALLOC_HISTORY_FALLOCATE;
+		base->history[base->history_index].data = data[i];
+		base->history[base->history_index].lineno = lineno;
+		base->history[base->history_index].filename = filename;
+		base->history_index = (base->history_index + 1)%(base->history_size);
+#endif
+	}
+	base->alloc_cnt += n;
+	
+	return n;
+}
+
 /***********************************************************************************/
 /* Function : fastalloc_free                                                       */
 /***********************************************************************************/
@@ -258,7 +322,7 @@ void fastalloc_free(fastalloc_t *base, void *data)
 		return;
 	}
 	
-	if((u32)elemt & base->byte_align)
+	if((size_t)elemt & base->byte_align)
 	{
 		ZLOG_ERR("invalid data address: %p\n", data);
 		return;
@@ -281,7 +345,7 @@ void fastalloc_free(fastalloc_t *base, void *data)
 	base->elemt_info[elemt_index].filename = filename;
 #endif
 
-	base->elemt_stack[base->sp] = (u32)elemt;
+	base->elemt_stack[base->sp] = elemt;
 	base->free_cnt ++;
 	base->sp ++;
 	
@@ -294,3 +358,70 @@ void fastalloc_free(fastalloc_t *base, void *data)
 #endif
 }
 
+/***********************************************************************************/
+/* Function : fastalloc_free_bulk                                                  */
+/***********************************************************************************/
+/* Description : - Return n buffers to pool                                        */
+/*                                                                                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   base               | i  | pointer to buffer pool                              */
+/*   data               | i  | pointers of data                                    */
+/*   n                  | i  | number of buffers                                   */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+void fastalloc_free_bulk(fastalloc_t *base, void **data, u32 n, char *filename, u32 lineno)
+#else
+void fastalloc_free_bulk(fastalloc_t *base, void **data, u32 n)
+#endif
+{
+	u8 *elemt;
+	u32 i, n_free = 0;
+	
+	if(base == NULL || data == NULL)
+		return;
+	
+	for(i=0; i<n; i++)
+	{
+		/* must be the start of an element in pool, checked by offset, not address bits */
+		elemt = data[i];
+		if(elemt == NULL || elemt < base->elemt_base || 
+			elemt >= base->elemt_base + base->elemt_size * base->elemt_num || 
+			(elemt - base->elemt_base) % base->elemt_size)
+		{
+			ZLOG_ERR("invalid data address: %p\n", data[i]);
+			continue;
+		}
+		
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+		u32 elemt_index;
+		
+		elemt_index = (elemt - base->elemt_base)/base->elemt_size;
+		if((base->elemt_info[elemt_index].flags & 0x01) == 0)
+		{
+			ZLOG_ERR("data hasn't been allocated: %p\n", data[i]);
+			continue;
+		}
+		
+		base->elemt_info[elemt_index].flags &= ~0x01;		//mark it as free
+		base->elemt_info[elemt_index].owner = 0;
+		base->elemt_info[elemt_index].lineno = lineno;
+		base->elemt_info[elemt_index].filename = filename;
+#endif
+
+		base->elemt_stack[base->sp++] = elemt;
+		n_free ++;
+		
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_HISTORY
+		base->history[base->history_index].flags = FASTALLOC_HISTORY_FFREE;		
+		base->history[base->history_index].data = data[i];
+		base->history[base->history_index].lineno = lineno;
+		base->history[base->history_index].filename = filename;
+		base->history_index = (base->history_index + 1)%(base->history_size);
+#endif
+	}
+	base->free_cnt += n_free;
+}
@@ -63,7 +63,7 @@ typedef struct fastalloc
 	
 	u8 *bufptr;
 	u8 *elemt_base;
-	u32 *elemt_stack;
+	u8 **elemt_stack;
 	u32 sp;
 	
 	u32 alloc_cnt;
@@ -81,12 +81,24 @@ typedef struct fastalloc
 
 #define FASTFREE(base, data) \
 	fastalloc_free((base), (data), __FILE__, __LINE__)
+
+#define FASTALLOC_BULK(base, data, n) \
+	fastalloc_alloc_bulk((base), (data), (n), __FILE__, __LINE__)
+
+#define FASTFREE_BULK(base, data, n) \
+	fastalloc_free_bulk((base), (data), (n), __FILE__, __LINE__)
 #else
 #define FASTALLOC(base) \
 	fastalloc_alloc(base)
 
 #define FASTFREE(base, data) \
 	fastalloc_free((base), (data))
+
+#define FASTALLOC_BULK(base, data, n) \
+	fastalloc_alloc_bulk((base), (data), (n))
+
+#define FASTFREE_BULK(base, data, n) \
+	fastalloc_free_bulk((base), (data), (n))
 #endif
 
 void fastalloc_destroy(fastalloc_t *base);
@@ -98,10 +110,20 @@ void *fastalloc_alloc(fastalloc_t *base, char *filename, u32 lineno);
 void *fastalloc_alloc(fastalloc_t *base);
 #endif
 #if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+u32 fastalloc_alloc_bulk(fastalloc_t *base, void **data, u32 n, char *filename, u32 lineno);
+#else
+u32 fastalloc_alloc_bulk(fastalloc_t *base, void **data, u32 n);
+#endif
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
 void fastalloc_free(fastalloc_t *base, void *data, char *filename, u32 lineno);
 #else
 void fastalloc_free(fastalloc_t *base, void *data);
 #endif
+#if FASTALLOC_TRACK_LEVEL >= FASTALLOC_ELEMENT_INFO
+void fastalloc_free_bulk(fastalloc_t *base, void **data, u32 n, char *filename, u32 lineno);
+#else
+void fastalloc_free_bulk(fastalloc_t *base, void **data, u32 n);
+#endif
 
 #endif /* _FASTALLOC_H_ */
 
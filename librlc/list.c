@@ -53,3 +53,12 @@ void dllist_remove(dllist_node_t *head, dllist_node_t *node)
 	node->next = NULL;
 }
 
+/* append nodes first...last which are already linked by next/prev */
+void dllist_append_chain(dllist_node_t *head, dllist_node_t *first, dllist_node_t *last)
+{
+	first->prev = head->prev;
+	last->next = head;
+	head->prev->next = first;
+	head->prev = last;
+}
+
@@ -43,6 +43,7 @@ typedef struct dllist_node
 void dllist_init(dllist_node_t *head);
 void dllist_append(dllist_node_t *head, dllist_node_t *node);
 void dllist_remove(dllist_node_t *head, dllist_node_t *node);
+void dllist_append_chain(dllist_node_t *head, dllist_node_t *first, dllist_node_t *last);
 
 #endif //__LIST_H__
 
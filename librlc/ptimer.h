@@ -32,7 +32,7 @@
 #define PTIMER_FLAG_PERIODIC 0x02
 
 
-typedef void (*onexpired_func_t)(void *, u32, u32);
+typedef void (*onexpired_func_t)(void *, size_t, size_t);
 
 /* timer */
 typedef struct ptimer
@@ -42,7 +42,7 @@ typedef struct ptimer
 	u32 duration;
 	u32 remainder;
 	onexpired_func_t onexpired_func;
-	u32 param[2];
+	size_t param[2];				/* wide enough for a pointer */
 }ptimer_t;
 
 
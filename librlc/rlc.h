@@ -28,6 +28,7 @@
 #include "rlc_pdu.h"
 #include "list.h"
 #include "ptimer.h"
+#include "rlc_ring.h"
 
 #define RLC_MOD(x, y) \
 	((x) & ((y)-1))
@@ -63,11 +64,31 @@
 	(RLC_MOD(sn_large-sn_small, sn_fs) < (sn_fs>>1))
 
 #define RLC_SN_FS_MAX 1024
+
+/* window storage: pointer per SN, then one bit per SN, see rlc_window_new() */
+#define RLC_WINDOW_SIZE(sn_fs) ((sn_fs) * sizeof(void *) + ((sn_fs) >> 3))
+#define RLC_WIN_POOL_MAX 256			/* free window blocks kept by a shard */
+
+/* one bit per SN, set if all byte segments of the PDU are received */
+#define RLC_SN_MAP_SET(map, sn) \
+	((map)[(sn)>>6] |= (1ULL << ((sn)&63)))
+
+#define RLC_SN_MAP_CLR(map, sn) \
+	((map)[(sn)>>6] &= ~(1ULL << ((sn)&63)))
 #define RLC_ASSEMBLY_QUEUE_SIZE_MAX 64
 
 #define RLC_LI_NUM_MAX 32
 #define RLC_SEG_NUM_MAX 32
 #define RLC_SDU_SEGMENT_MAX 32
+#define RLC_SDU_BATCH_MAX 64
+#define RLC_SDU_INGRESS_ALL 0xFFFFFFFF	/* drain all SDUs of ingress ring */
+
+/* entity starts on a cache line, so its hot fields share as few lines as possible */
+#define RLC_CACHE_ALIGNED __attribute__((aligned(RLC_CACHE_LINE)))
+
+/* max size of STATUS PDU, for 16 bits SN: 21 bits head + 128 * (NACK_SN, E1, E2, SOstart, SOend)
+ * of 50 bits (803 bytes); it is 680 bytes for 10 bits SN */
+#define RLC_AM_STATUS_PDU_MAX 804
 
 /* macro used by rlc_am_tx_build_pdu() */
 #define RLC_AM_FRESH_PDU 0
@@ -87,16 +108,85 @@ typedef struct rlc_sdu_segment
 	void (*free)(void *data, void *cookie);
 }rlc_sdu_segment_t;
 
+/* fields used to walk Tx queue are put with node and segment[0] in the first cache line */
 typedef struct rlc_sdu
 {
 	dllist_node_t node;				/* sdu list */
-	rlc_sdu_segment_t segment[RLC_SDU_SEGMENT_MAX];
 	u32 size;							/* total size of SDU */
+	u32 offset;							/* read offset */
 	u32 n_segment;						/* current segment number */
+	u32 enqueue_time;					/* RLC clock when SDU is enqueued */
+	rlc_sdu_segment_t segment[RLC_SDU_SEGMENT_MAX];
 	u32 intact;							/* all segment received */
-	u32 offset;							/* read offset */
+	u32 handle_id;						/* id of Tx handle, 0 if no handle */
 }rlc_sdu_t;
 
+/* handle of a SDU in Tx queue, returned by rlc_xx_tx_sdu_enqueue() */
+typedef struct rlc_sdu_handle
+{
+	rlc_sdu_t *sdu;
+	u32 id;
+}rlc_sdu_handle_t;
+
+/* one received PDU, used to pass PDUs of a MAC TB to RLC at one time */
+typedef struct rlc_pdu_desc
+{
+	u8 *buf_ptr;
+	u32 buf_len;
+	void *cookie;
+}rlc_pdu_desc_t;
+
+/* one SDU posted to SDU ingress ring of an entity by another thread */
+typedef struct rlc_sdu_desc
+{
+	u8 *buf_ptr;
+	u32 sdu_size;
+	void *cookie;
+	u32 post_time;						/* RLC clock of entity when posted, kept as enqueue_time */
+}rlc_sdu_desc_t;
+
+/**********************************************************************/
+/*                RLC Tx queue delay                                  */
+/**********************************************************************/
+#define RLC_DELAY_HIST_NBIN 16
+
+/* sojourn time of SDUs in Tx queue, in unit of RLC clock */
+typedef struct rlc_delay_stats
+{
+	u32 n_sample;						/* number of SDUs left Tx queue */
+	u32 max_delay;						/* max sojourn time */
+	u64 sum_delay;						/* sum of sojourn time */
+	u32 hist[RLC_DELAY_HIST_NBIN];		/* hist[0]: 0, hist[i]: [2^(i-1), 2^i), last one: no upper bound */
+}rlc_delay_stats_t;
+
+/* CoDel-like AQM on SDU Tx queue */
+typedef struct rlc_aqm
+{
+	u32 target;							/* target sojourn time, 0: AQM is disabled */
+	u32 interval;						/* time sojourn time should stay above target before drop */
+	u32 above_target;					/* sojourn time is above target */
+	u32 first_above_time;				/* time to start dropping if sojourn time keeps above target */
+	u32 dropping;						/* in dropping state */
+	u32 drop_next;						/* time to drop next SDU in dropping state */
+	u32 count;							/* number of SDU dropped since entering dropping state */
+	u32 lastcount;						/* count when entering last dropping state */
+	u32 n_drop;							/* counter: SDUs dropped by AQM */
+}rlc_aqm_t;
+
+/**********************************************************************/
+/*                RLC buffer status                                   */
+/**********************************************************************/
+/* buffer status of Tx entity, for BSR and MAC scheduling */
+typedef struct rlc_buffer_status
+{
+	u32 status_bytes;					/* size of STATUS PDU, 0 if no STATUS PDU */
+	u32 retx_bytes;						/* total size of ReTx PDUs (segments) */
+	u32 new_bytes;						/* size of fresh PDU to carry all SDUs in Tx queue */
+	u32 n_sdu;							/* number of SDU in Tx queue */
+	u32 hol_delay;						/* sojourn time of head-of-line SDU */
+	u32 window_stalled;					/* fresh PDU can't be sent for Tx window is full */
+}rlc_buffer_status_t;
+
 /**********************************************************************/
 /*                RLC TM                                              */
 /**********************************************************************/
@@ -112,6 +202,8 @@ typedef struct rlc_entity_tm
 	dllist_node_t sdu_tx_q;				/* SDU Tx queue */
 
 	void (*free_sdu)(void *, void *);			/* function to free SDU */
+	void (*free_pdu)(void *, void *);			/* function to free received PDU */
+	void (*deliv_sdu)(struct rlc_entity_tm *, rlc_sdu_t *);	/* deliver received PDU as SDU */
 }rlc_entity_tm_t;
 
 
@@ -135,6 +227,7 @@ typedef struct rlc_um_pdu
 	s32 n_li;							/* really the number of SDU */
 	u32 li_s[RLC_LI_NUM_MAX];
 	u8 *data_ptr;						/* the 1st SDU in PDU */
+	u32 ooo_sent;						/* bit i: SDU starting at li_s[i] delivered out of order */
 }rlc_um_pdu_t;
 
 /**********************************************************************/
@@ -143,24 +236,30 @@ typedef struct rlc_um_pdu
 /* rlc um tx entity */
 typedef struct rlc_entity_um_tx
 {
+	/* hot: read by scheduler every TTI, kept in the first cache line */
 	u16 type;							/* type of entity */
 	u32 logical_chan;					/* logical channel id */
 	void *userdata;						/* user data */
 	
 	u16 VT_US;							/* VT(US) */
 	u16 sn_max;							/* 5 bit SN: 31; 10 bit SN: 1023 */
-	
 	s32 sdu_total_size;					/* total size of SDU in Tx queue */
 	s32 n_sdu;							/* number of SDU in Tx queue */
-	dllist_node_t sdu_tx_q;			/* SDU Tx queue */
+	dllist_node_t sdu_tx_q;				/* SDU Tx queue */
+	rlc_ring_t *sdu_ingress;			/* SDUs posted by PDCP thread, NULL if not used */
+	volatile u32 *ingress_clock;		/* RLC clock of entity's shard, read by PDCP thread */
 
+	/* cold: used when PDU is built or by statistics */
 	void (*free_pdu)(void *, void *);			/* function to free PDU */
 	void (*free_sdu)(void *, void *);			/* function to free SDU */
-}rlc_entity_um_tx_t;
+	rlc_aqm_t aqm;						/* AQM on Tx queue */
+	rlc_delay_stats_t delay_stats;		/* sojourn time of SDUs in Tx queue */
+}RLC_CACHE_ALIGNED rlc_entity_um_tx_t;
 
 /* rlc um rx entity */
 typedef struct rlc_entity_um_rx
 {
+	/* hot: used for every received PDU */
 	u16 type;							/* type of entity */
 	u32 logical_chan;					/* logical channel id */
 	void *userdata;						/* user data */
@@ -170,18 +269,20 @@ typedef struct rlc_entity_um_rx
 	u16 VR_UH;							/* VR(UH) */
 	u16 UM_Window_Size;					/* const UM_Window_Size */
 	u16 sn_max;							/* 5 bit SN: 31; 10 bit SN: 1023 */
-	ptimer_t t_Reordering;			/* timer t-Reordering */
-	
-	rlc_um_pdu_t *pdu[RLC_SN_FS_MAX];	/* reception buffer */
+	u32 ooo_deliv;						/* deliver SDU once it is intact, not in SN order */
+	rlc_um_pdu_t **pdu;					/* reception buffer of sn_max+1, NULL if no window or hibernated */
+	dllist_node_t sdu_assembly_q;
+	dllist_node_t sdu_ooo_q;			/* SDUs delivered out of order */
 	void (*deliv_sdu)(struct rlc_entity_um_rx *, rlc_sdu_t *);
+	void (*deliv_sdu_batch)(struct rlc_entity_um_rx *, rlc_sdu_t *[], u32);	/* SDUs are owned by upper */
 	void (*free_pdu)(void *, void *);			/* function to free PDU */
 	void (*free_sdu)(void *, void *);			/* function to free SDU */
 	
-	dllist_node_t sdu_assembly_q;
-	
+	/* cold */
 	u32 n_discard_pdu;					/* counter: discarded PDUs */
 	u32 n_good_pdu;
-}rlc_entity_um_rx_t;
+	ptimer_t t_Reordering;				/* timer t-Reordering */
+}RLC_CACHE_ALIGNED rlc_entity_um_rx_t;
 
 /* rlc um entity */
 typedef struct rlc_entity_um
@@ -198,8 +299,6 @@ typedef struct rlc_entity_um
 /* RLC AM PDU segment */
 typedef struct rlc_am_pdu_segment
 {
-	dllist_node_t node;					/* link with next segment */
-	
 	u16 start_offset;					
 	u16 end_offset;						
 	
@@ -215,6 +314,8 @@ typedef struct rlc_am_pdu_segment
 	s32 n_li;							/* really the number of SDU */
 	u32 li_s[RLC_LI_NUM_MAX];
 	u8 *data_ptr;						/* the 1st SDU in PDU */
+	u32 is_new;							/* placed but not checked for out-of-order delivery */
+	u32 ooo_sent;						/* bit i: SDU starting at li_s[i] delivered out of order */
 }rlc_am_pdu_segment_t;
 
 typedef struct rlc_am_pdu_segment_info
@@ -242,6 +343,7 @@ typedef struct rlc_am_tx_pdu_ctrl
 	u8 *data_ptr;						/* the 1st SDU in PDU */
 
 	u32 RETX_COUNT;						/* RETX_COUNT defined in 36322 */
+	u32 retx_bytes;						/* total size of ReTx PDUs for segments below */
 	
 	/* received NACK and to be retransmitted segments */
 	u32 i_retransmit_seg;				/* index to first segment */
@@ -254,8 +356,14 @@ typedef struct rlc_am_rx_pdu_ctrl
 {
 	u32 delivery_offset;				/* before this offset, delivered SDU */
 	u16 is_intact;						/* is whole PDU recieved */
-
-	dllist_node_t rx_segq;				/* received but not delivered segments: rlc_am_pdu_segment_t */
+	
+	/* received segments, no overlap and sorted on start_offset */
+	u16 n_seg;							/* number of segments in rx_seg[] */
+	u16 n_gap;							/* number of holes before the last segment */
+	u16 i_deliv;						/* index of first segment not assembled */
+	u32 seg_cap;						/* room of rx_seg[] */
+	rlc_am_pdu_segment_t **rx_seg;		/* rx_seg_inline[], or on heap if more segments */
+	rlc_am_pdu_segment_t *rx_seg_inline[RLC_SEG_NUM_MAX];
 }rlc_am_rx_pdu_ctrl_t;
 
 typedef struct nacksn_info
@@ -270,63 +378,67 @@ struct rlc_entity_am_tx;
 /* rlc am tx entity */
 typedef struct rlc_entity_am_tx
 {
+	/* hot: read by scheduler every TTI, kept in the first cache line */
 	u16 type;							/* type of entity */
 	u32 logical_chan;					/* logical channel id */
 	void *userdata;						/* user data */
 	
-	struct rlc_entity_am_rx *amrx;		/* to brother */
-	
 	/* transmitting side state variables defined in 36322 */
 	u16 VT_A;							/* VT(A) */
 	u16 VT_MS;							/* VT(MS) */
 	u16 VT_S;							/* VT(S) */
 	u16 POLL_SN;						/* POLL_SN */
 	u16 sn_max;							/* MAX SN */
-	
-	/* transmitting side counters defined in 36322 */
+	u16 sn_bits;						/* length of SN field: 10 or 16 */
+	u16 li_bits;						/* length of LI field: 11 or 15 */
 	u16 PDU_WITHOUT_POLL;				/* PDU_WITHOUT_POLL */
-	u32 BYTE_WITHOUT_POLL;				/* BYTE_WITHOUT_POLL */
 	
-	/* transmitting side constant defined in 36322 */
+	s32 sdu_total_size;					/* total size of SDU in Tx queue */
+	s32 n_sdu;							/* number of SDU in Tx queue */
+	u32 retx_bytes;						/* total size of ReTx PDUs in Re-Tx queue */
+	u32 status_pdu_triggered;
+	dllist_node_t sdu_tx_q;				/* SDU Tx queue */
+	
+	/* warm: used when PDU is built */
+	rlc_ring_t *sdu_ingress;			/* SDUs posted by PDCP thread, NULL if not used */
+	volatile u32 *ingress_clock;		/* RLC clock of entity's shard, read by PDCP thread */
+	struct rlc_entity_am_rx *amrx;		/* to brother */
+	rlc_am_tx_pdu_ctrl_t **txpdu;		/* PDUs waiting for ACK, sn_max+1, NULL if hibernated */
+	dllist_node_t pdu_retx_q;			/* PDU Re-Tx queue: PDUs that are NACKed */
+	u32 BYTE_WITHOUT_POLL;				/* BYTE_WITHOUT_POLL */
+	u16 poll_bit;
 	u16 AM_Window_Size;					/* AM_Window_Size */
 	u16 maxRetxThreshold;
 	u16 pollPDU;
 	u16 pollByte;
-	u16 poll_bit;
 	
-	/* transmitting side timer defined in 36322 */
-	ptimer_t t_PollRetransmit;			/* t_PollRetransmit */
-	ptimer_t t_StatusProhibit;			/* timer t-StatusProhibit: more reasonable to put it on Tx entity */
+	/* last built STATUS PDU, reused if Rx state isn't changed */
+	u16 status_pdu_len;					/* size of STATUS PDU, 0: no cached PDU */
+	u16 status_pdu_grant;				/* requested size when STATUS PDU is built */
+	u32 status_pdu_gen;					/* amrx->rx_gen when STATUS PDU is built */
+	u32 status_pdu_truncated;			/* not all NACK info fit into requested size */
+	u8 *status_pdu_buf;					/* RLC_AM_STATUS_PDU_MAX bytes, allocated with windows */
 	
 	/* For AM mode, need these functions to handle memory allocation */
 	int (*max_retx_notify)(struct rlc_entity_am_tx *, u32);
 	void (*free_pdu)(void *, void *);			/* function to free PDU and PDU segment */
 	void (*free_sdu)(void *, void *);			/* function to free SDU */
 	
-	/* SDU queue */
-	s32 sdu_total_size;					/* total size of SDU in Tx queue */
-	s32 n_sdu;							/* number of SDU in Tx queue */
-	dllist_node_t sdu_tx_q;				/* SDU Tx queue */
-	
-	/* Re-Tx queue: PDUs that are NACKed and need to re-transmit */
-	dllist_node_t pdu_retx_q;			/* PDU Re-Tx queue */
-	
-	/* First Tx PDU: PDU that are waiting for ACK */
-	rlc_am_tx_pdu_ctrl_t *txpdu[RLC_SN_FS_MAX];
-	
-	/* STATUS PDU */
-	u32 status_pdu_triggered;
-}rlc_entity_am_tx_t;
+	/* cold: timers and statistics */
+	ptimer_t t_StatusProhibit;			/* timer t-StatusProhibit: more reasonable to put it on Tx entity */
+	ptimer_t t_PollRetransmit;			/* t_PollRetransmit */
+	rlc_aqm_t aqm;						/* AQM on Tx queue */
+	rlc_delay_stats_t delay_stats;		/* sojourn time of SDUs in Tx queue */
+}RLC_CACHE_ALIGNED rlc_entity_am_tx_t;
 
 /* rlc am rx entity */
 typedef struct rlc_entity_am_rx
 {
+	/* hot: used for every received PDU */
 	u16 type;
 	u32 logical_chan;					/* logical channel id */
 	void *userdata;						/* user data */
 	
-	struct rlc_entity_am_tx *amtx;		/* to brother */
-	
 	/* receiving side state variables defined in 36322 */
 	u16 VR_R;							/* VR(R) */
 	u16 VR_X;							/* VR(X) */
@@ -334,26 +446,30 @@ typedef struct rlc_entity_am_rx
 	u16 VR_MS;							/* VR(MS) */
 	u16 VR_MR;							/* VR(MR) */
 	u16 sn_max;							/* MAX SN */
-	
-	/* receiving side counters defined in 36322 */
+	u16 sn_bits;						/* length of SN field: 10 or 16 */
+	u16 li_bits;						/* length of LI field: 11 or 15 */
 	u16 AM_Window_Size;					/* const AM_Window_Size */
+	u32 nack_bits;						/* size in bits of NACK info for SN in [VR(R), VR(MS)) */
+	u32 rx_gen;							/* generation of Rx state, increased on any change */
+	u32 ooo_deliv;						/* deliver SDU once it is intact, not in SN order */
+	rlc_am_rx_pdu_ctrl_t **rxpdu;		/* reception buffer, sn_max+1, NULL if hibernated */
+	u64 *intact_map;					/* bit set if rxpdu[sn] is intact, after rxpdu in same storage */
 	
-	/* receiving side timer defined in 36322 */
-	ptimer_t t_Reordering;				/* timer t-Reordering */
-	ptimer_t t_StatusPdu;				/* timer to avoid t_PollRetransmit expires */
-	
-	/* For AM mode, need these functions to handle memory allocation */
+	/* warm */
+	struct rlc_entity_am_tx *amtx;		/* to brother */
+	dllist_node_t sdu_assembly_q;
+	dllist_node_t sdu_ooo_q;			/* SDUs delivered out of order */
 	void (*deliv_sdu)(struct rlc_entity_am_rx *, rlc_sdu_t *);
+	void (*deliv_sdu_batch)(struct rlc_entity_am_rx *, rlc_sdu_t *[], u32);	/* SDUs are owned by upper */
 	void (*free_pdu)(void *, void *);			/* function to free PDU and PDU segment */
 	void (*free_sdu)(void *, void *);			/* function to free SDU */
 	
-	rlc_am_rx_pdu_ctrl_t *rxpdu[RLC_SN_FS_MAX];	/* reception buffer */
-	
-	dllist_node_t sdu_assembly_q;
-	
+	/* cold */
 	u32 n_discard_pdu;					/* counter: discarded PDUs */
 	u32 n_good_pdu;
-}rlc_entity_am_rx_t;
+	ptimer_t t_Reordering;				/* timer t-Reordering */
+	ptimer_t t_StatusPdu;				/* timer to avoid t_PollRetransmit expires */
+}RLC_CACHE_ALIGNED rlc_entity_am_rx_t;
 
 /* rlc am entity */
 typedef struct rlc_entity_am
@@ -385,6 +501,146 @@ typedef union rlc_entity_general
 	rlc_entity_tm_t rlc_tm;
 }rlc_entity_general_t;
 
+/**********************************************************************/
+/*                RLC entity registry                                 */
+/**********************************************************************/
+/* key of a logical channel, upper bits are never all ones */
+#define RLC_REGISTRY_KEY(cell, rnti, lcid) \
+	(((u64)(u16)(cell) << 24) | ((u64)(u16)(rnti) << 8) | (u8)(lcid))
+#define RLC_REGISTRY_KEY_NONE ((u64)-1)
+
+/* entities of one type back to back, free ones on a stack of index */
+typedef struct rlc_entity_pool
+{
+	u8 *base;
+	u32 elemt_size;
+	u32 elemt_num;
+	u32 *free_stack;
+	u32 sp;
+}rlc_entity_pool_t;
+
+typedef struct rlc_registry_slot
+{
+	u64 key;							/* RLC_REGISTRY_KEY_NONE: empty */
+	void *entity;
+}rlc_registry_slot_t;
+
+typedef struct rlc_registry
+{
+	rlc_registry_slot_t *slot;			/* hash table, open addressing */
+	u32 slot_mask;
+	u32 hash_shift;
+	u32 n_entity;
+	rlc_entity_pool_t pool[RLC_ENTITY_TYPE_AM+1];	/* indexed by RLC_ENTITY_TYPE_xx */
+}rlc_registry_t;
+
+/**********************************************************************/
+/*                RLC logical channel prioritization                  */
+/**********************************************************************/
+#define RLC_LCP_LCH_MAX 11					/* logical channels of a UE: LCID 0..10 */
+#define RLC_LCP_PDU_MAX 32					/* RLC PDUs in one MAC PDU */
+#define RLC_LCP_PBR_INFINITY 0xFFFFFFFF
+
+/* one logical channel of 36.321 5.4.3.1 */
+typedef struct rlc_lcp_lch
+{
+	rlc_entity_common_head_t *entity;	/* TM, UM or AM entity in registry */
+	u8 lcid;
+	u8 priority;						/* 1 is the highest */
+	u16 type;							/* RLC_ENTITY_TYPE_xx */
+	u32 pbr;							/* prioritized bit rate in bytes per TTI */
+	u32 bucket_size;					/* PBR * BSD in bytes */
+	s32 bj;								/* Bj, may be negative */
+}rlc_lcp_lch_t;
+
+/* logical channels of a UE in priority order */
+typedef struct rlc_lcp_ue
+{
+	u16 cell;
+	u16 rnti;
+	u32 n_lch;
+	u32 last_tti;						/* TTI when Bj were updated */
+	rlc_lcp_lch_t lch[RLC_LCP_LCH_MAX];
+}rlc_lcp_ue_t;
+
+/* one MAC SDU, i.e. RLC PDU */
+typedef struct rlc_lcp_pdu
+{
+	u8 lcid;
+	u8 head_len;						/* MAC subheader with L field: 2 or 3 */
+	u16 length;							/* size of RLC PDU */
+	u32 offset;							/* offset of RLC PDU in payload buffer */
+	u32 pdu_type;						/* RLC_AM_xx_PDU, only for AM */
+}rlc_lcp_pdu_t;
+
+/* MAC PDU: head_size + payload_size + padding equals to the grant */
+typedef struct rlc_mac_pdu_desc
+{
+	u32 n_pdu;
+	u32 n_held;							/* AM fresh PDUs, each frees cookie once by free_pdu() */
+	u32 head_size;						/* MAC subheaders, all with L field */
+	u32 payload_size;					/* RLC PDUs back to back in payload buffer */
+	u32 padding;
+	rlc_lcp_pdu_t pdu[RLC_LCP_PDU_MAX];
+}rlc_mac_pdu_desc_t;
+
+/**********************************************************************/
+/*                RLC shard and runtime                               */
+/**********************************************************************/
+#define RLC_SHARD_MAX 64
+#define RLC_PRODUCER_MAX 8
+
+/* per-core context: timer wheel, memory pools and entities of UEs hashed to it.
+ * Library functions use the shard bound to calling thread by rlc_shard_enter(),
+ * so an entity must only be touched by the thread of its shard. */
+typedef struct rlc_shard
+{
+	u32 id;
+	u32 clock;							/* RLC clock, advanced by rlc_timer_push() */
+	u32 sdu_handle_id;					/* the last id assigned to a SDU handle, 0 is never used */
+	ptimer_table_t timerbase;
+	
+	struct fastalloc *mem_sdu_base;
+	struct fastalloc *mem_um_pdu_base;
+	struct fastalloc *mem_am_pdu_seg_base;
+	struct fastalloc *mem_am_pdu_rx_base;
+	struct fastalloc *mem_am_pdu_tx_base;
+	u32 n_win_pool;
+	void *win_pool[RLC_WIN_POOL_MAX];	/* free window blocks of RLC_SN_FS_MAX SN */
+	
+	rlc_registry_t *registry;
+	u32 n_ingress;
+	rlc_ring_t *ingress[RLC_PRODUCER_MAX];	/* rlc_msg_t from other threads, one ring per producer */
+	void (*free_buf)(void *, void *);	/* free buffer of a message without entity */
+	u32 n_drop_msg;						/* counter: messages without entity */
+}rlc_shard_t;
+
+#define RLC_MSG_SDU 0					/* SDU from PDCP to Tx entity */
+#define RLC_MSG_PDU 1					/* PDU from MAC to Rx entity */
+#define RLC_MSG_CALL 2					/* run func on the shard, e.g. to add or remove entity */
+
+typedef struct rlc_msg
+{
+	u16 type;
+	u16 cell;
+	u16 rnti;
+	u8 lcid;
+	u8 reserved;
+	u32 buf_len;
+	u8 *buf_ptr;
+	void *cookie;
+	void (*func)(rlc_shard_t *, struct rlc_msg *);
+}rlc_msg_t;
+
+typedef struct rlc_runtime
+{
+	u32 n_shard;
+	u32 n_producer;
+	rlc_shard_t *shard[RLC_SHARD_MAX];
+}rlc_runtime_t;
+
+extern __thread rlc_shard_t *rlc_shard_cur;
+
 typedef struct rlc_mem_counter
 {
 	u32 n_alloc_sdu;
@@ -407,43 +663,83 @@ void rlc_timer_start(ptimer_t *timer);
 void rlc_timer_stop(ptimer_t *timer);
 int rlc_timer_is_running(ptimer_t *timer);
 void rlc_timer_push(u32 time);
+u32 rlc_get_time();
 
 void rlc_init();
 
 rlc_sdu_t *rlc_sdu_new();
 void rlc_sdu_free(rlc_sdu_t *sdu);
+void rlc_sdu_free_bulk(rlc_sdu_t *sdus[], u32 n);
+u32 rlc_sdu_dequeue_intact(dllist_node_t *sdu_assembly_q, rlc_sdu_t *sdus[], u32 max);
 void rlc_dump_sdu(rlc_sdu_t *sdu);
 void rlc_serialize_sdu(u8 *data_ptr, rlc_sdu_t *sdu, u32 length);
+void rlc_sdu_set_handle(rlc_sdu_t *sdu, rlc_sdu_handle_t *handle);
+int rlc_sdu_discard(dllist_node_t *sdu_tx_q, rlc_sdu_handle_t *handle);
+void rlc_delay_stats_add(rlc_delay_stats_t *stats, u32 delay);
+void rlc_aqm_init(rlc_aqm_t *aqm, u32 target, u32 interval);
+int rlc_aqm_dequeue(rlc_aqm_t *aqm, dllist_node_t *sdu_tx_q, s32 *n_sdu, s32 *sdu_total_size);
+int rlc_sdu_enqueue_batch(dllist_node_t *sdu_tx_q, void (*free_sdu)(void *, void *), 
+		u8 *bufs[], u32 sizes[], void *cookies[], u32 enqueue_times[], u32 n, rlc_sdu_handle_t handles[], 
+		u32 *total_size);
+rlc_ring_t *rlc_sdu_ingress_create(u32 n);
+void rlc_sdu_ingress_destroy(rlc_ring_t *ring, void (*free_sdu)(void *, void *));
+int rlc_sdu_ingress_post(rlc_ring_t *ring, u8 *buf_ptr, u32 sdu_size, void *cookie, u32 post_time);
+void rlc_sdu_ingress_drain(rlc_ring_t *ring, dllist_node_t *sdu_tx_q, void (*free_sdu)(void *, void *), 
+		u32 need, s32 *n_sdu, s32 *sdu_total_size);
+void rlc_sdu_ingress_pending(rlc_ring_t *ring, s32 *n_sdu, s32 *sdu_total_size);
+void *rlc_window_new(u32 sn_fs);
+void rlc_window_free(void *win, u32 sn_fs);
 
 int rlc_dump_mem_counter();
 
-inline u32 rlc_li_len(u32 n_li);
+u32 rlc_li_len(u32 n_li);
 
-u32 rlc_parse_li(u32 e, rlc_li_t *li_ptr, u32 size, u8 **data_ptr, u32 *li_s);
-u32 rlc_build_li_from_sdu(u32 pdu_size, u32 head_len, dllist_node_t *sdu_q, u32 *li_s);
-int rlc_encode_li(rlc_li_t * li_ptr, u32 n_li, u32 li_s[]);
-int rlc_encode_sdu(u8 *data_ptr, u32 n_li, u32 li_s[], dllist_node_t *sdu_tx_q);
+u32 rlc_parse_li(u32 e, u8 *li_ptr, u32 size, u8 **data_ptr, u32 *li_s);
+int rlc_encode_li(u8 *li_ptr, u32 n_li, u32 li_s[]);
+u32 rlc_li15_len(u32 n_li);
+u32 rlc_parse_li15(u32 e, u8 *li_ptr, u32 size, u8 **data_ptr, u32 *li_s);
+int rlc_encode_li15(u8 *li_ptr, u32 n_li, u32 li_s[]);
+u32 rlc_encode_pdu(u8 *li_ptr, u32 size, u32 li_bits, dllist_node_t *sdu_q, u32 *li_s, 
+	u8 **data_ptr, u32 *data_size, rlc_delay_stats_t *stats);
 
 
 void rlc_tm_init(rlc_entity_tm_t *rlc_tm, void (*free_sdu)(void *, void *));
 int rlc_tm_reestablish(rlc_entity_tm_t *rlctm);
+void rlc_tm_set_deliv_func(rlc_entity_tm_t *rlc_tm, void (*deliv_sdu)(struct rlc_entity_tm *, rlc_sdu_t *), 
+		void (*free_pdu)(void *, void *));
 int rlc_tm_rx_process_pdu(rlc_entity_tm_t *tmrx, u8 *buf_ptr, u32 buf_len, void *cookie);
 int rlc_tm_tx_build_pdu(rlc_entity_tm_t *tmtx, rlc_sdu_t **out_sdu, u16 pdu_size);
 u32 rlc_tm_tx_estimate_pdu_size(rlc_entity_tm_t *tmtx);
-int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void *cookie);
+void rlc_tm_tx_get_buffer_status(rlc_entity_tm_t *tmtx, rlc_buffer_status_t *bs);
+int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle);
+int rlc_tm_tx_sdu_discard(rlc_entity_tm_t *tmtx, rlc_sdu_handle_t *handle);
 
-void rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t_Reordering,
+int rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t_Reordering,
 		void (*free_pdu)(void *, void *), void (*free_sdu)(void *, void *));
+void rlc_um_deinit(rlc_entity_um_t *rlc_um);
+int rlc_um_hibernate(rlc_entity_um_t *rlc_um);
+int rlc_um_resume(rlc_entity_um_t *rlc_um);
 int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie);
+u32 rlc_um_rx_process_pdus(rlc_entity_um_rx_t *umrx, rlc_pdu_desc_t pdus[], u32 n);
 void rlc_um_rx_delivery_sdu(rlc_entity_um_rx_t *umrx, dllist_node_t *sdu_assembly_q);
 int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size);
 u32 rlc_um_tx_estimate_pdu_size(rlc_entity_um_tx_t *umtx);
-int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie);
+void rlc_um_tx_get_buffer_status(rlc_entity_um_tx_t *umtx, rlc_buffer_status_t *bs);
+int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle);
+int rlc_um_tx_sdu_discard(rlc_entity_um_tx_t *umtx, rlc_sdu_handle_t *handle);
+int rlc_um_tx_sdu_enqueue_batch(rlc_entity_um_tx_t *umtx, u8 *bufs[], u32 sizes[], void *cookies[], u32 n, 
+		rlc_sdu_handle_t handles[]);
+u32 rlc_um_tx_get_hol_delay(rlc_entity_um_tx_t *umtx);
+void rlc_um_set_aqm(rlc_entity_um_t *rlc_um, u32 target, u32 interval);
+int rlc_um_set_sdu_ingress(rlc_entity_um_t *rlc_um, u32 n);
+int rlc_um_tx_sdu_post(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie);
 void rlc_um_set_deliv_func(rlc_entity_um_t *rlc_um, void (*deliv_sdu)(struct rlc_entity_um_rx *, rlc_sdu_t *));
+void rlc_um_set_deliv_batch_func(rlc_entity_um_t *rlc_um, void (*deliv_sdu_batch)(struct rlc_entity_um_rx *, rlc_sdu_t *[], u32));
+void rlc_um_set_ooo_delivery(rlc_entity_um_t *rlc_um, u32 enable);
 int rlc_um_reestablish(rlc_entity_um_t *rlcum);
 
 
-void rlc_am_init(rlc_entity_am_t *rlc_am, 
+int rlc_am_init(rlc_entity_am_t *rlc_am, 
 					u32 t_Reordering, 
 					u32 t_StatusPdu, 
 					u32 t_StatusProhibit, 
@@ -453,18 +749,58 @@ void rlc_am_init(rlc_entity_am_t *rlc_am,
 					u16 pollByte,
 					void (*free_pdu)(void *, void *),
 					void (*free_sdu)(void *, void *));
-int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie);
+void rlc_am_deinit(rlc_entity_am_t *rlc_am);
+int rlc_am_hibernate(rlc_entity_am_t *rlc_am);
+int rlc_am_resume(rlc_entity_am_t *rlc_am);
+int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle);
+int rlc_am_tx_sdu_discard(rlc_entity_am_tx_t *amtx, rlc_sdu_handle_t *handle);
+int rlc_am_tx_sdu_enqueue_batch(rlc_entity_am_tx_t *amtx, u8 *bufs[], u32 sizes[], void *cookies[], u32 n, 
+		rlc_sdu_handle_t handles[]);
+u32 rlc_am_tx_get_hol_delay(rlc_entity_am_tx_t *amtx);
+void rlc_am_set_aqm(rlc_entity_am_t *rlc_am, u32 target, u32 interval);
+int rlc_am_set_sdu_ingress(rlc_entity_am_t *rlc_am, u32 n);
+int rlc_am_tx_sdu_post(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie);
 u32 rlc_am_tx_get_status_pdu_size(rlc_entity_am_tx_t *amtx);
 u32 rlc_am_tx_get_fresh_pdu_size(rlc_entity_am_tx_t *amtx);
 u32 rlc_am_tx_get_retx_pdu_size(rlc_entity_am_tx_t *amtx);
 u32 rlc_am_tx_estimate_pdu_size(rlc_entity_am_tx_t *amtx, u32 *out_pdu_size);
+void rlc_am_tx_get_buffer_status(rlc_entity_am_tx_t *amtx, rlc_buffer_status_t *bs);
 int rlc_am_tx_build_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size, void *cookie, u32 *pdu_type);
 int rlc_am_rx_process_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, void *cookie);
+u32 rlc_am_rx_process_pdus(rlc_entity_am_rx_t *amrx, rlc_pdu_desc_t pdus[], u32 n);
 int rlc_am_trigger_status_report(rlc_entity_am_rx_t *amrx, rlc_entity_am_tx_t *amtx, u16 sn, int forced);
 void rlc_am_set_deliv_func(rlc_entity_am_t *rlc_am, void (*deliv_sdu)(struct rlc_entity_am_rx *, rlc_sdu_t *));
+void rlc_am_set_deliv_batch_func(rlc_entity_am_t *rlc_am, void (*deliv_sdu_batch)(struct rlc_entity_am_rx *, rlc_sdu_t *[], u32));
+void rlc_am_set_ooo_delivery(rlc_entity_am_t *rlc_am, u32 enable);
+int rlc_am_set_sn_len(rlc_entity_am_t *rlc_am, u32 sn_bits, u32 li_bits);
 void rlc_am_set_maxretx_func(rlc_entity_am_t *rlc_am, int (*max_retx)(struct rlc_entity_am_tx *, u32));
 int rlc_am_reestablish(rlc_entity_am_t *rlcam);
 
+rlc_registry_t *rlc_registry_create(u32 max_tm, u32 max_um, u32 max_am);
+void rlc_registry_destroy(rlc_registry_t *reg);
+void *rlc_registry_find(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid);
+void *rlc_registry_add(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid, u16 type);
+int rlc_registry_remove(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid);
+
+void rlc_lcp_init(rlc_lcp_ue_t *ue, u16 cell, u16 rnti, u32 tti);
+int rlc_lcp_add_lch(rlc_lcp_ue_t *ue, rlc_registry_t *reg, u8 lcid, u8 priority, u32 pbr, u32 bsd);
+int rlc_lcp_remove_lch(rlc_lcp_ue_t *ue, u8 lcid);
+u32 rlc_lcp_pending_bytes(rlc_lcp_ue_t *ue);
+u32 rlc_lcp_build_pdu(rlc_lcp_ue_t *ue, u32 tti, u8 *buf_ptr, u32 grant, void *cookie, rlc_mac_pdu_desc_t *desc);
+
+int rlc_shard_init(rlc_shard_t *shard, u32 id, u32 max_tm, u32 max_um, u32 max_am);
+void rlc_shard_deinit(rlc_shard_t *shard);
+rlc_shard_t *rlc_shard_create(u32 id, u32 max_tm, u32 max_um, u32 max_am, u32 n_producer, u32 ring_size,
+		void (*free_buf)(void *, void *));
+void rlc_shard_destroy(rlc_shard_t *shard);
+void rlc_shard_enter(rlc_shard_t *shard);
+u32 rlc_shard_poll(rlc_shard_t *shard, u32 max);
+rlc_runtime_t *rlc_runtime_create(u32 n_shard, u32 n_producer, u32 ring_size, 
+		u32 max_tm, u32 max_um, u32 max_am, void (*free_buf)(void *, void *));
+void rlc_runtime_destroy(rlc_runtime_t *rt);
+rlc_shard_t *rlc_runtime_get_shard(rlc_runtime_t *rt, u16 cell, u16 rnti);
+int rlc_runtime_post(rlc_runtime_t *rt, u32 producer, rlc_msg_t *msg);
+
 
 #endif //_RLC_H_
 
@@ -18,11 +18,13 @@
  * @file
  *   A RLC AM implementation that algins with 36322-930.
  *   Several points that has slight difference from 36322: 
- *   1) SDU discard procedure isn't implemented
+ *   1) SDU discard is triggered by upper layer with rlc_am_tx_sdu_discard(), and
+ *       only SDU that hasn't been segmented is discarded
  *   2) If a positive acknowledgement has been received for a SDU,
  *       there is no indication is sent to upper in current code.
- *   3) If a AM PDU that is completely or partly duplicated with any PDU in Rx buffer
- *       is recieved, the new received AM PDU will be dropped.
+ *   3) If a AM PDU that is partly duplicated with any PDU in Rx buffer is recieved,
+ *       only its byte segments not received before are kept. If there are more than
+ *       RLC_SEG_NUM_MAX segments for one SN, the segment array is grown on heap.
  *
  * @History
  * Phuuix Xiong, Create, 01-25-2011
@@ -38,6 +40,7 @@
  *       Retx queue
  */
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 
@@ -47,19 +50,32 @@
 #include "ptimer.h"
 #include "list.h"
 #include "fastalloc.h"
+#include "rlc_bitstream.h"
 
-extern void bitcpy(unsigned long *dst, int dst_idx, const unsigned long *src, int src_idx, u32 n);
+/* AM entity of Tx or Rx side, used to resume a hibernated entity */
+#define RLC_AM_TX_ENTITY(amtx) ((rlc_entity_am_t *)((u8 *)(amtx) - offsetof(rlc_entity_am_t, amtx)))
+#define RLC_AM_RX_ENTITY(amrx) ((rlc_entity_am_t *)((u8 *)(amrx) - offsetof(rlc_entity_am_t, amrx)))
 
 int rlc_am_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_am_rx_pdu_ctrl_t *pdu_ctrl);
 void rlc_am_rx_delivery_sdu(rlc_entity_am_rx_t *amrx, dllist_node_t *sdu_assembly_q);
+int rlc_am_rx_is_middle_pdu(rlc_am_rx_pdu_ctrl_t *pdu_ctrl);
+void rlc_am_rx_assemble_ooo_sdu(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t *pdu_ctrl);
+void rlc_am_rx_drop_ooo_sdu(rlc_entity_am_rx_t *amrx);
 int rlc_am_trigger_status_report(rlc_entity_am_rx_t *amrx, rlc_entity_am_tx_t *amtx, u16 sn, int forced);
 int rlc_am_tx_update_poll(rlc_entity_am_tx_t *amtx, u16 is_retx, u16 data_size);
 int rlc_am_tx_deliver_poll(rlc_entity_am_tx_t *amtx);
 void rlc_am_tx_add_retx(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl);
-
-extern fastalloc_t *g_mem_am_pdu_seg_base;
-extern fastalloc_t *g_mem_am_pdu_rx_base;
-extern fastalloc_t *g_mem_am_pdu_tx_base;
+void rlc_am_tx_update_retx_bytes(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl);
+u32 rlc_am_tx_get_retx_seg_size(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl, rlc_am_pdu_segment_info_t *pdu_segment);
+u32 rlc_am_rx_count_nack_bits(rlc_entity_am_rx_t *amrx);
+u32 rlc_am_rx_next_missing_sn(rlc_entity_am_rx_t *amrx, u32 sn);
+int rlc_am_rx_handle_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, void *cookie, u32 *n_placed);
+void rlc_am_rx_update_reordering(rlc_entity_am_rx_t *amrx);
+u32 rlc_am_head_len(u32 sn_bits, u32 is_segment);
+u32 rlc_am_li_len(u32 li_bits, u32 n_li);
+u32 rlc_am_encode_li(u32 li_bits, u8 *li_ptr, u32 n_li, u32 li_s[]);
+void rlc_am_set_head_sn(u32 sn_bits, u8 *buf_ptr, u32 sn, u32 is_segment, u32 lsf, u32 so);
+u32 rlc_am_get_head_sn(u32 sn_bits, u8 *buf_ptr, u32 *lsf, u32 *so);
 
 /***********************************************************************************/
 /* Function : t_Reordering_am_func                                                 */
@@ -71,11 +87,10 @@ extern fastalloc_t *g_mem_am_pdu_tx_base;
 /* ---------------------|----|-----------------------------------------------------*/
 /*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-static void t_Reordering_am_func(void *timer, u32 arg1, u32 arg2)
+static void t_Reordering_am_func(void *timer, size_t arg1, size_t arg2)
 {
 	rlc_entity_am_rx_t *amrx = (rlc_entity_am_rx_t *)arg1;
-	u32 sn;
-	u32 sn_fs = RLC_SN_MAX_10BITS + 1;
+	u32 sn_fs = amrx->sn_max + 1;
 /* 
 When t-Reordering expires, the receiving side of an AM RLC entity shall:
 -	update VR(MS) to the SN of the first AMD PDU with SN >= VR(X) for which not all byte segments have been received;
@@ -85,11 +100,9 @@ When t-Reordering expires, the receiving side of an AM RLC entity shall:
 */
 	ZLOG_DEBUG("t_Reordering expires: lcid=%d\n", amrx->logical_chan);
 
-	sn = amrx->VR_X;
-	while(amrx->rxpdu[sn] && amrx->rxpdu[sn]->is_intact)
-		sn = RLC_MOD(sn+1, sn_fs);
-
-	amrx->VR_MS = sn;
+	amrx->VR_MS = rlc_am_rx_next_missing_sn(amrx, amrx->VR_X);
+	amrx->nack_bits = rlc_am_rx_count_nack_bits(amrx);
+	amrx->rx_gen ++;
 
 	if(RLC_SN_LESS(amrx->VR_MS, amrx->VR_H, sn_fs))
 	{
@@ -116,7 +129,7 @@ When t-Reordering expires, the receiving side of an AM RLC entity shall:
 /* ---------------------|----|-----------------------------------------------------*/
 /*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-static void t_PollRetransmit_func(void *timer, u32 arg1, u32 arg2)
+static void t_PollRetransmit_func(void *timer, size_t arg1, size_t arg2)
 {
 	rlc_entity_am_tx_t *amtx = (rlc_entity_am_tx_t *)arg1;
 	u16 sn;
@@ -152,12 +165,13 @@ Upon expiry of t-PollRetransmit, the transmitting side of an AM RLC entity shall
 					pdu_ctrl->retransmit_seg[0].end_offset = maxso;
 					pdu_ctrl->retransmit_seg[0].pdu_size = pdu_ctrl->pdu_size;
 					rlc_am_tx_add_retx(amtx, pdu_ctrl);
+					rlc_am_tx_update_retx_bytes(amtx, pdu_ctrl);
 				}
 				
 				break;
 			}
 
-			sn = RLC_MOD(sn+1, RLC_SN_MAX_10BITS+1);
+			sn = RLC_MOD(sn+1, amtx->sn_max+1);
 		}
 	}
 }
@@ -172,7 +186,7 @@ Upon expiry of t-PollRetransmit, the transmitting side of an AM RLC entity shall
 /* ---------------------|----|-----------------------------------------------------*/
 /*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-static void t_StatusProhibit_func(void *timer, u32 arg1, u32 arg2)
+static void t_StatusProhibit_func(void *timer, size_t arg1, size_t arg2)
 {
 	rlc_entity_am_tx_t *amtx = (rlc_entity_am_tx_t *)arg1;
 	
@@ -190,7 +204,7 @@ static void t_StatusProhibit_func(void *timer, u32 arg1, u32 arg2)
 /* ---------------------|----|-----------------------------------------------------*/
 /*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-static void t_StatusPdu_func(void *timer, u32 arg1, u32 arg2)
+static void t_StatusPdu_func(void *timer, size_t arg1, size_t arg2)
 {
 	rlc_entity_am_rx_t *amrx = (rlc_entity_am_rx_t *)arg1;
 	
@@ -200,6 +214,48 @@ static void t_StatusPdu_func(void *timer, u32 arg1, u32 arg2)
 	rlc_am_trigger_status_report(amrx, amrx->amtx, 0/* sn */, 1 /* forced */);
 }
 
+/* window arrays are out of line, so hot state of Tx and Rx entity stays in few cache lines,
+ * STATUS PDU cache goes with them, so a hibernated entity keeps neither */
+static void rlc_am_window_free(rlc_entity_am_t *rlc_am)
+{
+	rlc_window_free(rlc_am->amtx.txpdu, rlc_am->amtx.sn_max + 1);
+	rlc_window_free(rlc_am->amrx.rxpdu, rlc_am->amrx.sn_max + 1);
+	free(rlc_am->amtx.status_pdu_buf);
+	rlc_am->amtx.txpdu = NULL;
+	rlc_am->amrx.rxpdu = NULL;
+	rlc_am->amrx.intact_map = NULL;
+	rlc_am->amtx.status_pdu_buf = NULL;
+	rlc_am->amtx.status_pdu_len = 0;
+}
+
+/* sn_fs is 1024 or 65536, old windows must be empty, intact_map follows rxpdu */
+static int rlc_am_window_alloc(rlc_entity_am_t *rlc_am, u32 sn_fs)
+{
+	rlc_am_tx_pdu_ctrl_t **txpdu;
+	rlc_am_rx_pdu_ctrl_t **rxpdu;
+	u8 *status_pdu_buf;
+	
+	rlc_am_window_free(rlc_am);
+	
+	txpdu = rlc_window_new(sn_fs);
+	rxpdu = rlc_window_new(sn_fs);
+	status_pdu_buf = malloc(RLC_AM_STATUS_PDU_MAX);
+	if(txpdu == NULL || rxpdu == NULL || status_pdu_buf == NULL)
+	{
+		ZLOG_ERR("out of memory: AM window arrays of %u SN.\n", sn_fs);
+		rlc_window_free(txpdu, sn_fs);
+		rlc_window_free(rxpdu, sn_fs);
+		free(status_pdu_buf);
+		return -1;
+	}
+	
+	rlc_am->amtx.txpdu = txpdu;
+	rlc_am->amrx.rxpdu = rxpdu;
+	rlc_am->amrx.intact_map = (u64 *)(rxpdu + sn_fs);
+	rlc_am->amtx.status_pdu_buf = status_pdu_buf;
+	return 0;
+}
+
 /***********************************************************************************/
 /* Function : rlc_am_init                                                          */
 /***********************************************************************************/
@@ -218,9 +274,9 @@ static void t_StatusPdu_func(void *timer, u32 arg1, u32 arg2)
 /*   pollByte           | i  | see spec                                            */
 /*   free_pdu           | i  | function to free pdu                                */
 /*   free_sdu           | i  | function to free sdu                                */
-/*   Return             |    | N/A                                                 */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
 /***********************************************************************************/
-void rlc_am_init(rlc_entity_am_t *rlc_am, 
+int rlc_am_init(rlc_entity_am_t *rlc_am, 
 					u32 t_Reordering, 
 					u32 t_StatusPdu,
 					u32 t_StatusProhibit, 
@@ -241,28 +297,33 @@ void rlc_am_init(rlc_entity_am_t *rlc_am,
 	rlc_am->amrx.amtx = &rlc_am->amtx;
 	rlc_am->amrx.AM_Window_Size = 512;
 	rlc_am->amrx.sn_max = RLC_SN_MAX_10BITS;
+	rlc_am->amrx.sn_bits = 10;
+	rlc_am->amrx.li_bits = 11;
 	rlc_am->amrx.VR_MR = rlc_am->amrx.VR_R + rlc_am->amrx.AM_Window_Size;
 	rlc_am->amrx.t_Reordering.duration = t_Reordering;
 	rlc_am->amrx.t_Reordering.onexpired_func = t_Reordering_am_func;
-	rlc_am->amrx.t_Reordering.param[0] = (u32)&rlc_am->amrx;
+	rlc_am->amrx.t_Reordering.param[0] = (size_t)&rlc_am->amrx;
 	rlc_am->amrx.t_StatusPdu.duration = t_StatusPdu;
 	rlc_am->amrx.t_StatusPdu.onexpired_func = t_StatusPdu_func;
-	rlc_am->amrx.t_StatusPdu.param[0] = (u32)&rlc_am->amrx;
+	rlc_am->amrx.t_StatusPdu.param[0] = (size_t)&rlc_am->amrx;
 	rlc_am->amrx.free_pdu = free_pdu;
 	rlc_am->amrx.free_sdu = free_sdu;
 	dllist_init(&(rlc_am->amrx.sdu_assembly_q));
+	dllist_init(&(rlc_am->amrx.sdu_ooo_q));
 
 	rlc_am->amtx.type = RLC_ENTITY_TYPE_AM;
 	rlc_am->amtx.amrx = &rlc_am->amrx;
 	rlc_am->amtx.AM_Window_Size = 512;
 	rlc_am->amtx.sn_max = RLC_SN_MAX_10BITS;
+	rlc_am->amtx.sn_bits = 10;
+	rlc_am->amtx.li_bits = 11;
 	rlc_am->amtx.VT_MS = rlc_am->amtx.VT_S + rlc_am->amtx.AM_Window_Size;
 	rlc_am->amtx.t_PollRetransmit.duration = t_PollRetransmit;
 	rlc_am->amtx.t_PollRetransmit.onexpired_func = t_PollRetransmit_func;
-	rlc_am->amtx.t_PollRetransmit.param[0] = (u32)&rlc_am->amtx;
+	rlc_am->amtx.t_PollRetransmit.param[0] = (size_t)&rlc_am->amtx;
 	rlc_am->amtx.t_StatusProhibit.duration = t_StatusProhibit;
 	rlc_am->amtx.t_StatusProhibit.onexpired_func = t_StatusProhibit_func;
-	rlc_am->amtx.t_StatusProhibit.param[0] = (u32)&rlc_am->amtx;
+	rlc_am->amtx.t_StatusProhibit.param[0] = (size_t)&rlc_am->amtx;
 	rlc_am->amtx.maxRetxThreshold = maxRetxThreshold;
 	rlc_am->amtx.pollPDU = pollPDU;
 	rlc_am->amtx.pollByte = pollByte;
@@ -270,6 +331,95 @@ void rlc_am_init(rlc_entity_am_t *rlc_am,
 	rlc_am->amtx.free_sdu = free_sdu;
 	dllist_init(&(rlc_am->amtx.sdu_tx_q));
 	dllist_init(&(rlc_am->amtx.pdu_retx_q));
+	
+	return rlc_am_window_alloc(rlc_am, RLC_SN_MAX_10BITS + 1);
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_deinit                                                        */
+/***********************************************************************************/
+/* Description : - Re-establish AM entity and free its window arrays and SDU       */
+/*                 ingress ring, rlc_am_init() is needed to use it again           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_deinit(rlc_entity_am_t *rlc_am)
+{
+	if(rlc_am == NULL)
+		return;
+	
+	rlc_am_reestablish(rlc_am);
+	rlc_am_set_sdu_ingress(rlc_am, 0);
+	rlc_am_window_free(rlc_am);
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_hibernate                                                     */
+/***********************************************************************************/
+/* Description : - Give back window arrays of an idle AM entity to the shard, only */
+/*                 state variables and config are kept                             */
+/*               - Entity is idle if all PDUs are acknowledged, no SDU is queued,  */
+/*                 no PDU is in reception buffer, no SDU is being assembled, no    */
+/*                 STATUS PDU is triggered and all timers are stopped              */
+/*               - Windows are allocated again on next enqueued SDU, SDU in        */
+/*                 ingress ring or received PDU, or by rlc_am_resume()             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | io | AM entity                                           */
+/*   Return             |    | 0 is success, -1 if entity is not idle              */
+/***********************************************************************************/
+int rlc_am_hibernate(rlc_entity_am_t *rlc_am)
+{
+	rlc_entity_am_rx_t *amrx;
+	rlc_entity_am_tx_t *amtx;
+	
+	if(rlc_am == NULL)
+		return -1;
+	
+	amrx = &rlc_am->amrx;
+	amtx = &rlc_am->amtx;
+	if(amtx->n_sdu || (amtx->sdu_ingress && rlc_ring_count(amtx->sdu_ingress)) ||
+		amtx->VT_A != amtx->VT_S || !DLLIST_EMPTY(&amtx->pdu_retx_q) || amtx->status_pdu_triggered ||
+		amrx->VR_R != amrx->VR_H || !DLLIST_EMPTY(&amrx->sdu_assembly_q) || !DLLIST_EMPTY(&amrx->sdu_ooo_q) ||
+		rlc_timer_is_running(&amtx->t_PollRetransmit) || rlc_timer_is_running(&amtx->t_StatusProhibit) ||
+		rlc_timer_is_running(&amrx->t_Reordering) || rlc_timer_is_running(&amrx->t_StatusPdu))
+	{
+		ZLOG_DEBUG("AM entity is not idle: lcid=%d n_sdu=%d VT(A)=%u VT(S)=%u VR(R)=%u VR(H)=%u.\n", 
+			amtx->logical_chan, amtx->n_sdu, amtx->VT_A, amtx->VT_S, amrx->VR_R, amrx->VR_H);
+		return -1;
+	}
+	
+	rlc_am_window_free(rlc_am);
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_resume                                                        */
+/***********************************************************************************/
+/* Description : - Allocate window arrays of a hibernated AM entity again          */
+/*               - Called by Tx and Rx path when needed, upper needn't call it     */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | io | AM entity                                           */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
+/***********************************************************************************/
+int rlc_am_resume(rlc_entity_am_t *rlc_am)
+{
+	if(rlc_am == NULL)
+		return -1;
+	
+	if(rlc_am->amtx.txpdu)
+		return 0;
+	
+	return rlc_am_window_alloc(rlc_am, rlc_am->amtx.sn_max + 1);
 }
 
 /***********************************************************************************/
@@ -291,6 +441,316 @@ void rlc_am_set_deliv_func(rlc_entity_am_t *rlc_am, void (*deliv_sdu)(struct rlc
 		rlc_am->amrx.deliv_sdu = deliv_sdu;
 }
 
+/***********************************************************************************/
+/* Function : rlc_am_set_deliv_batch_func                                          */
+/***********************************************************************************/
+/* Description : - deliver reassembled SDUs to Upper up to RLC_SDU_BATCH_MAX a call*/
+/*               - Ownership of SDUs is transferred, upper frees them with         */
+/*                 rlc_sdu_free_bulk() or rlc_sdu_free()                           */
+/*               - If set, it is used instead of deliv_sdu                         */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   deliv_sdu_batch    | i  | delivery function provided by upper, NULL to unset  */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_set_deliv_batch_func(rlc_entity_am_t *rlc_am, void (*deliv_sdu_batch)(struct rlc_entity_am_rx *, rlc_sdu_t *[], u32))
+{
+	if(rlc_am)
+		rlc_am->amrx.deliv_sdu_batch = deliv_sdu_batch;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_set_ooo_delivery                                              */
+/***********************************************************************************/
+/* Description : - Enable or disable out-of-order SDU delivery                     */
+/*               - If enabled, a SDU which is wholly carried in one AMD PDU is     */
+/*                 delivered as soon as all its bytes are received; SDUs spanning  */
+/*                 several AMD PDUs are still delivered in SN order                */
+/*               - Should be set before any PDU is received                        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   enable             | i  | 1: enable; 0: disable                               */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_set_ooo_delivery(rlc_entity_am_t *rlc_am, u32 enable)
+{
+	if(rlc_am)
+		rlc_am->amrx.ooo_deliv = enable;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_set_sn_len                                                    */
+/***********************************************************************************/
+/* Description : - Select length of SN and LI field of AMD PDU                     */
+/*               - 16 bits SN also uses 16 bits SO, window arrays are allocated    */
+/*                 again for 65536 SN (about 1MB)                                  */
+/*               - Must be called before any SDU or PDU is handled, or after       */
+/*                 re-establishment; fails if SN state or queues are not empty     */
+/*               - Cached STATUS PDU is dropped, it is in format of old SN length  */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   sn_bits            | i  | 10 or 16                                            */
+/*   li_bits            | i  | 11 or 15                                            */
+/*   Return             |    | 0: success; -1: invalid length, entity in use, or   */
+/*                      |    | out of memory                                       */
+/***********************************************************************************/
+int rlc_am_set_sn_len(rlc_entity_am_t *rlc_am, u32 sn_bits, u32 li_bits)
+{
+	rlc_entity_am_rx_t *amrx;
+	rlc_entity_am_tx_t *amtx;
+	u32 sn_max, window_size;
+	
+	if(rlc_am == NULL)
+		return -1;
+	
+	if((sn_bits != 10 && sn_bits != 16) || (li_bits != 11 && li_bits != 15))
+	{
+		ZLOG_ERR("invalid AM SN length %u or LI length %u.\n", sn_bits, li_bits);
+		return -1;
+	}
+	
+	amrx = &rlc_am->amrx;
+	amtx = &rlc_am->amtx;
+	if(amtx->VT_S || amtx->VT_A || amrx->VR_R || amrx->VR_H || 
+		amtx->n_sdu || (amtx->sdu_ingress && rlc_ring_count(amtx->sdu_ingress)) || !DLLIST_EMPTY(&amtx->pdu_retx_q) ||
+		!DLLIST_EMPTY(&amrx->sdu_assembly_q) || !DLLIST_EMPTY(&amrx->sdu_ooo_q))
+	{
+		ZLOG_ERR("AM SN length can't be changed in use: lcid=%d n_sdu=%d VT(A)=%u VT(S)=%u VR(R)=%u VR(H)=%u.\n", 
+			amtx->logical_chan, amtx->n_sdu, amtx->VT_A, amtx->VT_S, amrx->VR_R, amrx->VR_H);
+		return -1;
+	}
+	
+	sn_max = (1 << sn_bits) - 1;
+	if(sn_max != rlc_am->amtx.sn_max && rlc_am_window_alloc(rlc_am, sn_max + 1))
+		return -1;
+	window_size = (sn_max + 1) >> 1;
+	
+	rlc_am->amrx.sn_bits = sn_bits;
+	rlc_am->amrx.li_bits = li_bits;
+	rlc_am->amrx.sn_max = sn_max;
+	rlc_am->amrx.AM_Window_Size = window_size;
+	rlc_am->amrx.VR_MR = RLC_MOD(rlc_am->amrx.VR_R + window_size, sn_max + 1);
+	
+	rlc_am->amtx.sn_bits = sn_bits;
+	rlc_am->amtx.li_bits = li_bits;
+	rlc_am->amtx.sn_max = sn_max;
+	rlc_am->amtx.AM_Window_Size = window_size;
+	rlc_am->amtx.VT_MS = RLC_MOD(rlc_am->amtx.VT_A + window_size, sn_max + 1);
+	
+	/* STATUS PDU must be built again in new format */
+	amtx->status_pdu_len = 0;
+	amrx->rx_gen ++;
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_head_len                                                      */
+/***********************************************************************************/
+/* Description : - Length of fixed part of AMD PDU or AMD PDU segment header       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sn_bits            | i  | length of SN field                                  */
+/*   is_segment         | i  | 1: AMD PDU segment; 0: AMD PDU                      */
+/*   Return             |    | length in bytes                                     */
+/***********************************************************************************/
+u32 rlc_am_head_len(u32 sn_bits, u32 is_segment)
+{
+	if(sn_bits == 16)
+		return is_segment ? RLC_AM_SEGMENT_HEAD_LEN_16BITS : RLC_AM_HEAD_LEN_16BITS;
+	
+	return is_segment ? RLC_AM_SEGMENT_HEAD_LEN : RLC_AM_HEAD_LEN;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_li_len                                                        */
+/***********************************************************************************/
+/* Description : - Length of LIs in AMD PDU for n_li pieces of SDU                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_bits            | i  | length of LI field                                  */
+/*   n_li               | i  | the number of LI                                    */
+/*   Return             |    | length in bytes                                     */
+/***********************************************************************************/
+u32 rlc_am_li_len(u32 li_bits, u32 n_li)
+{
+	return (li_bits == 15) ? rlc_li15_len(n_li) : rlc_li_len(n_li);
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_encode_li                                                     */
+/***********************************************************************************/
+/* Description : - Write LIs of AMD PDU with 11 or 15 bits LI                     */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_bits            | i  | length of LI field                                  */
+/*   li_ptr             | o  | the start address of LI in PDU                      */
+/*   n_li               | i  | the number of LI                                    */
+/*   li_s               | i  | LI array                                            */
+/*   Return             |    | length of LIs in bytes                              */
+/***********************************************************************************/
+u32 rlc_am_encode_li(u32 li_bits, u8 *li_ptr, u32 n_li, u32 li_s[])
+{
+	if(li_bits == 15)
+		rlc_encode_li15(li_ptr, n_li, li_s);
+	else
+		rlc_encode_li(li_ptr, n_li, li_s);
+	
+	return rlc_am_li_len(li_bits, n_li);
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_set_head_sn                                                   */
+/***********************************************************************************/
+/* Description : - Write SN, and LSF/SO for AMD PDU segment, to AMD PDU header     */
+/*               - D/C, RF, P, FI and E are at same position for both SN length,   */
+/*                 they are written with rlc_am_head_set_xx() by caller            */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sn_bits            | i  | length of SN field                                  */
+/*   buf_ptr            | o  | start of AMD PDU                                    */
+/*   sn                 | i  | SN                                                  */
+/*   is_segment         | i  | 1: AMD PDU segment; 0: AMD PDU                      */
+/*   lsf                | i  | LSF, for AMD PDU segment only                       */
+/*   so                 | i  | SO, for AMD PDU segment only                        */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_set_head_sn(u32 sn_bits, u8 *buf_ptr, u32 sn, u32 is_segment, u32 lsf, u32 so)
+{
+	if(sn_bits == 16)
+	{
+		rlc_am_head_16bits_set_sn(buf_ptr, sn);
+		if(is_segment)
+			rlc_am_segment_head_16bits_set_lsf_so(buf_ptr, lsf, so);
+	}
+	else
+	{
+		rlc_am_head_set_sn(buf_ptr, sn);
+		if(is_segment)
+			rlc_am_segment_head_set_lsf_so(buf_ptr, lsf, so);
+	}
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_get_head_sn                                                   */
+/***********************************************************************************/
+/* Description : - Read SN, and LSF/SO for AMD PDU segment, from AMD PDU header    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sn_bits            | i  | length of SN field                                  */
+/*   buf_ptr            | i  | start of AMD PDU                                    */
+/*   lsf                | o  | NULL or LSF, 1 for AMD PDU                          */
+/*   so                 | o  | NULL or SO, 0 for AMD PDU                           */
+/*   Return             |    | SN                                                  */
+/***********************************************************************************/
+u32 rlc_am_get_head_sn(u32 sn_bits, u8 *buf_ptr, u32 *lsf, u32 *so)
+{
+	u32 sn, rf = rlc_am_head_get_rf(buf_ptr);
+	u32 seg_lsf = 1, seg_so = 0;
+	
+	if(sn_bits == 16)
+	{
+		if(rf)
+		{
+			seg_lsf = rlc_am_segment_head_16bits_get_lsf(buf_ptr);
+			seg_so = rlc_am_segment_head_16bits_get_so(buf_ptr);
+		}
+		sn = rlc_am_head_16bits_get_sn(buf_ptr);
+	}
+	else
+	{
+		if(rf)
+		{
+			seg_lsf = rlc_am_segment_head_get_lsf(buf_ptr);
+			seg_so = rlc_am_segment_head_get_so(buf_ptr);
+		}
+		sn = rlc_am_head_get_sn(buf_ptr);
+	}
+	
+	if(lsf)
+		*lsf = seg_lsf;
+	if(so)
+		*so = seg_so;
+	
+	return sn;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_set_aqm                                                       */
+/***********************************************************************************/
+/* Description : - Enable or disable AQM (CoDel) on SDU Tx queue                   */
+/*               - Time is in unit of RLC clock (rlc_timer_push)                   */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   target             | i  | target sojourn time, 0 to disable AQM               */
+/*   interval           | i  | sliding window of sojourn time above target         */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_set_aqm(rlc_entity_am_t *rlc_am, u32 target, u32 interval)
+{
+	if(rlc_am)
+		rlc_aqm_init(&rlc_am->amtx.aqm, target, interval);
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_set_sdu_ingress                                               */
+/***********************************************************************************/
+/* Description : - Enable or disable SDU ingress ring of Tx entity                 */
+/*               - Called before PDCP thread starts posting or after it stops      */
+/*               - SDUs left in old ring are moved to Tx queue                     */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_am             | i  | AM entity                                           */
+/*   n                  | i  | max number of SDU in ring, 0 to disable             */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
+/***********************************************************************************/
+int rlc_am_set_sdu_ingress(rlc_entity_am_t *rlc_am, u32 n)
+{
+	rlc_entity_am_tx_t *amtx;
+	
+	if(rlc_am == NULL)
+		return -1;
+	
+	amtx = &rlc_am->amtx;
+	if(amtx->sdu_ingress)
+	{
+		rlc_sdu_ingress_drain(amtx->sdu_ingress, &amtx->sdu_tx_q, amtx->free_sdu, RLC_SDU_INGRESS_ALL, &amtx->n_sdu, &amtx->sdu_total_size);
+		rlc_sdu_ingress_destroy(amtx->sdu_ingress, amtx->free_sdu);
+		amtx->sdu_ingress = NULL;
+	}
+	
+	if(n == 0)
+		return 0;
+	
+	amtx->sdu_ingress = rlc_sdu_ingress_create(n);
+	amtx->ingress_clock = &rlc_shard_cur->clock;
+	return amtx->sdu_ingress ? 0 : -1;
+}
+
 /***********************************************************************************/
 /* Function : rlc_am_set_maxretx_func                                              */
 /***********************************************************************************/
@@ -316,7 +776,7 @@ rlc_am_pdu_segment_t *rlc_am_pdu_segment_new()
 {
 	rlc_am_pdu_segment_t *pdu_segment = NULL;
 
-	pdu_segment = (rlc_am_pdu_segment_t *)FASTALLOC(g_mem_am_pdu_seg_base);
+	pdu_segment = (rlc_am_pdu_segment_t *)FASTALLOC(rlc_shard_cur->mem_am_pdu_seg_base);
 	if(pdu_segment)
 	{
 		pdu_segment->start_offset = 0;
@@ -331,8 +791,8 @@ rlc_am_pdu_segment_t *rlc_am_pdu_segment_new()
 		pdu_segment->lsf = 0;
 		pdu_segment->n_li = 0;
 		pdu_segment->data_ptr = NULL;
-
-		dllist_init(&pdu_segment->node);
+		pdu_segment->is_new = 0;
+		pdu_segment->ooo_sent = 0;
 	}
 	return pdu_segment;
 }
@@ -346,7 +806,7 @@ void rlc_am_pdu_segment_free(rlc_am_pdu_segment_t *pdu_segment)
 		if(pdu_segment->free)
 			pdu_segment->free(pdu_segment->buf_ptr, pdu_segment->buf_cookie);
 		
-		FASTFREE(g_mem_am_pdu_seg_base, pdu_segment);
+		FASTFREE(rlc_shard_cur->mem_am_pdu_seg_base, pdu_segment);
 	}
 }
 
@@ -367,7 +827,7 @@ rlc_am_tx_pdu_ctrl_t *rlc_am_tx_pdu_ctrl_new()
 {
 	rlc_am_tx_pdu_ctrl_t *pdu_ctrl;
 
-	pdu_ctrl = (rlc_am_tx_pdu_ctrl_t *)FASTALLOC(g_mem_am_pdu_tx_base);
+	pdu_ctrl = (rlc_am_tx_pdu_ctrl_t *)FASTALLOC(rlc_shard_cur->mem_am_pdu_tx_base);
 	if(pdu_ctrl)
 	{
 		pdu_ctrl->buf_ptr = NULL;
@@ -379,6 +839,7 @@ rlc_am_tx_pdu_ctrl_t *rlc_am_tx_pdu_ctrl_new()
 		pdu_ctrl->i_retransmit_seg = 0;
 		pdu_ctrl->n_retransmit_seg = 0;
 		pdu_ctrl->RETX_COUNT = 0;
+		pdu_ctrl->retx_bytes = 0;
 		pdu_ctrl->node.prev = NULL;
 		pdu_ctrl->node.next = NULL;
 	}
@@ -394,7 +855,7 @@ void rlc_am_tx_pdu_ctrl_free(rlc_am_tx_pdu_ctrl_t *pdu_ctrl)
 		pdu_ctrl->buf_free(pdu_ctrl->buf_ptr, pdu_ctrl->buf_cookie);
 
 	/* free pdu control */
-	FASTFREE(g_mem_am_pdu_tx_base, pdu_ctrl);
+	FASTFREE(rlc_shard_cur->mem_am_pdu_tx_base, pdu_ctrl);
 }
 
 /* dump a RLC AM Tx PDU control structure */
@@ -431,15 +892,19 @@ void rlc_am_tx_pdu_ctrl_dump(rlc_am_tx_pdu_ctrl_t *pdu_ctrl)
 /*   buf_ptr            | i  | RLC SDU buffer pointer                              */
 /*   sdu_size           | i  | Size of SDU                                         */
 /*   cookie             | i  | parameter of free function                          */
+/*   handle             | o  | handle for rlc_am_tx_sdu_discard(), may be NULL     */
 /*   Return             |    | 0 is success                                        */
 /***********************************************************************************/
-int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie)
+int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle)
 {
 	rlc_sdu_t *sdu;
 	
 	if(sdu_size <= 0 || buf_ptr == NULL || amtx == NULL)
 		return -1;
 	
+	if(amtx->txpdu == NULL && rlc_am_resume(RLC_AM_TX_ENTITY(amtx)))
+		return -1;
+	
 	sdu = rlc_sdu_new();
 	if(sdu == NULL)
 	{
@@ -455,6 +920,7 @@ int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, v
 	sdu->size = sdu_size;
 	sdu->n_segment = 1;
 	sdu->intact = 1;
+	rlc_sdu_set_handle(sdu, handle);
 	amtx->sdu_total_size += sdu_size;
 	amtx->n_sdu ++;
 	
@@ -464,37 +930,141 @@ int rlc_am_tx_sdu_enqueue(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, v
 	return 0;
 }
 
-
-/* return the number of not recieved PDU segment */
-u32 rlc_am_rx_get_n_miss_segment(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t *pdu_ctrl, rlc_spdu_so_t *so, u32 n_so)
+/***********************************************************************************/
+/* Function : rlc_am_tx_sdu_discard                                                */
+/***********************************************************************************/
+/* Description : - Discard a SDU in Tx queue by its handle in O(1)                 */
+/*               - Called by PDCP when discard timer expires                       */
+/*               - SDU which any segment has been mapped to PDU isn't discarded    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   handle             | i  | handle returned by rlc_am_tx_sdu_enqueue()          */
+/*   Return             |    | 0 is success                                        */
+/***********************************************************************************/
+int rlc_am_tx_sdu_discard(rlc_entity_am_tx_t *amtx, rlc_sdu_handle_t *handle)
 {
-	u32 n_miss = 0;
-	rlc_am_pdu_segment_t *pdu_segment;
-	u32 offset = 0;
+	int size;
 	
-	if(!pdu_ctrl->is_intact)
-	{
-		pdu_segment = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
+	if(amtx == NULL)
+		return -1;
+	
+	size = rlc_sdu_discard(&amtx->sdu_tx_q, handle);
+	if(size < 0)
+		return -1;
+	
+	amtx->sdu_total_size -= size;
+	amtx->n_sdu --;
+	
+	ZLOG_DEBUG("AM SDU discard: lcid=%d sdu_size=%u total_size=%u\n",
+			amtx->logical_chan, size, amtx->sdu_total_size);
+	
+	return 0;
+}
 
-		while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segment))
-		{
-			if(pdu_segment->start_offset != offset)
-			{
-				if(n_miss < n_so)
-				{
-					so[n_miss].sostart = offset;
-					so[n_miss].soend = pdu_segment->start_offset;
-				}
+/***********************************************************************************/
+/* Function : rlc_am_tx_sdu_enqueue_batch                                          */
+/***********************************************************************************/
+/* Description : - Enqueue a burst of RLC SDUs (only one segment each)             */
+/*               - Called by PDCP, etc                                             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   bufs               | i  | RLC SDU buffer pointers                             */
+/*   sizes              | i  | Size of SDUs                                        */
+/*   cookies            | i  | parameters of free function, may be NULL            */
+/*   n                  | i  | number of SDU                                       */
+/*   handles            | o  | handles for rlc_am_tx_sdu_discard(), may be NULL    */
+/*   Return             |    | number of enqueued SDU, -1 is failure               */
+/***********************************************************************************/
+int rlc_am_tx_sdu_enqueue_batch(rlc_entity_am_tx_t *amtx, u8 *bufs[], u32 sizes[], void *cookies[], u32 n, 
+		rlc_sdu_handle_t handles[])
+{
+	int n_sdu;
+	u32 total_size;
+	
+	if(amtx == NULL)
+		return -1;
+	
+	if(amtx->txpdu == NULL && rlc_am_resume(RLC_AM_TX_ENTITY(amtx)))
+		return -1;
+	
+	n_sdu = rlc_sdu_enqueue_batch(&amtx->sdu_tx_q, amtx->free_sdu, bufs, sizes, cookies, NULL, n, handles, &total_size);
+	if(n_sdu < 0)
+		return -1;
+	
+	amtx->sdu_total_size += total_size;
+	amtx->n_sdu += n_sdu;
+	
+	ZLOG_DEBUG("AM SDU batch enqueue: lcid=%d n_sdu=%d size=%u total_size=%u\n",
+			amtx->logical_chan, n_sdu, total_size, amtx->sdu_total_size);
+	
+	return n_sdu;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_tx_sdu_post                                                   */
+/***********************************************************************************/
+/* Description : - Post SDU to SDU ingress ring from PDCP thread, wait-free        */
+/*               - SDU is moved to Tx queue when MAC thread builds PDU             */
+/*               - No handle is given, posted SDU can't be discarded               */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   buf_ptr            | i  | RLC SDU buffer pointer                              */
+/*   sdu_size           | i  | Size of SDU                                         */
+/*   cookie             | i  | parameter of free function                          */
+/*   Return             |    | 0 is success, -1 if ring is full or not enabled     */
+/***********************************************************************************/
+int rlc_am_tx_sdu_post(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u32 sdu_size, void *cookie)
+{
+	if(amtx == NULL)
+		return -1;
+	
+	if(amtx->sdu_ingress == NULL)
+		return -1;
+	
+	return rlc_sdu_ingress_post(amtx->sdu_ingress, buf_ptr, sdu_size, cookie, *amtx->ingress_clock);
+}
+
+
+/* return the number of not recieved PDU segment */
+u32 rlc_am_rx_get_n_miss_segment(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t *pdu_ctrl, rlc_spdu_so_t *so, u32 n_so)
+{
+	u32 n_miss = 0;
+	rlc_am_pdu_segment_t *pdu_segment;
+	u32 offset = 0;
+	u32 i;
+	
+	if(!pdu_ctrl->is_intact)
+	{
+		assert(pdu_ctrl->n_seg > 0);
+		pdu_segment = pdu_ctrl->rx_seg[pdu_ctrl->n_seg-1];
+		
+		/* only the number of holes is asked */
+		if(n_so == 0)
+			return pdu_ctrl->n_gap + !pdu_segment->lsf;
+		
+		for(i=0; i<pdu_ctrl->n_seg && n_miss<n_so; i++)
+		{
+			if(pdu_ctrl->rx_seg[i]->start_offset != offset)
+			{
+				so[n_miss].sostart = offset;
+				so[n_miss].soend = pdu_ctrl->rx_seg[i]->start_offset;
 				n_miss ++;
 			}
 
-			offset = pdu_segment->end_offset;
-			
-			pdu_segment = (rlc_am_pdu_segment_t *)pdu_segment->node.next;
+			offset = pdu_ctrl->rx_seg[i]->end_offset;
 		}
+		n_miss = pdu_ctrl->n_gap;
 
 		/* for last one */
-		pdu_segment = (rlc_am_pdu_segment_t *)DLLIST_TAIL(&pdu_ctrl->rx_segq);
 		if(!pdu_segment->lsf)
 		{
 			if(n_miss < n_so)
@@ -509,6 +1079,91 @@ u32 rlc_am_rx_get_n_miss_segment(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t
 	return n_miss;
 }
 
+/***********************************************************************************/
+/* Function : rlc_am_rx_nack_bits                                                  */
+/***********************************************************************************/
+/* Description : - Size of NACK info in STATUS PDU for one SN                      */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | i  | RLC AM Rx entity                                    */
+/*   sn                 | i  | SN in [VR(R), VR(MS))                               */
+/*   Return             |    | size in bits                                        */
+/***********************************************************************************/
+u32 rlc_am_rx_nack_bits(rlc_entity_am_rx_t *amrx, u32 sn)
+{
+	rlc_am_rx_pdu_ctrl_t *pdu_ctrl = amrx->rxpdu[sn];
+	u32 nack_bits = RLC_AM_STATUS_NACK_BITS(amrx->sn_bits);
+	
+	if(pdu_ctrl == NULL)
+		return nack_bits;		//size of (NACK_SN,E1,E2) set
+	
+	/* size of (NACK_SN, E1, E2, SOstart, Soend) for each hole */
+	if(!pdu_ctrl->is_intact)
+		return rlc_am_rx_get_n_miss_segment(amrx, pdu_ctrl, NULL, 0)*(nack_bits + 2*RLC_AM_STATUS_SO_BITS(amrx->sn_bits));
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_count_nack_bits                                            */
+/***********************************************************************************/
+/* Description : - Size of NACK info in STATUS PDU for all SN in [VR(R), VR(MS))   */
+/*               - Only called when VR(MS) jumps, else amrx->nack_bits is updated  */
+/*                 incrementally on reception of PDU                               */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | i  | RLC AM Rx entity                                    */
+/*   Return             |    | size in bits                                        */
+/***********************************************************************************/
+u32 rlc_am_rx_count_nack_bits(rlc_entity_am_rx_t *amrx)
+{
+	u32 sn, nack_bits = 0;
+	
+	sn = amrx->VR_R;
+	while(sn != amrx->VR_MS)
+	{
+		nack_bits += rlc_am_rx_nack_bits(amrx, sn);
+		sn = RLC_MOD(sn+1, amrx->sn_max+1);
+	}
+	
+	return nack_bits;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_next_missing_sn                                            */
+/***********************************************************************************/
+/* Description : - Find the first SN >= sn for which not all byte segments have    */
+/*                 been received, 64 SN at a time in amrx->intact_map              */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | i  | RLC AM Rx entity                                    */
+/*   sn                 | i  | SN to start from                                    */
+/*   Return             |    | first missing SN                                    */
+/***********************************************************************************/
+u32 rlc_am_rx_next_missing_sn(rlc_entity_am_rx_t *amrx, u32 sn)
+{
+	u32 n_word = (amrx->sn_max + 1) >> 6;
+	u32 i_word = sn >> 6;
+	u64 missing = ~amrx->intact_map[i_word] & (~0ULL << (sn & 63));
+	u32 n;
+	
+	/* there is always a missing SN out of receiving window */
+	for(n=0; missing == 0 && n<n_word; n++)
+	{
+		i_word = (i_word + 1 == n_word) ? 0 : i_word + 1;
+		missing = ~amrx->intact_map[i_word];
+	}
+	
+	assert(missing);
+	return (i_word << 6) + __builtin_ctzll(missing);
+}
+
 /***********************************************************************************/
 /* Function : rlc_am_tx_get_status_pdu_size                                        */
 /***********************************************************************************/
@@ -522,39 +1177,13 @@ u32 rlc_am_rx_get_n_miss_segment(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t
 /***********************************************************************************/
 u32 rlc_am_tx_get_status_pdu_size(rlc_entity_am_tx_t *amtx)
 {
-	u32 pdu_size_in_bits = 0;
-	rlc_entity_am_rx_t *amrx;
-	u32 sn, n_miss;
-	rlc_am_rx_pdu_ctrl_t *pdu_ctrl;
-
 	if(amtx == NULL)
 		return 0;
 
-	amrx = amtx->amrx;
 	if(amtx->status_pdu_triggered && !rlc_timer_is_running(&amtx->t_StatusProhibit))
 	{
-		sn = amrx->VR_R;
-		while(sn != amrx->VR_MS)
-		{
-			pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)amrx->rxpdu[sn];
-			if(pdu_ctrl == NULL)
-			{
-				pdu_size_in_bits += 12;		//12 = size of (NACK_SN,E1,E2) set
-			}
-			else if(!pdu_ctrl->is_intact)
-			{
-				n_miss = rlc_am_rx_get_n_miss_segment(amrx, pdu_ctrl, NULL, 0);
-				pdu_size_in_bits += n_miss*42;	//42 = size of (NACK_SN, E1, E2, SOstart, Soend)
-			}
-
-			sn = RLC_MOD(sn+1, RLC_SN_MAX_10BITS+1);
-		}
-
-		/* add size of header */
-		pdu_size_in_bits += 15;
-
-		/* return in bytes */
-		return (pdu_size_in_bits+7)/8;
+		/* plus size of header, return in bytes */
+		return (amtx->amrx->nack_bits + RLC_AM_STATUS_HEAD_BITS(amtx->amrx->sn_bits) + 7)/8;
 	}
 	
 	return 0;
@@ -575,9 +1204,6 @@ u32 rlc_am_tx_get_status_pdu_size(rlc_entity_am_tx_t *amtx)
 u32 rlc_am_tx_get_retx_pdu_size(rlc_entity_am_tx_t *amtx)
 {
 	rlc_am_tx_pdu_ctrl_t *pdu_ctrl;
-	rlc_am_pdu_segment_info_t *pdu_segment;
-	u32 pdu_size;
-	u32 i_li, n_li, now_offset;
 	
 	/* ReTx PDU first */
 	if(!DLLIST_EMPTY(&amtx->pdu_retx_q))
@@ -585,59 +1211,104 @@ u32 rlc_am_tx_get_retx_pdu_size(rlc_entity_am_tx_t *amtx)
 		pdu_ctrl = (rlc_am_tx_pdu_ctrl_t *)DLLIST_HEAD(&amtx->pdu_retx_q);
 		assert(pdu_ctrl->n_retransmit_seg > 0);
 		
-		pdu_segment = &pdu_ctrl->retransmit_seg[pdu_ctrl->i_retransmit_seg];
-		
-		/* return size of the first segment if pdu_segment->pdu_size > 0
-		 * pdu_segment->pdu_size is pre-calculated:
-		 * 1) full pdu
-		 * 2) rlc_am_tx_get_retx_pdu_size() is repeatedly called and rlc_am_tx_build_retx_pdu isn't
-		 *     called in between.
-		 */
-		if(pdu_segment->pdu_size)
-			return pdu_segment->pdu_size;
-		
-		/* get number of LI in PDU segment */
-		/* 1) find start point */
-		n_li = 0;
-		now_offset = 0;
-		for(i_li = 0; i_li < pdu_ctrl->n_li; i_li ++)
-		{
-			if(now_offset < pdu_segment->start_offset)
-			{
-				now_offset += pdu_ctrl->li_s[i_li];
-			}
-			else
-				break;
-		}
-		
-		if(now_offset > pdu_segment->start_offset)
+		return rlc_am_tx_get_retx_seg_size(amtx, pdu_ctrl, &pdu_ctrl->retransmit_seg[pdu_ctrl->i_retransmit_seg]);
+	}
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_tx_update_retx_bytes                                          */
+/***********************************************************************************/
+/* Description : - Re-calculate ReTx size of PDU and update total ReTx size        */
+/*               - Called whenever segments waiting for ReTx are changed           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   pdu_ctrl           | i  | Tx PDU control                                      */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_tx_update_retx_bytes(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl)
+{
+	u32 i, retx_bytes = 0;
+	
+	for(i=0; i<pdu_ctrl->n_retransmit_seg; i++)
+	{
+		retx_bytes += rlc_am_tx_get_retx_seg_size(amtx, pdu_ctrl, 
+				&pdu_ctrl->retransmit_seg[RLC_MOD(pdu_ctrl->i_retransmit_seg+i, RLC_SEG_NUM_MAX)]);
+	}
+	
+	amtx->retx_bytes = amtx->retx_bytes - pdu_ctrl->retx_bytes + retx_bytes;
+	pdu_ctrl->retx_bytes = retx_bytes;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_tx_get_retx_seg_size                                          */
+/***********************************************************************************/
+/* Description : - return the size of ReTx PDU (segment) of a NACKed segment       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   pdu_ctrl           | i  | Tx PDU control                                      */
+/*   pdu_segment        | i  | NACKed segment                                      */
+/*   Return             |    | size of ReTx PDU                                    */
+/***********************************************************************************/
+u32 rlc_am_tx_get_retx_seg_size(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl, rlc_am_pdu_segment_info_t *pdu_segment)
+{
+	u32 pdu_size;
+	u32 i_li, n_li, now_offset;
+	
+	/* return saved size if pdu_segment->pdu_size > 0
+	 * pdu_segment->pdu_size is pre-calculated:
+	 * 1) full pdu
+	 * 2) the size has been calculated and rlc_am_tx_build_retx_pdu isn't called in between.
+	 */
+	if(pdu_segment->pdu_size)
+		return pdu_segment->pdu_size;
+	
+	/* get number of LI in PDU segment */
+	/* 1) find start point */
+	n_li = 0;
+	now_offset = 0;
+	for(i_li = 0; i_li < pdu_ctrl->n_li; i_li ++)
+	{
+		if(now_offset < pdu_segment->start_offset)
 		{
-			n_li ++;
+			now_offset += pdu_ctrl->li_s[i_li];
 		}
+		else
+			break;
+	}
+	
+	if(now_offset > pdu_segment->start_offset)
+	{
+		n_li ++;
+	}
 
-		/* 2) find stop point */
-		for(; i_li < pdu_ctrl->n_li; i_li ++)
+	/* 2) find stop point */
+	for(; i_li < pdu_ctrl->n_li; i_li ++)
+	{
+		if(now_offset < pdu_segment->end_offset)
 		{
-			if(now_offset < pdu_segment->end_offset)
-			{
-				now_offset += pdu_ctrl->li_s[i_li];
-				n_li ++;
-			}
-			else
-				break;
+			now_offset += pdu_ctrl->li_s[i_li];
+			n_li ++;
 		}
+		else
+			break;
+	}
 
-		assert(n_li > 0);
+	assert(n_li > 0);
 
-		pdu_size = sizeof(rlc_am_pdu_segment_head_t) + rlc_li_len(n_li)	+ pdu_segment->end_offset - pdu_segment->start_offset;
+	pdu_size = rlc_am_head_len(amtx->sn_bits, 1) + rlc_am_li_len(amtx->li_bits, n_li) + pdu_segment->end_offset - pdu_segment->start_offset;
 
-		/* save pdu_size for next use */
-		pdu_segment->pdu_size = pdu_size;
-		
-		return pdu_size;
-	}
+	/* save pdu_size for next use */
+	pdu_segment->pdu_size = pdu_size;
 	
-	return 0;
+	return pdu_size;
 }
 
 /***********************************************************************************/
@@ -654,15 +1325,21 @@ u32 rlc_am_tx_get_retx_pdu_size(rlc_entity_am_tx_t *amtx)
 u32 rlc_am_tx_get_fresh_pdu_size(rlc_entity_am_tx_t *amtx)
 {
 	
-	u32 head_len = sizeof(rlc_am_pdu_head_t);
+	u32 head_len = rlc_am_head_len(amtx->sn_bits, 0);
 	u32 li_len = 0;
 	u32 pdu_size;
+	s32 n_sdu = amtx->n_sdu;
+	s32 sdu_total_size = amtx->sdu_total_size;
+	
+	/* SDUs in ingress ring will be drained by next build */
+	if(amtx->sdu_ingress)
+		rlc_sdu_ingress_pending(amtx->sdu_ingress, &n_sdu, &sdu_total_size);
 	
 	/* no data in queue */
-	if(amtx->sdu_total_size == 0)
+	if(sdu_total_size == 0)
 		return 0;
 		
-	assert(amtx->n_sdu > 0);
+	assert(n_sdu > 0);
 	
 	/* The transmitting side of an AM RLC entity shall not deliver to lower layer 
 	   any RLC data PDU whose SN falls outside of the transmitting window.
@@ -671,9 +1348,9 @@ u32 rlc_am_tx_get_fresh_pdu_size(rlc_entity_am_tx_t *amtx)
 		return 0;
 	
 	/* number of LI equals to n_sdu-1 */
-	li_len = rlc_li_len(amtx->n_sdu);
+	li_len = rlc_am_li_len(amtx->li_bits, n_sdu);
 		
-	pdu_size = amtx->sdu_total_size + head_len + li_len;
+	pdu_size = sdu_total_size + head_len + li_len;
 	return RLC_MIN(pdu_size, 0xFFF0);
 }
 
@@ -718,6 +1395,46 @@ u32 rlc_am_tx_estimate_pdu_size(rlc_entity_am_tx_t *amtx, u32 *out_pdu_size)
 	return pdu_size;
 }
 
+/***********************************************************************************/
+/* Function : rlc_am_tx_get_buffer_status                                          */
+/***********************************************************************************/
+/* Description : - Get buffer status of RLC AM entity in O(1)                      */
+/*               - All fields are maintained incrementally, cheap for polling      */
+/*                 every TTI                                                       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   bs                 | o  | buffer status                                       */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_tx_get_buffer_status(rlc_entity_am_tx_t *amtx, rlc_buffer_status_t *bs)
+{
+	s32 n_sdu = amtx->n_sdu;
+	s32 sdu_total_size = amtx->sdu_total_size;
+	
+	/* SDUs in ingress ring will be drained by next build */
+	if(amtx->sdu_ingress)
+		rlc_sdu_ingress_pending(amtx->sdu_ingress, &n_sdu, &sdu_total_size);
+	
+	bs->status_bytes = rlc_am_tx_get_status_pdu_size(amtx);
+	bs->retx_bytes = amtx->retx_bytes;
+	bs->n_sdu = n_sdu;
+	bs->hol_delay = rlc_am_tx_get_hol_delay(amtx);
+	bs->window_stalled = 0;
+	
+	if(sdu_total_size == 0)
+	{
+		bs->new_bytes = 0;
+		return;
+	}
+	
+	/* no clamp: for BSR, not for building one PDU */
+	bs->new_bytes = sdu_total_size + rlc_am_head_len(amtx->sn_bits, 0) + rlc_am_li_len(amtx->li_bits, n_sdu);
+	bs->window_stalled = !RLC_SN_IN_TRANSMITTING_WIN(amtx->VT_S, amtx->VT_MS, amtx->VT_A, amtx->sn_max + 1);
+}
+
 /* add pdu_ctrl to ReTx queue: ascending on SN */
 void rlc_am_tx_add_retx(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl)
 {
@@ -730,7 +1447,7 @@ void rlc_am_tx_add_retx(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl
 	tmp_ctrl = (rlc_am_tx_pdu_ctrl_t *)DLLIST_HEAD(&amtx->pdu_retx_q);
 	while(!DLLIST_IS_HEAD(&amtx->pdu_retx_q,tmp_ctrl))
 	{
-		if(RLC_SN_LESS(tmp_ctrl->sn, pdu_ctrl->sn, (RLC_SN_MAX_10BITS+1)))
+		if(RLC_SN_LESS(tmp_ctrl->sn, pdu_ctrl->sn, (amtx->sn_max+1)))
 			tmp_ctrl = (rlc_am_tx_pdu_ctrl_t *)(tmp_ctrl->node.next);
 		else
 			break;
@@ -750,7 +1467,8 @@ void rlc_am_tx_add_retx(rlc_entity_am_tx_t *amtx, rlc_am_tx_pdu_ctrl_t *pdu_ctrl
 /* Function : rlc_am_tx_build_status_pdu                                           */
 /***********************************************************************************/
 /* Description : - Called by MAC to build RLC Status PDU                           */
-/*                                                                                 */
+/*               - The built PDU is cached and copied out again if Rx state isn't  */
+/*                 changed, eg. MAC drops the PDU and asks again                   */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
@@ -766,42 +1484,60 @@ int rlc_am_tx_build_status_pdu(rlc_entity_am_tx_t *amtx, rlc_entity_am_rx_t *amr
 	u32 pdu_size_in_bits = 0;
 	u16 sn, n_miss;
 	rlc_am_rx_pdu_ctrl_t *pdu_ctrl;
-	rlc_am_status_pdu_head_t *pdu_head = (rlc_am_status_pdu_head_t *)buf_ptr;
 	u32 ack_sn;
 	struct nacksn_info ninfo[MAXINFO_NUM];
 	u32 i, n_nacksn = 0;
 	rlc_spdu_so_t soinfo[MAXINFO_NUM];
-	u8 *old_buf_ptr = buf_ptr;
+	rlc_bitwriter_t bw;
+	u32 status_pdu_len;
+	u32 head_bits = RLC_AM_STATUS_HEAD_BITS(amrx->sn_bits);
+	u32 nack_bits = RLC_AM_STATUS_NACK_BITS(amrx->sn_bits);
+	u32 so_bits = RLC_AM_STATUS_SO_BITS(amrx->sn_bits);
 
 	if(amtx->status_pdu_triggered==0 || rlc_timer_is_running(&amtx->t_StatusProhibit))
 		return 0;
 	
-	if(pdu_size < sizeof(rlc_am_status_pdu_head_t))
+	if(pdu_size < (head_bits+7)/8)
 	{
 		ZLOG_WARN("lcid=%d pdu_size=%d is too small\n", amtx->logical_chan, pdu_size);
 		return 0;
 	}
 
-	memset(buf_ptr, 0, pdu_size);
+	/* reuse cached STATUS PDU: a whole one fits into pdu_size, or a truncated one with same pdu_size */
+	if(amtx->status_pdu_len && amtx->status_pdu_gen == amrx->rx_gen &&
+		((!amtx->status_pdu_truncated && pdu_size >= amtx->status_pdu_len) || 
+		(amtx->status_pdu_truncated && pdu_size == amtx->status_pdu_grant)))
+	{
+		memcpy(buf_ptr, amtx->status_pdu_buf, amtx->status_pdu_len);
+		
+		ZLOG_DEBUG("lcid=%d reuse cached STATUS PDU: size=%u\n", amtx->logical_chan, amtx->status_pdu_len);
+		
+		/* start timer t_StatusProhibit */
+		amtx->status_pdu_triggered = 0;
+		rlc_timer_start(&amtx->t_StatusProhibit);
+		
+		return amtx->status_pdu_len;
+	}
 
 	/* 15 = size of head
 	 *  12 = size of (NACK_SN,E1,E2) set
 	 *  30 = size of (SOstart, Soend)
 	 *  42 = 12 + 30
+	 * they are 23, 18, 32 and 50 for 16 bits SN
 	 */
 	
 	/* 1) first round: build nack_sn info */
 	ack_sn = amrx->VR_MS;
 	sn = amrx->VR_R;
-	pdu_size_in_bits = 15;
-	while(sn != amrx->VR_MS && n_nacksn<MAXINFO_NUM)
+	pdu_size_in_bits = head_bits;
+	while(sn != amrx->VR_MS)
 	{
 		pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)amrx->rxpdu[sn];
 		if(pdu_ctrl == NULL)
 		{
-			if(pdu_size >= (pdu_size_in_bits+12+7)/8)
+			if(pdu_size >= (pdu_size_in_bits+nack_bits+7)/8 && n_nacksn < MAXINFO_NUM)
 			{
-				pdu_size_in_bits += 12;
+				pdu_size_in_bits += nack_bits;
 				ninfo[n_nacksn].nacksn.nack_sn = sn;
 				ninfo[n_nacksn].nacksn.e1 = 1;
 				ninfo[n_nacksn].nacksn.e2 = 0;
@@ -817,9 +1553,9 @@ int rlc_am_tx_build_status_pdu(rlc_entity_am_tx_t *amtx, rlc_entity_am_rx_t *amr
 		else if(!pdu_ctrl->is_intact)
 		{
 			n_miss = rlc_am_rx_get_n_miss_segment(amrx, pdu_ctrl, soinfo, MAXINFO_NUM);
-			if(pdu_size >= (pdu_size_in_bits+42*n_miss+7)/8)
+			if(pdu_size >= (pdu_size_in_bits+(nack_bits+2*so_bits)*n_miss+7)/8 && n_nacksn + n_miss <= MAXINFO_NUM)
 			{
-				pdu_size_in_bits += 42*n_miss;
+				pdu_size_in_bits += (nack_bits+2*so_bits)*n_miss;
 				for(i=0; i<n_miss; i++)
 				{
 					ninfo[n_nacksn].nacksn.nack_sn = sn;
@@ -839,67 +1575,64 @@ int rlc_am_tx_build_status_pdu(rlc_entity_am_tx_t *amtx, rlc_entity_am_rx_t *amr
 			}
 		}
 
-		sn = RLC_MOD(sn+1, RLC_SN_MAX_10BITS+1);
+		sn = RLC_MOD(sn+1, amrx->sn_max+1);
 	}
 
 	/* set the last e1 to 0 */
 	if(n_nacksn)
 		ninfo[n_nacksn-1].nacksn.e1 = 0;
+	
+	amtx->status_pdu_truncated = (sn != amrx->VR_MS);
 
 	/* 2) second round: encoding PDU */
-	pdu_head->dc = RLC_AM_DC_CTRL_PDU;
-	pdu_head->cpt = 0;
-	pdu_head->e1 = (n_nacksn>0);
-	pdu_head->ack_sn = ack_sn;
+	rlc_bw_init(&bw, buf_ptr);
 	
-	pdu_size_in_bits = 15;	//15 = size of head
+	//size of head: D/C, CPT, ACK_SN, E1
+	rlc_bw_put(&bw, RLC_AM_DC_CTRL_PDU, 1);
+	rlc_bw_put(&bw, 0, 3);
+	rlc_bw_put(&bw, ack_sn, amrx->sn_bits);
+	rlc_bw_put(&bw, (n_nacksn>0), 1);
 
 	for(i=0; i<n_nacksn; i++)
 	{
-		if(ninfo[i].nacksn.e2 == 0)
-		{
-			//12 = size of (NACK_SN,E1,E2) set
-			bitcpy((unsigned long *)buf_ptr, pdu_size_in_bits, (const unsigned long *)&ninfo[i].nacksn, 0, 12);
-			pdu_size_in_bits += 12;
-			if(pdu_size_in_bits >= 32)
-			{
-				buf_ptr += 4;
-				pdu_size_in_bits -= 32;
-			}
-		}
-		else
+		//size of (NACK_SN,E1,E2) set
+		rlc_bw_put(&bw, ninfo[i].nacksn.nack_sn, amrx->sn_bits);
+		rlc_bw_put(&bw, ninfo[i].nacksn.e1, 1);
+		rlc_bw_put(&bw, ninfo[i].nacksn.e2, 1);
+		
+		if(ninfo[i].nacksn.e2)
 		{
-			//12 = size of (NACK_SN,E1,E2) set
-			bitcpy((unsigned long *)buf_ptr, pdu_size_in_bits, (const unsigned long *)&ninfo[i].nacksn, 0, 12);
-			pdu_size_in_bits += 12;
-			if(pdu_size_in_bits >= 32)
-			{
-				buf_ptr += 4;
-				pdu_size_in_bits -= 32;
-			}
-			//30 = size of (SOstart, Soend)
-			bitcpy((unsigned long *)buf_ptr, pdu_size_in_bits, (const unsigned long *)&ninfo[i].so, 0, 30);
-			pdu_size_in_bits += 30;
-			if(pdu_size_in_bits >= 32)
-			{
-				buf_ptr += 4;
-				pdu_size_in_bits -= 32;
-			}
+			//size of (SOstart, Soend)
+			rlc_bw_put(&bw, ninfo[i].so.sostart, so_bits);
+			rlc_bw_put(&bw, ninfo[i].so.soend, so_bits);
 		}
 	}
+	
+	status_pdu_len = rlc_bw_flush(&bw);
 
 	ZLOG_DEBUG("lcid=%d ack_sn=%u n_nacksn=%u pdu_size_in_bits=%u nack_sn=(0x%x 0x%x 0x%x..)\n", 
 			amtx->logical_chan, ack_sn, n_nacksn, pdu_size_in_bits,
-			ninfo[0].nacksn.nack_sn | (ninfo[0].nacksn.e2 << 15),
-			ninfo[1].nacksn.nack_sn | (ninfo[1].nacksn.e2 << 15),
-			ninfo[2].nacksn.nack_sn | (ninfo[2].nacksn.e2 << 15));
+			ninfo[0].nacksn.nack_sn | (ninfo[0].nacksn.e2 << 16),
+			ninfo[1].nacksn.nack_sn | (ninfo[1].nacksn.e2 << 16),
+			ninfo[2].nacksn.nack_sn | (ninfo[2].nacksn.e2 << 16));
 
 	/* start timer t_StatusProhibit */
 	amtx->status_pdu_triggered = 0;
 	ZLOG_DEBUG("start timer t_StatusProhibit: lcid=%d\n", amtx->logical_chan);
 	rlc_timer_start(&amtx->t_StatusProhibit);
 
-	return buf_ptr - old_buf_ptr + (pdu_size_in_bits+7)/8;
+	/* save STATUS PDU, cache is allocated with the windows */
+	if(status_pdu_len <= RLC_AM_STATUS_PDU_MAX && amtx->status_pdu_buf)
+	{
+		memcpy(amtx->status_pdu_buf, buf_ptr, status_pdu_len);
+		amtx->status_pdu_len = status_pdu_len;
+		amtx->status_pdu_grant = pdu_size;
+		amtx->status_pdu_gen = amrx->rx_gen;
+	}
+	else
+		amtx->status_pdu_len = 0;
+
+	return status_pdu_len;
 }
 
 /* update poll bit */
@@ -956,7 +1689,7 @@ int rlc_am_tx_deliver_poll(rlc_entity_am_tx_t *amtx)
 		amtx->BYTE_WITHOUT_POLL = 0;
 		
 		/* start timer t_PollRetransmit */
-		amtx->POLL_SN = (amtx->VT_S-1) & (amtx->sn_max+1);
+		amtx->POLL_SN = (amtx->VT_S-1) & amtx->sn_max;
 		if(rlc_timer_is_running(&amtx->t_PollRetransmit))
 		{
 			ZLOG_DEBUG("stop timer t_PollRetransmit: lcid=%d\n", amtx->logical_chan);
@@ -991,13 +1724,13 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 	u32 i_li;								//index in pdu_ctrl->li_s[]
 	s32 li_offset;							//
 	s32 remain_pdu_size;
-	rlc_am_pdu_segment_head_t *segment_head;
 	rlc_am_pdu_segment_t pdu_segment, *pdu_segment_ctrl;
-	rlc_li_t *li_ptr;
+	u8 *li_ptr;
 	u8 *data_ptr, *data_ptr_src;
 	u32 data_size = 0;						//size of SDU to copy
 	u8 fi[2];
 	u32 tmpv;
+	u32 so, lsf = 0;
 	rlc_am_pdu_segment_info_t *seginfo;
 	
 	if(DLLIST_EMPTY(&amtx->pdu_retx_q))
@@ -1040,19 +1773,19 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 		dllist_remove(&amtx->pdu_retx_q, &pdu_ctrl->node);
 		pdu_ctrl->n_retransmit_seg = 0;
 		pdu_ctrl->i_retransmit_seg = 0;
+		rlc_am_tx_update_retx_bytes(amtx, pdu_ctrl);
 
 		/* update the poll bit */
-		segment_head = (rlc_am_pdu_segment_head_t *)buf_ptr;
 		rlc_am_tx_update_poll(amtx, 1 /* is_retx */, data_size);
-		segment_head->p = rlc_am_tx_deliver_poll(amtx);
+		rlc_am_head_set_p(buf_ptr, rlc_am_tx_deliver_poll(amtx));
 
 		ZLOG_DEBUG("Retx build: lcid=%d sn=%u fi=%u n_li=%u li_s=(%u %u %u ..)\n", 
-			amtx->logical_chan, segment_head->sn, segment_head->fi, 
+			amtx->logical_chan, pdu_ctrl->sn, rlc_am_head_get_fi(buf_ptr), 
 			pdu_ctrl->n_li, 
 			pdu_ctrl->li_s[0], pdu_ctrl->li_s[1], pdu_ctrl->li_s[2]);
 	
 		ZLOG_DEBUG("after Retx build: lcid=%d pdu_size=%u poll=%d VT_A=%u VT_S=%u VT_MS=%u POLL_SN=%u\n", 
-			amtx->logical_chan, pdu_ctrl->pdu_size, segment_head->p, 
+			amtx->logical_chan, pdu_ctrl->pdu_size, rlc_am_head_get_p(buf_ptr), 
 			amtx->VT_A, amtx->VT_S, amtx->VT_MS, amtx->POLL_SN);
 	
 		return pdu_ctrl->pdu_size;
@@ -1063,14 +1796,11 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 
 	pdu_segment_ctrl->n_li = 0;
 
-	segment_head = (rlc_am_pdu_segment_head_t *)buf_ptr;
-	segment_head->dc = RLC_AM_DC_DATA_PDU;
-	segment_head->sn = pdu_ctrl->sn;
-	segment_head->rf = 1;
-	segment_head->lsf = 0;
-	segment_head->so = seginfo->start_offset;
+	rlc_am_head_set_dc(buf_ptr, RLC_AM_DC_DATA_PDU);
+	rlc_am_head_set_rf(buf_ptr, 1);
+	so = seginfo->start_offset;
 
-	remain_pdu_size = pdu_size - sizeof(rlc_am_pdu_segment_head_t);
+	remain_pdu_size = pdu_size - rlc_am_head_len(amtx->sn_bits, 1);
 	if(remain_pdu_size <= 0)
 		return 0;
 
@@ -1093,16 +1823,16 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 	/* find start point */
 	i_li = 0;
 	li_offset = 0;
-	while(li_offset<segment_head->so && i_li<pdu_ctrl->n_li)
+	while(li_offset<so && i_li<pdu_ctrl->n_li)
 		li_offset += pdu_ctrl->li_s[i_li++];
 
-	/* here li_offset >= segment_head->so */
-	if(li_offset > segment_head->so)
+	/* here li_offset >= so */
+	if(li_offset > so)
 	{
 		/* set first LI  */
 		pdu_segment_ctrl->n_li = 1;
 		tmpv = RLC_MIN(li_offset, seginfo->end_offset);
-		pdu_segment_ctrl->li_s[0] = RLC_MIN(remain_pdu_size, tmpv-segment_head->so);
+		pdu_segment_ctrl->li_s[0] = RLC_MIN(remain_pdu_size, tmpv-so);
 		remain_pdu_size -= pdu_segment_ctrl->li_s[0];
 		data_size += pdu_segment_ctrl->li_s[0];
 
@@ -1110,7 +1840,7 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 		fi[0] = 1;		//NFIRST
 		fi[1] = (li_offset != seginfo->start_offset + data_size);
 	}
-	else /* (li_offset == segment_head->so) */
+	else /* (li_offset == so) */
 	{
 		/* set FI */
 		if(i_li==0)
@@ -1128,7 +1858,7 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 		if(pdu_segment_ctrl->n_li > 0)
 		{
 			/* substrace the size of LI from remain_pdu_size */
-			if(pdu_segment_ctrl->n_li & 0x01)
+			if(amtx->li_bits == 15 || (pdu_segment_ctrl->n_li & 0x01))
 				lisize = 2;
 			else
 				lisize = 1;
@@ -1158,26 +1888,25 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 	assert(pdu_segment_ctrl->n_li > 0);
 
 	/* Write LI */
-	li_ptr = (rlc_li_t *)(segment_head+1);
-	rlc_encode_li(li_ptr, pdu_segment_ctrl->n_li, pdu_segment_ctrl->li_s);
+	li_ptr = buf_ptr + rlc_am_head_len(amtx->sn_bits, 1);
 
 	/* Wrtie data */
-	data_ptr = (u8 *)li_ptr + rlc_li_len(pdu_segment_ctrl->n_li);
+	data_ptr = li_ptr + rlc_am_encode_li(amtx->li_bits, li_ptr, pdu_segment_ctrl->n_li, pdu_segment_ctrl->li_s);
 	data_ptr_src = pdu_ctrl->data_ptr;
 	memcpy(data_ptr, data_ptr_src+seginfo->start_offset, data_size);
 	
 	/* set e:1 in head of PDU segment */
-	segment_head->e = pdu_segment_ctrl->n_li > 1;
+	rlc_am_head_set_e(buf_ptr, pdu_segment_ctrl->n_li > 1);
 
 	/* set poll bit */
 	rlc_am_tx_update_poll(amtx, 1 /* is_retx */, data_size);
-	segment_head->p = rlc_am_tx_deliver_poll(amtx);
+	rlc_am_head_set_p(buf_ptr, rlc_am_tx_deliver_poll(amtx));
 
 	/* if a whole regment is built */
 	if(seginfo->start_offset + data_size == seginfo->end_offset)
 	{
 		/* update LSF */
-		segment_head->lsf = seginfo->lsf;
+		lsf = seginfo->lsf;
 		/* update FI[1] if this is the last segment */
 		if(seginfo->lsf)
 			fi[1] = (pdu_ctrl->fi & 0x01);
@@ -1202,22 +1931,46 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 		/* must reset pdu_size here */
 		seginfo->pdu_size = 0;
 	}
+	rlc_am_tx_update_retx_bytes(amtx, pdu_ctrl);
 
-	/* set FI to PDU head */
-	segment_head->fi = (fi[0] << 1) | fi[1];
+	/* set FI, SN, LSF and SO to PDU head */
+	rlc_am_head_set_fi(buf_ptr, (fi[0] << 1) | fi[1]);
+	rlc_am_set_head_sn(amtx->sn_bits, buf_ptr, pdu_ctrl->sn, 1, lsf, so);
 
 	ZLOG_DEBUG("Retx build: lcid=%d sn=%u fi=%u lsf=%u n_li=%u li_s=(%u %u %u ..)\n", 
-			amtx->logical_chan, segment_head->sn, segment_head->fi, segment_head->lsf, 
+			amtx->logical_chan, pdu_ctrl->sn, rlc_am_head_get_fi(buf_ptr), lsf, 
 			pdu_segment_ctrl->n_li, 
 			pdu_segment_ctrl->li_s[0], pdu_segment_ctrl->li_s[1], pdu_segment_ctrl->li_s[2]);
 	
 	ZLOG_DEBUG("after Retx build: lcid=%d pdu_size=%u poll=%d VT_A=%u VT_S=%u VT_MS=%u POLL_SN=%u\n", 
-			amtx->logical_chan, pdu_size - remain_pdu_size, segment_head->p, 
+			amtx->logical_chan, pdu_size - remain_pdu_size, rlc_am_head_get_p(buf_ptr), 
 			amtx->VT_A, amtx->VT_S, amtx->VT_MS, amtx->POLL_SN);
 	
 	return pdu_size - remain_pdu_size;
 }
 
+/***********************************************************************************/
+/* Function : rlc_am_tx_get_hol_delay                                              */
+/***********************************************************************************/
+/* Description : - Get sojourn time of the head-of-line SDU in Tx queue            */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amtx               | i  | RLC AM entity                                       */
+/*   Return             |    | HOL delay in unit of RLC clock, 0 if queue is empty */
+/***********************************************************************************/
+u32 rlc_am_tx_get_hol_delay(rlc_entity_am_tx_t *amtx)
+{
+	rlc_sdu_t *sdu;
+	
+	if(amtx == NULL || DLLIST_EMPTY(&amtx->sdu_tx_q))
+		return 0;
+	
+	sdu = (rlc_sdu_t *)DLLIST_HEAD(&amtx->sdu_tx_q);
+	return rlc_get_time() - sdu->enqueue_time;
+}
+
 /***********************************************************************************/
 /* Function : rlc_am_tx_build_fresh_pdu                                            */
 /***********************************************************************************/
@@ -1236,7 +1989,7 @@ int rlc_am_tx_build_retx_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size
 int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size, void *cookie)
 {
 	u32 head_len;
-	rlc_li_t *li_ptr;
+	u8 *li_ptr;
 	u8 *data_ptr;
 	u32 data_size;
 	rlc_sdu_t *sdu;
@@ -1245,9 +1998,17 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 	ZLOG_DEBUG("before build: lcid=%d pdu_size=%u VT_A=%u VT_S=%u VT_MS=%u POLL_SN=%u\n", 
 			amtx->logical_chan, pdu_size, amtx->VT_A, amtx->VT_S, amtx->VT_MS, amtx->POLL_SN);
 	
-	if(pdu_size <= sizeof(rlc_am_pdu_head_t))
+	head_len = rlc_am_head_len(amtx->sn_bits, 0);
+	if(pdu_size <= head_len)
 		return 0;
 		
+	if(amtx->sdu_ingress)
+		rlc_sdu_ingress_drain(amtx->sdu_ingress, &amtx->sdu_tx_q, amtx->free_sdu, pdu_size, &amtx->n_sdu, &amtx->sdu_total_size);
+	
+	/* AQM drops SDUs staying too long in Tx queue */
+	if(amtx->aqm.target)
+		rlc_aqm_dequeue(&amtx->aqm, &amtx->sdu_tx_q, &amtx->n_sdu, &amtx->sdu_total_size);
+	
 	if(amtx->sdu_total_size == 0)		//no data in queue
 		return 0;
 
@@ -1270,7 +2031,6 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 	pdu_ctrl->buf_cookie = cookie;
 	pdu_ctrl->buf_free = amtx->free_pdu;
 
-	/* (1) first round: build LIs */
 	sdu = (rlc_sdu_t *)(DLLIST_HEAD(&amtx->sdu_tx_q));
 	assert(!DLLIST_IS_HEAD(&amtx->sdu_tx_q, sdu));
 	pdu_ctrl->n_li = 0;
@@ -1281,8 +2041,10 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 	else
 		pdu_ctrl->fi &= 0x01;			//FIRST
 
-	head_len = 2;
-	pdu_ctrl->n_li = rlc_build_li_from_sdu(pdu_size, head_len, &amtx->sdu_tx_q, pdu_ctrl->li_s);
+	/* write LIs and data in one walk of SDU queue */
+	li_ptr = pdu_ctrl->buf_ptr + head_len;
+	pdu_ctrl->n_li = rlc_encode_pdu(li_ptr, pdu_size - head_len, amtx->li_bits, &amtx->sdu_tx_q, pdu_ctrl->li_s, 
+		&data_ptr, &data_size, &amtx->delay_stats);
 
 	if(pdu_ctrl->n_li == 0)
 	{
@@ -1297,13 +2059,7 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 	assert(pdu_ctrl->n_li <= amtx->n_sdu);
 	assert(pdu_ctrl->n_li <= RLC_LI_NUM_MAX);
 	
-	/* (2) second round: write LIs and data */
-	li_ptr = (rlc_li_t *)(pdu_ctrl->buf_ptr + head_len);
-	rlc_encode_li(li_ptr, pdu_ctrl->n_li, pdu_ctrl->li_s);
-	
-	data_ptr = (u8 *)li_ptr + rlc_li_len(pdu_ctrl->n_li);
 	pdu_ctrl->data_ptr = data_ptr;
-	data_size = rlc_encode_sdu(data_ptr, pdu_ctrl->n_li, pdu_ctrl->li_s, &amtx->sdu_tx_q);
 	data_ptr += (data_size & 0xFFFF);
 	amtx->sdu_total_size -= (data_size & 0xFFFF);
 	amtx->n_sdu -= (data_size >> 16);
@@ -1323,16 +2079,16 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 	}
 
 	/* set RLC PDU header */
-	rlc_am_pdu_head_t *pdu_head;
+	u8 *pdu_head;
 	
-	pdu_head = (rlc_am_pdu_head_t *)pdu_ctrl->buf_ptr;
-	pdu_head->dc = 1;		//data
-	pdu_head->rf = 0;
-	pdu_head->e = (pdu_ctrl->n_li > 1);
-	pdu_head->fi = pdu_ctrl->fi;
-	pdu_head->sn = amtx->VT_S;
+	pdu_head = pdu_ctrl->buf_ptr;
+	rlc_am_head_set_dc(pdu_head, RLC_AM_DC_DATA_PDU);
+	rlc_am_head_set_rf(pdu_head, 0);
+	rlc_am_head_set_e(pdu_head, (pdu_ctrl->n_li > 1));
+	rlc_am_head_set_fi(pdu_head, pdu_ctrl->fi);
+	rlc_am_set_head_sn(amtx->sn_bits, pdu_ctrl->buf_ptr, amtx->VT_S, 0, 0, 0);
 	
-	pdu_ctrl->sn = pdu_head->sn;			//save sn to pdu_ctrl
+	pdu_ctrl->sn = amtx->VT_S;			//save sn to pdu_ctrl
 	pdu_ctrl->pdu_size = data_ptr-pdu_ctrl->buf_ptr;
 	
 	/* update AM Tx counter */
@@ -1341,14 +2097,14 @@ int rlc_am_tx_build_fresh_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_siz
 
 	/* set poll bit */
 	rlc_am_tx_update_poll(amtx, 0, data_size);
-	pdu_head->p = rlc_am_tx_deliver_poll(amtx);
+	rlc_am_head_set_p(pdu_head, rlc_am_tx_deliver_poll(amtx));
 
 	ZLOG_DEBUG("fresh build: lcid=%d poll=%u fi=%u n_li=%u li_s=(%u %u %u ..)\n", 
-			amtx->logical_chan, pdu_head->p, pdu_head->fi, pdu_ctrl->n_li, 
+			amtx->logical_chan, rlc_am_head_get_p(pdu_head), rlc_am_head_get_fi(pdu_head), pdu_ctrl->n_li, 
 			pdu_ctrl->li_s[0], pdu_ctrl->li_s[1], pdu_ctrl->li_s[2]);
 	
 	ZLOG_DEBUG("after build: lcid=%d pdu_size=%u poll=%d VT_A=%u VT_S=%u VT_MS=%u POLL_SN=%u\n", 
-			amtx->logical_chan, data_ptr-pdu_ctrl->buf_ptr, pdu_head->p, 
+			amtx->logical_chan, data_ptr-pdu_ctrl->buf_ptr, rlc_am_head_get_p(pdu_head), 
 			amtx->VT_A, amtx->VT_S, amtx->VT_MS, amtx->POLL_SN);
 	
 	return pdu_ctrl->pdu_size;
@@ -1384,6 +2140,15 @@ int rlc_am_tx_build_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size, voi
 	if(amtx == NULL)
 		return 0;
 	
+	/* hibernated entity has nothing to send but SDUs posted to ingress ring since */
+	if(amtx->txpdu == NULL)
+	{
+		if(amtx->sdu_ingress == NULL || rlc_ring_count(amtx->sdu_ingress) == 0)
+			return 0;
+		if(rlc_am_resume(RLC_AM_TX_ENTITY(amtx)))
+			return 0;
+	}
+	
 	ZLOG_DEBUG("request RLC AM to build PDU: lcid=%d buf_ptr=%p size=%u.\n", amtx->logical_chan, buf_ptr, pdu_size);
 	
 	/* Step1: first, build Status PDU */
@@ -1410,7 +2175,7 @@ int rlc_am_tx_build_pdu(rlc_entity_am_tx_t *amtx, u8 *buf_ptr, u16 pdu_size, voi
 /* trigger status pdu */
 int rlc_am_trigger_status_report(rlc_entity_am_rx_t *amrx, rlc_entity_am_tx_t *amtx, u16 sn, int forced)
 {
-	u16 sn_fs = amrx->sn_max+1;
+	u32 sn_fs = amrx->sn_max+1;
 	
 /*
  Triggers to initiate STATUS reporting include:
@@ -1442,12 +2207,16 @@ rlc_am_rx_pdu_ctrl_t *rlc_am_rx_pdu_ctrl_new()
 {
 	rlc_am_rx_pdu_ctrl_t *pdu_ctrl;
 
-	pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)FASTALLOC(g_mem_am_pdu_rx_base);
+	pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)FASTALLOC(rlc_shard_cur->mem_am_pdu_rx_base);
 	if(pdu_ctrl)
 	{
 		pdu_ctrl->delivery_offset = 0;
 		pdu_ctrl->is_intact = 0;
-		dllist_init(&pdu_ctrl->rx_segq);
+		pdu_ctrl->n_seg = 0;
+		pdu_ctrl->n_gap = 0;
+		pdu_ctrl->i_deliv = 0;
+		pdu_ctrl->seg_cap = RLC_SEG_NUM_MAX;
+		pdu_ctrl->rx_seg = pdu_ctrl->rx_seg_inline;
 	}
 
 	return pdu_ctrl;
@@ -1456,19 +2225,16 @@ rlc_am_rx_pdu_ctrl_t *rlc_am_rx_pdu_ctrl_new()
 /* free RLC AM Rx PDU control structure */
 void rlc_am_rx_pdu_ctrl_free(rlc_am_rx_pdu_ctrl_t *pdu_ctrl)
 {
-	rlc_am_pdu_segment_t *pdu_segment;
+	u32 i;
 	
 	/* free all segments */
-	while(!DLLIST_EMPTY(&pdu_ctrl->rx_segq))
-	{
-		pdu_segment = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
-		dllist_remove(&pdu_ctrl->rx_segq, &pdu_segment->node);
-		
-		rlc_am_pdu_segment_free(pdu_segment);
-	}
+	for(i=0; i<pdu_ctrl->n_seg; i++)
+		rlc_am_pdu_segment_free(pdu_ctrl->rx_seg[i]);
+	if(pdu_ctrl->rx_seg != pdu_ctrl->rx_seg_inline)
+		free(pdu_ctrl->rx_seg);
 
 	/* free pdu control */
-	FASTFREE(g_mem_am_pdu_rx_base, pdu_ctrl);
+	FASTFREE(rlc_shard_cur->mem_am_pdu_rx_base, pdu_ctrl);
 }
 
 /* free received PDU segment */
@@ -1487,83 +2253,85 @@ void rlc_am_rx_pdu_ctrl_dump(rlc_am_rx_pdu_ctrl_t *pdu_ctrl)
 	if(pdu_ctrl == NULL)
 		return;
 
-	ZLOG_INFO("delivery_offset=%u is_intac=%u\n", pdu_ctrl->delivery_offset, pdu_ctrl->is_intact);
+	ZLOG_INFO("delivery_offset=%u is_intac=%u n_seg=%u n_gap=%u\n", 
+			pdu_ctrl->delivery_offset, pdu_ctrl->is_intact, pdu_ctrl->n_seg, pdu_ctrl->n_gap);
 
-	idx = 0;
-	pdu_segment = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
-	while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segment))
+	for(idx=0; idx<pdu_ctrl->n_seg; idx++)
 	{
+		pdu_segment = pdu_ctrl->rx_seg[idx];
 		ZLOG_INFO("  %d: sn=%u so=(%u,%u) fi=%u lsf=%u n_li=%u li_s=(%u %u %u..)\n", 
 				idx, pdu_segment->sn, pdu_segment->start_offset, pdu_segment->end_offset,
 				pdu_segment->fi, pdu_segment->lsf, pdu_segment->n_li,
 				pdu_segment->li_s[0], pdu_segment->li_s[1], pdu_segment->li_s[2]);
-
-		pdu_segment = (rlc_am_pdu_segment_t *)pdu_segment->node.next;
 	}
 }
 
 /* process STATUS PDU */
 int rlc_am_rx_process_status_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len)
 {
-	rlc_am_status_pdu_head_t *pdu_head = (rlc_am_status_pdu_head_t *)buf_ptr;
 	nacksn_info_t ninfo[MAXINFO_NUM];
 	u16 ack_sn, sn, nack_sn;
 	int i, n=0;
-	u32 bit_offset = 15;
 	u32 e1;
 	rlc_am_tx_pdu_ctrl_t *pdu_ctrl;
 	rlc_entity_am_tx_t *amtx = amrx->amtx;
 	u32 maxso;
+	rlc_bitreader_t br;
+	u32 sn_bits = amtx->sn_bits;
+	u32 so_bits = RLC_AM_STATUS_SO_BITS(sn_bits);
 
-	ack_sn = pdu_head->ack_sn;
-	e1 = pdu_head->e1;
+	/* check pdu: pdu length */
+	if(buf_len < (RLC_AM_STATUS_HEAD_BITS(sn_bits)+7)/8)
+	{
+		ZLOG_WARN("invalid buf_len=%u, lcid=%d\n", buf_len, amrx->logical_chan);
+		return -1;
+	}
+	
+	/* skip D/C and CPT */
+	rlc_br_init(&br, buf_ptr, buf_len);
+	rlc_br_get(&br, 4);
+	ack_sn = rlc_br_get(&br, sn_bits);
+	e1 = rlc_br_get(&br, 1);
 
 	/* check pdu: VT_A <= ack_sn <= VT_S */
-	if(RLC_SN_LESS(amtx->VT_S, ack_sn, (RLC_SN_MAX_10BITS+1)))
+	if(RLC_SN_LESS(amtx->VT_S, ack_sn, (amtx->sn_max+1)))
 	{
 		ZLOG_WARN("wrong ACK_SN:%u > VT_S:%u, lcid=%d\n", ack_sn, amtx->VT_S, amtx->logical_chan);
 		return -1;
 	}
 
-	if(RLC_SN_LESS(ack_sn, amtx->VT_A,  (RLC_SN_MAX_10BITS+1)))
+	if(RLC_SN_LESS(ack_sn, amtx->VT_A,  (amtx->sn_max+1)))
 	{
 		ZLOG_WARN("wrong ACK_SN:%u < VT_A:%u, lcid=%d\n", ack_sn, amtx->VT_A, amtx->logical_chan);
 		return -1;
 	}
 
-	/* check pdu: pdu length */
-	if((bit_offset+7)/8 > buf_len)
-	{
-		ZLOG_WARN("invalid buf_len=%u, bit_offset=%u, lcid=%d\n", buf_len, bit_offset, amrx->logical_chan);
-		return -1;
-	}
-	
 	/* 1) extract nack info */
-	while(e1 && n<MAXINFO_NUM)
+	while(e1)
 	{
-		bitcpy((unsigned long *)&ninfo[n].nacksn, 0, (const unsigned long *)buf_ptr, bit_offset, 12);
-		bit_offset += 12;
-		if(bit_offset >= 32)
+		if(n >= MAXINFO_NUM)
 		{
-			buf_ptr += 4;
-			bit_offset -= 32;
+			ZLOG_WARN("too many NACK info: n=%d, lcid=%d\n", n, amrx->logical_chan);
+			return -1;
 		}
-		e1 = ninfo[n].nacksn.e1;
-		nack_sn = ninfo[n].nacksn.nack_sn;
+		
+		nack_sn = rlc_br_get(&br, sn_bits);
+		e1 = rlc_br_get(&br, 1);
+		ninfo[n].nacksn.nack_sn = nack_sn;
+		ninfo[n].nacksn.e1 = e1;
+		ninfo[n].nacksn.e2 = rlc_br_get(&br, 1);
 
 		if(ninfo[n].nacksn.e2)
 		{
-			bitcpy((unsigned long *)&ninfo[n].so, 0, (const unsigned long *)buf_ptr, bit_offset, 30);
-			bit_offset += 30;
-			if(bit_offset >= 32)
-			{
-				buf_ptr += 4;
-				bit_offset -= 32;
-			}
+			ninfo[n].so.sostart = rlc_br_get(&br, so_bits);
+			ninfo[n].so.soend = rlc_br_get(&br, so_bits);
+			/* all ones means till the last byte */
+			if(ninfo[n].so.soend == (1u << so_bits) - 1)
+				ninfo[n].so.soend = RLC_AM_SO_END;
 		}
 
 		/* check length of PDU */
-		if((buf_ptr-(u8 *)pdu_head) > buf_len)
+		if(br.overrun)
 		{
 			ZLOG_WARN("NACK info exceeds the buf_len=%u, lcid=%d\n", buf_len, amrx->logical_chan);
 			return -1;
@@ -1578,13 +2346,13 @@ int rlc_am_rx_process_status_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_
 	             received for retransmission.
 */
 		
-		if(RLC_SN_LESSTHAN(amtx->VT_S, nack_sn, (RLC_SN_MAX_10BITS+1)))
+		if(RLC_SN_LESSTHAN(amtx->VT_S, nack_sn, (amtx->sn_max+1)))
 		{
 			ZLOG_WARN("invalid NACK_SN: must NACK_SN=%u < VT(S)=%u, lcid=%d\n", nack_sn, amtx->VT_S, amrx->logical_chan);
 			return -1;
 		}
 		
-		if(RLC_SN_LESS(nack_sn, amtx->VT_A, (RLC_SN_MAX_10BITS+1)))
+		if(RLC_SN_LESS(nack_sn, amtx->VT_A, (amtx->sn_max+1)))
 		{
 			ZLOG_WARN("invalid NACK_SN: must VT(A)=%u <= NACK_SN=%u, lcid=%d\n", amtx->VT_A, nack_sn, amrx->logical_chan);
 			return -1;
@@ -1625,9 +2393,6 @@ int rlc_am_rx_process_status_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_
 		n++;
 	}
 
-	
-	assert(n<MAXINFO_NUM);
-	
 	/* check if nack_sn is in ascending order of sn */
 	ZLOG_DEBUG("status PDU: lcid=%d ack_sn=%u n_nack_sn=%u\n", amrx->logical_chan, ack_sn, n);
 	for(i=0; i<n; i++)
@@ -1637,7 +2402,7 @@ int rlc_am_rx_process_status_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_
 
 		if(i>0)
 		{
-			if(!RLC_SN_LESSTHAN(ninfo[i-1].nacksn.nack_sn, ninfo[i].nacksn.nack_sn, (RLC_SN_MAX_10BITS+1)))
+			if(!RLC_SN_LESSTHAN(ninfo[i-1].nacksn.nack_sn, ninfo[i].nacksn.nack_sn, (amtx->sn_max+1)))
 			{
 				ZLOG_WARN("NACK_SN must be in ascending order of SN: nack_sn[%u]=%u nack_sn[%u]=%u\n",
 						i-1, ninfo[i-1].nacksn.nack_sn, i, ninfo[i].nacksn.nack_sn);
@@ -1687,6 +2452,8 @@ int rlc_am_rx_process_status_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_
 
 				i++;
 			}while((i < n) && (sn == ninfo[i].nacksn.nack_sn));
+			
+			rlc_am_tx_update_retx_bytes(amtx, pdu_ctrl);
 		}
 		else
 		{
@@ -1697,12 +2464,18 @@ TODO:
 */
 			if(pdu_ctrl)
 			{
+				/* ACKed PDU may be still in ReTx queue */
+				if(pdu_ctrl->node.next)
+				{
+					dllist_remove(&amtx->pdu_retx_q, &pdu_ctrl->node);
+					amtx->retx_bytes -= pdu_ctrl->retx_bytes;
+				}
 				rlc_am_tx_pdu_ctrl_free(amtx->txpdu[sn]);
 				amtx->txpdu[sn] = NULL;
 			}
 		}
 
-		sn = RLC_MOD(sn+1, RLC_SN_MAX_10BITS+1);
+		sn = RLC_MOD(sn+1, amtx->sn_max+1);
 	}
 
 	/*
@@ -1716,7 +2489,7 @@ TODO:
 		amtx->VT_A = ack_sn;
 
 	/* also need to update VT(MS) */
-	amtx->VT_MS = RLC_MOD(amtx->VT_A + amtx->AM_Window_Size, RLC_SN_MAX_10BITS+1);
+	amtx->VT_MS = RLC_MOD(amtx->VT_A + amtx->AM_Window_Size, amtx->sn_max+1);
 	
 /*
 	Upon reception of a STATUS report from the receiving RLC AM entity the transmitting side of an AM RLC entity shall:
@@ -1724,7 +2497,7 @@ TODO:
 		 -	if t-PollRetransmit is running:
 				-	stop and reset t-PollRetransmit.
 */
-	if(RLC_SN_LESS(amtx->POLL_SN, ack_sn, (RLC_SN_MAX_10BITS+1)))
+	if(RLC_SN_LESS(amtx->POLL_SN, ack_sn, (amtx->sn_max+1)))
 	{
 		if(rlc_timer_is_running(&amtx->t_PollRetransmit))
 		{
@@ -1737,33 +2510,239 @@ TODO:
 }
 
 
+/* rx_seg[] is full: double it on heap, the inline array serves the usual few segments */
+static int rlc_am_rx_grow_segments(rlc_am_rx_pdu_ctrl_t *pdu_ctrl)
+{
+	rlc_am_pdu_segment_t **rx_seg;
+	u32 seg_cap = pdu_ctrl->seg_cap * 2;
+	
+	/* n_seg is 16 bits */
+	if(seg_cap > 0xFFFF)
+		rx_seg = NULL;
+	else
+		rx_seg = malloc(seg_cap * sizeof(rx_seg[0]));
+	if(rx_seg == NULL)
+	{
+		ZLOG_ERR("out of memory for %u segments of PDU: sn=%u.\n", seg_cap, pdu_ctrl->rx_seg[0]->sn);
+		return -1;
+	}
+	
+	memcpy(rx_seg, pdu_ctrl->rx_seg, pdu_ctrl->n_seg * sizeof(rx_seg[0]));
+	if(pdu_ctrl->rx_seg != pdu_ctrl->rx_seg_inline)
+		free(pdu_ctrl->rx_seg);
+	pdu_ctrl->rx_seg = rx_seg;
+	pdu_ctrl->seg_cap = seg_cap;
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_insert_segment                                             */
+/***********************************************************************************/
+/* Description : - Insert a received segment into sorted rx_seg[] of PDU           */
+/*               - Overlap is detected by binary search, the number of holes and   */
+/*                 is_intact are updated in O(1)                                   */
+/*               - rx_seg[] is grown if full, so no received byte is dropped for   */
+/*                 a PDU re-segmented into many pieces                             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   pdu_ctrl           | io | Rx PDU control                                      */
+/*   pdu_segment        | i  | received segment                                    */
+/*   Return             |    | 0 is success, 1 if segment overlaps, -1 if out of   */
+/*                      |    | memory                                              */
+/***********************************************************************************/
+int rlc_am_rx_insert_segment(rlc_am_rx_pdu_ctrl_t *pdu_ctrl, rlc_am_pdu_segment_t *pdu_segment)
+{
+	u32 lo, hi, mid;
+	u32 so = pdu_segment->start_offset;
+	u32 eo = pdu_segment->end_offset;
+	u32 prev_eo;
+	int n_gap;
+	
+	/* find the first segment which start_offset > so */
+	lo = 0;
+	hi = pdu_ctrl->n_seg;
+	while(lo < hi)
+	{
+		mid = (lo + hi) >> 1;
+		if(pdu_ctrl->rx_seg[mid]->start_offset <= so)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	/* overlap with previous or next segment */
+	prev_eo = lo ? pdu_ctrl->rx_seg[lo-1]->end_offset : 0;
+	if(prev_eo > so)
+		return 1;
+	if(lo < pdu_ctrl->n_seg && pdu_ctrl->rx_seg[lo]->start_offset < eo)
+		return 1;
+	
+	if(pdu_ctrl->n_seg >= pdu_ctrl->seg_cap && rlc_am_rx_grow_segments(pdu_ctrl))
+		return -1;
+	
+	/* update number of holes */
+	n_gap = pdu_ctrl->n_gap + (prev_eo != so);
+	if(lo < pdu_ctrl->n_seg)
+		n_gap += (eo != pdu_ctrl->rx_seg[lo]->start_offset) - (prev_eo != pdu_ctrl->rx_seg[lo]->start_offset);
+	pdu_ctrl->n_gap = n_gap;
+	
+	memmove(&pdu_ctrl->rx_seg[lo+1], &pdu_ctrl->rx_seg[lo], (pdu_ctrl->n_seg-lo)*sizeof(pdu_ctrl->rx_seg[0]));
+	pdu_ctrl->rx_seg[lo] = pdu_segment;
+	pdu_ctrl->n_seg ++;
+	pdu_segment->is_new = 1;
+	
+	pdu_ctrl->is_intact = (pdu_ctrl->n_gap == 0 && pdu_ctrl->rx_seg[pdu_ctrl->n_seg-1]->lsf);
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_trim_segment                                               */
+/***********************************************************************************/
+/* Description : - Build a piece of received segment for byte range [so, eo)       */
+/*               - No data copy: piece points into the PDU buffer of segment       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   pdu_segment        | i  | received segment                                    */
+/*   piece              | o  | piece of segment                                    */
+/*   so                 | i  | start offset of piece                               */
+/*   eo                 | i  | end offset of piece                                 */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_rx_trim_segment(rlc_am_pdu_segment_t *pdu_segment, rlc_am_pdu_segment_t *piece, u32 so, u32 eo)
+{
+	u32 i_li = 0;
+	u32 offset = pdu_segment->start_offset;		//start offset of SDU of li_s[i_li]
+	u32 fi;
+	
+	/* skip SDUs before so */
+	while(i_li < pdu_segment->n_li && offset + pdu_segment->li_s[i_li] <= so)
+		offset += pdu_segment->li_s[i_li++];
+	
+	/* first bit of FI: NFIRST */
+	if(offset != so)
+		fi = 0x02;
+	else
+		fi = (i_li == 0) ? (pdu_segment->fi & 0x02) : 0;
+	
+	piece->n_li = 0;
+	piece->data_ptr = pdu_segment->data_ptr + (so - pdu_segment->start_offset);
+	while(i_li < pdu_segment->n_li && offset < eo)
+	{
+		piece->li_s[piece->n_li++] = RLC_MIN(offset + pdu_segment->li_s[i_li], eo) - RLC_MAX(offset, so);
+		offset += pdu_segment->li_s[i_li++];
+	}
+	
+	/* second bit of FI: NLAST */
+	if(offset != eo)
+		fi |= 0x01;
+	else if(i_li == pdu_segment->n_li)
+		fi |= (pdu_segment->fi & 0x01);
+	
+	piece->fi = fi;
+	piece->sn = pdu_segment->sn;
+	piece->start_offset = so;
+	piece->end_offset = eo;
+	piece->lsf = (eo == pdu_segment->end_offset) ? pdu_segment->lsf : 0;
+	piece->buf_ptr = pdu_segment->buf_ptr;
+	piece->buf_len = pdu_segment->buf_len;
+}
+
+/* insert byte range [so, eo) of segment as a piece, which holds a reference to segment */
+static int rlc_am_rx_insert_piece(rlc_am_rx_pdu_ctrl_t *pdu_ctrl, rlc_am_pdu_segment_t *pdu_segment, u32 so, u32 eo)
+{
+	rlc_am_pdu_segment_t *piece;
+	
+	piece = rlc_am_pdu_segment_new();
+	if(piece == NULL)
+	{
+		ZLOG_ERR("out of memory for new PDU segment: sn=%u.\n", pdu_segment->sn);
+		return -1;
+	}
+	
+	rlc_am_rx_trim_segment(pdu_segment, piece, so, eo);
+	if(rlc_am_rx_insert_segment(pdu_ctrl, piece))
+	{
+		/* no reference is taken yet, only piece itself is freed */
+		rlc_am_pdu_segment_free(piece);
+		return -1;
+	}
+	
+	piece->free = rlc_am_rxseg_free;
+	piece->buf_cookie = pdu_segment;
+	RLC_REF(pdu_segment);
+	RLC_REF(piece);
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_insert_trimmed_segment                                     */
+/***********************************************************************************/
+/* Description : - Insert the not yet received byte ranges of a partly duplicated  */
+/*                 segment, as 36.322 5.1.3.2.2 requires                           */
+/*               - Each piece holds a reference to segment, PDU buffer is freed    */
+/*                 when the last piece is freed                                    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   pdu_ctrl           | io | Rx PDU control                                      */
+/*   pdu_segment        | i  | received segment which overlaps received ones       */
+/*   Return             |    | 0 is success, 1 if nothing new or out of memory     */
+/***********************************************************************************/
+int rlc_am_rx_insert_trimmed_segment(rlc_am_rx_pdu_ctrl_t *pdu_ctrl, rlc_am_pdu_segment_t *pdu_segment)
+{
+	rlc_am_pdu_segment_t *seg;
+	u32 i = 0, n_piece = 0;
+	u32 offset = pdu_segment->start_offset;
+	u32 eo = pdu_segment->end_offset;
+	u32 hole_eo;
+	
+	/* fill holes in [start_offset, end_offset), a piece inserted before rx_seg[i] moves it to i+1 */
+	while(offset < eo)
+	{
+		while(i < pdu_ctrl->n_seg && pdu_ctrl->rx_seg[i]->end_offset <= offset)
+			i++;
+		
+		seg = (i < pdu_ctrl->n_seg) ? pdu_ctrl->rx_seg[i] : NULL;
+		if(seg && seg->start_offset <= offset)
+		{
+			offset = seg->end_offset;
+			continue;
+		}
+		
+		hole_eo = seg ? RLC_MIN(seg->start_offset, eo) : eo;
+		if(rlc_am_rx_insert_piece(pdu_ctrl, pdu_segment, offset, hole_eo))
+			break;
+		n_piece ++;
+		offset = hole_eo;
+	}
+	
+	return (n_piece == 0);
+}
+
 /* Place received PDU in Rx buffer 
-    FIXME: For briefness, the partly duplicated PDU or PDU segments are simplely discarded. 
-    This treatment is not fully aligned to 36.322 and need to be improved. 
+    If the PDU or PDU segment is partly duplicated, only the byte segments not received before are kept.
   */
-rlc_am_rx_pdu_ctrl_t *rlc_am_place_pdu_in_rxbuf(rlc_entity_am_rx_t *amrx, u32 sn, rlc_am_pdu_head_t *pdu_hdr, u32 pdu_size, void *cookie)
+rlc_am_rx_pdu_ctrl_t *rlc_am_place_pdu_in_rxbuf(rlc_entity_am_rx_t *amrx, u32 sn, u8 *buf_ptr, u32 pdu_size, void *cookie)
 {
 	rlc_am_rx_pdu_ctrl_t *pdu_ctrl;
-	rlc_am_pdu_segment_t *pdu_segment, *pdu_segtmp;
-	rlc_am_pdu_segment_head_t *seg_hdr;
-	rlc_li_t *li_ptr;
+	rlc_am_pdu_segment_t *pdu_segment;
+	u8 *li_ptr;
+	u32 head_len, so, lsf;
 	s32 length;
+	int ret = 0;
 	int duplicated = 0;
-	u16 so, eo;
+	int trimmed = 0;
 	
-	seg_hdr = (rlc_am_pdu_segment_head_t *)pdu_hdr;
-
 	/* parse LI */
-	if(pdu_hdr->rf)
-	{
-		length = pdu_size - sizeof(rlc_am_pdu_segment_head_t);
-		li_ptr = (rlc_li_t *)(seg_hdr+1);
-	}
-	else
-	{
-		length = pdu_size - sizeof(rlc_am_pdu_head_t);
-		li_ptr = (rlc_li_t *)(pdu_hdr+1);
-	}
+	head_len = rlc_am_head_len(amrx->sn_bits, rlc_am_head_get_rf(buf_ptr));
+	length = pdu_size - head_len;
+	li_ptr = buf_ptr + head_len;
 
 	/* create a new segment control: just a little bit waste if this pdu is duplicated */
 	pdu_segment = rlc_am_pdu_segment_new();
@@ -1773,7 +2752,10 @@ rlc_am_rx_pdu_ctrl_t *rlc_am_place_pdu_in_rxbuf(rlc_entity_am_rx_t *amrx, u32 sn
 		return NULL;
 	}
 	
- 	pdu_segment->n_li = rlc_parse_li(pdu_hdr->e, li_ptr, length, &pdu_segment->data_ptr, pdu_segment->li_s);
+ 	if(amrx->li_bits == 15)
+		pdu_segment->n_li = rlc_parse_li15(rlc_am_head_get_e(buf_ptr), li_ptr, length, &pdu_segment->data_ptr, pdu_segment->li_s);
+	else
+		pdu_segment->n_li = rlc_parse_li(rlc_am_head_get_e(buf_ptr), li_ptr, length, &pdu_segment->data_ptr, pdu_segment->li_s);
  	if(pdu_segment->n_li <= 0 || pdu_segment->n_li > RLC_LI_NUM_MAX)
  	{
  		ZLOG_WARN("wrong AM PDU: lcid=%d n_li=%d, sn=%u, size=%d.\n", 
@@ -1783,164 +2765,89 @@ rlc_am_rx_pdu_ctrl_t *rlc_am_place_pdu_in_rxbuf(rlc_entity_am_rx_t *amrx, u32 sn
  	}
 
 	pdu_segment->buf_len = pdu_size;
-	pdu_segment->buf_ptr = (u8 *)pdu_hdr;
+	pdu_segment->buf_ptr = buf_ptr;
 	pdu_segment->buf_cookie = cookie;
-	pdu_segment->fi = pdu_hdr->fi;
+	pdu_segment->fi = rlc_am_head_get_fi(buf_ptr);
 	pdu_segment->sn = sn;
-	if(pdu_hdr->rf)
-	{
-		pdu_segment->start_offset = seg_hdr->so;
-		pdu_segment->end_offset = pdu_segment->start_offset + pdu_size-(pdu_segment->data_ptr - (u8 *)pdu_hdr);
-		pdu_segment->lsf = seg_hdr->lsf;
-	}
-	else
-	{
-		pdu_segment->start_offset = 0;
-		pdu_segment->end_offset = pdu_segment->start_offset + pdu_size-(pdu_segment->data_ptr - (u8 *)pdu_hdr);
-		pdu_segment->lsf = 1;
-	}
+	rlc_am_get_head_sn(amrx->sn_bits, buf_ptr, &lsf, &so);
+	pdu_segment->start_offset = so;
+	pdu_segment->end_offset = pdu_segment->start_offset + pdu_size-(pdu_segment->data_ptr - buf_ptr);
+	pdu_segment->lsf = lsf;
 	
 	/* get old pdu control pointer */
 	pdu_ctrl = amrx->rxpdu[sn];
 	
-	if(pdu_hdr->rf == 0)
+	if(pdu_ctrl)
 	{
-		/* Rx a PDU */
-		if(pdu_ctrl)
+		/* Rx a PDU or PDU segment but not the first arrival */
+		if(pdu_ctrl->is_intact)
+			duplicated = 1;
+		else if((ret = rlc_am_rx_insert_segment(pdu_ctrl, pdu_segment)) > 0)
+		{
+			/* partly duplicated: keep byte segments not received before */
+			duplicated = rlc_am_rx_insert_trimmed_segment(pdu_ctrl, pdu_segment);
+			trimmed = !duplicated;
+		}
+		
+		if(ret < 0)
 		{
-			ZLOG_WARN("RLC AM PDU duplicated: lcid=%d SN=%d.\n", amrx->logical_chan, sn);
 			rlc_am_pdu_segment_free(pdu_segment);
 			return NULL;
 		}
-
-		/* now allocate new PDU control */
-		pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)rlc_am_rx_pdu_ctrl_new();
-		if(pdu_ctrl == NULL)
+		
+		if(duplicated)
 		{
-			ZLOG_ERR("out of memory for new AM PDU: lcid=%d.\n", amrx->logical_chan);
+			ZLOG_WARN("RLC AM PDU Segment duplicated: lcid=%d SN=%d rf=%d so=%d eo=%d.\n", 
+					amrx->logical_chan, sn, rlc_am_head_get_rf(buf_ptr), pdu_segment->start_offset, pdu_segment->end_offset);
 			rlc_am_pdu_segment_free(pdu_segment);
 			return NULL;
 		}
-
-		pdu_segment->free = amrx->free_pdu;
-		RLC_REF(pdu_segment);
-		dllist_append(&pdu_ctrl->rx_segq, &pdu_segment->node);
-		pdu_ctrl->is_intact = 1;
-		
-		/* place in Rx buf */
-		amrx->rxpdu[sn] = pdu_ctrl;
-		return pdu_ctrl;
 	}
 	else
 	{
-		/* Rx a PDU segment */
+		/* allocate new PDU control */
+		pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)rlc_am_rx_pdu_ctrl_new();
 		if(pdu_ctrl == NULL)
 		{
-			/* allocate new PDU control */
-			pdu_ctrl = (rlc_am_rx_pdu_ctrl_t *)rlc_am_rx_pdu_ctrl_new();
-			if(pdu_ctrl == NULL)
-			{
-				ZLOG_ERR("out of memory for new AM PDU: lcid=%d.\n", amrx->logical_chan);
-				rlc_am_pdu_segment_free(pdu_segment);
-				return NULL;
-			}
-
-			pdu_segment->free = amrx->free_pdu;
-			RLC_REF(pdu_segment);
-			dllist_append(&pdu_ctrl->rx_segq, &pdu_segment->node);
-			pdu_ctrl->is_intact = 0;
-			
-			/* place in Rx buf */
-			amrx->rxpdu[sn] = pdu_ctrl;
-			return pdu_ctrl;
-		}
-		else
-		{
-			/* new pdu segment recieved but not the first arrival */
-			if(pdu_ctrl->is_intact)
-			{
-				duplicated = 1;
-			}
-			else
-			{
-				/* must be a segment: insert into rx_segq if not duplicated */
-				so = pdu_segment->start_offset;
-				eo = pdu_segment->end_offset;
-				pdu_segtmp = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
-				while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segtmp))
-				{
-					if(pdu_segtmp->start_offset <= so && pdu_segtmp->end_offset > so)
-					{
-						duplicated = 1;
-						break;
-					}
-					else if(pdu_segtmp->start_offset > so)
-					{
-						if(pdu_segtmp->start_offset < eo)
-							duplicated = 1;
-						break;
-					}
-
-					pdu_segtmp = (rlc_am_pdu_segment_t *)pdu_segtmp->node.next;
-				}
-
-				if(duplicated)
-				{
-					ZLOG_WARN("RLC AM PDU Segment duplicated: lcid=%d SN=%d rf=%d so=%d eo=%d.\n", 
-							amrx->logical_chan, sn, pdu_hdr->rf, so, eo);
-					rlc_am_pdu_segment_free(pdu_segment);
-					return NULL;
-				}
-				
-				/* insert pdu_segment before pdu_segtmp */
-				pdu_segment->free = amrx->free_pdu;
-				RLC_REF(pdu_segment);
-				pdu_segment->node.next = &pdu_segtmp->node;
-				pdu_segment->node.prev = pdu_segtmp->node.prev;
-				(pdu_segtmp->node.prev)->next = &pdu_segment->node;
-				pdu_segtmp->node.prev = &pdu_segment->node;
-
-				/* loop list to check intact */
-				pdu_segtmp = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
-				so = 0;
-				while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segtmp))
-				{
-					if(pdu_segtmp->start_offset != so)
-						break;
-
-					so = pdu_segtmp->end_offset;
-					if(pdu_segtmp->lsf)
-					{
-						pdu_ctrl->is_intact = 1;
-						break;
-					}
-
-					pdu_segtmp = (rlc_am_pdu_segment_t *)pdu_segtmp->node.next;
-				}
-			}
+			ZLOG_ERR("out of memory for new AM PDU: lcid=%d.\n", amrx->logical_chan);
+			rlc_am_pdu_segment_free(pdu_segment);
+			return NULL;
 		}
+		
+		rlc_am_rx_insert_segment(pdu_ctrl, pdu_segment);
+		
+		/* place in Rx buf */
+		amrx->rxpdu[sn] = pdu_ctrl;
 	}
 	
+	if(pdu_ctrl->is_intact)
+		RLC_SN_MAP_SET(amrx->intact_map, sn);
+	
+	/* if trimmed, pdu_segment is referenced by its pieces only */
+	pdu_segment->free = amrx->free_pdu;
+	if(!trimmed)
+		RLC_REF(pdu_segment);
+	
 	return pdu_ctrl;
 }
 
 /* process data pdu */
 int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, void *cookie)
 {
-	u16 sn, sn_fs;
+	u16 sn;
+	u32 sn_fs;
 	rlc_am_rx_pdu_ctrl_t *pdu_ctrl = NULL;
-	rlc_am_pdu_head_t *pdu_hdr;
 	int discard = 0;
+	u32 nack_bits = 0, in_status;
 	
 	assert(buf_ptr);
 	assert(buf_len > 0);
 	
-	pdu_hdr = (rlc_am_pdu_head_t *)buf_ptr;
-	sn = pdu_hdr->sn;
-	sn_fs = RLC_SN_MAX_10BITS+1;
+	sn = rlc_am_get_head_sn(amrx->sn_bits, buf_ptr, NULL, NULL);
+	sn_fs = amrx->sn_max+1;
 
 	ZLOG_DEBUG("RLC AM Counters before processing PDU: lcid=%d sn=%u fi=%u VR_R=%u VR_X=%u VR_H=%u VR_MR=%u VR_MS=%u.\n", 
-		amrx->logical_chan, sn, pdu_hdr->fi, amrx->VR_R, amrx->VR_X, amrx->VR_H, amrx->VR_MR, amrx->VR_MS);
+		amrx->logical_chan, sn, rlc_am_head_get_fi(buf_ptr), amrx->VR_R, amrx->VR_X, amrx->VR_H, amrx->VR_MR, amrx->VR_MS);
 		
 /*
  -	if x falls outside of the receiving window (VR(R) <= SN < VR(MR)); or
@@ -1959,17 +2866,31 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
  	}
 	else
 	{
+		/* NACK info of SN in [VR(R), VR(MS)) is changed */
+		in_status = RLC_SN_IN_WINDOW(sn, amrx->VR_MS, amrx->VR_R, sn_fs);
+		if(in_status)
+			nack_bits = rlc_am_rx_nack_bits(amrx, sn);
+		
 		/* To make things simple, just discard whole PDU/segment, not only the duplicate byte segments */
-		pdu_ctrl = rlc_am_place_pdu_in_rxbuf(amrx, sn, pdu_hdr, buf_len, cookie);
+		pdu_ctrl = rlc_am_place_pdu_in_rxbuf(amrx, sn, buf_ptr, buf_len, cookie);
 		if(pdu_ctrl == NULL)
 		{
 			ZLOG_NOTICE("sn has been partly recieved: lcid=%d sn=%u\n", amrx->logical_chan, sn);
 			discard = 1;
 		}
+		else
+		{
+			amrx->rx_gen ++;
+			if(in_status)
+				amrx->nack_bits = amrx->nack_bits - nack_bits + rlc_am_rx_nack_bits(amrx, sn);
+			
+			if(amrx->ooo_deliv)
+				rlc_am_rx_assemble_ooo_sdu(amrx, pdu_ctrl);
+		}
 	}
 
 /* status report handling */
-	if(pdu_hdr->p)
+	if(rlc_am_head_get_p(buf_ptr))
 	{
 		rlc_am_trigger_status_report(amrx, amrx->amtx, sn, discard);
 		ZLOG_DEBUG("Rx poll_bit=1 and status_pdu_triggered=%u, lcid=%d\n", 
@@ -2005,14 +2926,7 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
         have been received;
 */
 	if(sn == amrx->VR_MS && pdu_ctrl->is_intact)
-	{
-		do{
-			sn = RLC_MOD(sn+1, sn_fs);
-			pdu_ctrl = amrx->rxpdu[sn];
-		}while(pdu_ctrl && pdu_ctrl->is_intact);
-		
-		amrx->VR_MS = sn;
-	}
+		amrx->VR_MS = rlc_am_rx_next_missing_sn(amrx, sn);
 
 /*
 -	if x = VR(R):
@@ -2024,7 +2938,6 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
         and in-sequence byte segments of the AMD PDU with SN = VR(R), remove RLC headers when doing so and deliver 
         the reassembled RLC SDUs to upper layer in sequence if not delivered before;
 */
-	sn = pdu_hdr->sn;
 	if(sn == amrx->VR_R)
 	{
 		do{
@@ -2035,6 +2948,7 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
 				/* free rxpdu[sn] */
 				rlc_am_rx_pdu_ctrl_free(amrx->rxpdu[sn]);
 				amrx->rxpdu[sn] = NULL;
+				RLC_SN_MAP_CLR(amrx->intact_map, sn);
 
 				/* to next pdu */
 				sn = RLC_MOD((sn + 1), sn_fs);
@@ -2048,7 +2962,25 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
 		amrx->VR_R = RLC_MOD(sn, sn_fs);
 		amrx->VR_MR = RLC_MOD(sn+amrx->AM_Window_Size, sn_fs);
 	}
+	
+	return 0;
+}
 
+/***********************************************************************************/
+/* Function : rlc_am_rx_update_reordering                                          */
+/***********************************************************************************/
+/* Description : - stop or start t-Reordering after AM data PDUs are placed        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | io | RLC AM Rx entity                                    */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_rx_update_reordering(rlc_entity_am_rx_t *amrx)
+{
+	u32 sn_fs = amrx->sn_max+1;
+	
 /* 
 -	if t-Reordering is running:
     -	if VR(X) = VR(R); or
@@ -2085,11 +3017,6 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
 
 	ZLOG_DEBUG("RLC AM Counters after processing PDU: lcid=%d VR_R=%u VR_X=%u VR_H=%u VR_MR=%u VR_MS=%u.\n", 
 		amrx->logical_chan, amrx->VR_R, amrx->VR_X, amrx->VR_H, amrx->VR_MR, amrx->VR_MS);
-	
-	/* deliver intact SDU to upper */
-	rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_assembly_q);
-	
-	return 0;
 }
 
 /* Process received RLC AM PDU
@@ -2097,12 +3024,71 @@ int rlc_am_rx_process_data_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_le
  */
 int rlc_am_rx_process_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, void *cookie)
 {
-	rlc_am_pdu_head_t *pdu_hdr;
+	u32 n_placed = 0;
 	int ret;
 
 	assert(amrx);
 	assert(buf_ptr);
 	
+	ret = rlc_am_rx_handle_pdu(amrx, buf_ptr, buf_len, cookie, &n_placed);
+	if(n_placed)
+	{
+		rlc_am_rx_update_reordering(amrx);
+		
+		/* deliver intact SDU to upper */
+		rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_ooo_q);
+		rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_assembly_q);
+	}
+	
+	return ret;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_process_pdus                                               */
+/***********************************************************************************/
+/* Description : - Process all AM PDUs of one MAC TB                               */
+/*               - t-Reordering is checked and SDUs are delivered once after all   */
+/*                 PDUs are handled, as if the PDUs are received at the same time  */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | io | RLC AM Rx entity                                    */
+/*   pdus               | i  | received PDUs, all are freed by amrx->free_pdu()    */
+/*   n                  | i  | number of PDUs                                      */
+/*   Return             |    | number of PDUs processed successfully               */
+/***********************************************************************************/
+u32 rlc_am_rx_process_pdus(rlc_entity_am_rx_t *amrx, rlc_pdu_desc_t pdus[], u32 n)
+{
+	u32 i, n_ok = 0, n_placed = 0;
+	
+	assert(amrx);
+	
+	for(i=0; i<n; i++)
+	{
+		if(rlc_am_rx_handle_pdu(amrx, pdus[i].buf_ptr, pdus[i].buf_len, pdus[i].cookie, &n_placed) == 0)
+			n_ok ++;
+	}
+	
+	if(n_placed)
+	{
+		rlc_am_rx_update_reordering(amrx);
+		rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_ooo_q);
+		rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_assembly_q);
+	}
+	
+	return n_ok;
+}
+
+/* Handle one received RLC AM PDU, n_placed is increased if it is a data PDU placed in Rx buffer
+ * return: on success return 0; on error return non-zero
+ */
+int rlc_am_rx_handle_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, void *cookie, u32 *n_placed)
+{
+	int ret;
+
+	assert(buf_ptr);
+	
 	if(buf_len < 2)
 	{
 		ZLOG_DEBUG("lcid=%d buf_ptr=%p pdu_len=%d\n", amrx->logical_chan, buf_ptr, buf_len);
@@ -2110,9 +3096,16 @@ int rlc_am_rx_process_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, vo
 		return -1;
 	}
 	
+	/* hibernated entity: both windows are needed, even by STATUS PDU */
+	if(amrx->rxpdu == NULL && rlc_am_resume(RLC_AM_RX_ENTITY(amrx)))
+	{
+		amrx->n_discard_pdu ++;
+		amrx->free_pdu(buf_ptr, cookie);
+		return -1;
+	}
+	
 	/* parse header */
-	pdu_hdr = (rlc_am_pdu_head_t *)buf_ptr;
-	if(pdu_hdr->dc == RLC_AM_DC_CTRL_PDU)
+	if(rlc_am_head_get_dc(buf_ptr) == RLC_AM_DC_CTRL_PDU)
 	{
 		//control PDU: only status PDU now
 		ret = rlc_am_rx_process_status_pdu(amrx, buf_ptr, buf_len);
@@ -2125,6 +3118,8 @@ int rlc_am_rx_process_pdu(rlc_entity_am_rx_t *amrx, u8 *buf_ptr, u32 buf_len, vo
 		ret = rlc_am_rx_process_data_pdu(amrx, buf_ptr, buf_len, cookie);
 		if(ret)
 			amrx->free_pdu(buf_ptr, cookie);
+		else
+			(*n_placed) ++;
 		return ret;
 	}
 }
@@ -2148,19 +3143,10 @@ int rlc_am_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_am_rx_pdu_ctrl_t *
 	u32 is_first, is_last;
 	rlc_am_pdu_segment_t *pdu_segment;
 
-	/* get the PDU segment corresponding to delivery offset */
-	pdu_segment = (rlc_am_pdu_segment_t *)DLLIST_HEAD(&pdu_ctrl->rx_segq);
-	while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segment))
-	{
-		if(pdu_segment->start_offset < pdu_ctrl->delivery_offset)
-			pdu_segment = (rlc_am_pdu_segment_t *)pdu_segment->node.next;
-		else
-			break;
-	}
-
-	/* assemble pdu_segment in pdu_ctrl */
-	while(!DLLIST_IS_HEAD(&pdu_ctrl->rx_segq, pdu_segment))
+	/* assemble pdu_segment in pdu_ctrl: from the segment corresponding to delivery offset */
+	while(pdu_ctrl->i_deliv < pdu_ctrl->n_seg)
 	{
+		pdu_segment = pdu_ctrl->rx_seg[pdu_ctrl->i_deliv];
 		if(pdu_segment->start_offset != pdu_ctrl->delivery_offset)
 		{
 			ZLOG_DEBUG("no valid segment: start_offset=%d but delivery_offset=%d.\n", 
@@ -2256,19 +3242,225 @@ int rlc_am_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_am_rx_pdu_ctrl_t *
 			sdu->intact = 0;
 		}
 
-		/* update delivery offset: we do this even end_offset=0x7FFF */
+		/* update delivery offset: we do this even end_offset=RLC_AM_SO_END */
 		pdu_ctrl->delivery_offset += pdu_segment->end_offset-pdu_segment->start_offset;
-		
-		pdu_segment = (rlc_am_pdu_segment_t *)pdu_segment->node.next;
+		pdu_ctrl->i_deliv ++;
 	}
 	
 	return 0;
 }
 
+/* whole AMD PDU is received and all of its bytes are a middle part of one SDU */
+int rlc_am_rx_is_middle_pdu(rlc_am_rx_pdu_ctrl_t *pdu_ctrl)
+{
+	u32 i;
+	
+	if(!pdu_ctrl->is_intact)
+		return 0;
+	
+	for(i=0; i<pdu_ctrl->n_seg; i++)
+	{
+		if(pdu_ctrl->rx_seg[i]->fi != 0x03 || pdu_ctrl->rx_seg[i]->n_li != 1)
+			return 0;
+	}
+	
+	return 1;
+}
+
+/***********************************************************************************/
+/* Function : rlc_am_rx_assemble_ooo_sdu                                           */
+/***********************************************************************************/
+/* Description : - Assemble SDUs which have bytes in segments newly placed and     */
+/*                 have all bytes received, to amrx->sdu_ooo_q                     */
+/*               - A SDU may span several SNs: the scan goes back from the PDU     */
+/*                 while its head continues a SDU of previous SN, and forward      */
+/*                 while its tail goes on in next SN, over intact middle PDUs      */
+/*               - Works on contiguous received bytes, no matter of VR(R)          */
+/*               - First piece of each delivered SDU is marked in ooo_sent, so     */
+/*                 rlc_am_rx_drop_ooo_sdu() drops it after in-order assembly       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   amrx               | io | RLC AM Rx entity                                    */
+/*   pdu_ctrl           | io | Rx PDU control of the placed PDU                    */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_am_rx_assemble_ooo_sdu(rlc_entity_am_rx_t *amrx, rlc_am_rx_pdu_ctrl_t *pdu_ctrl)
+{
+	rlc_am_rx_pdu_ctrl_t *pc;
+	rlc_am_pdu_segment_t *pdu_segment, *first_seg = NULL;
+	rlc_sdu_segment_t piece[RLC_SDU_SEGMENT_MAX];
+	rlc_sdu_t *sdu;
+	u32 sn_fs = amrx->sn_max + 1;
+	u32 sn, lo, hi, n, i, j, li_idx, first_li = 0, n_piece = 0, size = 0;
+	u32 collecting = 0, has_new = 0, prev_eo;
+	u32 is_first, is_last;
+	u8 *data_ptr;
+	
+	/* an SDU has at most RLC_SDU_SEGMENT_MAX pieces, so never walk further */
+	lo = hi = pdu_ctrl->rx_seg[0]->sn;
+	pc = pdu_ctrl;
+	for(n=0; n<RLC_SDU_SEGMENT_MAX; n++)
+	{
+		if(pc->rx_seg[0]->start_offset != 0 || !(pc->rx_seg[0]->fi & 0x02))
+			break;
+		
+		sn = RLC_MOD(lo + sn_fs - 1, sn_fs);
+		if(!RLC_SN_IN_RECEIVING_WIN(sn, amrx->VR_MR, amrx->VR_R, sn_fs) || 
+			(pc = amrx->rxpdu[sn]) == NULL || !pc->rx_seg[pc->n_seg-1]->lsf)
+			break;
+		
+		lo = sn;
+		if(!rlc_am_rx_is_middle_pdu(pc))
+			break;
+	}
+	
+	pc = pdu_ctrl;
+	for(n=0; n<RLC_SDU_SEGMENT_MAX; n++)
+	{
+		if(!pc->rx_seg[pc->n_seg-1]->lsf || !(pc->rx_seg[pc->n_seg-1]->fi & 0x01))
+			break;
+		
+		sn = RLC_MOD(hi + 1, sn_fs);
+		if(!RLC_SN_IN_RECEIVING_WIN(sn, amrx->VR_MR, amrx->VR_R, sn_fs) || 
+			(pc = amrx->rxpdu[sn]) == NULL || pc->rx_seg[0]->start_offset != 0)
+			break;
+		
+		hi = sn;
+		if(!rlc_am_rx_is_middle_pdu(pc))
+			break;
+	}
+	
+	for(sn=lo; ; sn=RLC_MOD(sn + 1, sn_fs))
+	{
+		pc = amrx->rxpdu[sn];
+		prev_eo = 0;
+		
+		for(i=0; i<pc->n_seg; i++)
+		{
+			pdu_segment = pc->rx_seg[i];
+			
+			/* a hole breaks the SDU being collected */
+			if(pdu_segment->start_offset != prev_eo)
+				collecting = 0;
+			prev_eo = pdu_segment->end_offset;
+			
+			data_ptr = pdu_segment->data_ptr;
+			for(li_idx=0; li_idx<pdu_segment->n_li; li_idx++)
+			{
+				is_first = (li_idx > 0) || !(pdu_segment->fi & 0x02);
+				is_last = (li_idx+1 < pdu_segment->n_li) || !(pdu_segment->fi & 0x01);
+				
+				if(is_first)
+				{
+					collecting = 1;
+					n_piece = 0;
+					size = 0;
+					has_new = 0;
+					first_seg = pdu_segment;
+					first_li = li_idx;
+				}
+				
+				if(collecting && n_piece < RLC_SDU_SEGMENT_MAX)
+				{
+					piece[n_piece].data = data_ptr;
+					piece[n_piece].length = pdu_segment->li_s[li_idx];
+					piece[n_piece].cookie = pdu_segment;
+					piece[n_piece].free = rlc_am_rxseg_free;
+					size += pdu_segment->li_s[li_idx];
+					has_new |= pdu_segment->is_new;
+					n_piece ++;
+					
+					if(is_last)
+					{
+						collecting = 0;
+						
+						/* if no piece is new, SDU has been delivered before */
+						if(has_new && (sdu = rlc_sdu_new()) != NULL)
+						{
+							for(j=0; j<n_piece; j++)
+							{
+								RLC_REF((rlc_am_pdu_segment_t *)piece[j].cookie);
+								sdu->segment[j] = piece[j];
+							}
+							sdu->n_segment = n_piece;
+							sdu->size = size;
+							sdu->intact = 1;
+							dllist_append(&amrx->sdu_ooo_q, (dllist_node_t *)sdu);
+							first_seg->ooo_sent |= 1u << first_li;
+						}
+					}
+				}
+				else
+					collecting = 0;
+				
+				data_ptr += pdu_segment->li_s[li_idx];
+			}
+		}
+		
+		/* SDU goes on in next SN only if this one is received up to its end */
+		if(!pc->rx_seg[pc->n_seg-1]->lsf)
+			collecting = 0;
+		
+		if(sn == hi)
+			break;
+	}
+	
+	for(i=0; i<pdu_ctrl->n_seg; i++)
+		pdu_ctrl->rx_seg[i]->is_new = 0;
+}
+
+/* drop SDUs delivered out of order from assembly queue, they are known by their first piece */
+void rlc_am_rx_drop_ooo_sdu(rlc_entity_am_rx_t *amrx)
+{
+	rlc_am_pdu_segment_t *pdu_segment;
+	rlc_sdu_t *sdu, *next;
+	u32 li_idx;
+	u8 *data_ptr;
+	
+	sdu = (rlc_sdu_t *)amrx->sdu_assembly_q.next;
+	while(((dllist_node_t *)sdu != &amrx->sdu_assembly_q) && sdu->intact)
+	{
+		next = (rlc_sdu_t *)sdu->node.next;
+		
+		/* LI of first piece in its segment */
+		pdu_segment = (rlc_am_pdu_segment_t *)sdu->segment[0].cookie;
+		data_ptr = pdu_segment->data_ptr;
+		for(li_idx=0; li_idx<pdu_segment->n_li && data_ptr<sdu->segment[0].data; li_idx++)
+			data_ptr += pdu_segment->li_s[li_idx];
+		
+		if(li_idx < RLC_LI_NUM_MAX && (pdu_segment->ooo_sent & (1u << li_idx)))
+		{
+			dllist_remove(&amrx->sdu_assembly_q, (dllist_node_t *)sdu);
+			rlc_sdu_free(sdu);
+		}
+		
+		sdu = next;
+	}
+}
+
 /* deliver reassemblied SDU to upper */
 void rlc_am_rx_delivery_sdu(rlc_entity_am_rx_t *amrx, dllist_node_t *sdu_assembly_q)
 {
 	rlc_sdu_t *sdu;
+	rlc_sdu_t *sdus[RLC_SDU_BATCH_MAX];
+	u32 n;
+	
+	/* SDUs have been delivered by rlc_am_rx_assemble_ooo_sdu() */
+	if(amrx->ooo_deliv && sdu_assembly_q == &amrx->sdu_assembly_q)
+		rlc_am_rx_drop_ooo_sdu(amrx);
+	
+	if(amrx->deliv_sdu_batch)
+	{
+		/* SDUs are owned by upper from now */
+		while((n = rlc_sdu_dequeue_intact(sdu_assembly_q, sdus, RLC_SDU_BATCH_MAX)) > 0)
+		{
+			ZLOG_DEBUG("deliver %u SDUs to upper: lcid=%d.\n", n, amrx->logical_chan);
+			amrx->deliv_sdu_batch(amrx, sdus, n);
+		}
+		return;
+	}
 	
 	sdu = (rlc_sdu_t *)sdu_assembly_q->next;
 	while(((dllist_node_t *)sdu != sdu_assembly_q) && sdu->intact)
@@ -2318,7 +3510,7 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 
 	/* force reassemble SDU */
 	sn = amrx->VR_R;
-	while(RLC_SN_LESS(sn, amrx->VR_H, (RLC_SN_MAX_10BITS+1)))
+	while(RLC_SN_LESS(sn, amrx->VR_H, (amrx->sn_max+1)))
 	{
 		if(amrx->rxpdu[sn])
 		{
@@ -2328,7 +3520,7 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 			rlc_am_rx_pdu_ctrl_free(amrx->rxpdu[sn]);
 			amrx->rxpdu[sn] = NULL;
 		}
-		sn = RLC_MOD((sn + 1), (RLC_SN_MAX_10BITS+1));
+		sn = RLC_MOD((sn + 1), (amrx->sn_max+1));
 	}
 
 	rlc_am_rx_delivery_sdu(amrx, &amrx->sdu_assembly_q);
@@ -2345,6 +3537,8 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 	}
 
 	/* discard all RLC SDUs and AMD PDUs in the transmitting side */
+	if(amtx->sdu_ingress)
+		rlc_sdu_ingress_drain(amtx->sdu_ingress, &amtx->sdu_tx_q, amtx->free_sdu, RLC_SDU_INGRESS_ALL, &amtx->n_sdu, &amtx->sdu_total_size);
 	while(!DLLIST_EMPTY(&amtx->sdu_tx_q))
 	{
 		sdu = (rlc_sdu_t *)(amtx->sdu_tx_q.next);
@@ -2358,16 +3552,17 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 		pdu_ctrl = (rlc_am_tx_pdu_ctrl_t *)(amtx->pdu_retx_q.next);
 		dllist_remove(&amtx->pdu_retx_q, (dllist_node_t *)pdu_ctrl);
 	}
+	amtx->retx_bytes = 0;
 
 	sn = amtx->VT_A;
-	while(RLC_SN_LESS(sn, amtx->VT_S, (RLC_SN_MAX_10BITS+1)))
+	while(RLC_SN_LESS(sn, amtx->VT_S, (amtx->sn_max+1)))
 	{
 		if(amtx->txpdu[sn])
 		{
 			rlc_am_tx_pdu_ctrl_free(amtx->txpdu[sn]);
 			amtx->txpdu[sn] = NULL;
 		}
-		sn = RLC_MOD((sn + 1), (RLC_SN_MAX_10BITS+1));
+		sn = RLC_MOD((sn + 1), (amtx->sn_max+1));
 	}
 
 	/* reset timers and state variables */
@@ -2388,6 +3583,10 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 	amrx->VR_H = 0;
 	amrx->VR_MS = 0;
 	amrx->VR_X = 0;
+	amrx->nack_bits = 0;
+	amrx->rx_gen ++;
+	if(amrx->intact_map)
+		memset(amrx->intact_map, 0, ((amrx->sn_max + 1) >> 6) * sizeof(u64));
 	amrx->n_discard_pdu = 0;
 	amrx->n_good_pdu = 0;
 
@@ -2397,6 +3596,7 @@ int rlc_am_reestablish(rlc_entity_am_t *rlcam)
 	amtx->poll_bit = 0;
 	amtx->sdu_total_size = 0;
 	amtx->status_pdu_triggered = 0;
+	amtx->status_pdu_len = 0;
 	amtx->VT_A = 0;
 	amtx->VT_S = 0;
 	amtx->VT_MS = amtx->VT_S + amtx->AM_Window_Size;
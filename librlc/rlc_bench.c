@@ -0,0 +1,968 @@
+/* rlc_bench.c
+ * measure time per PDU on RLC UM Rx path with small packets, e.g. VoLTE bearers.
+ * PDUs are built once by a UM Tx entity and replayed to the Rx entity round by
+ * round, so no malloc() is counted in the measured loop.
+ *
+ * With options, TM/UM/AM loopback pairs are driven TTI by TTI over a lossy and
+ * reordering link instead, and throughput, cycles per operation and SDU latency
+ * are printed in JSON. The link is driven by a seeded generator, so a run is
+ * reproducible and two builds can be compared by their JSON output.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rlc.h"
+#include "log.h"
+
+#define BENCH_N_PDU 1024			/* one round covers all 10 bits SN */
+#define BENCH_N_ALLOC 1000000
+#define BENCH_N_LI 20				/* SDUs per PDU for LI parsing and Tx */
+#define BENCH_N_TX_SDU 16000		/* SDUs in Tx queue, within SDU pool */
+#define BENCH_N_UE 1024				/* UEs in registry case, 4 bearers each */
+
+rlc_um_pdu_t *rlc_um_pdu_new();
+void rlc_um_pdu_free(rlc_um_pdu_t *pdu);
+
+static u8 *bench_pdu[BENCH_N_PDU];
+static u32 bench_pdu_len[BENCH_N_PDU];
+static u32 bench_n_sdu;
+
+/* PDUs are replayed, never freed by RLC */
+static void bench_free_pdu(void *data, void *cookie)
+{
+}
+
+static void bench_free_sdu(void *data, void *cookie)
+{
+	free(data);
+}
+
+static void bench_deliv_sdu(struct rlc_entity_um_rx *umrx, rlc_sdu_t *sdu)
+{
+	bench_n_sdu ++;
+}
+
+static u64 bench_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 bench_cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	u32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((u64)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+static void bench_report(const char *name, u64 ns, u64 cycles, u32 n)
+{
+	printf("%-32s %10u %10.1f ns %10.1f cycles\n", name, n, (double)ns/n, (double)cycles/n);
+}
+
+/* build BENCH_N_PDU UMD PDUs with 10 bits SN, one SDU per PDU */
+static int bench_build_um_pdus(u32 sdu_size)
+{
+	rlc_entity_um_t um;
+	u8 buf[2048];
+	u8 *sdu;
+	int i, len;
+
+	rlc_um_init(&um, 10, 512, 50, bench_free_pdu, bench_free_sdu);
+
+	for(i=0; i<BENCH_N_PDU; i++)
+	{
+		sdu = malloc(sdu_size);
+		memset(sdu, i, sdu_size);
+		rlc_um_tx_sdu_enqueue(&um.umtx, sdu, sdu_size, NULL, NULL);
+
+		len = rlc_um_tx_build_pdu(&um.umtx, buf, sdu_size + 2);
+		if(len <= 0)
+		{
+			rlc_um_deinit(&um);
+			return -1;
+		}
+
+		bench_pdu[i] = malloc(len);
+		memcpy(bench_pdu[i], buf, len);
+		bench_pdu_len[i] = len;
+	}
+
+	rlc_um_deinit(&um);
+	return 0;
+}
+
+static void bench_um_rx(const char *name, u32 window_size, u32 n_round)
+{
+	rlc_entity_um_t um;
+	u64 ns, cycles;
+	u32 r, i;
+
+	rlc_um_init(&um, 10, window_size, 50, bench_free_pdu, bench_free_sdu);
+	rlc_um_set_deliv_func(&um, bench_deliv_sdu);
+	bench_n_sdu = 0;
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(r=0; r<n_round; r++)
+	{
+		for(i=0; i<BENCH_N_PDU; i++)
+			rlc_um_rx_process_pdu(&um.umrx, bench_pdu[i], bench_pdu_len[i], NULL);
+	}
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	if(bench_n_sdu != n_round * BENCH_N_PDU)
+		printf("%s: only %u SDUs are delivered\n", name, bench_n_sdu);
+
+	bench_report(name, ns, cycles, n_round * BENCH_N_PDU);
+	rlc_um_deinit(&um);
+}
+
+static void bench_um_pdu_alloc()
+{
+	rlc_um_pdu_t *pdu;
+	u64 ns, cycles;
+	u32 i;
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(i=0; i<BENCH_N_ALLOC; i++)
+	{
+		pdu = rlc_um_pdu_new();
+		rlc_um_pdu_free(pdu);
+	}
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	bench_report("UM PDU new/free", ns, cycles, BENCH_N_ALLOC);
+}
+
+/* SDUs of Tx case are in a static buffer */
+static void bench_keep_sdu(void *data, void *cookie)
+{
+}
+
+/* pack BENCH_N_LI small SDUs into one UMD PDU, Tx queue is filled up before
+ * so SDU control info is mostly out of cache as in a loaded eNB */
+static void bench_um_tx(u32 sdu_size, u32 n_round)
+{
+	rlc_entity_um_t um;
+	static u8 sdu[2048];
+	u8 buf[64 + BENCH_N_LI * 2048];
+	u32 pdu_size = 2 + rlc_li_len(BENCH_N_LI) + BENCH_N_LI * sdu_size;
+	u64 ns = 0, cycles = 0, t_ns, t_cycles;
+	u32 r, i, n_pdu = 0;
+
+	rlc_um_init(&um, 10, 512, 50, bench_free_pdu, bench_keep_sdu);
+
+	for(r=0; r<n_round/100+1; r++)
+	{
+		for(i=0; i<BENCH_N_TX_SDU; i++)
+			rlc_um_tx_sdu_enqueue(&um.umtx, sdu, sdu_size, NULL, NULL);
+
+		t_ns = bench_ns();
+		t_cycles = bench_cycles();
+		for(i=0; i<BENCH_N_TX_SDU/BENCH_N_LI; i++)
+		{
+			if(rlc_um_tx_build_pdu(&um.umtx, buf, pdu_size) != pdu_size)
+			{
+				printf("UM Tx: failed to build PDU\n");
+				rlc_um_deinit(&um);
+				return;
+			}
+		}
+		cycles += bench_cycles() - t_cycles;
+		ns += bench_ns() - t_ns;
+		n_pdu += i;
+	}
+
+	bench_report("UM Tx, 20 SDUs per PDU", ns, cycles, n_pdu);
+	rlc_um_deinit(&um);
+}
+
+/* same PDUs as bench_um_tx(), SDUs are posted to SDU ingress ring as by a PDCP
+ * thread and drained by the builder, one thread here so only the ring is counted */
+static void bench_um_tx_ingress(u32 sdu_size, u32 n_round)
+{
+	rlc_entity_um_t um;
+	static u8 sdu[2048];
+	u8 buf[64 + BENCH_N_LI * 2048];
+	u32 pdu_size = 2 + rlc_li_len(BENCH_N_LI) + BENCH_N_LI * sdu_size;
+	u64 ns, cycles;
+	u32 r, i, n_pdu = n_round * 100;
+
+	rlc_um_init(&um, 10, 512, 50, bench_free_pdu, bench_keep_sdu);
+	if(rlc_um_set_sdu_ingress(&um, BENCH_N_LI * 4))
+	{
+		rlc_um_deinit(&um);
+		return;
+	}
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(r=0; r<n_pdu; r++)
+	{
+		for(i=0; i<BENCH_N_LI; i++)
+			rlc_um_tx_sdu_post(&um.umtx, sdu, sdu_size, NULL);
+
+		if(rlc_um_tx_build_pdu(&um.umtx, buf, pdu_size) != pdu_size)
+		{
+			printf("UM Tx ingress: failed to build PDU\n");
+			break;
+		}
+	}
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	bench_report("UM Tx by ingress ring", ns, cycles, r);
+
+	rlc_um_deinit(&um);
+}
+
+/* parse LIs of a UMD PDU packing BENCH_N_LI small SDUs */
+static void bench_parse_li(u32 sdu_size)
+{
+	u8 buf[64 + BENCH_N_LI * 2048];
+	u32 li_s[RLC_LI_NUM_MAX];
+	u32 size, i, n_li = 0;
+	u8 *data_ptr;
+	u64 ns, cycles;
+
+	for(i=0; i<BENCH_N_LI; i++)
+		li_s[i] = sdu_size;
+	rlc_encode_li(buf, BENCH_N_LI, li_s);
+	size = rlc_li_len(BENCH_N_LI) + BENCH_N_LI * sdu_size;
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(i=0; i<BENCH_N_ALLOC; i++)
+		n_li += rlc_parse_li(1, buf, size, &data_ptr, li_s);
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	if(n_li != BENCH_N_ALLOC * BENCH_N_LI)
+		printf("LI parse: wrong number of LI %u\n", n_li);
+
+	bench_report("LI parse, 20 SDUs", ns, cycles, BENCH_N_ALLOC);
+}
+
+/* find entity of a MAC subheader among BENCH_N_UE*4 bearers, UEs in random order */
+static void bench_registry_find()
+{
+	rlc_registry_t *reg;
+	static u16 rnti[BENCH_N_ALLOC/4];
+	u64 ns, cycles;
+	u32 i, n_found = 0;
+
+	reg = rlc_registry_create(BENCH_N_UE * 4, 0, 0);
+	if(reg == NULL)
+		return;
+	for(i=0; i<BENCH_N_UE*4; i++)
+		rlc_tm_init(rlc_registry_add(reg, 0, 0x3D + i/4, 3 + i%4, RLC_ENTITY_TYPE_TM), bench_keep_sdu);
+	for(i=0; i<BENCH_N_ALLOC/4; i++)
+		rnti[i] = 0x3D + rand() % BENCH_N_UE;
+
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(i=0; i<BENCH_N_ALLOC; i++)
+		n_found += (rlc_registry_find(reg, 0, rnti[i/4], 3 + i%4) != NULL);
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	if(n_found != BENCH_N_ALLOC)
+		printf("Registry: only %u entities are found\n", n_found);
+
+	bench_report("Registry find, 4096 bearers", ns, cycles, BENCH_N_ALLOC);
+
+	for(i=0; i<BENCH_N_UE*4; i++)
+		rlc_registry_remove(reg, 0, 0x3D + i/4, 3 + i%4);
+	rlc_registry_destroy(reg);
+}
+
+/* loopback pair: Tx entity (cell 0) -> lossy link -> Rx entity (cell 1), AM STATUS
+ * PDUs go back on the same link. Latency is in TTIs of RLC clock, each SDU starts with
+ * its enqueue time, sequence number and size, and ends with the low byte of sequence
+ * number, so a SDU reassembled wrongly is counted as corrupt. Entities run on their
+ * own shard, whose pools are sized for them */
+#define BENCH_LOOP_ENT_MAX 64
+#define BENCH_LOOP_GRANT_MAX 9000
+#define BENCH_LOOP_PDU_MIN 16			/* tail of grant smaller than this is padding */
+#define BENCH_LOOP_HOLD_MAX 16			/* PDUs held back by reordering per pair */
+#define BENCH_LOOP_DELAY_MAX 4			/* reordered PDU is late by 1..4 TTIs */
+#define BENCH_LOOP_SDU_QUEUED 512		/* SDUs queued per Tx entity, within its share of SDU pool */
+#define BENCH_LOOP_SDU_HEAD 12			/* enqueue time, sequence number and size */
+#define BENCH_LOOP_SDU_MIN (BENCH_LOOP_SDU_HEAD + 1)	/* head and tail don't overlap */
+#define BENCH_LOOP_DRAIN 200			/* TTIs without new SDU at the end of run */
+#define BENCH_LOOP_LAT_MAX 1024			/* latency histogram size, in TTIs */
+#define BENCH_LOOP_RNTI 0x3D
+#define BENCH_LOOP_LCID 3
+
+enum
+{
+	BENCH_OP_ENQUEUE,
+	BENCH_OP_BUILD,
+	BENCH_OP_PROCESS,
+	BENCH_OP_STATUS,					/* build and process of AM STATUS PDU */
+	BENCH_OP_MAX
+};
+
+static const char *bench_op_name[BENCH_OP_MAX] = {"enqueue", "build", "process", "status"};
+
+typedef struct bench_held
+{
+	u8 *data;
+	u32 length;
+	u32 due;							/* RLC clock to deliver the PDU */
+}bench_held_t;
+
+typedef struct bench_pair
+{
+	void *tx;
+	void *rx;
+	u32 n_queued;						/* SDUs not freed by Tx entity yet */
+	u32 n_held;
+	bench_held_t held[BENCH_LOOP_HOLD_MAX];
+}bench_pair_t;
+
+typedef struct bench_loop_cfg
+{
+	u16 type;							/* RLC_ENTITY_TYPE_XX */
+	u32 sdu_min;
+	u32 sdu_max;
+	u32 grant;							/* bytes per TTI per pair */
+	u32 loss;							/* PDU loss rate, in 1/10000 */
+	u32 reorder;						/* PDU reordering rate, in 1/10000 */
+	u32 n_ent;
+	u32 n_tti;
+	u32 n_sdu_tti;						/* SDUs offered per TTI per pair */
+	u32 seed;
+}bench_loop_cfg_t;
+
+typedef struct bench_loop_stat
+{
+	u64 op_cycles[BENCH_OP_MAX];
+	u64 op_count[BENCH_OP_MAX];
+	u64 n_offered;
+	u64 n_blocked;						/* SDUs not offered for Tx queue is full */
+	u64 n_deliv;
+	u64 deliv_bytes;
+	u64 n_corrupt;						/* SDUs delivered with wrong head or tail */
+	u64 n_pdu;
+	u64 pdu_bytes;
+	u64 n_lost;
+	u64 n_reordered;
+	u32 lat_max;
+	u32 lat_hist[BENCH_LOOP_LAT_MAX];
+	u64 lat_over;						/* SDUs of latency beyond histogram */
+}bench_loop_stat_t;
+
+static bench_loop_cfg_t bench_cfg;
+static bench_loop_stat_t bench_stat;
+static u32 bench_seed;
+static u32 bench_sdu_seq;				/* sequence number of next SDU, of all pairs */
+
+/* LCG of ANSI C, same sequence on every platform for a seed */
+static u32 bench_rand()
+{
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return (bench_seed >> 16) & 0x7FFF;
+}
+
+static int bench_chance(u32 rate)
+{
+	return rate && (bench_rand() * 10000 >> 15) < rate;
+}
+
+static void bench_loop_free_buf(void *data, void *cookie)
+{
+	free(cookie);
+}
+
+static void bench_loop_free_sdu(void *data, void *cookie)
+{
+	((bench_pair_t *)cookie)->n_queued --;
+	free(data);
+}
+
+static u32 bench_get_u32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/* head is the first BENCH_LOOP_SDU_HEAD bytes of SDU, tail is its last byte */
+static void bench_loop_latency(const u8 *head, u8 tail, u32 size)
+{
+	u32 stamp = bench_get_u32(head), seq = bench_get_u32(head + 4), lat;
+
+	if(size < BENCH_LOOP_SDU_MIN || bench_get_u32(head + 8) != size || 
+		seq >= bench_sdu_seq || tail != (u8)seq || (s32)(rlc_get_time() - stamp) < 0)
+	{
+		bench_stat.n_corrupt ++;
+		return;
+	}
+
+	lat = rlc_get_time() - stamp;
+	bench_stat.n_deliv ++;
+	bench_stat.deliv_bytes += size;
+	if(lat > bench_stat.lat_max)
+		bench_stat.lat_max = lat;
+	if(lat < BENCH_LOOP_LAT_MAX)
+		bench_stat.lat_hist[lat] ++;
+	else
+		bench_stat.lat_over ++;
+}
+
+/* head may be split in segments of reassembled SDU */
+static void bench_loop_sdu_latency(rlc_sdu_t *sdu)
+{
+	u8 head[BENCH_LOOP_SDU_HEAD], tail = 0;
+	u32 i, j, k = 0;
+
+	for(i=0; i<sdu->n_segment && k<BENCH_LOOP_SDU_HEAD; i++)
+	{
+		for(j=0; j<sdu->segment[i].length && k<BENCH_LOOP_SDU_HEAD; j++)
+			head[k++] = sdu->segment[i].data[j];
+	}
+	for(i=sdu->n_segment; i>0; i--)
+	{
+		if(sdu->segment[i-1].length)
+		{
+			tail = sdu->segment[i-1].data[sdu->segment[i-1].length - 1];
+			break;
+		}
+	}
+
+	if(k < BENCH_LOOP_SDU_HEAD)
+	{
+		bench_stat.n_corrupt ++;
+		return;
+	}
+	bench_loop_latency(head, tail, sdu->size);
+}
+
+static void bench_loop_deliv_um(struct rlc_entity_um_rx *umrx, rlc_sdu_t *sdu)
+{
+	bench_loop_sdu_latency(sdu);
+}
+
+static void bench_loop_deliv_am(struct rlc_entity_am_rx *amrx, rlc_sdu_t *sdu)
+{
+	bench_loop_sdu_latency(sdu);
+}
+
+static void bench_loop_op(u32 op, u64 cycles)
+{
+	bench_stat.op_cycles[op] += cycles;
+	bench_stat.op_count[op] ++;
+}
+
+/* Rx entity takes over the PDU, SDUs are delivered (and counted) inside */
+static void bench_loop_process(bench_pair_t *pair, u8 *pdu, u32 length)
+{
+	u64 t = bench_cycles();
+
+	if(bench_cfg.type == RLC_ENTITY_TYPE_UM)
+		rlc_um_rx_process_pdu(&((rlc_entity_um_t *)pair->rx)->umrx, pdu, length, pdu);
+	else if(bench_cfg.type == RLC_ENTITY_TYPE_AM)
+		rlc_am_rx_process_pdu(&((rlc_entity_am_t *)pair->rx)->amrx, pdu, length, pdu);
+	else
+		rlc_tm_rx_process_pdu((rlc_entity_tm_t *)pair->rx, pdu, length, pdu);
+	bench_loop_op(BENCH_OP_PROCESS, bench_cycles() - t);
+
+	/* TM PDU is the SDU itself and is not kept by Rx entity */
+	if(bench_cfg.type == RLC_ENTITY_TYPE_TM)
+	{
+		if(length < BENCH_LOOP_SDU_MIN)
+			bench_stat.n_corrupt ++;
+		else
+			bench_loop_latency(pdu, pdu[length - 1], length);
+		free(pdu);
+	}
+}
+
+/* copy PDU to the other side as by PHY, or lose it, or hold it for some TTIs */
+static void bench_loop_link(bench_pair_t *pair, u8 *data, u32 length)
+{
+	bench_held_t *held;
+	u8 *pdu;
+
+	if(bench_chance(bench_cfg.loss))
+	{
+		bench_stat.n_lost ++;
+		return;
+	}
+
+	pdu = malloc(length);
+	memcpy(pdu, data, length);
+
+	if(bench_chance(bench_cfg.reorder) && pair->n_held < BENCH_LOOP_HOLD_MAX)
+	{
+		held = &pair->held[pair->n_held++];
+		held->data = pdu;
+		held->length = length;
+		held->due = rlc_get_time() + 1 + bench_rand() % BENCH_LOOP_DELAY_MAX;
+		bench_stat.n_reordered ++;
+		return;
+	}
+
+	bench_loop_process(pair, pdu, length);
+}
+
+/* deliver held PDUs which are due, before PDUs of this TTI */
+static void bench_loop_release(bench_pair_t *pair, int all)
+{
+	u32 i, n = 0;
+
+	for(i=0; i<pair->n_held; i++)
+	{
+		if(all || (s32)(rlc_get_time() - pair->held[i].due) >= 0)
+			bench_loop_process(pair, pair->held[i].data, pair->held[i].length);
+		else
+			pair->held[n++] = pair->held[i];
+	}
+	pair->n_held = n;
+}
+
+static void bench_loop_enqueue(bench_pair_t *pair, u32 cap)
+{
+	u32 size, seq = bench_sdu_seq, now = rlc_get_time();
+	u8 *sdu;
+	u64 t;
+	int ret;
+
+	if(pair->n_queued >= cap)
+	{
+		bench_stat.n_blocked ++;
+		return;
+	}
+
+	size = bench_cfg.sdu_min + bench_rand() % (bench_cfg.sdu_max - bench_cfg.sdu_min + 1);
+	sdu = malloc(size);
+	memset(sdu, 0, size);
+	memcpy(sdu, &now, 4);
+	memcpy(sdu + 4, &seq, 4);
+	memcpy(sdu + 8, &size, 4);
+	sdu[size - 1] = (u8)seq;
+
+	t = bench_cycles();
+	if(bench_cfg.type == RLC_ENTITY_TYPE_UM)
+		ret = rlc_um_tx_sdu_enqueue(&((rlc_entity_um_t *)pair->tx)->umtx, sdu, size, pair, NULL);
+	else if(bench_cfg.type == RLC_ENTITY_TYPE_AM)
+		ret = rlc_am_tx_sdu_enqueue(&((rlc_entity_am_t *)pair->tx)->amtx, sdu, size, pair, NULL);
+	else
+		ret = rlc_tm_tx_sdu_enqueue((rlc_entity_tm_t *)pair->tx, sdu, size, pair, NULL);
+	bench_loop_op(BENCH_OP_ENQUEUE, bench_cycles() - t);
+
+	if(ret < 0)
+	{
+		free(sdu);
+		bench_stat.n_blocked ++;
+		return;
+	}
+
+	pair->n_queued ++;
+	bench_stat.n_offered ++;
+	bench_sdu_seq ++;
+}
+
+/* spend the grant of a TTI on PDUs of Tx entity */
+static void bench_loop_build(bench_pair_t *pair)
+{
+	static u8 buf[BENCH_LOOP_GRANT_MAX];
+	rlc_sdu_t *sdu;
+	u32 pdu_type = RLC_AM_FRESH_PDU, left = bench_cfg.grant;
+	u8 *pdu;
+	u64 t;
+	int len;
+
+	while(left >= BENCH_LOOP_PDU_MIN)
+	{
+		/* AM keeps fresh PDU for ReTx, so every PDU has its own buffer */
+		pdu = buf;
+		if(bench_cfg.type == RLC_ENTITY_TYPE_AM)
+			pdu = malloc(left);
+
+		t = bench_cycles();
+		if(bench_cfg.type == RLC_ENTITY_TYPE_UM)
+			len = rlc_um_tx_build_pdu(&((rlc_entity_um_t *)pair->tx)->umtx, pdu, left);
+		else if(bench_cfg.type == RLC_ENTITY_TYPE_AM)
+			len = rlc_am_tx_build_pdu(&((rlc_entity_am_t *)pair->tx)->amtx, pdu, left, pdu, &pdu_type);
+		else
+		{
+			len = rlc_tm_tx_build_pdu((rlc_entity_tm_t *)pair->tx, &sdu, left);
+			if(len > 0)
+			{
+				rlc_serialize_sdu(pdu, sdu, len);
+				rlc_sdu_free(sdu);
+			}
+		}
+		t = bench_cycles() - t;
+
+		if(len <= 0)
+		{
+			if(pdu != buf)
+				free(pdu);
+			break;
+		}
+
+		bench_loop_op(BENCH_OP_BUILD, t);
+		bench_stat.n_pdu ++;
+		bench_stat.pdu_bytes += len;
+		left -= len;
+
+		bench_loop_link(pair, pdu, len);
+		if(pdu != buf && pdu_type != RLC_AM_FRESH_PDU)
+			free(pdu);
+	}
+}
+
+/* STATUS PDU of AM Rx side, sent back to Tx side on the lossy link */
+static void bench_loop_status(bench_pair_t *pair)
+{
+	rlc_entity_am_t *tx = (rlc_entity_am_t *)pair->tx;
+	rlc_entity_am_t *rx = (rlc_entity_am_t *)pair->rx;
+	rlc_buffer_status_t bs;
+	u32 pdu_type;
+	u8 *pdu;
+	u64 t, t_process;
+	int len;
+
+	rlc_am_tx_get_buffer_status(&rx->amtx, &bs);
+	if(bs.status_bytes == 0)
+		return;
+
+	/* Rx side has no SDU, so the PDU is STATUS PDU */
+	pdu = malloc(bench_cfg.grant);
+	t = bench_cycles();
+	len = rlc_am_tx_build_pdu(&rx->amtx, pdu, bench_cfg.grant, pdu, &pdu_type);
+	t = bench_cycles() - t;
+	if(len <= 0)
+	{
+		free(pdu);
+		return;
+	}
+
+	if(bench_chance(bench_cfg.loss))
+	{
+		bench_stat.n_lost ++;
+		free(pdu);
+	}
+	else
+	{
+		t_process = bench_cycles();
+		rlc_am_rx_process_pdu(&tx->amrx, pdu, len, pdu);
+		t += bench_cycles() - t_process;
+	}
+	bench_loop_op(BENCH_OP_STATUS, t);
+}
+
+/* latency beyond histogram is printed as ">max" */
+static void bench_loop_percentile(char *str, u32 permille)
+{
+	u64 n = 0, rank = (bench_stat.n_deliv * permille + 999) / 1000;
+	u32 i;
+
+	for(i=0; i<BENCH_LOOP_LAT_MAX; i++)
+	{
+		n += bench_stat.lat_hist[i];
+		if(n >= rank)
+		{
+			sprintf(str, "%u", i);
+			return;
+		}
+	}
+	sprintf(str, "\">%u\"", BENCH_LOOP_LAT_MAX - 1);
+}
+
+static void bench_loop_json(u32 n_tti, u64 ns, u64 cycles)
+{
+	static const char *type_name[] = {"tm", "um", "am"};
+	double ns_per_cycle = cycles ? (double)ns / cycles : 0;
+	char p50[16], p90[16], p99[16], p999[16];
+	u32 op;
+
+	printf("  {\n");
+	printf("    \"mode\": \"%s\",\n", type_name[bench_cfg.type]);
+	printf("    \"sdu_size_min\": %u,\n", bench_cfg.sdu_min);
+	printf("    \"sdu_size_max\": %u,\n", bench_cfg.sdu_max);
+	printf("    \"grant\": %u,\n", bench_cfg.grant);
+	printf("    \"loss_pct\": %.2f,\n", bench_cfg.loss / 100.0);
+	printf("    \"reorder_pct\": %.2f,\n", bench_cfg.reorder / 100.0);
+	printf("    \"entities\": %u,\n", bench_cfg.n_ent);
+	printf("    \"sdus_per_tti\": %u,\n", bench_cfg.n_sdu_tti);
+	printf("    \"seed\": %u,\n", bench_cfg.seed);
+	printf("    \"ttis\": %u,\n", n_tti);
+	printf("    \"sdu_offered\": %llu,\n", (unsigned long long)bench_stat.n_offered);
+	printf("    \"sdu_blocked\": %llu,\n", (unsigned long long)bench_stat.n_blocked);
+	printf("    \"sdu_delivered\": %llu,\n", (unsigned long long)bench_stat.n_deliv);
+	printf("    \"sdu_corrupt\": %llu,\n", (unsigned long long)bench_stat.n_corrupt);
+	printf("    \"sdu_bytes\": %llu,\n", (unsigned long long)bench_stat.deliv_bytes);
+	printf("    \"pdu_built\": %llu,\n", (unsigned long long)bench_stat.n_pdu);
+	printf("    \"pdu_bytes\": %llu,\n", (unsigned long long)bench_stat.pdu_bytes);
+	printf("    \"pdu_lost\": %llu,\n", (unsigned long long)bench_stat.n_lost);
+	printf("    \"pdu_reordered\": %llu,\n", (unsigned long long)bench_stat.n_reordered);
+	printf("    \"wall_ns\": %llu,\n", (unsigned long long)ns);
+	printf("    \"pdu_per_s\": %.0f,\n", bench_stat.n_pdu * 1e9 / ns);
+	printf("    \"sdu_per_s\": %.0f,\n", bench_stat.n_deliv * 1e9 / ns);
+	printf("    \"cpu_mbps\": %.1f,\n", bench_stat.deliv_bytes * 8e3 / ns);
+	printf("    \"goodput_mbps\": %.3f,\n", bench_stat.deliv_bytes * 8e-3 / n_tti);
+	printf("    \"ops\": {\n");
+	for(op=0; op<BENCH_OP_MAX; op++)
+	{
+		u64 n = bench_stat.op_count[op];
+
+		printf("      \"%s\": {\"count\": %llu, \"cycles\": %.1f, \"ns\": %.1f}%s\n", bench_op_name[op],
+			(unsigned long long)n, n ? (double)bench_stat.op_cycles[op] / n : 0,
+			n ? bench_stat.op_cycles[op] * ns_per_cycle / n : 0, op == BENCH_OP_MAX - 1 ? "" : ",");
+	}
+	printf("    },\n");
+	bench_loop_percentile(p50, 500);
+	bench_loop_percentile(p90, 900);
+	bench_loop_percentile(p99, 990);
+	bench_loop_percentile(p999, 999);
+	printf("    \"latency_tti\": {\"p50\": %s, \"p90\": %s, \"p99\": %s, \"p999\": %s, \"max\": %u, "
+		"\"over\": %llu}\n", p50, p90, p99, p999, bench_stat.lat_max, (unsigned long long)bench_stat.lat_over);
+	printf("  }");
+}
+
+static int bench_loop(bench_loop_cfg_t *cfg)
+{
+	rlc_shard_t *shard;
+	rlc_registry_t *reg;
+	bench_pair_t *pairs;
+	u32 n = cfg->n_ent;
+	u32 tti, i, k, cell, n_tti;
+	u64 ns, cycles;
+	void *entity;
+
+	bench_cfg = *cfg;
+	memset(&bench_stat, 0, sizeof(bench_stat));
+	bench_seed = cfg->seed;
+	bench_sdu_seq = 0;
+
+	/* pools and registry of the shard are sized for 2n entities, RLC clock starts at 0 */
+	shard = rlc_shard_create(0, cfg->type == RLC_ENTITY_TYPE_TM ? 2*n : 0,
+			cfg->type == RLC_ENTITY_TYPE_UM ? 2*n : 0, cfg->type == RLC_ENTITY_TYPE_AM ? 2*n : 0, 0, 1, NULL);
+	pairs = calloc(n, sizeof(bench_pair_t));
+	if(shard == NULL || pairs == NULL)
+	{
+		free(pairs);
+		rlc_shard_destroy(shard);
+		return -1;
+	}
+	rlc_shard_enter(shard);
+	reg = shard->registry;
+
+	for(i=0; i<2*n; i++)
+	{
+		cell = i / n;
+		entity = rlc_registry_add(reg, cell, BENCH_LOOP_RNTI + i%n, BENCH_LOOP_LCID, cfg->type);
+		if(cfg->type == RLC_ENTITY_TYPE_UM)
+		{
+			rlc_um_init(entity, 10, 512, 20, bench_loop_free_buf, bench_loop_free_sdu);
+			rlc_um_set_deliv_func(entity, bench_loop_deliv_um);
+		}
+		else if(cfg->type == RLC_ENTITY_TYPE_AM)
+		{
+			rlc_am_init(entity, 20, 20, 10, 40, 32, 16, 8000, bench_loop_free_buf, bench_loop_free_sdu);
+			rlc_am_set_deliv_func(entity, bench_loop_deliv_am);
+		}
+		else
+			rlc_tm_init(entity, bench_loop_free_sdu);
+
+		if(cell == 0)
+			pairs[i%n].tx = entity;
+		else
+			pairs[i%n].rx = entity;
+	}
+
+	n_tti = cfg->n_tti + BENCH_LOOP_DRAIN;
+	ns = bench_ns();
+	cycles = bench_cycles();
+	for(tti=0; tti<n_tti; tti++)
+	{
+		for(i=0; i<n; i++)
+		{
+			bench_loop_release(&pairs[i], 0);
+			for(k=0; k<cfg->n_sdu_tti && tti<cfg->n_tti; k++)
+				bench_loop_enqueue(&pairs[i], BENCH_LOOP_SDU_QUEUED);
+			bench_loop_build(&pairs[i]);
+			if(cfg->type == RLC_ENTITY_TYPE_AM)
+				bench_loop_status(&pairs[i]);
+		}
+		rlc_timer_push(1);
+	}
+	cycles = bench_cycles() - cycles;
+	ns = bench_ns() - ns;
+
+	bench_loop_json(n_tti, ns, cycles);
+
+	/* entities are removed with the shard */
+	for(i=0; i<n; i++)
+		bench_loop_release(&pairs[i], 1);
+	rlc_shard_destroy(shard);
+	free(pairs);
+	return 0;
+}
+
+static void bench_usage()
+{
+	printf("rlc_bench [n_round] [sdu_size (1..2000)]\n");
+	printf("rlc_bench -m tm|um|am|all [-s sdu_size[-sdu_size_max] (%u..2000)] [-g grant (%u..%u)]\n"
+			"          [-l loss %%] [-r reorder %%] [-n entities (1..%u)] [-t ttis] [-k sdus per tti] [-S seed]\n",
+			BENCH_LOOP_SDU_MIN, BENCH_LOOP_PDU_MIN, BENCH_LOOP_GRANT_MAX, BENCH_LOOP_ENT_MAX);
+}
+
+/* loopback runs, one JSON object per mode */
+static int bench_loop_main(int argc, char *argv[])
+{
+	static const char *type_name[] = {"tm", "um", "am"};
+	bench_loop_cfg_t cfg;
+	int type = -1, opt, n_run = 0;
+
+	cfg.sdu_min = cfg.sdu_max = 300;
+	cfg.grant = 1000;
+	cfg.loss = 0;
+	cfg.reorder = 0;
+	cfg.n_ent = 8;
+	cfg.n_tti = 10000;
+	cfg.n_sdu_tti = 2;
+	cfg.seed = 1;
+
+	while((opt = getopt(argc, argv, "m:s:g:l:r:n:t:k:S:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'm':
+				for(type=RLC_ENTITY_TYPE_AM; type>=0; type--)
+				{
+					if(strcmp(optarg, type_name[type]) == 0)
+						break;
+				}
+				if(type < 0 && strcmp(optarg, "all"))
+				{
+					bench_usage();
+					return -1;
+				}
+				break;
+			case 's':
+				if(sscanf(optarg, "%u-%u", &cfg.sdu_min, &cfg.sdu_max) < 2)
+					cfg.sdu_max = cfg.sdu_min;
+				break;
+			case 'g':
+				cfg.grant = atoi(optarg);
+				break;
+			case 'l':
+				cfg.loss = (u32)(atof(optarg) * 100 + 0.5);
+				break;
+			case 'r':
+				cfg.reorder = (u32)(atof(optarg) * 100 + 0.5);
+				break;
+			case 'n':
+				cfg.n_ent = atoi(optarg);
+				break;
+			case 't':
+				cfg.n_tti = atoi(optarg);
+				break;
+			case 'k':
+				cfg.n_sdu_tti = atoi(optarg);
+				break;
+			case 'S':
+				cfg.seed = atoi(optarg);
+				break;
+			default:
+				bench_usage();
+				return -1;
+		}
+	}
+
+	if(cfg.sdu_min < BENCH_LOOP_SDU_MIN || cfg.sdu_min > cfg.sdu_max || cfg.sdu_max > 2000 
+		|| cfg.grant < BENCH_LOOP_PDU_MIN || cfg.grant > BENCH_LOOP_GRANT_MAX
+		|| cfg.loss > 10000 || cfg.reorder > 10000 
+		|| cfg.n_ent == 0 || cfg.n_ent > BENCH_LOOP_ENT_MAX || cfg.n_tti == 0)
+	{
+		bench_usage();
+		return -1;
+	}
+
+	if(type == RLC_ENTITY_TYPE_TM && cfg.sdu_max > cfg.grant)
+	{
+		fprintf(stderr, "TM can't segment SDU: sdu_size_max %u is larger than grant %u.\n", cfg.sdu_max, cfg.grant);
+		return -1;
+	}
+
+	printf("[\n");
+	for(cfg.type=RLC_ENTITY_TYPE_TM; cfg.type<=RLC_ENTITY_TYPE_AM; cfg.type++)
+	{
+		if(type >= 0 && cfg.type != type)
+			continue;
+
+		/* TM can't segment SDU, skipped silently by -m all only */
+		if(cfg.type == RLC_ENTITY_TYPE_TM && cfg.sdu_max > cfg.grant)
+			continue;
+
+		if(n_run++)
+			printf(",\n");
+		if(bench_loop(&cfg))
+			return -1;
+	}
+	printf("\n]\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	u32 n_round = 1000;
+	u32 sdu_size = 40;
+
+	/* log errors only, on stderr in loopback mode to keep JSON on stdout clean */
+	zlog_default = openzlog((argc > 1 && argv[1][0] == '-') ? ZLOG_STDERR : ZLOG_STDOUT);
+	zlog_default->maskpri = LOG_ERR;
+
+	if(argc > 1 && argv[1][0] == '-')
+	{
+		rlc_init();
+		return bench_loop_main(argc, argv);
+	}
+
+	if(argc > 1)
+		n_round = atoi(argv[1]);
+	if(argc > 2)
+		sdu_size = atoi(argv[2]);
+	if(n_round == 0 || sdu_size == 0 || sdu_size > 2000)
+	{
+		bench_usage();
+		return -1;
+	}
+
+	rlc_init();
+
+	if(bench_build_um_pdus(sdu_size))
+	{
+		printf("failed to build UM PDUs\n");
+		return -1;
+	}
+
+	printf("%-32s %10s %13s %17s\n", "case", "count", "time/op", "cycles/op");
+	bench_um_pdu_alloc();
+	bench_parse_li(sdu_size);
+	bench_um_rx("UM Rx, window 512", 512, n_round);
+	bench_um_rx("UM Rx, window 0", 0, n_round);
+	bench_um_tx(sdu_size, n_round);
+	bench_um_tx_ingress(sdu_size, n_round);
+	bench_registry_find();
+
+	return 0;
+}
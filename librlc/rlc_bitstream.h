@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2011-2012 Phuuix Xiong <phuuix@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file
+ * Bit-stream writer and reader for RLC control PDU (head file)
+ *   Fields are packed MSB first as on the air, a 64-bit accumulator is flushed
+ *   or refilled 32 bits at a time. Bytes are always accessed one by one, so
+ *   it works on any host endian and needs no alignment.
+ */
+
+#ifndef _RLC_BITSTREAM_H_
+#define _RLC_BITSTREAM_H_
+
+#include "stdtypes.h"
+
+typedef struct rlc_bitwriter
+{
+	u8 *start;
+	u8 *ptr;
+	u64 acc;				/* pending bits in low n_bits */
+	u32 n_bits;				/* always < 32 between calls */
+}rlc_bitwriter_t;
+
+typedef struct rlc_bitreader
+{
+	const u8 *ptr;
+	const u8 *end;
+	u64 acc;				/* unread bits in low n_bits */
+	u32 n_bits;
+	u32 overrun;			/* set if read beyond end */
+}rlc_bitreader_t;
+
+static inline void rlc_bw_init(rlc_bitwriter_t *bw, u8 *buf_ptr)
+{
+	bw->start = buf_ptr;
+	bw->ptr = buf_ptr;
+	bw->acc = 0;
+	bw->n_bits = 0;
+}
+
+/* append the low n bits of value, n <= 32 */
+static inline void rlc_bw_put(rlc_bitwriter_t *bw, u32 value, u32 n)
+{
+	u32 word;
+
+	bw->acc = (bw->acc << n) | (value & (((u64)1 << n) - 1));
+	bw->n_bits += n;
+	if(bw->n_bits >= 32)
+	{
+		bw->n_bits -= 32;
+		word = (u32)(bw->acc >> bw->n_bits);
+		bw->ptr[0] = (u8)(word >> 24);
+		bw->ptr[1] = (u8)(word >> 16);
+		bw->ptr[2] = (u8)(word >> 8);
+		bw->ptr[3] = (u8)word;
+		bw->ptr += 4;
+	}
+}
+
+/* write out pending bits with zero padding, return number of bytes written */
+static inline u32 rlc_bw_flush(rlc_bitwriter_t *bw)
+{
+	while(bw->n_bits >= 8)
+	{
+		bw->n_bits -= 8;
+		*bw->ptr++ = (u8)(bw->acc >> bw->n_bits);
+	}
+
+	if(bw->n_bits)
+	{
+		*bw->ptr++ = (u8)(bw->acc << (8 - bw->n_bits));
+		bw->n_bits = 0;
+	}
+
+	return bw->ptr - bw->start;
+}
+
+static inline void rlc_br_init(rlc_bitreader_t *br, const u8 *buf_ptr, u32 buf_len)
+{
+	br->ptr = buf_ptr;
+	br->end = buf_ptr + buf_len;
+	br->acc = 0;
+	br->n_bits = 0;
+	br->overrun = 0;
+}
+
+/* read next n bits, n <= 32 */
+static inline u32 rlc_br_get(rlc_bitreader_t *br, u32 n)
+{
+	if(br->n_bits < n)
+	{
+		if(br->end - br->ptr >= 4)
+		{
+			br->acc = (br->acc << 32) | ((u32)br->ptr[0] << 24) | ((u32)br->ptr[1] << 16) |
+				((u32)br->ptr[2] << 8) | br->ptr[3];
+			br->ptr += 4;
+			br->n_bits += 32;
+		}
+		else
+		{
+			while(br->n_bits < n)
+			{
+				if(br->ptr < br->end)
+					br->acc = (br->acc << 8) | *br->ptr++;
+				else
+				{
+					br->acc <<= 8;
+					br->overrun = 1;
+				}
+				br->n_bits += 8;
+			}
+		}
+	}
+
+	br->n_bits -= n;
+	return (u32)((br->acc >> br->n_bits) & (((u64)1 << n) - 1));
+}
+
+#endif /* _RLC_BITSTREAM_H_ */
@@ -32,36 +32,43 @@
 #include "ptimer.h"
 #include "fastalloc.h"
 
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
 /* some macros for memory allocation, change them to fulfill your requirement */
 #define RLC_AM_ENTITY_MAX 10
 #define RLC_UM_ENTITY_MAX 10
 
-#define RLC_MEM_SDU_MAX (RLC_UM_ENTITY_MAX+RLC_AM_ENTITY_MAX)*1024
-#define RLC_MEM_UM_PDU_MAX RLC_UM_ENTITY_MAX*1024
-#define RLC_MEM_AM_PDU_SEG_MAX RLC_AM_ENTITY_MAX*128
-#define RLC_MEM_AM_PDU_RX_MAX RLC_AM_ENTITY_MAX*1024
-#define RLC_MEM_AM_PDU_TX_MAX RLC_AM_ENTITY_MAX*1024
+/* pool elements per entity, a shard sizes its pools by its max entities */
+#define RLC_MEM_SDU_PER_ENTITY 1024
+#define RLC_MEM_UM_PDU_PER_ENTITY 1024
+#define RLC_MEM_AM_PDU_SEG_PER_ENTITY 128
+#define RLC_MEM_AM_PDU_RX_PER_ENTITY 1024
+#define RLC_MEM_AM_PDU_TX_PER_ENTITY 1024
+
+/* max entities of a shard, or the SDU pool exceeds 4GB */
+#define RLC_SHARD_ENTITY_MAX 2048
 
+/* pool of n entities, at least one so that the pool exists */
+#define RLC_MEM_NUM(n, per_entity) (((n) ? (n) : 1) * (per_entity))
 
-fastalloc_t *g_mem_sdu_base;
-fastalloc_t *g_mem_um_pdu_base;
-fastalloc_t *g_mem_am_pdu_seg_base;
-fastalloc_t *g_mem_am_pdu_rx_base;
-fastalloc_t *g_mem_am_pdu_tx_base;
 
+/* shard of threads which never call rlc_shard_enter() */
+static rlc_shard_t rlc_shard_default;
+__thread rlc_shard_t *rlc_shard_cur = &rlc_shard_default;
 
 /*************** Timer APIS: a wrapper of ptimer ********************/
-static ptimer_table_t rlc_timerbase;
 #define RLC_TIMER_NSLOT 2048
 
 void rlc_timer_start(ptimer_t *timer)
 {
-	ptimer_start(&rlc_timerbase, timer, timer->duration);
+	ptimer_start(&rlc_shard_cur->timerbase, timer, timer->duration);
 }
 
 void rlc_timer_stop(ptimer_t *timer)
 {
-	ptimer_cancel(&rlc_timerbase, timer);
+	ptimer_cancel(&rlc_shard_cur->timerbase, timer);
 }
 
 int rlc_timer_is_running(ptimer_t *timer)
@@ -71,7 +78,112 @@ int rlc_timer_is_running(ptimer_t *timer)
 
 void rlc_timer_push(u32 time)
 {
-	ptimer_consume_time(&rlc_timerbase, time);
+	rlc_shard_cur->clock += time;
+	ptimer_consume_time(&rlc_shard_cur->timerbase, time);
+}
+
+u32 rlc_get_time()
+{
+	return rlc_shard_cur->clock;
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_init                                                       */
+/***********************************************************************************/
+/* Description : - Init timer wheel and memory pools of a shard                    */
+/*                 Pools are sized for max_xx entities, TM SDUs come from the SDU  */
+/*                 pool as well                                                    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   shard              | o  | shard                                               */
+/*   id                 | i  | shard id                                            */
+/*   max_tm             | i  | max number of TM entities                           */
+/*   max_um             | i  | max number of UM entities                           */
+/*   max_am             | i  | max number of AM entities                           */
+/*   Return             |    | 0 is success, -1 if too many entities or out of     */
+/*                      |    | memory                                              */
+/***********************************************************************************/
+int rlc_shard_init(rlc_shard_t *shard, u32 id, u32 max_tm, u32 max_um, u32 max_am)
+{
+	memset(shard, 0, sizeof(rlc_shard_t));
+	shard->id = id;
+
+	if(max_tm > RLC_SHARD_ENTITY_MAX || max_um > RLC_SHARD_ENTITY_MAX || max_am > RLC_SHARD_ENTITY_MAX ||
+		max_tm + max_um + max_am > RLC_SHARD_ENTITY_MAX)
+	{
+		ZLOG_ERR("too many entities for pools of shard %u: max_tm=%u max_um=%u max_am=%u, at most %u.\n", 
+			id, max_tm, max_um, max_am, RLC_SHARD_ENTITY_MAX);
+		return -1;
+	}
+
+	/* init timer */
+	if(ptimer_init(&shard->timerbase, RLC_TIMER_NSLOT))
+		return -1;
+
+	/* init memory pool */
+	shard->mem_sdu_base = fastalloc_create(sizeof(rlc_sdu_t), 
+		RLC_MEM_NUM(max_tm+max_um+max_am, RLC_MEM_SDU_PER_ENTITY), 0, 1000);
+	shard->mem_um_pdu_base = fastalloc_create(sizeof(rlc_um_pdu_t), 
+		RLC_MEM_NUM(max_um, RLC_MEM_UM_PDU_PER_ENTITY), 0, 1000);
+	shard->mem_am_pdu_seg_base = fastalloc_create(sizeof(rlc_am_pdu_segment_t), 
+		RLC_MEM_NUM(max_am, RLC_MEM_AM_PDU_SEG_PER_ENTITY), 0, 1000);
+	shard->mem_am_pdu_rx_base = fastalloc_create(sizeof(rlc_am_rx_pdu_ctrl_t), 
+		RLC_MEM_NUM(max_am, RLC_MEM_AM_PDU_RX_PER_ENTITY), 0, 1000);
+	shard->mem_am_pdu_tx_base = fastalloc_create(sizeof(rlc_am_tx_pdu_ctrl_t), 
+		RLC_MEM_NUM(max_am, RLC_MEM_AM_PDU_TX_PER_ENTITY), 0, 1000);
+	if(shard->mem_sdu_base == NULL || shard->mem_um_pdu_base == NULL || shard->mem_am_pdu_seg_base == NULL ||
+		shard->mem_am_pdu_rx_base == NULL || shard->mem_am_pdu_tx_base == NULL)
+	{
+		ZLOG_ERR("out of memory for pools of shard %u.\n", id);
+		rlc_shard_deinit(shard);
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_deinit                                                     */
+/***********************************************************************************/
+/* Description : - Free timer wheel, memory pools and window blocks of a shard     */
+/*                 Entities of the shard must be removed before                    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   shard              | i  | shard                                               */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_shard_deinit(rlc_shard_t *shard)
+{
+	while(shard->n_win_pool)
+		free(shard->win_pool[--shard->n_win_pool]);
+	fastalloc_destroy(shard->mem_sdu_base);
+	fastalloc_destroy(shard->mem_um_pdu_base);
+	fastalloc_destroy(shard->mem_am_pdu_seg_base);
+	fastalloc_destroy(shard->mem_am_pdu_rx_base);
+	fastalloc_destroy(shard->mem_am_pdu_tx_base);
+	free(shard->timerbase.table);
+	shard->timerbase.table = NULL;
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_enter                                                      */
+/***********************************************************************************/
+/* Description : - Bind calling thread to a shard, NULL for the default shard      */
+/*                 Timers and memory pools of the shard are used from now on       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   shard              | i  | shard                                               */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_shard_enter(rlc_shard_t *shard)
+{
+	rlc_shard_cur = shard ? shard : &rlc_shard_default;
 }
 
 /***********************************************************************************/
@@ -86,20 +198,11 @@ void rlc_timer_push(u32 time)
 /***********************************************************************************/
 void rlc_init()
 {
-	/* init timer */
-	ptimer_init(&rlc_timerbase, RLC_TIMER_NSLOT);
+	int ret;
 
-	/* init memory pool */
-	g_mem_sdu_base = fastalloc_create(sizeof(rlc_sdu_t), RLC_MEM_SDU_MAX, 0, 1000);
-	assert(g_mem_sdu_base);
-	g_mem_um_pdu_base = fastalloc_create(sizeof(rlc_um_pdu_t), RLC_MEM_UM_PDU_MAX, 0, 1000);
-	assert(g_mem_sdu_base);
-	g_mem_am_pdu_seg_base = fastalloc_create(sizeof(rlc_am_pdu_segment_t), RLC_MEM_AM_PDU_SEG_MAX, 0, 1000);
-	assert(g_mem_sdu_base);
-	g_mem_am_pdu_rx_base = fastalloc_create(sizeof(rlc_am_rx_pdu_ctrl_t), RLC_MEM_AM_PDU_RX_MAX, 0, 1000);
-	assert(g_mem_sdu_base);
-	g_mem_am_pdu_tx_base = fastalloc_create(sizeof(rlc_am_tx_pdu_ctrl_t), RLC_MEM_AM_PDU_TX_MAX, 0, 1000);
-	assert(g_mem_sdu_base);
+	/* timer and memory pools of threads not bound to any shard, TM SDUs share the SDU pool */
+	ret = rlc_shard_init(&rlc_shard_default, 0, 0, RLC_UM_ENTITY_MAX, RLC_AM_ENTITY_MAX);
+	assert(ret == 0);
 }
 
 
@@ -120,12 +223,14 @@ rlc_sdu_t *rlc_sdu_new()
 {
 	rlc_sdu_t *sdu;
 
-	sdu = (rlc_sdu_t *)FASTALLOC(g_mem_sdu_base);
+	sdu = (rlc_sdu_t *)FASTALLOC(rlc_shard_cur->mem_sdu_base);
 	if(sdu)
 	{
 		sdu->size = 0;
 		sdu->offset = 0;
 		sdu->n_segment = 0;
+		sdu->handle_id = 0;
+		sdu->enqueue_time = rlc_shard_cur->clock;
 	}
 	else
 		ZLOG_ERR("out of memory to new SDU control.\n");
@@ -138,6 +243,8 @@ rlc_sdu_t *rlc_sdu_new()
 /***********************************************************************************/
 /* Description : - free RLC SDU control info and its segmentations                 */
 /*               - Notice: will be optimized                                       */
+/*               - SDU control goes back to pool of the calling thread's shard, so */
+/*                 SDUs delivered to Upper must be freed on the shard thread       */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
@@ -156,8 +263,71 @@ void rlc_sdu_free(rlc_sdu_t *sdu)
 			sdu->segment[i].free(sdu->segment[i].data, sdu->segment[i].cookie);
 	}
 	
-	/* free sdu control info */
-	FASTFREE(g_mem_sdu_base, sdu);
+	/* free sdu control info: handle is invalid from now */
+	sdu->handle_id = 0;
+	FASTFREE(rlc_shard_cur->mem_sdu_base, sdu);
+}
+
+/***********************************************************************************/
+/* Function : rlc_sdu_free_bulk                                                    */
+/***********************************************************************************/
+/* Description : - free n RLC SDUs, eg. SDUs got by deliv_sdu_batch()              */
+/*               - SDU controls are returned to pool in one call                   */
+/*               - Must be called on the shard thread, as rlc_sdu_free()           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sdus               | i  | pointers to RLC SDU Control                         */
+/*   n                  | i  | number of SDUs                                      */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_sdu_free_bulk(rlc_sdu_t *sdus[], u32 n)
+{
+	u32 i;
+	int j;
+	
+	for(i=0; i<n; i++)
+	{
+		for(j=0; j<sdus[i]->n_segment; j++)
+		{
+			if(sdus[i]->segment[j].free)
+				sdus[i]->segment[j].free(sdus[i]->segment[j].data, sdus[i]->segment[j].cookie);
+		}
+		sdus[i]->handle_id = 0;
+	}
+	
+	FASTFREE_BULK(rlc_shard_cur->mem_sdu_base, (void **)sdus, n);
+}
+
+/***********************************************************************************/
+/* Function : rlc_sdu_dequeue_intact                                               */
+/***********************************************************************************/
+/* Description : - remove intact SDUs from head of assembly queue                  */
+/*               - stop at the first SDU not intact                                */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sdu_assembly_q     | io | assemblied RLC SDU queue                            */
+/*   sdus               | o  | removed SDUs                                        */
+/*   max                | i  | max number of SDUs to remove                        */
+/*   Return             |    | number of SDUs removed                              */
+/***********************************************************************************/
+u32 rlc_sdu_dequeue_intact(dllist_node_t *sdu_assembly_q, rlc_sdu_t *sdus[], u32 max)
+{
+	rlc_sdu_t *sdu;
+	u32 n = 0;
+	
+	sdu = (rlc_sdu_t *)sdu_assembly_q->next;
+	while(n < max && (dllist_node_t *)sdu != sdu_assembly_q && sdu->intact)
+	{
+		dllist_remove(sdu_assembly_q, (dllist_node_t *)sdu);
+		sdus[n++] = sdu;
+		sdu = (rlc_sdu_t *)sdu_assembly_q->next;
+	}
+	
+	return n;
 }
 
 /***********************************************************************************/
@@ -195,25 +365,25 @@ int rlc_dump_mem_counter()
 {
 	int errcnt = 0;
 	
-	ZLOG_INFO("n_alloc_amrx_pdu=%u\n", g_mem_am_pdu_rx_base->alloc_cnt);
-	ZLOG_INFO("n_free_amrx_pdu=%u\n", g_mem_am_pdu_rx_base->free_cnt);
-	errcnt += (g_mem_am_pdu_rx_base->alloc_cnt != g_mem_am_pdu_rx_base->free_cnt);
+	ZLOG_INFO("n_alloc_amrx_pdu=%u\n", rlc_shard_cur->mem_am_pdu_rx_base->alloc_cnt);
+	ZLOG_INFO("n_free_amrx_pdu=%u\n", rlc_shard_cur->mem_am_pdu_rx_base->free_cnt);
+	errcnt += (rlc_shard_cur->mem_am_pdu_rx_base->alloc_cnt != rlc_shard_cur->mem_am_pdu_rx_base->free_cnt);
 	
-	ZLOG_INFO("n_alloc_amtx_pdu=%u\n", g_mem_am_pdu_tx_base->alloc_cnt);
-	ZLOG_INFO("n_free_amtx_pdu=%u\n", g_mem_am_pdu_tx_base->free_cnt);
-	errcnt += (g_mem_am_pdu_tx_base->alloc_cnt != g_mem_am_pdu_tx_base->free_cnt);
+	ZLOG_INFO("n_alloc_amtx_pdu=%u\n", rlc_shard_cur->mem_am_pdu_tx_base->alloc_cnt);
+	ZLOG_INFO("n_free_amtx_pdu=%u\n", rlc_shard_cur->mem_am_pdu_tx_base->free_cnt);
+	errcnt += (rlc_shard_cur->mem_am_pdu_tx_base->alloc_cnt != rlc_shard_cur->mem_am_pdu_tx_base->free_cnt);
 	
-	ZLOG_INFO("n_alloc_am_pdu_seg=%u\n", g_mem_am_pdu_seg_base->alloc_cnt);
-	ZLOG_INFO("n_free_am_pdu_seg=%u\n", g_mem_am_pdu_seg_base->free_cnt);
-	errcnt += (g_mem_am_pdu_seg_base->alloc_cnt != g_mem_am_pdu_seg_base->free_cnt);
+	ZLOG_INFO("n_alloc_am_pdu_seg=%u\n", rlc_shard_cur->mem_am_pdu_seg_base->alloc_cnt);
+	ZLOG_INFO("n_free_am_pdu_seg=%u\n", rlc_shard_cur->mem_am_pdu_seg_base->free_cnt);
+	errcnt += (rlc_shard_cur->mem_am_pdu_seg_base->alloc_cnt != rlc_shard_cur->mem_am_pdu_seg_base->free_cnt);
 	
-	ZLOG_INFO("n_alloc_sdu=%u\n", g_mem_sdu_base->alloc_cnt);
-	ZLOG_INFO("n_free_sdu=%u\n", g_mem_sdu_base->free_cnt);
-	errcnt += (g_mem_sdu_base->alloc_cnt != g_mem_sdu_base->free_cnt);
+	ZLOG_INFO("n_alloc_sdu=%u\n", rlc_shard_cur->mem_sdu_base->alloc_cnt);
+	ZLOG_INFO("n_free_sdu=%u\n", rlc_shard_cur->mem_sdu_base->free_cnt);
+	errcnt += (rlc_shard_cur->mem_sdu_base->alloc_cnt != rlc_shard_cur->mem_sdu_base->free_cnt);
 	
-	ZLOG_INFO("n_alloc_um_pdu=%u\n", g_mem_um_pdu_base->alloc_cnt);
-	ZLOG_INFO("n_free_um_pdu=%u\n", g_mem_um_pdu_base->free_cnt);
-	errcnt += (g_mem_um_pdu_base->alloc_cnt != g_mem_um_pdu_base->free_cnt);
+	ZLOG_INFO("n_alloc_um_pdu=%u\n", rlc_shard_cur->mem_um_pdu_base->alloc_cnt);
+	ZLOG_INFO("n_free_um_pdu=%u\n", rlc_shard_cur->mem_um_pdu_base->free_cnt);
+	errcnt += (rlc_shard_cur->mem_um_pdu_base->alloc_cnt != rlc_shard_cur->mem_um_pdu_base->free_cnt);
 
 	return errcnt;
 }
@@ -241,291 +411,1052 @@ void rlc_serialize_sdu(u8 *data_ptr, rlc_sdu_t *sdu, u32 length)
 }
 
 /***********************************************************************************/
-/* Function : rlc_li_len                                                           */
+/* Function : rlc_sdu_set_handle                                                   */
 /***********************************************************************************/
-/* Description : - calculate the length of LI in RLC PDU                           */
+/* Description : - Assign a new handle id to SDU and fill the handle               */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   n_li               | i  | The number of LI                                    */
-/*   Return             |    | Length of LI (align to bytes)                       */
+/*   sdu                | i  | SDU control info pointer                            */
+/*   handle             | o  | SDU handle, may be NULL                             */
+/*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-inline u32 rlc_li_len(u32 n_li)
+void rlc_sdu_set_handle(rlc_sdu_t *sdu, rlc_sdu_handle_t *handle)
 {
-	u32 li_len;
-
-	assert(n_li);
+	if(handle == NULL)
+		return;
 	
-	li_len = ((n_li-1)>>1)*3 + (((n_li&0x01) == 0)<<1);
-
-	return li_len;
+	rlc_shard_cur->sdu_handle_id ++;
+	if(rlc_shard_cur->sdu_handle_id == 0)
+		rlc_shard_cur->sdu_handle_id = 1;
+	
+	sdu->handle_id = rlc_shard_cur->sdu_handle_id;
+	handle->sdu = sdu;
+	handle->id = rlc_shard_cur->sdu_handle_id;
 }
 
 /***********************************************************************************/
-/* Function : rlc_parse_li                                                         */
+/* Function : rlc_sdu_discard                                                      */
 /***********************************************************************************/
-/* Description : - Paser LIs in RLC PDU header                                     */
-/*                                                                                 */
+/* Description : - Remove a SDU from Tx queue by handle and free it in O(1)        */
+/*               - Only SDU that no segment has been mapped to PDU is discarded    */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   e                  | i  | E in RLC header                                     */
-/*   li_ptr             | i  | point to the first LI or first SDU                  */
-/*   size               | i  | including size of all LIs and size of all SDUs      */
-/*   data_ptr           | o  | poniter to first SDU                                */
-/*   li_s               | o  | to store parsed LIs                                 */
-/*   Return             |    | number of LIs                                       */
+/*   sdu_tx_q           | i  | SDU Tx queue which SDU was enqueued to              */
+/*   handle             | i  | SDU handle                                          */
+/*   Return             |    | size of discarded SDU, -1 if SDU can't be discarded */
 /***********************************************************************************/
-u32 rlc_parse_li(u32 e, rlc_li_t *li_ptr, u32 size, u8 **data_ptr, u32 *li_s)
+int rlc_sdu_discard(dllist_node_t *sdu_tx_q, rlc_sdu_handle_t *handle)
 {
-	u32 n_li = 0;
-	u32 clen = 0;
-
-	assert(size > 0);
+	rlc_sdu_t *sdu;
+	int size;
 	
-	if(e == 0)
-	{
-		li_s[0] = size;
-		*data_ptr = (u8 *)li_ptr;
- 		return 1;
-	}
+	if(handle == NULL || handle->sdu == NULL || handle->id == 0)
+		return -1;
 	
-	/* parse LI in case of number of LI > 1 */
-	while((n_li < RLC_LI_NUM_MAX-1) && (clen < size))
-	{
-		if(li_ptr->li1 == 0)
-			return -1;
-			
-		li_s[n_li++] = li_ptr->li1;
-		clen += li_ptr->li1 + 2;
-		
-		if(li_ptr->e1)
-		{
-			if(li_ptr->li2 == 0)
-				return -1;
-				
-			li_s[n_li++] = li_ptr->li2;
-			clen += li_ptr->li2 + 1;
-			if(li_ptr->e2)
-			{
-				li_ptr ++;
-			}
-			else{
-				*data_ptr = (u8 *)li_ptr + 3;
-				break;
-			}
-		}
-		else{
-			*data_ptr = (u8 *)li_ptr + 2;
-			break;
-		}
-	}
+	sdu = handle->sdu;
 	
-	if(clen < size)
-	{
-		/* the last LI may not exist */
-		li_s[n_li++] = size - clen;
-		clen = size;
-	}
+	/* SDU control is reused or SDU has left Tx queue */
+	if(sdu->handle_id != handle->id || sdu->node.next == NULL)
+		return -1;
 	
-	/* check PDU size with clen */
-	if(clen != size)
-		return -2;
-
-	return n_li;
+	/* any segment of SDU has been submitted to lower layer */
+	if(sdu->offset != 0)
+		return -1;
+	
+	size = sdu->size;
+	dllist_remove(sdu_tx_q, (dllist_node_t *)sdu);
+	rlc_sdu_free(sdu);
+	handle->sdu = NULL;
+	
+	return size;
 }
 
 /***********************************************************************************/
-/* Function : rlc_build_li_from_sdu                                                */
+/* Function : rlc_sdu_enqueue_batch                                                */
 /***********************************************************************************/
-/* Description : - Given the PDU size and SDU queue, build LI array                */
+/* Description : - Enqueue a burst of SDUs (one segment each) to Tx queue          */
+/*               - SDU controls are allocated in bulk and linked by one splice     */
+/*                 for every RLC_SDU_BATCH_MAX SDUs                                */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   pdu_size           | i  | The allowed size of PDU                             */
-/*   head_len           | i  | the length the PDU head                             */
-/*   sdu_q              | i  | the SDU queue                                       */
-/*   li_s               | o  | LI array                                            */
-/*   Return             |    | The number of LI                                    */
+/*   sdu_tx_q           | i  | SDU Tx queue                                        */
+/*   free_sdu           | i  | function to free SDU buffer                         */
+/*   bufs               | i  | SDU buffer pointers                                 */
+/*   sizes              | i  | Size of SDUs                                        */
+/*   cookies            | i  | parameters of free function, may be NULL            */
+/*   enqueue_times      | i  | RLC clock when SDUs arrived, NULL for now           */
+/*   n                  | i  | number of SDU                                       */
+/*   handles            | o  | SDU handles, may be NULL                            */
+/*   total_size         | o  | total size of enqueued SDUs                         */
+/*   Return             |    | number of enqueued SDU, -1 if parameter is invalid  */
 /***********************************************************************************/
-u32 rlc_build_li_from_sdu(u32 pdu_size, u32 head_len, dllist_node_t *sdu_q, u32 *li_s)
+int rlc_sdu_enqueue_batch(dllist_node_t *sdu_tx_q, void (*free_sdu)(void *, void *), 
+		u8 *bufs[], u32 sizes[], void *cookies[], u32 enqueue_times[], u32 n, rlc_sdu_handle_t handles[], 
+		u32 *total_size)
 {
-	s32 remain_pdu_size;
-	u32 n_li = 0;
-	u32 sdu_size, lisize = 0;
+	rlc_sdu_t *sdus[RLC_SDU_BATCH_MAX];
 	rlc_sdu_t *sdu;
-
-	sdu = (rlc_sdu_t *)(DLLIST_HEAD(sdu_q));
-	assert(!DLLIST_IS_HEAD(sdu_q,sdu));
+	u32 i, idx, n_alloc, n_batch, n_done = 0;
+	u32 size = 0;
 	
-	remain_pdu_size = pdu_size - head_len;
-	if(remain_pdu_size < 1)		//at leaset 1 byte data
+	*total_size = 0;
+	if(bufs == NULL || sizes == NULL)
+		return -1;
+	
+	for(i=0; i<n; i++)
 	{
-		ZLOG_WARN("pdu_size is two small.\n");
-		return 0;
+		if(bufs[i] == NULL || sizes[i] == 0)
+			return -1;
 	}
 	
-	do{
-		/* substract LI length for current RLC SDU */
-		if(n_li > 0)
+	while(n_done < n)
+	{
+		n_batch = RLC_MIN(n - n_done, RLC_SDU_BATCH_MAX);
+		n_alloc = FASTALLOC_BULK(rlc_shard_cur->mem_sdu_base, (void **)sdus, n_batch);
+		if(n_alloc != n_batch)
 		{
-			if(n_li & 0x01)
-				lisize = 2;
-			else
-				lisize = 1;
-				
-			if(remain_pdu_size <= lisize)
-			{
-				break;	//can't contain LI
-			}
-			else
-				remain_pdu_size -= lisize;
+			while(n_alloc)
+				FASTFREE(rlc_shard_cur->mem_sdu_base, sdus[--n_alloc]);
+			ZLOG_ERR("out of memory to new %u SDU controls.\n", n_batch);
+			break;
 		}
 		
-		sdu_size = sdu->size - sdu->offset;
-		assert(sdu_size > 0);
-		if(sdu_size <= remain_pdu_size)
-		{
-			if(sdu_size <= RLC_LI_VALUE_MAX)
-			{
-				li_s[n_li++] = sdu_size;
-				remain_pdu_size -= sdu_size;
-			}
-			else	//usually won't go into else branch 
-			{
-				if(n_li == 0)
-				{
-					//if this is the first SDU, it's size can be large than 2047
-					//but on other SDUs can be in current PDU
-					li_s[n_li++] = sdu_size;
-					remain_pdu_size -= sdu_size;
-				}
-				else
-					remain_pdu_size += lisize;	//add back lisize
-				break;
-			}
-		}
-		else
+		for(i=0; i<n_batch; i++)
 		{
-			if(remain_pdu_size <= RLC_LI_VALUE_MAX)
-			{
-				li_s[n_li++] = remain_pdu_size;
-				remain_pdu_size = 0;
-			}
-			else	//usually won't go into else branch 
-			{
-				if(n_li == 0)
-				{
-					li_s[n_li++] = remain_pdu_size;
-					remain_pdu_size = 0;
-				}
-				else
-					remain_pdu_size += lisize;	//add back lisize
-				break;
-			}
+			sdu = sdus[i];
+			idx = n_done + i;
+			
+			sdu->node.prev = (i > 0) ? (dllist_node_t *)sdus[i-1] : NULL;
+			sdu->node.next = (i < n_batch-1) ? (dllist_node_t *)sdus[i+1] : NULL;
+			sdu->segment[0].cookie = cookies ? cookies[idx] : NULL;
+			sdu->segment[0].free = free_sdu;
+			sdu->segment[0].data = bufs[idx];
+			sdu->segment[0].length = sizes[idx];
+			sdu->size = sizes[idx];
+			sdu->offset = 0;
+			sdu->n_segment = 1;
+			sdu->intact = 1;
+			sdu->handle_id = 0;
+			sdu->enqueue_time = enqueue_times ? enqueue_times[idx] : rlc_shard_cur->clock;
+			if(handles)
+				rlc_sdu_set_handle(sdu, &handles[idx]);
+			size += sizes[idx];
 		}
-
-		/* n_li should not large than RLC_LI_NUM_MAX */
-		if(n_li == RLC_LI_NUM_MAX)
-			break;
 		
-		sdu = (rlc_sdu_t *)(sdu->node.next);
-	}while(remain_pdu_size > 0 && !DLLIST_IS_HEAD(sdu_q, sdu));
+		dllist_append_chain(sdu_tx_q, (dllist_node_t *)sdus[0], (dllist_node_t *)sdus[n_batch-1]);
+		n_done += n_batch;
+	}
+	
+	*total_size = size;
+	return n_done;
+}
 
-	return n_li;
+/***********************************************************************************/
+/* Function : rlc_sdu_ingress_create                                               */
+/***********************************************************************************/
+/* Description : - Create SDU ingress ring: PDCP thread posts SDUs to it and the   */
+/*                 MAC thread moves them to Tx queue when building PDU             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   n                  | i  | max number of SDU in ring, rounded up to power of 2 */
+/*   Return             |    | ring, NULL if out of memory                         */
+/***********************************************************************************/
+rlc_ring_t *rlc_sdu_ingress_create(u32 n)
+{
+	rlc_ring_t *ring;
+	
+	ring = rlc_ring_create(sizeof(rlc_sdu_desc_t), n);
+	if(ring == NULL)
+		ZLOG_ERR("out of memory to create SDU ingress ring: n=%u.\n", n);
+	
+	return ring;
 }
 
 /***********************************************************************************/
-/* Function : rlc_encode_li                                                        */
+/* Function : rlc_sdu_ingress_destroy                                              */
 /***********************************************************************************/
-/* Description : - Given the LI array, build the LI of PDU                         */
+/* Description : - Free SDUs left in ingress ring and destroy it                   */
+/*               - Producer must have stopped posting                              */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   li_ptr             | o  | The start address of LI in PDU                      */
-/*   n_li               | i  | the number of LI                                    */
-/*   li_s               | i  | LI array                                            */
-/*   Return             |    | 0                                                   */
+/*   ring               | i  | SDU ingress ring, may be NULL                       */
+/*   free_sdu           | i  | function to free SDU buffer                         */
+/*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-int rlc_encode_li(rlc_li_t * li_ptr, u32 n_li, u32 li_s[])
+void rlc_sdu_ingress_destroy(rlc_ring_t *ring, void (*free_sdu)(void *, void *))
 {
-	u32 i_li;
+	rlc_sdu_desc_t descs[RLC_SDU_BATCH_MAX];
+	u32 i, n;
 	
-	for(i_li=0; i_li<n_li; i_li++)
-	{		
-		if(i_li > 0)
+	if(ring == NULL)
+		return;
+	
+	while((n = rlc_ring_pop_bulk(ring, descs, RLC_SDU_BATCH_MAX)) > 0)
+	{
+		for(i=0; i<n; i++)
 		{
-			if(i_li & 0x01)
-			{
-				li_ptr->e1 = (i_li == n_li - 1) ? 0 : 1;
-				li_ptr->li1 = li_s[i_li-1];
-			}
-			else
-			{
-				li_ptr->e2 = (i_li == n_li - 1) ? 0 : 1;
-				li_ptr->li2 = li_s[i_li-1];
-				li_ptr ++;
-			}
+			if(free_sdu)
+				free_sdu(descs[i].buf_ptr, descs[i].cookie);
 		}
 	}
-
-	return 0;
+	
+	rlc_ring_destroy(ring);
 }
 
 /***********************************************************************************/
-/* Function : rlc_encode_sdu                                                       */
+/* Function : rlc_sdu_ingress_post                                                 */
 /***********************************************************************************/
-/* Description : - Given the LI array and SDU queue, build the data part of PDU    */
+/* Description : - Post one SDU to ingress ring, wait-free, no lock                */
+/*               - Only one thread may post to a ring                              */
 /*                                                                                 */
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   datatr             | o  | The start address of data part in PDU               */
-/*   n_li               | i  | the number of LI                                    */
-/*   li_s               | i  | LI array                                            */
-/*   sdu_tx_q           | i  | SDU queue                                           */
-/*   Return             |    | the number of SDU and the total size of SDU         */
+/*   ring               | i  | SDU ingress ring                                    */
+/*   buf_ptr            | i  | RLC SDU buffer pointer                              */
+/*   sdu_size           | i  | size of RLC SDU                                     */
+/*   cookie             | i  | parameter of free function                          */
+/*   post_time          | i  | RLC clock of entity, time in ring counts as delay   */
+/*   Return             |    | 0 is success, -1 if ring is full, SDU is not taken  */
 /***********************************************************************************/
-int rlc_encode_sdu(u8 *data_ptr, u32 n_li, u32 li_s[], dllist_node_t *sdu_tx_q)
+int rlc_sdu_ingress_post(rlc_ring_t *ring, u8 *buf_ptr, u32 sdu_size, void *cookie, u32 post_time)
 {
-	u32 li_idx;
-	rlc_sdu_t *sdu;
-	u16 total_size = 0, n_sdu = 0;
+	rlc_sdu_desc_t desc;
 	
-	for(li_idx=0; li_idx<n_li; li_idx++)
-	{
-		sdu = (rlc_sdu_t *)DLLIST_HEAD(sdu_tx_q);
+	if(ring == NULL || buf_ptr == NULL || sdu_size == 0)
+		return -1;
+	
+	desc.buf_ptr = buf_ptr;
+	desc.sdu_size = sdu_size;
+	desc.cookie = cookie;
+	desc.post_time = post_time;
+	
+	return rlc_ring_push_sized(ring, &desc, sdu_size);
+}
+
+/***********************************************************************************/
+/* Function : rlc_sdu_ingress_drain                                                */
+/***********************************************************************************/
+/* Description : - Move SDUs posted to ingress ring to Tx queue by batch enqueue   */
+/*               - Stop once Tx queue holds need bytes, the rest stay in ring so   */
+/*                 a full ring pushes back on PDCP, not an unbounded Tx queue      */
+/*               - SDU is freed if there is no memory for its control info         */
+/*               - enqueue_time of SDU is its post time, so AQM and delay stats    */
+/*                 see the time spent in ring                                      */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ring               | i  | SDU ingress ring                                    */
+/*   sdu_tx_q           | i  | SDU Tx queue                                        */
+/*   free_sdu           | i  | function to free SDU buffer                         */
+/*   need               | i  | bytes wanted in Tx queue or RLC_SDU_INGRESS_ALL     */
+/*   n_sdu              | io | number of SDU in Tx queue                           */
+/*   sdu_total_size     | io | total size of SDU in Tx queue                       */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_sdu_ingress_drain(rlc_ring_t *ring, dllist_node_t *sdu_tx_q, void (*free_sdu)(void *, void *), 
+		u32 need, s32 *n_sdu, s32 *sdu_total_size)
+{
+	rlc_sdu_desc_t descs[RLC_SDU_BATCH_MAX];
+	u8 *bufs[RLC_SDU_BATCH_MAX];
+	u32 sizes[RLC_SDU_BATCH_MAX];
+	void *cookies[RLC_SDU_BATCH_MAX];
+	u32 times[RLC_SDU_BATCH_MAX];
+	u32 i, n, size, total_size;
+	int n_done;
+	
+	while((u32)*sdu_total_size < need && (n = rlc_ring_pop_bulk(ring, descs, RLC_SDU_BATCH_MAX)) > 0)
+	{
+		size = 0;
+		for(i=0; i<n; i++)
+		{
+			bufs[i] = descs[i].buf_ptr;
+			sizes[i] = descs[i].sdu_size;
+			cookies[i] = descs[i].cookie;
+			times[i] = descs[i].post_time;
+			size += descs[i].sdu_size;
+		}
 		
-		/* write data */
-		rlc_serialize_sdu(data_ptr, sdu, li_s[li_idx]);
-		total_size += li_s[li_idx];
+		n_done = rlc_sdu_enqueue_batch(sdu_tx_q, free_sdu, bufs, sizes, cookies, times, n, NULL, &total_size);
+		if(n_done < 0)
+			n_done = 0;
+		for(i=n_done; i<n; i++)
+		{
+			if(free_sdu)
+				free_sdu(bufs[i], cookies[i]);
+		}
 		
-		if(li_idx != n_li - 1)
+		*n_sdu += n_done;
+		*sdu_total_size += total_size;
+		rlc_ring_consume_sum(ring, size);
+	}
+}
+
+/***********************************************************************************/
+/* Function : rlc_sdu_ingress_pending                                              */
+/***********************************************************************************/
+/* Description : - Add SDUs posted but not yet drained to Tx queue counters        */
+/*               - Used by scheduler, nothing is moved                             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ring               | i  | SDU ingress ring                                    */
+/*   n_sdu              | io | number of SDU                                       */
+/*   sdu_total_size     | io | total size of SDU                                   */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_sdu_ingress_pending(rlc_ring_t *ring, s32 *n_sdu, s32 *sdu_total_size)
+{
+	u32 n;
+	
+	/* count is read first, bytes of these SDUs are already published then */
+	n = rlc_ring_count(ring);
+	if(n == 0)
+		return;
+	
+	*n_sdu += n;
+	*sdu_total_size += rlc_ring_sum(ring);
+}
+
+/***********************************************************************************/
+/* Function : rlc_window_new                                                       */
+/***********************************************************************************/
+/* Description : - Allocate zeroed window storage: sn_fs pointers followed by one  */
+/*                 bit per SN                                                      */
+/*               - Storage of 10 bits SN is taken from free blocks of the shard    */
+/*                 first, as given back by hibernated or removed entities          */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   sn_fs              | i  | number of SN, 32 to 65536                           */
+/*   Return             |    | window storage, NULL if out of memory               */
+/***********************************************************************************/
+void *rlc_window_new(u32 sn_fs)
+{
+	rlc_shard_t *shard = rlc_shard_cur;
+	void *win;
+	
+	if(sn_fs > RLC_SN_FS_MAX)
+		return calloc(1, RLC_WINDOW_SIZE(sn_fs));
+	
+	if(shard->n_win_pool == 0)
+		return calloc(1, RLC_WINDOW_SIZE(RLC_SN_FS_MAX));
+	
+	win = shard->win_pool[--shard->n_win_pool];
+	memset(win, 0, RLC_WINDOW_SIZE(sn_fs));
+	return win;
+}
+
+/***********************************************************************************/
+/* Function : rlc_window_free                                                      */
+/***********************************************************************************/
+/* Description : - Give back window storage from rlc_window_new()                  */
+/*               - Storage of 10 bits SN is kept by the shard up to                */
+/*                 RLC_WIN_POOL_MAX blocks, others go back to heap                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   win                | i  | window storage, may be NULL                         */
+/*   sn_fs              | i  | number of SN given to rlc_window_new()              */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_window_free(void *win, u32 sn_fs)
+{
+	rlc_shard_t *shard = rlc_shard_cur;
+	
+	if(win == NULL)
+		return;
+	
+	if(sn_fs > RLC_SN_FS_MAX || shard->n_win_pool == RLC_WIN_POOL_MAX)
+		free(win);
+	else
+		shard->win_pool[shard->n_win_pool++] = win;
+}
+
+/***********************************************************************************/
+/* Function : rlc_delay_stats_add                                                  */
+/***********************************************************************************/
+/* Description : - Add a sample of SDU sojourn time to delay statistics            */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   stats              | io | delay statistics                                    */
+/*   delay              | i  | sojourn time of SDU                                 */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_delay_stats_add(rlc_delay_stats_t *stats, u32 delay)
+{
+	u32 bin;
+	
+	/* bin i holds [2^(i-1), 2^i) */
+	bin = delay ? (32 - __builtin_clz(delay)) : 0;
+	if(bin >= RLC_DELAY_HIST_NBIN)
+		bin = RLC_DELAY_HIST_NBIN - 1;
+	
+	stats->hist[bin] ++;
+	stats->n_sample ++;
+	stats->sum_delay += delay;
+	if(delay > stats->max_delay)
+		stats->max_delay = delay;
+}
+
+/***********************************************************************************/
+/* Function : rlc_aqm_init                                                         */
+/***********************************************************************************/
+/* Description : - Configure AQM of SDU Tx queue                                   */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   aqm                | o  | AQM                                                 */
+/*   target             | i  | target sojourn time, 0 to disable AQM               */
+/*   interval           | i  | sliding window of sojourn time above target         */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_aqm_init(rlc_aqm_t *aqm, u32 target, u32 interval)
+{
+	aqm->target = target;
+	aqm->interval = interval ? interval : 1;
+	aqm->above_target = 0;
+	aqm->first_above_time = 0;
+	aqm->dropping = 0;
+	aqm->drop_next = 0;
+	aqm->count = 0;
+	aqm->lastcount = 0;
+}
+
+/* integer square root */
+static u32 rlc_isqrt(u32 x)
+{
+	u32 r = 0, bit = 1 << 30;
+	
+	while(bit > x)
+		bit >>= 2;
+	while(bit)
+	{
+		if(x >= r + bit)
+		{
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else
+			r >>= 1;
+		bit >>= 2;
+	}
+	
+	return r;
+}
+
+#define RLC_TIME_AFTER_EQ(a, b) ((s32)((a) - (b)) >= 0)
+
+/* CoDel control law: next drop time */
+static u32 rlc_aqm_control_law(rlc_aqm_t *aqm, u32 t)
+{
+	return t + aqm->interval / rlc_isqrt(aqm->count);
+}
+
+/* judge if head SDU should be dropped */
+static int rlc_aqm_ok_to_drop(rlc_aqm_t *aqm, rlc_sdu_t *sdu, u32 now, s32 n_sdu)
+{
+	/* keep at least one SDU in queue */
+	if((s32)(now - sdu->enqueue_time) < (s32)aqm->target || n_sdu <= 1)
+	{
+		aqm->above_target = 0;
+		return 0;
+	}
+	
+	if(aqm->above_target == 0)
+	{
+		aqm->above_target = 1;
+		aqm->first_above_time = now + aqm->interval;
+		return 0;
+	}
+	
+	return RLC_TIME_AFTER_EQ(now, aqm->first_above_time);
+}
+
+/***********************************************************************************/
+/* Function : rlc_aqm_dequeue                                                      */
+/***********************************************************************************/
+/* Description : - Run CoDel on head of SDU Tx queue before building fresh PDU     */
+/*               - SDU that has been segmented is never dropped                    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   aqm                | io | AQM                                                 */
+/*   sdu_tx_q           | i  | SDU Tx queue                                        */
+/*   n_sdu              | io | number of SDU in Tx queue                           */
+/*   sdu_total_size     | io | total size of SDU in Tx queue                       */
+/*   Return             |    | number of dropped SDU                               */
+/***********************************************************************************/
+int rlc_aqm_dequeue(rlc_aqm_t *aqm, dllist_node_t *sdu_tx_q, s32 *n_sdu, s32 *sdu_total_size)
+{
+	rlc_sdu_t *sdu;
+	u32 now = rlc_shard_cur->clock;
+	u32 delta;
+	int n_drop = 0;
+	int ok_to_drop;
+	
+	if(DLLIST_EMPTY(sdu_tx_q))
+	{
+		aqm->above_target = 0;
+		aqm->dropping = 0;
+		return 0;
+	}
+	
+	sdu = (rlc_sdu_t *)DLLIST_HEAD(sdu_tx_q);
+	if(sdu->offset != 0)
+		return 0;
+	
+	ok_to_drop = rlc_aqm_ok_to_drop(aqm, sdu, now, *n_sdu);
+	if(aqm->dropping)
+	{
+		if(!ok_to_drop)
+		{
+			aqm->dropping = 0;
+			return 0;
+		}
+		
+		while(aqm->dropping && RLC_TIME_AFTER_EQ(now, aqm->drop_next))
 		{
-			//remove and free sdu
-			n_sdu ++;
 			dllist_remove(sdu_tx_q, (dllist_node_t *)sdu);
+			*n_sdu -= 1;
+			*sdu_total_size -= sdu->size;
 			rlc_sdu_free(sdu);
-			data_ptr += li_s[li_idx];
+			n_drop ++;
+			aqm->count ++;
+			
+			sdu = (rlc_sdu_t *)DLLIST_HEAD(sdu_tx_q);
+			if(DLLIST_EMPTY(sdu_tx_q) || !rlc_aqm_ok_to_drop(aqm, sdu, now, *n_sdu))
+				aqm->dropping = 0;
+			else
+				aqm->drop_next = rlc_aqm_control_law(aqm, aqm->drop_next);
 		}
+	}
+	else if(ok_to_drop)
+	{
+		dllist_remove(sdu_tx_q, (dllist_node_t *)sdu);
+		*n_sdu -= 1;
+		*sdu_total_size -= sdu->size;
+		rlc_sdu_free(sdu);
+		n_drop ++;
+		
+		/* re-enter dropping state with the drop rate close to last one */
+		aqm->dropping = 1;
+		delta = aqm->count - aqm->lastcount;
+		if(delta > 1 && (s32)(now - aqm->drop_next) < (s32)(16 * aqm->interval))
+			aqm->count = delta;
 		else
+			aqm->count = 1;
+		aqm->drop_next = rlc_aqm_control_law(aqm, now);
+		aqm->lastcount = aqm->count;
+	}
+	
+	aqm->n_drop += n_drop;
+	return n_drop;
+}
+
+/***********************************************************************************/
+/* Function : rlc_li_len                                                           */
+/***********************************************************************************/
+/* Description : - calculate the length of LI in RLC PDU                           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   n_li               | i  | The number of LI                                    */
+/*   Return             |    | Length of LI (align to bytes)                       */
+/***********************************************************************************/
+inline u32 rlc_li_len(u32 n_li)
+{
+	u32 li_len;
+
+	assert(n_li);
+	
+	li_len = ((n_li-1)>>1)*3 + (((n_li&0x01) == 0)<<1);
+
+	return li_len;
+}
+
+/***********************************************************************************/
+/* Function : rlc_li15_len                                                         */
+/***********************************************************************************/
+/* Description : - calculate the length of 15 bits LI in RLC PDU                   */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   n_li               | i  | The number of LI                                    */
+/*   Return             |    | Length of LI, E and LI take two bytes               */
+/***********************************************************************************/
+u32 rlc_li15_len(u32 n_li)
+{
+	assert(n_li);
+	
+	return (n_li-1)<<1;
+}
+
+/***********************************************************************************/
+/* Function : rlc_unpack_li                                                        */
+/***********************************************************************************/
+/* Description : - Unpack the chain of 11 bits LIs till the one with E=0           */
+/*               - with SSSE3, 8 E/LI fields are unpacked from 12 bytes at a time  */
+/*                 and E bits and zero LIs are checked by masks                    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_ptr             | i  | point to the first LI                               */
+/*   size               | i  | bytes from li_ptr to the end of PDU                 */
+/*   li_s               | o  | to store LIs, at least max_li+1 entries             */
+/*   max_li             | i  | max number of LI in the chain                       */
+/*   li_sum             | o  | sum of unpacked LIs                                 */
+/*   Return             |    | number of LIs, 0 if any LI is 0 or chain is broken  */
+/***********************************************************************************/
+static inline u32 rlc_unpack_li(const u8 *li_ptr, u32 size, u32 *li_s, u32 max_li, u32 *li_sum)
+{
+	u32 n_li = 0;
+	u32 sum = 0;
+	u32 off = 0;
+	u32 li, pair;
+#ifdef __SSSE3__
+	u32 max_li_simd = max_li;
+#endif
+
+#ifdef __SSSE3__
+	/* each 16 bits lane gets the two bytes holding one E/LI field, big endian */
+	const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i even = _mm_setr_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+	const __m128i lane = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m128i mask12 = _mm_set1_epi16(0x0FFF);
+	const __m128i mask11 = _mm_set1_epi16(0x07FF);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	
+	/* worth only for more than 2 LIs; 16 bytes are loaded for 12 bytes of LIs, don't read beyond PDU */
+	if(size < 16 || !rlc_li_get_e1(li_ptr) || !rlc_li_get_e2(li_ptr))
+		max_li_simd = 0;
+	
+	while(n_li + 8 <= max_li_simd && off + 16 <= size)
+	{
+		__m128i v, field, li_v, s;
+		u32 emask, zmask, n = 8;
+		
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(li_ptr + off)), shuf);
+		/* even fields are the high 12 bits, odd fields the low 12 bits */
+		field = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), even), _mm_andnot_si128(even, v));
+		field = _mm_and_si128(field, mask12);
+		li_v = _mm_and_si128(field, mask11);
+		
+		/* bit 2k+1: E of field k, and LI of field k is 0 */
+		emask = _mm_movemask_epi8(_mm_slli_epi16(field, 4)) & 0xAAAA;
+		zmask = _mm_movemask_epi8(_mm_cmpeq_epi16(li_v, zero)) & 0xAAAA;
+		if(emask != 0xAAAA)
+		{
+			/* the chain ends at the first E=0 */
+			n = (__builtin_ctz(~emask & 0xAAAA) >> 1) + 1;
+			zmask &= (1 << (n << 1)) - 1;
+			li_v = _mm_and_si128(li_v, _mm_cmplt_epi16(lane, _mm_set1_epi16(n)));
+		}
+		if(zmask)
+			return 0;
+		
+		_mm_storeu_si128((__m128i *)&li_s[n_li], _mm_unpacklo_epi16(li_v, zero));
+		_mm_storeu_si128((__m128i *)&li_s[n_li+4], _mm_unpackhi_epi16(li_v, zero));
+		
+		s = _mm_madd_epi16(li_v, ones);
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+		sum += _mm_cvtsi128_si32(s);
+		n_li += n;
+		
+		if(emask != 0xAAAA)
 		{
-			//last SDU
-			if(sdu->offset == sdu->size)
+			*li_sum = sum;
+			return n_li;
+		}
+		off += 12;
+	}
+#endif
+
+	/* one E/LI pair in 3 bytes at a time, E1(bit 23) LI1(bit 22-12) E2(bit 11) LI2(bit 10-0) */
+	while(n_li < max_li && off + 2 <= size)
+	{
+		pair = ((u32)li_ptr[off] << 16) | ((u32)li_ptr[off+1] << 8);
+		if(off + 3 <= size)
+			pair |= li_ptr[off+2];
+		
+		li = (pair >> 12) & 0x7FF;
+		if(li == 0)
+			return 0;
+		li_s[n_li++] = li;
+		sum += li;
+		
+		if((pair & 0x800000) == 0)
+		{
+			*li_sum = sum;
+			return n_li;
+		}
+		
+		li = pair & 0x7FF;
+		if(li == 0 || n_li == max_li || off + 3 > size)
+			return 0;
+		li_s[n_li++] = li;
+		sum += li;
+		
+		if((pair & 0x800) == 0)
+		{
+			*li_sum = sum;
+			return n_li;
+		}
+		off += 3;
+	}
+	
+	/* E chain exceeds max_li or PDU */
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_parse_li                                                         */
+/***********************************************************************************/
+/* Description : - Paser LIs in RLC PDU header                                     */
+/*                                                                                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   e                  | i  | E in RLC header                                     */
+/*   li_ptr             | i  | point to the first LI or first SDU                  */
+/*   size               | i  | including size of all LIs and size of all SDUs      */
+/*   data_ptr           | o  | poniter to first SDU                                */
+/*   li_s               | o  | to store parsed LIs                                 */
+/*   Return             |    | number of LIs                                       */
+/***********************************************************************************/
+u32 rlc_parse_li(u32 e, u8 *li_ptr, u32 size, u8 **data_ptr, u32 *li_s)
+{
+	u32 n_li;
+	u32 clen, li_sum;
+
+	assert(size > 0);
+	
+	if(e == 0)
+	{
+		li_s[0] = size;
+		*data_ptr = li_ptr;
+ 		return 1;
+	}
+	
+	/* parse LI in case of number of LI > 1, the last LI may not exist */
+	n_li = rlc_unpack_li(li_ptr, size, li_s, RLC_LI_NUM_MAX-1, &li_sum);
+	if(n_li == 0)
+		return -1;
+	
+	/* n_li LIs take 1.5 bytes each, rounded up */
+	clen = (n_li * 3 + 1) >> 1;
+	*data_ptr = li_ptr + clen;
+	clen += li_sum;
+	
+	if(clen < size)
+	{
+		li_s[n_li++] = size - clen;
+		clen = size;
+	}
+	
+	/* check PDU size with clen */
+	if(clen != size)
+		return -2;
+
+	return n_li;
+}
+
+/***********************************************************************************/
+/* Function : rlc_parse_li15                                                       */
+/***********************************************************************************/
+/* Description : - Paser 15 bits LIs in RLC PDU header                             */
+/*               - same as rlc_parse_li()                                          */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   e                  | i  | E in RLC header                                     */
+/*   li_ptr             | i  | point to the first LI or first SDU                  */
+/*   size               | i  | including size of all LIs and size of all SDUs      */
+/*   data_ptr           | o  | poniter to first SDU                                */
+/*   li_s               | o  | to store parsed LIs                                 */
+/*   Return             |    | number of LIs                                       */
+/***********************************************************************************/
+u32 rlc_parse_li15(u32 e, u8 *li_ptr, u32 size, u8 **data_ptr, u32 *li_s)
+{
+	u32 n_li = 0;
+	u32 clen = 0;
+	u32 li;
+
+	assert(size > 0);
+	
+	if(e == 0)
+	{
+		li_s[0] = size;
+		*data_ptr = li_ptr;
+ 		return 1;
+	}
+	
+	while((n_li < RLC_LI_NUM_MAX-1) && (clen < size))
+	{
+		li = rlc_li15_get_li(li_ptr);
+		if(li == 0)
+			return -1;
+		
+		li_s[n_li++] = li;
+		clen += li + 2;
+		
+		if(!rlc_li15_get_e(li_ptr))
+		{
+			*data_ptr = li_ptr + 2;
+			break;
+		}
+		li_ptr += 2;
+	}
+	
+	if(clen < size)
+	{
+		/* the last LI may not exist */
+		li_s[n_li++] = size - clen;
+		clen = size;
+	}
+	
+	/* check PDU size with clen */
+	if(clen != size)
+		return -2;
+
+	return n_li;
+}
+
+/***********************************************************************************/
+/* Function : rlc_encode_li                                                        */
+/***********************************************************************************/
+/* Description : - Given the LI array, build the LI of PDU                         */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_ptr             | o  | The start address of LI in PDU                      */
+/*   n_li               | i  | the number of LI                                    */
+/*   li_s               | i  | LI array                                            */
+/*   Return             |    | 0                                                   */
+/***********************************************************************************/
+int rlc_encode_li(u8 *li_ptr, u32 n_li, u32 li_s[])
+{
+	u32 i_li;
+	
+	for(i_li=0; i_li<n_li; i_li++)
+	{		
+		if(i_li > 0)
+		{
+			if(i_li & 0x01)
 			{
-				//remove and free sdu
-				n_sdu ++;
-				dllist_remove(sdu_tx_q, (dllist_node_t *)sdu);
-				rlc_sdu_free(sdu);
+				rlc_li_set_first(li_ptr, (i_li == n_li - 1) ? 0 : 1, li_s[i_li-1]);
+			}
+			else
+			{
+				rlc_li_set_second(li_ptr, (i_li == n_li - 1) ? 0 : 1, li_s[i_li-1]);
+				li_ptr += 3;
 			}
-			data_ptr += li_s[li_idx];
 		}
 	}
 
-	return ((n_sdu << 16) | total_size);
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_encode_li15                                                      */
+/***********************************************************************************/
+/* Description : - Given the LI array, build the 15 bits LI of PDU                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_ptr             | o  | The start address of LI in PDU                      */
+/*   n_li               | i  | the number of LI                                    */
+/*   li_s               | i  | LI array                                            */
+/*   Return             |    | 0                                                   */
+/***********************************************************************************/
+int rlc_encode_li15(u8 *li_ptr, u32 n_li, u32 li_s[])
+{
+	u32 i_li;
+	
+	for(i_li=1; i_li<n_li; i_li++)
+	{
+		rlc_li15_set(li_ptr, (i_li == n_li - 1) ? 0 : 1, li_s[i_li-1]);
+		li_ptr += 2;
+	}
+
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_encode_pdu                                                       */
+/***********************************************************************************/
+/* Description : - Given the room and SDU queue, write LIs and data part of PDU    */
+/*               - SDU queue is walked only once: SDUs mapped to the PDU are kept  */
+/*                 in a local array to write data and free them afterwards         */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   li_ptr             | o  | The start address of LI in PDU, just after head     */
+/*   size               | i  | room for LIs and data: PDU size minus head length   */
+/*   li_bits            | i  | length of LI field: 11 or 15                        */
+/*   sdu_q              | io | SDU queue, SDUs fully mapped are removed and freed  */
+/*   li_s               | o  | LI array                                            */
+/*   data_ptr           | o  | start address of data part in PDU                   */
+/*   data_size          | o  | the number of SDU freed and the total size of data  */
+/*   stats              | io | sojourn time statistics of SDU queue, may be NULL   */
+/*   Return             |    | The number of LI, 0 if PDU is not built             */
+/***********************************************************************************/
+u32 rlc_encode_pdu(u8 *li_ptr, u32 size, u32 li_bits, dllist_node_t *sdu_q, u32 *li_s, 
+	u8 **data_ptr, u32 *data_size, rlc_delay_stats_t *stats)
+{
+	rlc_sdu_t *mapped[RLC_LI_NUM_MAX];
+	s32 remain_pdu_size = size;
+	u32 n_li = 0, li_idx;
+	u32 sdu_size, lisize = 0;
+	u32 li_max = (li_bits == 15) ? RLC_LI_VALUE_MAX_15BITS : RLC_LI_VALUE_MAX;
+	u16 total_size = 0, n_sdu = 0;
+	u8 *ptr;
+	rlc_sdu_t *sdu;
+
+	sdu = (rlc_sdu_t *)(DLLIST_HEAD(sdu_q));
+	assert(!DLLIST_IS_HEAD(sdu_q,sdu));
+	
+	if(remain_pdu_size < 1)		//at leaset 1 byte data
+	{
+		ZLOG_WARN("pdu_size is two small.\n");
+		return 0;
+	}
+	
+	/* (1) build LIs */
+	do{
+		/* substract LI length for current RLC SDU */
+		if(n_li > 0)
+		{
+			if(li_bits == 15 || (n_li & 0x01))
+				lisize = 2;
+			else
+				lisize = 1;
+				
+			if(remain_pdu_size <= lisize)
+			{
+				break;	//can't contain LI
+			}
+			else
+				remain_pdu_size -= lisize;
+		}
+		
+		sdu_size = sdu->size - sdu->offset;
+		assert(sdu_size > 0);
+		if(sdu_size <= remain_pdu_size)
+		{
+			if(sdu_size <= li_max)
+			{
+				mapped[n_li] = sdu;
+				li_s[n_li++] = sdu_size;
+				remain_pdu_size -= sdu_size;
+			}
+			else	//usually won't go into else branch 
+			{
+				if(n_li == 0)
+				{
+					//if this is the first SDU, it's size can be large than 2047
+					//but on other SDUs can be in current PDU
+					mapped[n_li] = sdu;
+					li_s[n_li++] = sdu_size;
+					remain_pdu_size -= sdu_size;
+				}
+				else
+					remain_pdu_size += lisize;	//add back lisize
+				break;
+			}
+		}
+		else
+		{
+			if(remain_pdu_size <= li_max)
+			{
+				mapped[n_li] = sdu;
+				li_s[n_li++] = remain_pdu_size;
+				remain_pdu_size = 0;
+			}
+			else	//usually won't go into else branch 
+			{
+				if(n_li == 0)
+				{
+					mapped[n_li] = sdu;
+					li_s[n_li++] = remain_pdu_size;
+					remain_pdu_size = 0;
+				}
+				else
+					remain_pdu_size += lisize;	//add back lisize
+				break;
+			}
+		}
+
+		/* n_li should not large than RLC_LI_NUM_MAX */
+		if(n_li == RLC_LI_NUM_MAX)
+			break;
+		
+		sdu = (rlc_sdu_t *)(sdu->node.next);
+	}while(remain_pdu_size > 0 && !DLLIST_IS_HEAD(sdu_q, sdu));
+
+	/* (2) write LIs, then data from mapped SDUs without walking the queue again */
+	if(li_bits == 15)
+	{
+		rlc_encode_li15(li_ptr, n_li, li_s);
+		ptr = li_ptr + rlc_li15_len(n_li);
+	}
+	else
+	{
+		rlc_encode_li(li_ptr, n_li, li_s);
+		ptr = li_ptr + rlc_li_len(n_li);
+	}
+	*data_ptr = ptr;
+	
+	for(li_idx=0; li_idx<n_li; li_idx++)
+	{
+		sdu = mapped[li_idx];
+		
+		/* write data */
+		rlc_serialize_sdu(ptr, sdu, li_s[li_idx]);
+		ptr += li_s[li_idx];
+		total_size += li_s[li_idx];
+		
+		/* all SDUs but the last one are fully mapped */
+		if(sdu->offset == sdu->size)
+		{
+			//remove and free sdu
+			n_sdu ++;
+			if(stats)
+				rlc_delay_stats_add(stats, rlc_shard_cur->clock - sdu->enqueue_time);
+			dllist_remove(sdu_q, (dllist_node_t *)sdu);
+			rlc_sdu_free(sdu);
+		}
+	}
+
+	*data_size = (n_sdu << 16) | total_size;
+	return n_li;
 }
 
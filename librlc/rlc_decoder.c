@@ -8,6 +8,7 @@
 #include <assert.h>
 
 #include "rlc.h"
+#include "rlc_bitstream.h"
 
 static u8 rlc_pdu[10000];
 
@@ -17,7 +18,6 @@ static char *rlc_mode_str[] = {
 	"UM 10 Bits SN",
 };
 
-extern void bitcpy(unsigned long *dst, int dst_idx, const unsigned long *src, int src_idx, u32 n);
 
 int read_one_byte(FILE *fp, u8 *byte)
 {
@@ -61,36 +61,36 @@ int read_one_byte(FILE *fp, u8 *byte)
 
 void decode_rlc_um5(u8 *pdu, u32 nByte)
 {
-	rlc_um_pdu_head_5bits_t *um_pdu;
+	u32 fi, e, sn;
 	u32 li_s[RLC_LI_NUM_MAX];
 	u32 n_li = 0;
 	u8 *data_ptr;
 	u8 i;
 	u8 headlen = 1;
 
-	um_pdu = (rlc_um_pdu_head_5bits_t *)pdu;
+	rlc_um_head_5bits_decode(pdu, &fi, &e, &sn);
 
-	printf("UM PDU: FI=%u E=%u SN=%u\n", um_pdu->fi, um_pdu->e, um_pdu->sn);
+	printf("UM PDU: FI=%u E=%u SN=%u\n", fi, e, sn);
 
-	n_li = rlc_parse_li(um_pdu->e, (rlc_li_t *)&pdu[headlen], nByte-headlen, &data_ptr, li_s);
+	n_li = rlc_parse_li(e, &pdu[headlen], nByte-headlen, &data_ptr, li_s);
 	for(i=0; i<n_li; i++)
 		printf("  LI %u: %u\n", i+1, li_s[i]);
 }
 
 void decode_rlc_um10(u8 *pdu, u32 nByte)
 {
-	rlc_um_pdu_head_10bits_t *um_pdu;
+	u32 fi, e, sn;
 	u32 li_s[RLC_LI_NUM_MAX];
 	u32 n_li = 0;
 	u8 *data_ptr;
 	u8 i;
 	u8 headlen = 2;
 
-	um_pdu = (rlc_um_pdu_head_10bits_t *)pdu;
+	rlc_um_head_10bits_decode(pdu, &fi, &e, &sn);
 
-	printf("UM PDU: FI=%u E=%u SN=%u\n", um_pdu->fi, um_pdu->e, um_pdu->sn);
+	printf("UM PDU: FI=%u E=%u SN=%u\n", fi, e, sn);
 
-	n_li = rlc_parse_li(um_pdu->e, (rlc_li_t *)&pdu[headlen], nByte-headlen, &data_ptr, li_s);
+	n_li = rlc_parse_li(e, &pdu[headlen], nByte-headlen, &data_ptr, li_s);
 	for(i=0; i<n_li; i++)
 		printf("  LI %u: %u\n", i+1, li_s[i]);
 }
@@ -98,46 +98,34 @@ void decode_rlc_um10(u8 *pdu, u32 nByte)
 #define MAXINFO_NUM 128
 void decode_rlc_am_status_pdu(u8 *pdu, u32 nByte)
 {
-	rlc_am_status_pdu_head_t *am_pdu;
 	u32 n=0;
 	u8 i;
-	u32 bit_offset = 15;
-	u32 e1;
+	u32 cpt, ack_sn, e1;
 	nacksn_info_t ninfo[MAXINFO_NUM];
-	u8 *buf_ptr = pdu;
-	u16 nack_sn;
-
-	am_pdu = (rlc_am_status_pdu_head_t *)pdu;
-	printf("AM Status PDU: CPT=%u ACK_SN=%u E1=%u\n", am_pdu->cpt, am_pdu->ack_sn, am_pdu->e1);
-
-	e1 = am_pdu->e1;
+	rlc_bitreader_t br;
+
+	rlc_br_init(&br, pdu, nByte);
+	rlc_br_get(&br, 1);
+	cpt = rlc_br_get(&br, 3);
+	ack_sn = rlc_br_get(&br, 10);
+	e1 = rlc_br_get(&br, 1);
+	printf("AM Status PDU: CPT=%u ACK_SN=%u E1=%u\n", cpt, ack_sn, e1);
 	
 	/* 1) extract nack info */
 	while(e1 && n<MAXINFO_NUM)
 	{
-		bitcpy((unsigned long *)&ninfo[n].nacksn, 0, (const unsigned long *)buf_ptr, bit_offset, 12);
-		bit_offset += 12;
-		if(bit_offset >= 32)
-		{
-			buf_ptr += 4;
-			bit_offset -= 32;
-		}
-		e1 = ninfo[n].nacksn.e1;
-		nack_sn = ninfo[n].nacksn.nack_sn;
+		ninfo[n].nacksn.nack_sn = rlc_br_get(&br, 10);
+		e1 = ninfo[n].nacksn.e1 = rlc_br_get(&br, 1);
+		ninfo[n].nacksn.e2 = rlc_br_get(&br, 1);
 
 		if(ninfo[n].nacksn.e2)
 		{
-			bitcpy((unsigned long *)&ninfo[n].so, 0, (const unsigned long *)buf_ptr, bit_offset, 30);
-			bit_offset += 30;
-			if(bit_offset >= 32)
-			{
-				buf_ptr += 4;
-				bit_offset -= 32;
-			}
+			ninfo[n].so.sostart = rlc_br_get(&br, 15);
+			ninfo[n].so.soend = rlc_br_get(&br, 15);
 		}
 
 		/* check length of PDU */
-		if((buf_ptr-pdu) > nByte)
+		if(br.overrun)
 		{
 			printf("NACK info exceeds the buf_len=%u\n", nByte);
 			break;
@@ -158,50 +146,42 @@ void decode_rlc_am_status_pdu(u8 *pdu, u32 nByte)
 
 void decode_rlc_am_data_pdu(u8 *pdu, u32 nByte)
 {
-	rlc_am_pdu_head_t *am_pdu;
 	u32 li_s[RLC_LI_NUM_MAX];
 	u32 n_li = 0;
 	u8 *data_ptr;
 	u8 i;
 	u8 headlen = 2;
 
-	am_pdu = (rlc_am_pdu_head_t *)pdu;
+	printf("AM Data PDU: RF=%u Poll=%u FI=%u E=%u sn=%u\n", rlc_am_head_get_rf(pdu), rlc_am_head_get_p(pdu), 
+			rlc_am_head_get_fi(pdu), rlc_am_head_get_e(pdu), rlc_am_head_get_sn(pdu));
 
-	printf("AM Data PDU: RF=%u Poll=%u FI=%u E=%u sn=%u\n", am_pdu->rf, am_pdu->p, am_pdu->fi, am_pdu->e, am_pdu->sn);
-
-	n_li = rlc_parse_li(am_pdu->e, (rlc_li_t *)&pdu[headlen], nByte-headlen, &data_ptr, li_s);
+	n_li = rlc_parse_li(rlc_am_head_get_e(pdu), &pdu[headlen], nByte-headlen, &data_ptr, li_s);
 	for(i=0; i<n_li; i++)
 		printf("  LI %u: %u\n", i+1, li_s[i]);
 }
 
 void decode_rlc_am_data_pdu_reseg(u8 *pdu, u32 nByte)
 {
-	rlc_am_pdu_segment_head_t *am_pdu;
 	u32 li_s[RLC_LI_NUM_MAX];
 	u32 n_li = 0;
 	u8 *data_ptr;
 	u8 i;
 	u8 headlen = 4;
 	
-	am_pdu = (rlc_am_pdu_segment_head_t *)pdu;
-
 	printf("AM Data PDU: RF=%u Poll=%u FI=%u E=%u sn=%u LSF=%u SO=%u\n", 
-			am_pdu->rf, am_pdu->p, am_pdu->fi, am_pdu->e, am_pdu->sn, am_pdu->lsf, am_pdu->so);
+			rlc_am_head_get_rf(pdu), rlc_am_head_get_p(pdu), rlc_am_head_get_fi(pdu), rlc_am_head_get_e(pdu), 
+			rlc_am_head_get_sn(pdu), rlc_am_segment_head_get_lsf(pdu), rlc_am_segment_head_get_so(pdu));
 
-	n_li = rlc_parse_li(am_pdu->e, (rlc_li_t *)&pdu[headlen], nByte-headlen, &data_ptr, li_s);
+	n_li = rlc_parse_li(rlc_am_head_get_e(pdu), &pdu[headlen], nByte-headlen, &data_ptr, li_s);
 	for(i=0; i<n_li; i++)
 		printf("  LI %u: %u\n", i+1, li_s[i]);
 }
 
 void decode_rlc_am(u8 *pdu, u32 nByte)
 {
-	rlc_am_pdu_head_t *am_pdu;
-
-	am_pdu = (rlc_am_pdu_head_t *)pdu;
-
-	if(am_pdu->dc == 0)
+	if(rlc_am_head_get_dc(pdu) == RLC_AM_DC_CTRL_PDU)
 		decode_rlc_am_status_pdu(pdu, nByte);
-	else if(am_pdu->rf == 0)
+	else if(rlc_am_head_get_rf(pdu) == 0)
 	{
 		if(nByte > 2) 
 			decode_rlc_am_data_pdu(pdu, nByte);
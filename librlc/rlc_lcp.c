@@ -0,0 +1,338 @@
+/**
+ * Copyright (c) 2011-2012 Phuuix Xiong <phuuix@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file
+ *   Logical channel prioritization of 36.321 5.4.3.1 over the entities of a UE.
+ *   Logical channels are kept in priority order with their entity found once
+ *   in the registry, and Bj is brought up to date only when the UE gets a
+ *   grant, so one MAC PDU costs O(logical channels of the UE), whatever the
+ *   number of UEs or the TTIs since the last grant.
+ */
+/*
+ * rlc_lcp.c: RLC logical channel prioritization code
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "rlc.h"
+#include "log.h"
+
+#define RLC_LCP_BUCKET_MAX 0x7FFFFFFF		/* Bj is s32 */
+#define RLC_LCP_L_MAX 0x7FFF				/* 15 bits L field */
+#define RLC_LCP_PDU_SIZE_MIN 2				/* smallest PDU worth a subheader */
+
+/* size of MAC subheader with L field */
+static inline u32 rlc_lcp_head_len(u32 length)
+{
+	return (length < 128)?2:3;
+}
+
+/* Bj += PBR * TTIs elapsed, up to bucket size */
+static void rlc_lcp_fill_bucket(rlc_lcp_lch_t *lch, u32 elapsed)
+{
+	u64 add;
+	u32 room;
+
+	if(lch->pbr == RLC_LCP_PBR_INFINITY)
+		return;
+
+	/* enough TTIs to fill the bucket from any Bj, keeps add in 64 bits */
+	if(elapsed > lch->bucket_size)
+		elapsed = lch->bucket_size;
+
+	add = (u64)lch->pbr * elapsed;
+	room = lch->bucket_size - (u32)lch->bj;
+	lch->bj = (add >= room)?(s32)lch->bucket_size:lch->bj + (s32)add;
+}
+
+/* bytes waiting for transmission, STATUS and ReTx PDUs included */
+static u32 rlc_lcp_pending(rlc_lcp_lch_t *lch)
+{
+	rlc_buffer_status_t bs;
+
+	if(lch->type == RLC_ENTITY_TYPE_UM)
+		return rlc_um_tx_estimate_pdu_size(&((rlc_entity_um_t *)lch->entity)->umtx);
+
+	if(lch->type == RLC_ENTITY_TYPE_AM)
+	{
+		rlc_am_tx_get_buffer_status(&((rlc_entity_am_t *)lch->entity)->amtx, &bs);
+		return bs.status_bytes + bs.retx_bytes + (bs.window_stalled?0:bs.new_bytes);
+	}
+
+	/* TM: SDU is sent as a whole */
+	return rlc_tm_tx_estimate_pdu_size((rlc_entity_tm_t *)lch->entity);
+}
+
+/* build RLC PDUs of lch with at most budget bytes, subheaders included.
+ * Return bytes taken from the grant */
+static u32 rlc_lcp_serve(rlc_lcp_lch_t *lch, u8 *buf_ptr, u32 budget, void *cookie, rlc_mac_pdu_desc_t *desc)
+{
+	rlc_lcp_pdu_t *pdu;
+	rlc_sdu_t *sdu;
+	u8 *data_ptr;
+	u32 pending, size, pdu_type = 0;
+	u32 used = 0;
+	int len;
+
+	while(desc->n_pdu < RLC_LCP_PDU_MAX && budget - used >= 2 + RLC_LCP_PDU_SIZE_MIN)
+	{
+		pending = rlc_lcp_pending(lch);
+		if(pending == 0)
+			break;
+
+		size = budget - used - 2;
+		if(size >= 128)
+			size --;
+		size = RLC_MIN(size, pending);
+		size = RLC_MIN(size, RLC_LCP_L_MAX);
+
+		data_ptr = buf_ptr + desc->payload_size;
+		if(lch->type == RLC_ENTITY_TYPE_UM)
+			len = rlc_um_tx_build_pdu(&((rlc_entity_um_t *)lch->entity)->umtx, data_ptr, size);
+		else if(lch->type == RLC_ENTITY_TYPE_AM)
+			len = rlc_am_tx_build_pdu(&((rlc_entity_am_t *)lch->entity)->amtx, data_ptr, size, cookie, &pdu_type);
+		else
+		{
+			len = rlc_tm_tx_build_pdu((rlc_entity_tm_t *)lch->entity, &sdu, size);
+			if(len > 0)
+			{
+				rlc_serialize_sdu(data_ptr, sdu, len);
+				rlc_sdu_free(sdu);
+			}
+		}
+		if(len <= 0)
+			break;
+
+		pdu = &desc->pdu[desc->n_pdu++];
+		pdu->lcid = lch->lcid;
+		pdu->head_len = rlc_lcp_head_len(len);
+		pdu->length = len;
+		pdu->offset = desc->payload_size;
+		pdu->pdu_type = pdu_type;
+
+		if(lch->type == RLC_ENTITY_TYPE_AM && pdu_type == RLC_AM_FRESH_PDU)
+			desc->n_held ++;
+		desc->head_size += pdu->head_len;
+		desc->payload_size += len;
+		used += pdu->head_len + len;
+	}
+
+	return used;
+}
+
+/***********************************************************************************/
+/* Function : rlc_lcp_init                                                         */
+/***********************************************************************************/
+/* Description : - Init LCP context of a UE without logical channel                */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ue                 | o  | LCP context of UE                                   */
+/*   cell               | i  | cell index                                          */
+/*   rnti               | i  | RNTI of UE                                          */
+/*   tti                | i  | current TTI, the clock of rlc_lcp_build_pdu()       */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_lcp_init(rlc_lcp_ue_t *ue, u16 cell, u16 rnti, u32 tti)
+{
+	memset(ue, 0, sizeof(rlc_lcp_ue_t));
+	ue->cell = cell;
+	ue->rnti = rnti;
+	ue->last_tti = tti;
+}
+
+/***********************************************************************************/
+/* Function : rlc_lcp_add_lch                                                      */
+/***********************************************************************************/
+/* Description : - Add a logical channel whose entity is in the registry           */
+/*                 Bj starts from 0 as 36.321 asks on channel establishment        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ue                 | i  | LCP context of UE                                   */
+/*   reg                | i  | registry of the entity                              */
+/*   lcid               | i  | logical channel id                                  */
+/*   priority           | i  | priority, 1 is the highest                          */
+/*   pbr                | i  | PBR in bytes per TTI, or RLC_LCP_PBR_INFINITY       */
+/*   bsd                | i  | bucket size duration in TTIs                        */
+/*   Return             |    | 0 is success, -1 if no entity, exists or full       */
+/***********************************************************************************/
+int rlc_lcp_add_lch(rlc_lcp_ue_t *ue, rlc_registry_t *reg, u8 lcid, u8 priority, u32 pbr, u32 bsd)
+{
+	rlc_entity_common_head_t *entity;
+	rlc_lcp_lch_t *lch;
+	u32 i;
+
+	entity = rlc_registry_find(reg, ue->cell, ue->rnti, lcid);
+	if(entity == NULL)
+	{
+		ZLOG_ERR("no entity: cell=%u rnti=%u lcid=%u.\n", ue->cell, ue->rnti, lcid);
+		return -1;
+	}
+
+	for(i=0; i<ue->n_lch; i++)
+	{
+		if(ue->lch[i].lcid == lcid)
+		{
+			ZLOG_ERR("logical channel exists: rnti=%u lcid=%u.\n", ue->rnti, lcid);
+			return -1;
+		}
+	}
+
+	if(ue->n_lch >= RLC_LCP_LCH_MAX)
+	{
+		ZLOG_ERR("too many logical channels: rnti=%u lcid=%u.\n", ue->rnti, lcid);
+		return -1;
+	}
+
+	/* after channels of the same or higher priority */
+	for(i=ue->n_lch; i>0 && ue->lch[i-1].priority > priority; i--)
+		ue->lch[i] = ue->lch[i-1];
+
+	lch = &ue->lch[i];
+	lch->entity = entity;
+	lch->lcid = lcid;
+	lch->priority = priority;
+	lch->type = entity->type;
+	lch->pbr = pbr;
+	lch->bucket_size = RLC_MIN((u64)pbr * bsd, RLC_LCP_BUCKET_MAX);
+	lch->bj = 0;
+	ue->n_lch ++;
+
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_lcp_remove_lch                                                   */
+/***********************************************************************************/
+/* Description : - Remove a logical channel, before its entity is removed from     */
+/*                 registry                                                        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ue                 | i  | LCP context of UE                                   */
+/*   lcid               | i  | logical channel id                                  */
+/*   Return             |    | 0 is success, -1 if not found                       */
+/***********************************************************************************/
+int rlc_lcp_remove_lch(rlc_lcp_ue_t *ue, u8 lcid)
+{
+	u32 i;
+
+	for(i=0; i<ue->n_lch; i++)
+	{
+		if(ue->lch[i].lcid == lcid)
+			break;
+	}
+	if(i == ue->n_lch)
+		return -1;
+
+	ue->n_lch --;
+	for(; i<ue->n_lch; i++)
+		ue->lch[i] = ue->lch[i+1];
+
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_lcp_pending_bytes                                                */
+/***********************************************************************************/
+/* Description : - Bytes waiting for transmission in all logical channels of a UE, */
+/*                 e.g. for MAC scheduler to size the grant                        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ue                 | i  | LCP context of UE                                   */
+/*   Return             |    | sum of RLC PDU sizes, MAC subheaders not counted    */
+/***********************************************************************************/
+u32 rlc_lcp_pending_bytes(rlc_lcp_ue_t *ue)
+{
+	u32 i, pending = 0;
+
+	for(i=0; i<ue->n_lch; i++)
+		pending += rlc_lcp_pending(&ue->lch[i]);
+
+	return pending;
+}
+
+/***********************************************************************************/
+/* Function : rlc_lcp_build_pdu                                                    */
+/***********************************************************************************/
+/* Description : - Share a grant among logical channels of a UE and build their    */
+/*                 RLC PDUs back to back in buf_ptr                                */
+/*               - Channels with Bj > 0 are served up to Bj in priority order,     */
+/*                 then what is left goes to channels in priority order            */
+/*               - desc tells LCID and size of each MAC SDU, subheader size and    */
+/*                 padding, so MAC writes the header in front of buf_ptr           */
+/*               - cookie is kept by each AM fresh PDU and freed by free_pdu(),    */
+/*                 desc->n_held times in all                                       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   ue                 | i  | LCP context of UE                                   */
+/*   tti                | i  | current TTI                                         */
+/*   buf_ptr            | o  | payload buffer, at least grant bytes                */
+/*   grant              | i  | size of MAC PDU                                     */
+/*   cookie             | i  | parameter of free_pdu() for AM fresh PDUs           */
+/*   desc               | o  | MAC PDU descriptor                                  */
+/*   Return             |    | size of payload, 0 if nothing to send               */
+/***********************************************************************************/
+u32 rlc_lcp_build_pdu(rlc_lcp_ue_t *ue, u32 tti, u8 *buf_ptr, u32 grant, void *cookie, rlc_mac_pdu_desc_t *desc)
+{
+	rlc_lcp_lch_t *lch;
+	u32 elapsed = tti - ue->last_tti;
+	u32 left = grant;
+	u32 i, payload, quota;
+
+	desc->n_pdu = 0;
+	desc->n_held = 0;
+	desc->head_size = 0;
+	desc->payload_size = 0;
+
+	ue->last_tti = tti;
+
+	/* step 1: Bj > 0 in priority order, Bj is decreased by MAC SDUs served */
+	for(i=0; i<ue->n_lch; i++)
+	{
+		lch = &ue->lch[i];
+		rlc_lcp_fill_bucket(lch, elapsed);
+		if(lch->pbr != RLC_LCP_PBR_INFINITY && lch->bj <= 0)
+			continue;
+
+		if(lch->pbr == RLC_LCP_PBR_INFINITY)
+			quota = left;
+		else
+			quota = RLC_MIN((u32)lch->bj + rlc_lcp_head_len(lch->bj), left);
+
+		payload = desc->payload_size;
+		left -= rlc_lcp_serve(lch, buf_ptr, quota, cookie, desc);
+		if(lch->pbr != RLC_LCP_PBR_INFINITY)
+			lch->bj -= desc->payload_size - payload;
+	}
+
+	/* step 2: the rest in strict priority order */
+	for(i=0; i<ue->n_lch && left >= 2 + RLC_LCP_PDU_SIZE_MIN; i++)
+		left -= rlc_lcp_serve(&ue->lch[i], buf_ptr, left, cookie, desc);
+
+	desc->padding = left;
+
+	return desc->payload_size;
+}
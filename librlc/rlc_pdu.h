@@ -24,6 +24,8 @@
 #ifndef _RLC_PDU_H_
 #define _RLC_PDU_H_
 
+#include "stdtypes.h"
+
 #define RLC_FI_FIRST_LAST 0x00
 #define RLC_FI_FIRST_NLAST 0x01
 #define RLC_FI_NFIRST_LAST 0x02
@@ -31,168 +33,188 @@
 
 #define RLC_SN_MAX_5BITS ((1<<5)-1)
 #define RLC_SN_MAX_10BITS ((1<<10)-1)
+#define RLC_SN_MAX_16BITS ((1<<16)-1)
 
 #define RLC_LI_VALUE_MAX 2047
+#define RLC_LI_VALUE_MAX_15BITS 32767
 
 #define RLC_AM_DC_CTRL_PDU 0
 #define RLC_AM_DC_DATA_PDU 1
 
-#define RLC_AM_SO_END 0x7FFF
-
-#pragma pack(1)
-#if (1) //__BYTE_ORDER == __BIG_ENDIANS
-/* Need to define data stucture as below even RLC pairs both run on little endian CPU. */
-typedef struct rlc_um_pdu_head_5bits
-{
-	u32 fi:2;
-	u32 e:1;
-	u32 sn:5;
-}rlc_um_pdu_head_5bits_t;
-
-typedef struct rlc_um_pdu_head_10bits
-{
-	u32 r1_1:1;
-	u32 r1_2:1;
-	u32 r1_3:1;
-	u32 fi:2;
-	u32 e:1;
-	u32 sn:10;
-}rlc_um_pdu_head_10bits_t;
-
-typedef struct rlc_am_pdu_head
-{
-	u32 dc:1;
-	u32 rf:1;
-	u32 p:1;
-	u32 fi:2;
-	u32 e:1;
-	u32 sn:10;
-}rlc_am_pdu_head_t;
-
-typedef struct rlc_am_pdu_segment_head
-{
-	u32 dc:1;
-	u32 rf:1;
-	u32 p:1;
-	u32 fi:2;
-	u32 e:1;
-	u32 sn:10;
-		
-	u32 lsf:1;
-	u32 so:15;
-}rlc_am_pdu_segment_head_t;
-
-typedef struct rlc_am_status_pdu_head
-{
-	u32 dc:1;
-	u32 cpt:3;
-	u32 ack_sn:10;
-	u32 e1:1;
-	u32 more:1;
-}rlc_am_status_pdu_head_t;
-
-typedef struct rlc_li
-{
-	u32 e1:1;
-	u32 li1:11;
-	u32 e2:1;
-	u32 li2:11;
-}rlc_li_t;
-
-/* NACK_SN/E1/E2 set in Status PDU */
-typedef struct rlc_spdu_nacksn
+/* SOend in STATUS PDU: till the last byte, all ones on air (0x7FFF or 0xFFFF) */
+#define RLC_AM_SO_END 0xFFFF
+
+/* field length in bits of STATUS PDU: head (D/C, CPT, ACK_SN, E1), (NACK_SN, E1, E2) set and SO */
+#define RLC_AM_STATUS_HEAD_BITS(sn_bits) (4 + (sn_bits) + 1)
+#define RLC_AM_STATUS_NACK_BITS(sn_bits) ((sn_bits) + 2)
+#define RLC_AM_STATUS_SO_BITS(sn_bits) ((sn_bits) == 16 ? 16 : 15)
+
+/* header length in bytes */
+#define RLC_UM_HEAD_LEN_5BITS 1
+#define RLC_UM_HEAD_LEN_10BITS 2
+#define RLC_AM_HEAD_LEN 2
+#define RLC_AM_SEGMENT_HEAD_LEN 4
+#define RLC_AM_HEAD_LEN_16BITS 3
+#define RLC_AM_SEGMENT_HEAD_LEN_16BITS 5
+
+/*
+ * Header codec
+ *   Headers are read and written byte by byte with shift and mask, MSB first as
+ *   on the air, so PDUs are same on big and little endian hosts and no alignment
+ *   is needed. All accessors are inlined to a few instructions.
+ */
+
+/* get/set a field of (mask) bits at (shift) in one byte */
+static inline u32 rlc_hdr_get(const u8 *p, u32 shift, u32 mask)
 {
-	u32 nack_sn:10;
-	u32 e1:1;
-	u32 e2:1;
-	u32 reserved:20;
-}rlc_spdu_nacksn_t;
+	return (p[0] >> shift) & mask;
+}
 
-/* SOstart/SOend in Status PDU */
-typedef struct rlc_spdu_so
+static inline void rlc_hdr_set(u8 *p, u32 shift, u32 mask, u32 value)
 {
-	u32 sostart:15;
-	u32 soend:15;
-	u32 reserved:2;
-}rlc_spdu_so_t;
+	p[0] = (u8)((p[0] & ~(mask << shift)) | ((value & mask) << shift));
+}
+
+/* big endian 16 bits field */
+static inline u32 rlc_hdr_get16(const u8 *p)
+{
+	return ((u32)p[0] << 8) | p[1];
+}
+
+static inline void rlc_hdr_set16(u8 *p, u32 value)
+{
+	p[0] = (u8)(value >> 8);
+	p[1] = (u8)value;
+}
+
+/* UMD PDU, 5 bits SN: FI(2) E(1) SN(5) */
+static inline void rlc_um_head_5bits_encode(u8 *p, u32 fi, u32 e, u32 sn)
+{
+	p[0] = (u8)((fi << 6) | (e << 5) | (sn & 0x1F));
+}
+
+static inline void rlc_um_head_5bits_decode(const u8 *p, u32 *fi, u32 *e, u32 *sn)
+{
+	*fi = p[0] >> 6;
+	*e = (p[0] >> 5) & 0x01;
+	*sn = p[0] & 0x1F;
+}
+
+/* UMD PDU, 10 bits SN: R1(3) FI(2) E(1) SN(10) */
+static inline void rlc_um_head_10bits_encode(u8 *p, u32 fi, u32 e, u32 sn)
+{
+	p[0] = (u8)((fi << 3) | (e << 2) | ((sn >> 8) & 0x03));
+	p[1] = (u8)sn;
+}
+
+static inline void rlc_um_head_10bits_decode(const u8 *p, u32 *fi, u32 *e, u32 *sn)
+{
+	*fi = (p[0] >> 3) & 0x03;
+	*e = (p[0] >> 2) & 0x01;
+	*sn = ((p[0] & 0x03) << 8) | p[1];
+}
+
+/* 
+ * AMD PDU and AMD PDU segment, first byte is same for both SN length:
+ *   D/C(1) RF(1) P(1) FI(2) E(1) + SN[9:8](2) for 10 bits SN
+ *                                + R1(1) R1/LSF(1) for 16 bits SN
+ * D/C is also the first bit of STATUS PDU.
+ */
+static inline u32 rlc_am_head_get_dc(const u8 *p) { return rlc_hdr_get(p, 7, 0x01); }
+static inline u32 rlc_am_head_get_rf(const u8 *p) { return rlc_hdr_get(p, 6, 0x01); }
+static inline u32 rlc_am_head_get_p(const u8 *p) { return rlc_hdr_get(p, 5, 0x01); }
+static inline u32 rlc_am_head_get_fi(const u8 *p) { return rlc_hdr_get(p, 3, 0x03); }
+static inline u32 rlc_am_head_get_e(const u8 *p) { return rlc_hdr_get(p, 2, 0x01); }
+
+static inline void rlc_am_head_set_dc(u8 *p, u32 dc) { rlc_hdr_set(p, 7, 0x01, dc); }
+static inline void rlc_am_head_set_rf(u8 *p, u32 rf) { rlc_hdr_set(p, 6, 0x01, rf); }
+static inline void rlc_am_head_set_p(u8 *p, u32 poll) { rlc_hdr_set(p, 5, 0x01, poll); }
+static inline void rlc_am_head_set_fi(u8 *p, u32 fi) { rlc_hdr_set(p, 3, 0x03, fi); }
+static inline void rlc_am_head_set_e(u8 *p, u32 e) { rlc_hdr_set(p, 2, 0x01, e); }
+
+/* 10 bits SN: SN(10) over byte 0-1; segment adds LSF(1) SO(15) in byte 2-3 */
+static inline u32 rlc_am_head_get_sn(const u8 *p)
+{
+	return ((p[0] & 0x03) << 8) | p[1];
+}
+
+static inline void rlc_am_head_set_sn(u8 *p, u32 sn)
+{
+	rlc_hdr_set(p, 0, 0x03, sn >> 8);
+	p[1] = (u8)sn;
+}
+
+static inline u32 rlc_am_segment_head_get_lsf(const u8 *p) { return p[2] >> 7; }
+static inline u32 rlc_am_segment_head_get_so(const u8 *p) { return rlc_hdr_get16(p + 2) & 0x7FFF; }
+
+static inline void rlc_am_segment_head_set_lsf_so(u8 *p, u32 lsf, u32 so)
+{
+	rlc_hdr_set16(p + 2, (lsf << 15) | (so & 0x7FFF));
+}
+
+/* 16 bits SN: SN(16) in byte 1-2; segment has LSF as last bit of byte 0, SO(16) in byte 3-4 */
+static inline u32 rlc_am_head_16bits_get_sn(const u8 *p) { return rlc_hdr_get16(p + 1); }
+
+static inline void rlc_am_head_16bits_set_sn(u8 *p, u32 sn)
+{
+	rlc_hdr_set(p, 0, 0x03, 0);		/* R1 R1 */
+	rlc_hdr_set16(p + 1, sn);
+}
+
+static inline u32 rlc_am_segment_head_16bits_get_lsf(const u8 *p) { return p[0] & 0x01; }
+static inline u32 rlc_am_segment_head_16bits_get_so(const u8 *p) { return rlc_hdr_get16(p + 3); }
+
+static inline void rlc_am_segment_head_16bits_set_lsf_so(u8 *p, u32 lsf, u32 so)
+{
+	rlc_hdr_set(p, 0, 0x03, lsf);	/* R1 LSF */
+	rlc_hdr_set16(p + 3, so);
+}
+
+/*
+ * 11 bits LI: two LIs in 3 bytes as E1(1) LI1(11) E2(1) LI2(11),
+ *   an odd last LI takes 2 bytes with 4 bits padding.
+ */
+static inline u32 rlc_li_get_e1(const u8 *p) { return p[0] >> 7; }
+static inline u32 rlc_li_get_li1(const u8 *p) { return ((p[0] & 0x7F) << 4) | (p[1] >> 4); }
+static inline u32 rlc_li_get_e2(const u8 *p) { return (p[1] >> 3) & 0x01; }
+static inline u32 rlc_li_get_li2(const u8 *p) { return ((p[1] & 0x07) << 8) | p[2]; }
+
+/* write E1/LI1 and zero the padding */
+static inline void rlc_li_set_first(u8 *p, u32 e, u32 li)
+{
+	p[0] = (u8)((e << 7) | ((li >> 4) & 0x7F));
+	p[1] = (u8)(li << 4);
+}
+
+/* write E2/LI2, E1/LI1 must be written before */
+static inline void rlc_li_set_second(u8 *p, u32 e, u32 li)
+{
+	p[1] |= (u8)((e << 3) | ((li >> 8) & 0x07));
+	p[2] = (u8)li;
+}
+
+/* 15 bits LI: E(1) LI(15) in 2 bytes */
+static inline u32 rlc_li15_get_e(const u8 *p) { return p[0] >> 7; }
+static inline u32 rlc_li15_get_li(const u8 *p) { return rlc_hdr_get16(p) & 0x7FFF; }
+
+static inline void rlc_li15_set(u8 *p, u32 e, u32 li)
+{
+	rlc_hdr_set16(p, (e << 15) | (li & 0x7FFF));
+}
 
-#else /* __BYTE_ORDER == __LITTLE_ENDIAN */ 
-#warning "__LITTLE_ENDIAN__ won't work!!! Please enable __BIG_ENDIANS macro even RLC pairs both run on little endian CPU."
-
-typedef struct rlc_um_pdu_head_5bits
-{
-	u32 sn:5;
-	u32 e:1;
-	u32 fi:2;
-}rlc_um_pdu_head_5bits_t;
-
-typedef struct rlc_um_pdu_head_10bits
-{
-	u32 sn:10;
-	u32 e:1;
-	u32 fi:2;
-	u32 r1_3:1;
-	u32 r1_2:1;
-	u32 r1_1:1;
-}rlc_um_pdu_head_10bits_t;
-
-typedef struct rlc_am_pdu_head
-{
-	u32 sn:10;
-	u32 e:1;
-	u32 fi:2;
-	u32 p:1;
-	u32 rf:1;
-	u32 dc:1;
-}rlc_am_pdu_head_t;
-
-typedef struct rlc_am_pdu_segment_head
-{
-	u32 so:15;
-	u32 lsf:1;
-		
-	u32 sn:10;
-	u32 e:1;
-	u32 fi:2;
-	u32 p:1;
-	u32 rf:1;
-	u32 dc:1;
-}rlc_am_pdu_segment_head_t;
-
-typedef struct rlc_am_status_pdu_head
-{
-	u32 more:1;
-	u32 e1:1;
-	u32 ack_sn:10;
-	u32 cpt:3;
-	u32 dc:1;
-}rlc_am_status_pdu_head_t;
-
-typedef struct rlc_li
-{
-	u32 li2:11;
-	u32 e2:1;
-	u32 li1:11;
-	u32 e1:1;
-}rlc_li_t;
-
-/* NACK_SN/E1/E2 set in Status PDU */
+/* NACK_SN/E1/E2 set in Status PDU, decoded, wide enough for 16 bits SN */
 typedef struct rlc_spdu_nacksn
 {
-	u32 reserved:20;
-	u32 e2:1;
-	u32 e1:1;
-	u32 nack_sn:10;
+	u16 nack_sn;
+	u8 e1;
+	u8 e2;
 }rlc_spdu_nacksn_t;
 
-/* SOstart/SOend in Status PDU */
+/* SOstart/SOend in Status PDU, decoded, wide enough for 16 bits SN */
 typedef struct rlc_spdu_so
 {
-	u32 reserved:2;
-	u32 soend:15;
-	u32 sostart:15;
+	u16 sostart;
+	u16 soend;
 }rlc_spdu_so_t;
-#endif /* __BYTE_ORDER == __BIG_ENDIAN */
-#pragma pack()
 
 #endif //_RLC_PDU_H_
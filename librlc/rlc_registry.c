@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2011-2012 Phuuix Xiong <phuuix@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file
+ *   RLC entity registry: find entity by (cell, RNTI, LCID).
+ *   Entities of each type are kept back to back in their own pool, the hash
+ *   table is open addressing with linear probing and is at most half full.
+ */
+/*
+ * rlc_registry.c: RLC entity registry code
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "rlc.h"
+#include "log.h"
+
+#define RLC_REGISTRY_HASH_MUL 0x9E3779B97F4A7C15ULL		/* 2^64 / golden ratio */
+
+static inline u32 rlc_registry_hash(rlc_registry_t *reg, u64 key)
+{
+	return (u32)((key * RLC_REGISTRY_HASH_MUL) >> reg->hash_shift);
+}
+
+static int rlc_entity_pool_init(rlc_entity_pool_t *pool, u32 elemt_size, u32 elemt_num)
+{
+	u32 i;
+
+	pool->elemt_size = elemt_size;
+	pool->elemt_num = elemt_num;
+	pool->sp = 0;
+	if(elemt_num == 0)
+		return 0;
+
+	/* entities are cache line aligned, so are their hot fields */
+	if(posix_memalign((void **)&pool->base, RLC_CACHE_LINE, (size_t)elemt_num * elemt_size))
+		pool->base = NULL;
+	pool->free_stack = malloc(sizeof(u32) * elemt_num);
+	if(pool->base == NULL || pool->free_stack == NULL)
+		return -1;
+	memset(pool->base, 0, (size_t)elemt_num * elemt_size);
+
+	/* lowest index on top, so live entities stay packed at the pool head */
+	for(i=0; i<elemt_num; i++)
+		pool->free_stack[pool->sp++] = elemt_num - 1 - i;
+
+	return 0;
+}
+
+static int rlc_entity_pool_owns(rlc_entity_pool_t *pool, void *entity)
+{
+	u8 *p = (u8 *)entity;
+
+	return pool->base && p >= pool->base && p < pool->base + (size_t)pool->elemt_size * pool->elemt_num;
+}
+
+/***********************************************************************************/
+/* Function : rlc_registry_destroy                                                 */
+/***********************************************************************************/
+/* Description : - Destroy a registry and its entity pools                         */
+/*                 Entities must be removed before, so timers are stopped          */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   reg                | i  | registry                                            */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_registry_destroy(rlc_registry_t *reg)
+{
+	u32 type;
+
+	if(reg == NULL)
+		return;
+
+	if(reg->n_entity)
+		ZLOG_WARN("registry is destroyed with %u entities.\n", reg->n_entity);
+
+	for(type=RLC_ENTITY_TYPE_TM; type<=RLC_ENTITY_TYPE_AM; type++)
+	{
+		free(reg->pool[type].base);
+		free(reg->pool[type].free_stack);
+	}
+
+	free(reg->slot);
+	free(reg);
+}
+
+/***********************************************************************************/
+/* Function : rlc_registry_create                                                  */
+/***********************************************************************************/
+/* Description : - Create a registry with room for max_xx entities of each type    */
+/*                 Memory of all entities is allocated here, none on add           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   max_tm             | i  | max number of TM entities                           */
+/*   max_um             | i  | max number of UM entities                           */
+/*   max_am             | i  | max number of AM entities                           */
+/*   Return             |    | registry, NULL if out of memory                     */
+/***********************************************************************************/
+rlc_registry_t *rlc_registry_create(u32 max_tm, u32 max_um, u32 max_am)
+{
+	rlc_registry_t *reg;
+	u32 n_slot, bits, i;
+
+	reg = malloc(sizeof(rlc_registry_t));
+	if(reg == NULL)
+		return NULL;
+	memset(reg, 0, sizeof(rlc_registry_t));
+
+	/* at least twice of max entities, so probe sequences stay short */
+	for(bits=4, n_slot=16; n_slot < 2 * (max_tm + max_um + max_am); bits++)
+		n_slot <<= 1;
+	reg->slot_mask = n_slot - 1;
+	reg->hash_shift = 64 - bits;
+
+	reg->slot = malloc(sizeof(rlc_registry_slot_t) * n_slot);
+	if(reg->slot == NULL)
+		goto fail;
+	for(i=0; i<n_slot; i++)
+	{
+		reg->slot[i].key = RLC_REGISTRY_KEY_NONE;
+		reg->slot[i].entity = NULL;
+	}
+
+	if(rlc_entity_pool_init(&reg->pool[RLC_ENTITY_TYPE_TM], sizeof(rlc_entity_tm_t), max_tm) ||
+		rlc_entity_pool_init(&reg->pool[RLC_ENTITY_TYPE_UM], sizeof(rlc_entity_um_t), max_um) ||
+		rlc_entity_pool_init(&reg->pool[RLC_ENTITY_TYPE_AM], sizeof(rlc_entity_am_t), max_am))
+		goto fail;
+
+	return reg;
+
+fail:
+	ZLOG_ERR("out of memory: max_tm=%u max_um=%u max_am=%u.\n", max_tm, max_um, max_am);
+	rlc_registry_destroy(reg);
+	return NULL;
+}
+
+/***********************************************************************************/
+/* Function : rlc_registry_find                                                    */
+/***********************************************************************************/
+/* Description : - Find RLC entity of a logical channel                            */
+/*                 Entity starts with rlc_entity_common_head_t to tell its type    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   reg                | i  | registry                                            */
+/*   cell               | i  | cell index                                          */
+/*   rnti               | i  | RNTI of UE                                          */
+/*   lcid               | i  | logical channel id                                  */
+/*   Return             |    | entity, NULL if not found                           */
+/***********************************************************************************/
+void *rlc_registry_find(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid)
+{
+	u64 key = RLC_REGISTRY_KEY(cell, rnti, lcid);
+	u32 i;
+
+	for(i=rlc_registry_hash(reg, key); reg->slot[i].key != RLC_REGISTRY_KEY_NONE; i=(i+1) & reg->slot_mask)
+	{
+		if(reg->slot[i].key == key)
+			return reg->slot[i].entity;
+	}
+
+	return NULL;
+}
+
+/***********************************************************************************/
+/* Function : rlc_registry_add                                                     */
+/***********************************************************************************/
+/* Description : - Take an entity from the pool of its type and register it        */
+/*                 Caller must init it by rlc_tm_init/rlc_um_init/rlc_am_init      */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   reg                | i  | registry                                            */
+/*   cell               | i  | cell index                                          */
+/*   rnti               | i  | RNTI of UE                                          */
+/*   lcid               | i  | logical channel id                                  */
+/*   type               | i  | RLC_ENTITY_TYPE_TM, _UM or _AM                      */
+/*   Return             |    | zeroed entity, NULL if exists or pool is empty      */
+/***********************************************************************************/
+void *rlc_registry_add(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid, u16 type)
+{
+	u64 key = RLC_REGISTRY_KEY(cell, rnti, lcid);
+	rlc_entity_pool_t *pool;
+	rlc_entity_common_head_t *entity;
+	u32 i;
+
+	if(type > RLC_ENTITY_TYPE_AM)
+	{
+		ZLOG_ERR("unknown RLC type: %u.\n", type);
+		return NULL;
+	}
+
+	for(i=rlc_registry_hash(reg, key); reg->slot[i].key != RLC_REGISTRY_KEY_NONE; i=(i+1) & reg->slot_mask)
+	{
+		if(reg->slot[i].key == key)
+		{
+			ZLOG_ERR("entity exists: cell=%u rnti=%u lcid=%u.\n", cell, rnti, lcid);
+			return NULL;
+		}
+	}
+
+	pool = &reg->pool[type];
+	if(pool->sp == 0)
+	{
+		ZLOG_ERR("no free entity: cell=%u rnti=%u lcid=%u type=%u.\n", cell, rnti, lcid, type);
+		return NULL;
+	}
+
+	entity = (rlc_entity_common_head_t *)(pool->base + (size_t)pool->elemt_size * pool->free_stack[--pool->sp]);
+	memset(entity, 0, pool->elemt_size);
+	entity->type = type;
+
+	reg->slot[i].key = key;
+	reg->slot[i].entity = entity;
+	reg->n_entity ++;
+
+	return entity;
+}
+
+/***********************************************************************************/
+/* Function : rlc_registry_remove                                                  */
+/***********************************************************************************/
+/* Description : - Unregister an entity and give it back to its pool               */
+/*                 Entity is re-established, so timers are stopped and buffered    */
+/*                 SDUs and PDUs are freed, then its window arrays and SDU ingress */
+/*                 ring are freed                                                  */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   reg                | i  | registry                                            */
+/*   cell               | i  | cell index                                          */
+/*   rnti               | i  | RNTI of UE                                          */
+/*   lcid               | i  | logical channel id                                  */
+/*   Return             |    | 0 is success, -1 if not found                       */
+/***********************************************************************************/
+int rlc_registry_remove(rlc_registry_t *reg, u16 cell, u16 rnti, u8 lcid)
+{
+	u64 key = RLC_REGISTRY_KEY(cell, rnti, lcid);
+	rlc_entity_pool_t *pool;
+	void *entity;
+	u32 i, j, home, type;
+
+	for(i=rlc_registry_hash(reg, key); reg->slot[i].key != key; i=(i+1) & reg->slot_mask)
+	{
+		if(reg->slot[i].key == RLC_REGISTRY_KEY_NONE)
+		{
+			ZLOG_WARN("entity not found: cell=%u rnti=%u lcid=%u.\n", cell, rnti, lcid);
+			return -1;
+		}
+	}
+	entity = reg->slot[i].entity;
+
+	/* the pool tells entity type, type field may be changed by user */
+	for(type=RLC_ENTITY_TYPE_TM; type<=RLC_ENTITY_TYPE_AM; type++)
+	{
+		if(rlc_entity_pool_owns(&reg->pool[type], entity))
+			break;
+	}
+
+	if(type == RLC_ENTITY_TYPE_UM)
+		rlc_um_deinit((rlc_entity_um_t *)entity);
+	else if(type == RLC_ENTITY_TYPE_AM)
+		rlc_am_deinit((rlc_entity_am_t *)entity);
+	else
+		rlc_tm_reestablish((rlc_entity_tm_t *)entity);
+
+	pool = &reg->pool[type];
+	pool->free_stack[pool->sp++] = ((u8 *)entity - pool->base) / pool->elemt_size;
+	reg->n_entity --;
+
+	/* backward shift deletion: move up entries whose probe sequence crosses slot i */
+	for(j=(i+1) & reg->slot_mask; reg->slot[j].key != RLC_REGISTRY_KEY_NONE; j=(j+1) & reg->slot_mask)
+	{
+		home = rlc_registry_hash(reg, reg->slot[j].key);
+		if(((j - home) & reg->slot_mask) >= ((j - i) & reg->slot_mask))
+		{
+			reg->slot[i] = reg->slot[j];
+			i = j;
+		}
+	}
+	reg->slot[i].key = RLC_REGISTRY_KEY_NONE;
+	reg->slot[i].entity = NULL;
+
+	return 0;
+}
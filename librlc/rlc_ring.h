@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2011-2012 Phuuix Xiong <phuuix@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file
+ * Lock-free single-producer/single-consumer ring of fixed size elements (head file)
+ *   Producer only writes head, consumer only writes tail, each on its own cache
+ *   line. Elements are published by a release store of head and taken back by
+ *   a release store of tail, so no lock or atomic read-modify-write is needed.
+ *   Each side keeps a cached copy of the other index and reloads it only when
+ *   the ring looks full or empty.
+ *   Optional byte counters let the consumer see how many bytes are queued
+ *   without popping: producer adds to head_sum before it publishes head.
+ */
+
+#ifndef _RLC_RING_H_
+#define _RLC_RING_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stdtypes.h"
+
+#define RLC_CACHE_LINE 64
+
+typedef struct rlc_ring
+{
+	/* read-only after create */
+	u8 *buf;
+	u32 elemt_size;
+	u32 mask;							/* number of elements - 1 */
+	u8 pad0[RLC_CACHE_LINE - sizeof(u8 *) - 2*sizeof(u32)];
+
+	/* producer side */
+	u32 head;							/* next element to write */
+	u32 tail_cache;						/* last tail seen by producer */
+	u32 head_sum;						/* bytes pushed by rlc_ring_push_sized() */
+	u8 pad1[RLC_CACHE_LINE - 3*sizeof(u32)];
+
+	/* consumer side */
+	u32 tail;							/* next element to read */
+	u32 head_cache;						/* last head seen by consumer */
+	u32 tail_sum;						/* bytes taken by rlc_ring_consume_sum() */
+	u8 pad2[RLC_CACHE_LINE - 3*sizeof(u32)];
+}rlc_ring_t;
+
+#define RLC_RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RLC_RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* n is rounded up to power of 2, return NULL if out of memory */
+static inline rlc_ring_t *rlc_ring_create(u32 elemt_size, u32 n)
+{
+	rlc_ring_t *ring;
+	u32 size = 2;
+
+	while(size < n)
+		size <<= 1;
+
+	ring = malloc(sizeof(rlc_ring_t));
+	if(ring == NULL)
+		return NULL;
+	memset(ring, 0, sizeof(rlc_ring_t));
+
+	ring->buf = malloc((size_t)elemt_size * size);
+	if(ring->buf == NULL)
+	{
+		free(ring);
+		return NULL;
+	}
+	ring->elemt_size = elemt_size;
+	ring->mask = size - 1;
+
+	return ring;
+}
+
+static inline void rlc_ring_destroy(rlc_ring_t *ring)
+{
+	if(ring)
+	{
+		free(ring->buf);
+		free(ring);
+	}
+}
+
+/* producer: copy in one element, return -1 if full */
+static inline int rlc_ring_push(rlc_ring_t *ring, const void *elemt)
+{
+	u32 head = ring->head;
+
+	if(head - ring->tail_cache > ring->mask)
+	{
+		ring->tail_cache = RLC_RING_LOAD(&ring->tail);
+		if(head - ring->tail_cache > ring->mask)
+			return -1;
+	}
+
+	memcpy(ring->buf + (size_t)(head & ring->mask) * ring->elemt_size, elemt, ring->elemt_size);
+	RLC_RING_STORE(&ring->head, head + 1);
+
+	return 0;
+}
+
+/* producer: same as rlc_ring_push(), also count size bytes in ring */
+static inline int rlc_ring_push_sized(rlc_ring_t *ring, const void *elemt, u32 size)
+{
+	u32 head = ring->head;
+
+	if(head - ring->tail_cache > ring->mask)
+	{
+		ring->tail_cache = RLC_RING_LOAD(&ring->tail);
+		if(head - ring->tail_cache > ring->mask)
+			return -1;
+	}
+
+	memcpy(ring->buf + (size_t)(head & ring->mask) * ring->elemt_size, elemt, ring->elemt_size);
+	RLC_RING_STORE(&ring->head_sum, ring->head_sum + size);
+	RLC_RING_STORE(&ring->head, head + 1);
+
+	return 0;
+}
+
+/* consumer: copy out at most max elements, return number of elements */
+static inline u32 rlc_ring_pop_bulk(rlc_ring_t *ring, void *elemts, u32 max)
+{
+	u32 tail = ring->tail;
+	u32 n, i;
+
+	if(ring->head_cache - tail < max)
+		ring->head_cache = RLC_RING_LOAD(&ring->head);
+
+	n = ring->head_cache - tail;
+	if(n > max)
+		n = max;
+
+	for(i=0; i<n; i++)
+		memcpy((u8 *)elemts + (size_t)i * ring->elemt_size,
+			ring->buf + (size_t)((tail + i) & ring->mask) * ring->elemt_size, ring->elemt_size);
+
+	if(n)
+		RLC_RING_STORE(&ring->tail, tail + n);
+
+	return n;
+}
+
+/* number of elements in ring, exact for the consumer, a hint for others */
+static inline u32 rlc_ring_count(rlc_ring_t *ring)
+{
+	return RLC_RING_LOAD(&ring->head) - RLC_RING_LOAD(&ring->tail);
+}
+
+/* consumer: take back size bytes of elements popped by rlc_ring_pop_bulk() */
+static inline void rlc_ring_consume_sum(rlc_ring_t *ring, u32 size)
+{
+	RLC_RING_STORE(&ring->tail_sum, ring->tail_sum + size);
+}
+
+/* bytes in ring, never less than bytes of elements seen by the consumer */
+static inline u32 rlc_ring_sum(rlc_ring_t *ring)
+{
+	return RLC_RING_LOAD(&ring->head_sum) - RLC_RING_LOAD(&ring->tail_sum);
+}
+
+#endif /* _RLC_RING_H_ */
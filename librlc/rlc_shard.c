@@ -0,0 +1,374 @@
+/**
+ * Copyright (c) 2011-2012 Phuuix Xiong <phuuix@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file
+ *   Sharded RLC runtime.
+ *   UEs are hashed to N shards, each shard is served by one worker thread and
+ *   owns its entities, memory pools and timer wheel, so no lock is needed on
+ *   any RLC path. Other threads (PDCP, MAC Rx) post work to a shard through
+ *   SPSC rings, one ring per producer thread.
+ */
+/*
+ * rlc_shard.c: RLC shard and runtime code
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "rlc.h"
+#include "log.h"
+
+#define RLC_SHARD_POLL_BATCH 32
+#define RLC_SHARD_HASH_MUL 0x9E3779B1		/* 2^32 / golden ratio */
+
+static void rlc_shard_drop_msg(rlc_shard_t *shard, rlc_msg_t *msg)
+{
+	shard->n_drop_msg ++;
+	if(shard->free_buf && msg->buf_ptr)
+		shard->free_buf(msg->buf_ptr, msg->cookie);
+}
+
+/* run one message on the shard thread, buffer is always consumed */
+static void rlc_shard_dispatch(rlc_shard_t *shard, rlc_msg_t *msg)
+{
+	rlc_entity_common_head_t *entity;
+	rlc_pdu_desc_t pdu;
+	int ret = -1;
+
+	if(msg->type == RLC_MSG_CALL)
+	{
+		msg->func(shard, msg);
+		return;
+	}
+
+	entity = rlc_registry_find(shard->registry, msg->cell, msg->rnti, msg->lcid);
+	if(entity == NULL)
+	{
+		ZLOG_WARN("no entity: shard=%u cell=%u rnti=%u lcid=%u.\n", shard->id, msg->cell, msg->rnti, msg->lcid);
+		rlc_shard_drop_msg(shard, msg);
+		return;
+	}
+
+	if(msg->type == RLC_MSG_SDU)
+	{
+		if(entity->type == RLC_ENTITY_TYPE_UM)
+			ret = rlc_um_tx_sdu_enqueue(&((rlc_entity_um_t *)entity)->umtx, msg->buf_ptr, msg->buf_len, msg->cookie, NULL);
+		else if(entity->type == RLC_ENTITY_TYPE_AM)
+			ret = rlc_am_tx_sdu_enqueue(&((rlc_entity_am_t *)entity)->amtx, msg->buf_ptr, msg->buf_len, msg->cookie, NULL);
+		else
+			ret = rlc_tm_tx_sdu_enqueue((rlc_entity_tm_t *)entity, msg->buf_ptr, msg->buf_len, msg->cookie, NULL);
+
+		if(ret != 0)
+			rlc_shard_drop_msg(shard, msg);
+	}
+	else if(msg->type == RLC_MSG_PDU && entity->type == RLC_ENTITY_TYPE_TM)
+	{
+		/* TM PDU is delivered as is, not taken if no deliv function is set */
+		ret = rlc_tm_rx_process_pdu((rlc_entity_tm_t *)entity, msg->buf_ptr, msg->buf_len, msg->cookie);
+		if(ret != 0)
+			rlc_shard_drop_msg(shard, msg);
+	}
+	else if(msg->type == RLC_MSG_PDU)
+	{
+		/* batch API frees PDU even if it is discarded */
+		pdu.buf_ptr = msg->buf_ptr;
+		pdu.buf_len = msg->buf_len;
+		pdu.cookie = msg->cookie;
+		if(entity->type == RLC_ENTITY_TYPE_UM)
+			rlc_um_rx_process_pdus(&((rlc_entity_um_t *)entity)->umrx, &pdu, 1);
+		else
+			rlc_am_rx_process_pdus(&((rlc_entity_am_t *)entity)->amrx, &pdu, 1);
+	}
+	else
+		rlc_shard_drop_msg(shard, msg);
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_poll                                                       */
+/***********************************************************************************/
+/* Description : - Run messages posted to a shard, in order per producer           */
+/*                 Called by the thread bound to the shard                         */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   shard              | i  | shard                                               */
+/*   max                | i  | max number of messages to run                       */
+/*   Return             |    | number of messages run                              */
+/***********************************************************************************/
+u32 rlc_shard_poll(rlc_shard_t *shard, u32 max)
+{
+	rlc_msg_t msgs[RLC_SHARD_POLL_BATCH];
+	u32 p, i, n, n_busy, total = 0;
+
+	/* one batch per producer in turn, so a busy producer can't starve others */
+	do
+	{
+		n_busy = 0;
+		for(p=0; p<shard->n_ingress && total<max; p++)
+		{
+			n = rlc_ring_pop_bulk(shard->ingress[p], msgs, RLC_MIN(RLC_SHARD_POLL_BATCH, max - total));
+			for(i=0; i<n; i++)
+				rlc_shard_dispatch(shard, &msgs[i]);
+			total += n;
+			n_busy += (n == RLC_SHARD_POLL_BATCH);
+		}
+	}while(n_busy && total<max);
+
+	return total;
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_destroy                                                    */
+/***********************************************************************************/
+/* Description : - Remove all entities of a shard and free it                      */
+/*                 Worker thread of the shard must be stopped before               */
+/*               - Pending calls are run first, SDUs and PDUs are dropped          */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   shard              | i  | shard                                               */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_shard_destroy(rlc_shard_t *shard)
+{
+	rlc_shard_t *saved = rlc_shard_cur;
+	rlc_registry_t *reg;
+	rlc_msg_t msg;
+	u64 key;
+	u32 p, i;
+
+	if(shard == NULL)
+		return;
+
+	/* entities and buffers go back to pools of the shard */
+	rlc_shard_cur = shard;
+
+	for(p=0; p<shard->n_ingress; p++)
+	{
+		if(shard->ingress[p] == NULL)
+			continue;
+		/* calls are still run, so what they own is released by them */
+		while(rlc_ring_pop_bulk(shard->ingress[p], &msg, 1))
+		{
+			if(msg.type == RLC_MSG_CALL)
+				msg.func(shard, &msg);
+			else
+				rlc_shard_drop_msg(shard, &msg);
+		}
+		rlc_ring_destroy(shard->ingress[p]);
+	}
+
+	reg = shard->registry;
+	if(reg)
+	{
+		/* removal may shift a later entry into slot i, so check it again */
+		for(i=0; i<=reg->slot_mask; )
+		{
+			key = reg->slot[i].key;
+			if(key == RLC_REGISTRY_KEY_NONE)
+				i++;
+			else
+				rlc_registry_remove(reg, (u16)(key >> 24), (u16)(key >> 8), (u8)key);
+		}
+		rlc_registry_destroy(reg);
+	}
+
+	rlc_shard_deinit(shard);
+	free(shard);
+
+	rlc_shard_enter((saved == shard) ? NULL : saved);
+}
+
+/***********************************************************************************/
+/* Function : rlc_shard_create                                                     */
+/***********************************************************************************/
+/* Description : - Create a shard with its own pools, timer wheel and registry     */
+/*                 Pools and registry are both sized for max_xx entities           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   id                 | i  | shard id                                            */
+/*   max_tm             | i  | max number of TM entities                           */
+/*   max_um             | i  | max number of UM entities                           */
+/*   max_am             | i  | max number of AM entities                           */
+/*   n_producer         | i  | number of threads posting to shard                  */
+/*   ring_size          | i  | messages per ingress ring                           */
+/*   free_buf           | i  | free buffer of message which has no entity          */
+/*   Return             |    | shard, NULL if too many entities or out of memory   */
+/***********************************************************************************/
+rlc_shard_t *rlc_shard_create(u32 id, u32 max_tm, u32 max_um, u32 max_am, u32 n_producer, u32 ring_size,
+		void (*free_buf)(void *, void *))
+{
+	rlc_shard_t *shard;
+	u32 p;
+
+	if(n_producer > RLC_PRODUCER_MAX)
+	{
+		ZLOG_ERR("too many producers: %u.\n", n_producer);
+		return NULL;
+	}
+
+	shard = malloc(sizeof(rlc_shard_t));
+	if(shard == NULL)
+		return NULL;
+
+	if(rlc_shard_init(shard, id, max_tm, max_um, max_am))
+	{
+		free(shard);
+		return NULL;
+	}
+	shard->free_buf = free_buf;
+
+	shard->registry = rlc_registry_create(max_tm, max_um, max_am);
+	if(shard->registry == NULL)
+		goto fail;
+
+	for(p=0; p<n_producer; p++)
+	{
+		shard->ingress[p] = rlc_ring_create(sizeof(rlc_msg_t), ring_size);
+		shard->n_ingress ++;
+		if(shard->ingress[p] == NULL)
+			goto fail;
+	}
+
+	return shard;
+
+fail:
+	ZLOG_ERR("out of memory for shard %u.\n", id);
+	rlc_shard_destroy(shard);
+	return NULL;
+}
+
+/***********************************************************************************/
+/* Function : rlc_runtime_destroy                                                  */
+/***********************************************************************************/
+/* Description : - Destroy all shards of a runtime                                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rt                 | i  | runtime                                             */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_runtime_destroy(rlc_runtime_t *rt)
+{
+	u32 s;
+
+	if(rt == NULL)
+		return;
+
+	for(s=0; s<rt->n_shard; s++)
+		rlc_shard_destroy(rt->shard[s]);
+
+	free(rt);
+}
+
+/***********************************************************************************/
+/* Function : rlc_runtime_create                                                   */
+/***********************************************************************************/
+/* Description : - Create n_shard shards, max_xx entities per shard                */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   n_shard            | i  | number of shards, usually one per core              */
+/*   n_producer         | i  | number of threads posting messages                  */
+/*   ring_size          | i  | messages per ingress ring                           */
+/*   max_tm             | i  | max number of TM entities per shard                 */
+/*   max_um             | i  | max number of UM entities per shard                 */
+/*   max_am             | i  | max number of AM entities per shard                 */
+/*   free_buf           | i  | free buffer of message which has no entity          */
+/*   Return             |    | runtime, NULL on error                              */
+/***********************************************************************************/
+rlc_runtime_t *rlc_runtime_create(u32 n_shard, u32 n_producer, u32 ring_size,
+		u32 max_tm, u32 max_um, u32 max_am, void (*free_buf)(void *, void *))
+{
+	rlc_runtime_t *rt;
+	u32 s;
+
+	if(n_shard == 0 || n_shard > RLC_SHARD_MAX)
+	{
+		ZLOG_ERR("invalid number of shards: %u.\n", n_shard);
+		return NULL;
+	}
+
+	rt = malloc(sizeof(rlc_runtime_t));
+	if(rt == NULL)
+		return NULL;
+	memset(rt, 0, sizeof(rlc_runtime_t));
+	rt->n_producer = n_producer;
+
+	for(s=0; s<n_shard; s++)
+	{
+		rt->shard[s] = rlc_shard_create(s, max_tm, max_um, max_am, n_producer, ring_size, free_buf);
+		if(rt->shard[s] == NULL)
+		{
+			rlc_runtime_destroy(rt);
+			return NULL;
+		}
+		rt->n_shard ++;
+	}
+
+	return rt;
+}
+
+/***********************************************************************************/
+/* Function : rlc_runtime_get_shard                                                */
+/***********************************************************************************/
+/* Description : - Shard of a UE, all bearers of a UE are in the same shard        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rt                 | i  | runtime                                             */
+/*   cell               | i  | cell index                                          */
+/*   rnti               | i  | RNTI of UE                                          */
+/*   Return             |    | shard                                               */
+/***********************************************************************************/
+rlc_shard_t *rlc_runtime_get_shard(rlc_runtime_t *rt, u16 cell, u16 rnti)
+{
+	u32 h = (((u32)cell << 16) | rnti) * RLC_SHARD_HASH_MUL;
+
+	return rt->shard[(u32)(((u64)h * rt->n_shard) >> 32)];
+}
+
+/***********************************************************************************/
+/* Function : rlc_runtime_post                                                     */
+/***********************************************************************************/
+/* Description : - Post a message to shard of the UE, without any lock             */
+/*                 Each producer thread must use its own producer id               */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rt                 | i  | runtime                                             */
+/*   producer           | i  | producer id, 0 ~ n_producer-1                       */
+/*   msg                | i  | message, copied into ring                           */
+/*   Return             |    | 0 is success, -1 if ring is full                    */
+/***********************************************************************************/
+int rlc_runtime_post(rlc_runtime_t *rt, u32 producer, rlc_msg_t *msg)
+{
+	rlc_shard_t *shard;
+
+	if(producer >= rt->n_producer)
+		return -1;
+
+	shard = rlc_runtime_get_shard(rt, msg->cell, msg->rnti);
+	return rlc_ring_push(shard->ingress[producer], msg);
+}
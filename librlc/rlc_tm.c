@@ -92,9 +92,66 @@ int rlc_tm_reestablish(rlc_entity_tm_t *rlctm)
 }
 
 
-/* a dummy function, just for compatibility */
+/***********************************************************************************/
+/* Function : rlc_tm_set_deliv_func                                                */
+/***********************************************************************************/
+/* Description : - Set the callback function which delivers received PDUs to Upper */
+/*                 TM PDU is the SDU itself, e.g. CCCH                             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_tm             | i  | pointer of RLC TM entity                            */
+/*   deliv_sdu          | i  | function to deliver SDU                             */
+/*   free_pdu           | i  | function to free PDU buffer after delivery          */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_tm_set_deliv_func(rlc_entity_tm_t *rlc_tm, void (*deliv_sdu)(struct rlc_entity_tm *, rlc_sdu_t *), 
+		void (*free_pdu)(void *, void *))
+{
+	rlc_tm->deliv_sdu = deliv_sdu;
+	rlc_tm->free_pdu = free_pdu;
+}
+
+/***********************************************************************************/
+/* Function : rlc_tm_rx_process_pdu                                                */
+/***********************************************************************************/
+/* Description : - Deliver a received TM PDU to Upper as a SDU of one segment      */
+/*               - SDU is freed after deliv_sdu() returns, PDU buffer is freed by  */
+/*                 free_pdu() then                                                 */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   tmrx               | i  | RLC TM entity                                       */
+/*   buf_ptr            | i  | PDU buffer                                          */
+/*   buf_len            | i  | size of PDU                                         */
+/*   cookie             | i  | parameter of free function                          */
+/*   Return             |    | 0 is success, -1 if no deliv function is set or out */
+/*                      |    | of memory, PDU is not taken then                    */
+/***********************************************************************************/
 int rlc_tm_rx_process_pdu(rlc_entity_tm_t *tmrx, u8 *buf_ptr, u32 buf_len, void *cookie)
 {
+	rlc_sdu_t *sdu;
+	
+	if(tmrx == NULL || tmrx->deliv_sdu == NULL || buf_ptr == NULL || buf_len == 0)
+		return -1;
+	
+	sdu = rlc_sdu_new();
+	if(sdu == NULL)
+		return -1;
+	
+	sdu->segment[0].data = buf_ptr;
+	sdu->segment[0].length = buf_len;
+	sdu->segment[0].free = tmrx->free_pdu;
+	sdu->segment[0].cookie = cookie;
+	sdu->n_segment = 1;
+	sdu->size = buf_len;
+	sdu->intact = 1;
+	
+	tmrx->deliv_sdu(tmrx, sdu);
+	
+	rlc_sdu_free(sdu);
 	return 0;
 }
 
@@ -165,6 +222,36 @@ u32 rlc_tm_tx_estimate_pdu_size(rlc_entity_tm_t *tmtx)
 	return sdu->size;
 }
 
+/***********************************************************************************/
+/* Function : rlc_tm_tx_get_buffer_status                                          */
+/***********************************************************************************/
+/* Description : - Get buffer status of RLC TM entity in O(1)                      */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   tmtx               | i  | RLC TM entity                                       */
+/*   bs                 | o  | buffer status                                       */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_tm_tx_get_buffer_status(rlc_entity_tm_t *tmtx, rlc_buffer_status_t *bs)
+{
+	rlc_sdu_t *sdu;
+	
+	bs->status_bytes = 0;
+	bs->retx_bytes = 0;
+	bs->new_bytes = tmtx->sdu_total_size;
+	bs->n_sdu = tmtx->n_sdu;
+	bs->window_stalled = 0;
+	bs->hol_delay = 0;
+	
+	if(!DLLIST_EMPTY(&tmtx->sdu_tx_q))
+	{
+		sdu = (rlc_sdu_t *)DLLIST_HEAD(&tmtx->sdu_tx_q);
+		bs->hol_delay = rlc_get_time() - sdu->enqueue_time;
+	}
+}
+
 /***********************************************************************************/
 /* Function : rlc_tm_tx_sdu_enqueue                                                */
 /***********************************************************************************/
@@ -178,9 +265,10 @@ u32 rlc_tm_tx_estimate_pdu_size(rlc_entity_tm_t *tmtx)
 /*   buf_ptr            | i  | RLC SDU buffer pointer                              */
 /*   sdu_size           | i  | Size of SDU                                         */
 /*   cookie             | i  | parameter of free function                          */
+/*   handle             | o  | handle for rlc_tm_tx_sdu_discard(), may be NULL     */
 /*   Return             |    | 0 is success                                        */
 /***********************************************************************************/
-int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void *cookie)
+int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle)
 {
 	rlc_sdu_t *sdu;
 	
@@ -203,6 +291,7 @@ int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void
 	sdu->size = sdu_size;
 	sdu->n_segment = 1;
 	sdu->intact = 1;
+	rlc_sdu_set_handle(sdu, handle);
 	tmtx->sdu_total_size += sdu_size;
 	tmtx->n_sdu ++;
 	
@@ -211,3 +300,37 @@ int rlc_tm_tx_sdu_enqueue(rlc_entity_tm_t *tmtx, u8 *buf_ptr, u32 sdu_size, void
 	
 	return 0;
 }
+
+/***********************************************************************************/
+/* Function : rlc_tm_tx_sdu_discard                                                */
+/***********************************************************************************/
+/* Description : - Discard a SDU in Tx queue by its handle in O(1)                 */
+/*               - Called by PDCP when discard timer expires                       */
+/*               - SDU which any segment has been mapped to PDU isn't discarded    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   tmtx               | i  | RLC TM entity                                       */
+/*   handle             | i  | handle returned by rlc_tm_tx_sdu_enqueue()          */
+/*   Return             |    | 0 is success                                        */
+/***********************************************************************************/
+int rlc_tm_tx_sdu_discard(rlc_entity_tm_t *tmtx, rlc_sdu_handle_t *handle)
+{
+	int size;
+	
+	if(tmtx == NULL)
+		return -1;
+	
+	size = rlc_sdu_discard(&tmtx->sdu_tx_q, handle);
+	if(size < 0)
+		return -1;
+	
+	tmtx->sdu_total_size -= size;
+	tmtx->n_sdu --;
+	
+	ZLOG_DEBUG("TM SDU discard: logical_chan=%d sdu_size=%u total_size=%u\n",
+			tmtx->logical_chan, size, tmtx->sdu_total_size);
+	
+	return 0;
+}
@@ -37,8 +37,12 @@
 int rlc_um_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_um_pdu_t *pdu);
 rlc_um_pdu_t *rlc_um_pdu_new();
 void rlc_um_pdu_free(rlc_um_pdu_t *pdu);
-
-extern fastalloc_t *g_mem_um_pdu_base;
+rlc_um_pdu_t *rlc_um_rx_parse_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie);
+int rlc_um_rx_place_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie);
+int rlc_um_rx_place_pdu_nowin(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie);
+void rlc_um_rx_update_reordering(rlc_entity_um_rx_t *umrx);
+void rlc_um_rx_assemble_ooo_sdu(rlc_entity_um_rx_t *umrx, rlc_um_pdu_t *pdu);
+void rlc_um_rx_drop_ooo_sdu(rlc_entity_um_rx_t *umrx);
 
 /***********************************************************************************/
 /* Function : rlc_um_pdu_new                                                       */
@@ -55,10 +59,20 @@ rlc_um_pdu_t *rlc_um_pdu_new()
 {
 	rlc_um_pdu_t *pdu;
 
-	pdu = (rlc_um_pdu_t *)FASTALLOC(g_mem_um_pdu_base);
+	pdu = (rlc_um_pdu_t *)FASTALLOC(rlc_shard_cur->mem_um_pdu_base);
 	if(pdu)
 	{
-		memset(pdu, 0, sizeof(rlc_um_pdu_t));
+		/* li_s[] is written by rlc_parse_li(), no need to clear it */
+		pdu->refcnt = 0;
+		pdu->buf_ptr = NULL;
+		pdu->buf_len = 0;
+		pdu->buf_free = NULL;
+		pdu->cookie = NULL;
+		pdu->fi = 0;
+		pdu->sn = 0;
+		pdu->n_li = 0;
+		pdu->data_ptr = NULL;
+		pdu->ooo_sent = 0;
 	}
 	
 	return pdu;
@@ -87,7 +101,7 @@ void rlc_um_pdu_free(rlc_um_pdu_t *pdu)
 			if(pdu->buf_free)
 				pdu->buf_free(pdu->buf_ptr, pdu->cookie);
 
-			FASTFREE(g_mem_um_pdu_base, pdu);
+			FASTFREE(rlc_shard_cur->mem_um_pdu_base, pdu);
 		}
 	}
 }
@@ -102,7 +116,7 @@ void rlc_um_pdu_free(rlc_um_pdu_t *pdu)
 /* ---------------------|----|-----------------------------------------------------*/
 /*   Return             |    | N/A                                                 */
 /***********************************************************************************/
-static void t_Reordering_um_func(void *timer, u32 arg1, u32 arg2)
+static void t_Reordering_um_func(void *timer, size_t arg1, size_t arg2)
 {
 	rlc_entity_um_rx_t *umrx = (rlc_entity_um_rx_t *)arg1;
 	u16 sn, sn_fs;
@@ -164,9 +178,10 @@ static void t_Reordering_um_func(void *timer, u32 arg1, u32 arg2)
 /*   buf_ptr            | i  | RLC SDU buffer pointer                              */
 /*   sdu_size           | i  | Size of SDU                                         */
 /*   cookie             | i  | parameter of free function                          */
+/*   handle             | o  | handle for rlc_um_tx_sdu_discard(), may be NULL     */
 /*   Return             |    | 0 is success                                        */
 /***********************************************************************************/
-int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie)
+int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie, rlc_sdu_handle_t *handle)
 {
 	rlc_sdu_t *sdu;
 	
@@ -189,6 +204,7 @@ int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, v
 	sdu->size = sdu_size;
 	sdu->n_segment = 1;
 	sdu->intact = 1;
+	rlc_sdu_set_handle(sdu, handle);
 	umtx->sdu_total_size += sdu_size;
 	umtx->n_sdu ++;
 	
@@ -198,6 +214,106 @@ int rlc_um_tx_sdu_enqueue(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, v
 	return 0;
 }
 
+/***********************************************************************************/
+/* Function : rlc_um_tx_sdu_discard                                                */
+/***********************************************************************************/
+/* Description : - Discard a SDU in Tx queue by its handle in O(1)                 */
+/*               - Called by PDCP when discard timer expires                       */
+/*               - SDU which any segment has been mapped to PDU isn't discarded    */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umtx               | i  | RLC UM entity                                       */
+/*   handle             | i  | handle returned by rlc_um_tx_sdu_enqueue()          */
+/*   Return             |    | 0 is success                                        */
+/***********************************************************************************/
+int rlc_um_tx_sdu_discard(rlc_entity_um_tx_t *umtx, rlc_sdu_handle_t *handle)
+{
+	int size;
+	
+	if(umtx == NULL)
+		return -1;
+	
+	size = rlc_sdu_discard(&umtx->sdu_tx_q, handle);
+	if(size < 0)
+		return -1;
+	
+	umtx->sdu_total_size -= size;
+	umtx->n_sdu --;
+	
+	ZLOG_DEBUG("UM SDU discard: lcid=%d sdu_size=%u total_size=%u\n",
+			umtx->logical_chan, size, umtx->sdu_total_size);
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_tx_sdu_enqueue_batch                                          */
+/***********************************************************************************/
+/* Description : - Enqueue a burst of RLC SDUs (only one segment each)             */
+/*               - Called by PDCP, etc                                             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umtx               | i  | RLC UM entity                                       */
+/*   bufs               | i  | RLC SDU buffer pointers                             */
+/*   sizes              | i  | Size of SDUs                                        */
+/*   cookies            | i  | parameters of free function, may be NULL            */
+/*   n                  | i  | number of SDU                                       */
+/*   handles            | o  | handles for rlc_um_tx_sdu_discard(), may be NULL    */
+/*   Return             |    | number of enqueued SDU, -1 is failure               */
+/***********************************************************************************/
+int rlc_um_tx_sdu_enqueue_batch(rlc_entity_um_tx_t *umtx, u8 *bufs[], u32 sizes[], void *cookies[], u32 n, 
+		rlc_sdu_handle_t handles[])
+{
+	int n_sdu;
+	u32 total_size;
+	
+	if(umtx == NULL)
+		return -1;
+	
+	n_sdu = rlc_sdu_enqueue_batch(&umtx->sdu_tx_q, umtx->free_sdu, bufs, sizes, cookies, NULL, n, handles, &total_size);
+	if(n_sdu < 0)
+		return -1;
+	
+	umtx->sdu_total_size += total_size;
+	umtx->n_sdu += n_sdu;
+	
+	ZLOG_DEBUG("UM SDU batch enqueue: lcid=%d n_sdu=%d size=%u total_size=%u\n",
+			umtx->logical_chan, n_sdu, total_size, umtx->sdu_total_size);
+	
+	return n_sdu;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_tx_sdu_post                                                   */
+/***********************************************************************************/
+/* Description : - Post SDU to SDU ingress ring from PDCP thread, wait-free        */
+/*               - SDU is moved to Tx queue when MAC thread builds PDU             */
+/*               - No handle is given, posted SDU can't be discarded               */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umtx               | i  | RLC UM entity                                       */
+/*   buf_ptr            | i  | RLC SDU buffer pointer                              */
+/*   sdu_size           | i  | Size of SDU                                         */
+/*   cookie             | i  | parameter of free function                          */
+/*   Return             |    | 0 is success, -1 if ring is full or not enabled     */
+/***********************************************************************************/
+int rlc_um_tx_sdu_post(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u32 sdu_size, void *cookie)
+{
+	if(umtx == NULL)
+		return -1;
+	
+	if(umtx->sdu_ingress == NULL)
+		return -1;
+	
+	return rlc_sdu_ingress_post(umtx->sdu_ingress, buf_ptr, sdu_size, cookie, *umtx->ingress_clock);
+}
+
 /***********************************************************************************/
 /* Function : rlc_um_tx_estimate_pdu_size                                               */
 /***********************************************************************************/
@@ -216,24 +332,76 @@ u32 rlc_um_tx_estimate_pdu_size(rlc_entity_um_tx_t *umtx)
 	u32 head_len;
 	u32 li_len;
 	u32 pdu_size;
+	s32 n_sdu = umtx->n_sdu;
+	s32 sdu_total_size = umtx->sdu_total_size;
+	
+	/* SDUs in ingress ring will be drained by next build */
+	if(umtx->sdu_ingress)
+		rlc_sdu_ingress_pending(umtx->sdu_ingress, &n_sdu, &sdu_total_size);
 	
 	/* no data in queue */
-	if(umtx->sdu_total_size == 0)
+	if(sdu_total_size == 0)
 		return 0;
 	
 	/* get length of RLD PDU header */
 	head_len = (umtx->sn_max==RLC_SN_MAX_5BITS)?1:2;
 	
 	/* number of LI equals to n_sdu-1 */
-	li_len = ((umtx->n_sdu-1)>>1)*3;
-	if((umtx->n_sdu-1) & 0x01)
+	li_len = ((n_sdu-1)>>1)*3;
+	if((n_sdu-1) & 0x01)
 		li_len += 2;
 		
-	pdu_size = umtx->sdu_total_size + head_len + li_len;
+	pdu_size = sdu_total_size + head_len + li_len;
 	return pdu_size;
 }
 
+/***********************************************************************************/
+/* Function : rlc_um_tx_get_buffer_status                                          */
+/***********************************************************************************/
+/* Description : - Get buffer status of RLC UM entity in O(1)                      */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umtx               | i  | RLC UM entity                                       */
+/*   bs                 | o  | buffer status                                       */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_tx_get_buffer_status(rlc_entity_um_tx_t *umtx, rlc_buffer_status_t *bs)
+{
+	bs->status_bytes = 0;
+	bs->retx_bytes = 0;
+	bs->new_bytes = rlc_um_tx_estimate_pdu_size(umtx);
+	bs->n_sdu = umtx->n_sdu;
+	if(umtx->sdu_ingress)
+		bs->n_sdu += rlc_ring_count(umtx->sdu_ingress);
+	bs->hol_delay = rlc_um_tx_get_hol_delay(umtx);
+	bs->window_stalled = 0;
+}
+
+
 
+/***********************************************************************************/
+/* Function : rlc_um_tx_get_hol_delay                                              */
+/***********************************************************************************/
+/* Description : - Get sojourn time of the head-of-line SDU in Tx queue            */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umtx               | i  | RLC UM entity                                       */
+/*   Return             |    | HOL delay in unit of RLC clock, 0 if queue is empty */
+/***********************************************************************************/
+u32 rlc_um_tx_get_hol_delay(rlc_entity_um_tx_t *umtx)
+{
+	rlc_sdu_t *sdu;
+	
+	if(umtx == NULL || DLLIST_EMPTY(&umtx->sdu_tx_q))
+		return 0;
+	
+	sdu = (rlc_sdu_t *)DLLIST_HEAD(&umtx->sdu_tx_q);
+	return rlc_get_time() - sdu->enqueue_time;
+}
 
 /***********************************************************************************/
 /* Function : rlc_um_tx_build_pdu                                                  */
@@ -252,7 +420,7 @@ u32 rlc_um_tx_estimate_pdu_size(rlc_entity_um_tx_t *umtx)
 int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 {
 	u32 head_len;
-	rlc_li_t *li_ptr;
+	u8 *li_ptr;
 	u8 *data_ptr;
 	u32 data_size;
 	rlc_sdu_t *sdu;
@@ -260,12 +428,18 @@ int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 	
 	ZLOG_DEBUG("request RLC UM to build PDU: lcid=%d size=%u.\n", umtx->logical_chan, pdu_size);
 	
+	if(umtx->sdu_ingress)
+		rlc_sdu_ingress_drain(umtx->sdu_ingress, &umtx->sdu_tx_q, umtx->free_sdu, pdu_size, &umtx->n_sdu, &umtx->sdu_total_size);
+	
+	/* AQM drops SDUs staying too long in Tx queue */
+	if(umtx->aqm.target)
+		rlc_aqm_dequeue(&umtx->aqm, &umtx->sdu_tx_q, &umtx->n_sdu, &umtx->sdu_total_size);
+	
 	if(umtx->sdu_total_size == 0)		//no data in queue
 		return 0;
 
 	assert(umtx->n_sdu > 0);
 	
-	/* (1) first round: build LIs */
 	sdu = (rlc_sdu_t *)umtx->sdu_tx_q.next;
 	pdu.n_li = 0;
 	pdu.fi = 0;
@@ -279,7 +453,10 @@ int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 	if(pdu_size < head_len)		//at leaset 1 byte data
 		return 0;
 
-	pdu.n_li = rlc_build_li_from_sdu(pdu_size, head_len, &umtx->sdu_tx_q, pdu.li_s);
+	/* write LIs and data in one walk of SDU queue */
+	li_ptr = buf_ptr + head_len;
+	pdu.n_li = rlc_encode_pdu(li_ptr, pdu_size - head_len, 11, &umtx->sdu_tx_q, pdu.li_s, 
+		&data_ptr, &data_size, &umtx->delay_stats);
 	if(pdu.n_li == 0)
 	{
 		ZLOG_WARN("RLC build LI: number of LI is 0, lcid=%d.\n", umtx->logical_chan);
@@ -289,14 +466,6 @@ int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 	assert(pdu.n_li <= umtx->n_sdu);
 	assert(pdu.n_li <= RLC_LI_NUM_MAX);
 	
-	/* (2) second round: write LIs and data */
-	li_ptr = (rlc_li_t *)(buf_ptr + head_len);
-	rlc_encode_li(li_ptr, pdu.n_li, pdu.li_s);
-	
-	data_ptr = (u8 *)li_ptr + ((pdu.n_li-1)>>1)*3;
-	if((pdu.n_li & 0x01) == 0)
-		data_ptr += 2;
-	data_size = rlc_encode_sdu(data_ptr, pdu.n_li, pdu.li_s, &umtx->sdu_tx_q);
 	data_ptr += (data_size & 0xFFFF);
 	umtx->sdu_total_size -= (data_size & 0xFFFF);
 	umtx->n_sdu -= (data_size >> 16);
@@ -317,30 +486,13 @@ int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 	
 	/* set RLC PDU header */
 	if(umtx->sn_max== RLC_SN_MAX_5BITS)
-	{
-		rlc_um_pdu_head_5bits_t *pdu_head;
-		pdu_head = (rlc_um_pdu_head_5bits_t *)buf_ptr;
-		pdu_head->e = (pdu.n_li > 1);
-		pdu_head->fi = pdu.fi;
-		pdu_head->sn = umtx->VT_US;
-
-		ZLOG_DEBUG("After build: lcid=%d fi=%u sn=%u n_li=%u li_s=(%u %u %u ..)\n", 
-			umtx->logical_chan, pdu_head->fi, pdu_head->sn, pdu.n_li, 
-			pdu.li_s[0], pdu.li_s[1], pdu.li_s[2]);
-	}
+		rlc_um_head_5bits_encode(buf_ptr, pdu.fi, (pdu.n_li > 1), umtx->VT_US);
 	else
-	{
-		rlc_um_pdu_head_10bits_t *pdu_head;
-		pdu_head = (rlc_um_pdu_head_10bits_t *)buf_ptr;
-		*buf_ptr = 0;			//set r1
-		pdu_head->e = (pdu.n_li > 1);
-		pdu_head->fi = pdu.fi;
-		pdu_head->sn = umtx->VT_US;
+		rlc_um_head_10bits_encode(buf_ptr, pdu.fi, (pdu.n_li > 1), umtx->VT_US);
 
-		ZLOG_DEBUG("After build: lcid=%d fi=%u sn=%u n_li=%u li_s=(%u %u %u ..)\n", 
-			umtx->logical_chan, pdu_head->fi, pdu_head->sn, pdu.n_li, 
-			pdu.li_s[0], pdu.li_s[1], pdu.li_s[2]);
-	}
+	ZLOG_DEBUG("After build: lcid=%d fi=%u sn=%u n_li=%u li_s=(%u %u %u ..)\n", 
+		umtx->logical_chan, pdu.fi, umtx->VT_US, pdu.n_li, 
+		pdu.li_s[0], pdu.li_s[1], pdu.li_s[2]);
 	
 	/* update UM counter */
 	umtx->VT_US++;
@@ -359,12 +511,95 @@ int rlc_um_tx_build_pdu(rlc_entity_um_tx_t *umtx, u8 *buf_ptr, u16 pdu_size)
 /* Interface :                                                                     */
 /*      Name            | io |       Description                                   */
 /* ---------------------|----|-----------------------------------------------------*/
-/*   Return             |    | Size of RLC PDU                                     */
+/*   Return             |    | 0 is success, -1 if PDU is discarded                */
 /***********************************************************************************/
 int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie)
 {
-	u16 sn, sn_fs, sn_reodering_low;
-	rlc_li_t *li_ptr = NULL;
+	/* no reordering: nothing to do but deliver */
+	if(umrx->UM_Window_Size == 0)
+	{
+		if(rlc_um_rx_place_pdu_nowin(umrx, buf_ptr, buf_len, cookie))
+			return -1;
+		
+		rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_assembly_q);
+		return 0;
+	}
+	
+	if(rlc_um_rx_place_pdu(umrx, buf_ptr, buf_len, cookie))
+		return -1;
+	
+	rlc_um_rx_update_reordering(umrx);
+	
+	/* deliver intact SDU to upper */
+	rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_ooo_q);
+	rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_assembly_q);
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_rx_process_pdus                                               */
+/***********************************************************************************/
+/* Description : - receive all UM PDUs of one MAC TB                               */
+/*               - t-Reordering is checked and SDUs are delivered once after all   */
+/*                 PDUs are placed, as if the PDUs are received at the same time   */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umrx               | io | RLC UM Rx entity                                    */
+/*   pdus               | i  | received PDUs, all are freed by umrx->free_pdu()    */
+/*   n                  | i  | number of PDUs                                      */
+/*   Return             |    | number of PDUs placed in reception buffer           */
+/***********************************************************************************/
+u32 rlc_um_rx_process_pdus(rlc_entity_um_rx_t *umrx, rlc_pdu_desc_t pdus[], u32 n)
+{
+	u32 i, n_placed = 0;
+	
+	if(umrx->UM_Window_Size == 0)
+	{
+		for(i=0; i<n; i++)
+		{
+			if(rlc_um_rx_place_pdu_nowin(umrx, pdus[i].buf_ptr, pdus[i].buf_len, pdus[i].cookie) == 0)
+				n_placed ++;
+		}
+		
+		if(n_placed)
+			rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_assembly_q);
+		
+		return n_placed;
+	}
+	
+	for(i=0; i<n; i++)
+	{
+		if(rlc_um_rx_place_pdu(umrx, pdus[i].buf_ptr, pdus[i].buf_len, pdus[i].cookie) == 0)
+			n_placed ++;
+	}
+	
+	if(n_placed)
+	{
+		rlc_um_rx_update_reordering(umrx);
+		rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_ooo_q);
+		rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_assembly_q);
+	}
+	
+	return n_placed;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_rx_parse_pdu                                                  */
+/***********************************************************************************/
+/* Description : - parse header and LIs of one UM PDU                              */
+/*               - the PDU buffer is freed if it is wrong                          */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   Return             |    | PDU control info, NULL if PDU is discarded          */
+/***********************************************************************************/
+rlc_um_pdu_t *rlc_um_rx_parse_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie)
+{
+	u8 *li_ptr = NULL;
 	u32 e;
 	rlc_um_pdu_t *pdu;
 			
@@ -374,7 +609,7 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 	{
 		ZLOG_ERR("out of memory for new UM PDU: lcid=%d.\n", umrx->logical_chan);
 		umrx->free_pdu(buf_ptr, cookie);
-		return -1;
+		return NULL;
 	}
 	pdu->buf_ptr = buf_ptr;
 	pdu->buf_len = buf_len;
@@ -384,31 +619,62 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 	/* parse header */
 	if(umrx->sn_max == RLC_SN_MAX_5BITS)
 	{
-		rlc_um_pdu_head_5bits_t *pdu_hdr;
-		
-		pdu_hdr = (rlc_um_pdu_head_5bits_t *)buf_ptr;
-		pdu->fi = pdu_hdr->fi;
-		sn = pdu->sn = pdu_hdr->sn;
-		sn_fs = RLC_SN_MAX_5BITS+1;
-		buf_len -= 1;
-		li_ptr = (rlc_li_t *)(pdu_hdr+1);
-		e = pdu_hdr->e;
+		rlc_um_head_5bits_decode(buf_ptr, &pdu->fi, &e, &pdu->sn);
+		buf_len -= RLC_UM_HEAD_LEN_5BITS;
+		li_ptr = buf_ptr + RLC_UM_HEAD_LEN_5BITS;
 	}
 	else
 	{
-		rlc_um_pdu_head_10bits_t *pdu_hdr;
-		
-		pdu_hdr = (rlc_um_pdu_head_10bits_t *)buf_ptr;
-		pdu->fi = pdu_hdr->fi;
-		sn = pdu->sn = pdu_hdr->sn;
-		sn_fs = RLC_SN_MAX_10BITS+1;
-		buf_len -= 2;
-		li_ptr = (rlc_li_t *)(pdu_hdr+1);
-		e = pdu_hdr->e;
+		rlc_um_head_10bits_decode(buf_ptr, &pdu->fi, &e, &pdu->sn);
+		buf_len -= RLC_UM_HEAD_LEN_10BITS;
+		li_ptr = buf_ptr + RLC_UM_HEAD_LEN_10BITS;
 	}
 	
 	ZLOG_DEBUG("RLC UM process PDU: lcid=%d sn=%u fi=%u pdu_size=%u VR_UR=%u VR_UX=%u VR_UH=%u.\n", 
-			umrx->logical_chan, sn, pdu->fi, pdu->buf_len, umrx->VR_UR, umrx->VR_UX, umrx->VR_UH);
+			umrx->logical_chan, pdu->sn, pdu->fi, pdu->buf_len, umrx->VR_UR, umrx->VR_UX, umrx->VR_UH);
+	
+ 	pdu->n_li = rlc_parse_li(e, li_ptr, buf_len, &pdu->data_ptr, pdu->li_s);
+ 	if(pdu->n_li <= 0 || pdu->n_li > RLC_LI_NUM_MAX)
+ 	{
+ 		ZLOG_WARN("wrong UM PDU: lcid=%d n_li=%d, sn=%u, size=%d.\n", umrx->logical_chan, (int)pdu->n_li, pdu->sn, buf_len);
+ 		umrx->n_discard_pdu ++;
+ 		rlc_um_pdu_free(pdu);
+ 		return NULL;
+ 	}
+	
+	return pdu;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_rx_place_pdu                                                  */
+/***********************************************************************************/
+/* Description : - place one UM PDU in reception buffer and update VR(UR)/VR(UH)   */
+/*               - the assembled SDU is append to entity's SDU queue               */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   Return             |    | 0 is success, -1 if PDU is discarded                */
+/***********************************************************************************/
+int rlc_um_rx_place_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie)
+{
+	u16 sn, sn_fs, sn_reodering_low;
+	rlc_um_pdu_t *pdu;
+	
+	/* hibernated entity, umrx is the first field of rlc_entity_um_t */
+	if(umrx->pdu == NULL && rlc_um_resume((rlc_entity_um_t *)umrx))
+	{
+		umrx->n_discard_pdu ++;
+		umrx->free_pdu(buf_ptr, cookie);
+		return -1;
+	}
+	
+	pdu = rlc_um_rx_parse_pdu(umrx, buf_ptr, buf_len, cookie);
+	if(pdu == NULL)
+		return -1;
+	
+	sn = pdu->sn;
+	sn_fs = umrx->sn_max+1;
 			
 	/* Receive operations */
 	
@@ -443,17 +709,13 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 /*
  -	place the received UMD PDU in the reception buffer.
  */
- 	pdu->n_li = rlc_parse_li(e, li_ptr, buf_len, &pdu->data_ptr, pdu->li_s);
- 	if(pdu->n_li <= 0 || pdu->n_li > RLC_LI_NUM_MAX)
- 	{
- 		ZLOG_WARN("wrong UM PDU: lcid=%d n_li=%d, sn=%u, size=%d.\n", umrx->logical_chan, (int)pdu->n_li, sn, buf_len);
- 		umrx->n_discard_pdu ++;
- 		rlc_um_pdu_free(pdu);
- 		return -1;
- 	}
- 	/* store pdu */
+ 	/* store pdu: reference of reception buffer is released in rlc_um_rx_assemble_sdu() */
 	assert(umrx->pdu[sn] == NULL);
 	umrx->pdu[sn] = pdu;
+	RLC_REF(pdu);
+	
+	if(umrx->ooo_deliv)
+		rlc_um_rx_assemble_ooo_sdu(umrx, pdu);
 
 /*
  -	if x falls outside of the reordering window:
@@ -509,7 +771,70 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 		
 		umrx->VR_UR = RLC_MOD(sn, sn_fs);
 	}
+	
+	return 0;
+}
 
+/***********************************************************************************/
+/* Function : rlc_um_rx_place_pdu_nowin                                            */
+/***********************************************************************************/
+/* Description : - receive one UM PDU when UM_Window_Size is 0                     */
+/*               - Every PDU falls outside of the reordering window, so it is      */
+/*                 reassembled at once: no reception buffer, no t-Reordering       */
+/*               - VR(UR) and VR(UH) are always the next expected SN, a gap in SN  */
+/*                 discards the SDU waiting for its remaining segments             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   Return             |    | 0 is success, -1 if PDU is discarded                */
+/***********************************************************************************/
+int rlc_um_rx_place_pdu_nowin(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, void *cookie)
+{
+	rlc_um_pdu_t *pdu;
+	rlc_sdu_t *sdu;
+	
+	pdu = rlc_um_rx_parse_pdu(umrx, buf_ptr, buf_len, cookie);
+	if(pdu == NULL)
+		return -1;
+	
+	if(pdu->sn != umrx->VR_UH)
+	{
+		sdu = (rlc_sdu_t *)DLLIST_TAIL(&umrx->sdu_assembly_q);
+		if(!DLLIST_IS_HEAD(&umrx->sdu_assembly_q, sdu) && !sdu->intact)
+		{
+			ZLOG_WARN("UM PDU lost before sn=%u, discard SDU: lcid=%d VR_UH=%u.\n", 
+					pdu->sn, umrx->logical_chan, umrx->VR_UH);
+			dllist_remove(&umrx->sdu_assembly_q, (dllist_node_t *)sdu);
+			rlc_sdu_free(sdu);
+		}
+	}
+	
+	umrx->VR_UH = RLC_MOD(pdu->sn+1, umrx->sn_max+1);
+	umrx->VR_UR = umrx->VR_UH;
+	
+	/* reference is released in rlc_um_rx_assemble_sdu() */
+	RLC_REF(pdu);
+	rlc_um_rx_assemble_sdu(&umrx->sdu_assembly_q, pdu);
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_rx_update_reordering                                          */
+/***********************************************************************************/
+/* Description : - stop or start t-Reordering after UM PDUs are placed             */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umrx               | io | RLC UM Rx entity                                    */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_rx_update_reordering(rlc_entity_um_rx_t *umrx)
+{
+	u16 sn_fs = umrx->sn_max+1;
+	u16 sn_reodering_low = RLC_MOD(umrx->VR_UH - umrx->UM_Window_Size, sn_fs);
 
 /*
  -	if t-Reordering is running:
@@ -547,11 +872,6 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 	
 	ZLOG_DEBUG("RLC UM Counter after processing: lcid=%d VR_UR=%u VR_UX=%u VR_UH=%u.\n", 
 			umrx->logical_chan, umrx->VR_UR, umrx->VR_UX, umrx->VR_UH);
-	
-	/* deliver intact SDU to upper */
-	rlc_um_rx_delivery_sdu(umrx, &umrx->sdu_assembly_q);
-	
-	return 0;	
 }
 
 /***********************************************************************************/
@@ -568,6 +888,23 @@ int rlc_um_rx_process_pdu(rlc_entity_um_rx_t *umrx, u8 *buf_ptr, u32 buf_len, vo
 void rlc_um_rx_delivery_sdu(rlc_entity_um_rx_t *umrx, dllist_node_t *sdu_assembly_q)
 {
 	rlc_sdu_t *sdu;
+	rlc_sdu_t *sdus[RLC_SDU_BATCH_MAX];
+	u32 n;
+	
+	/* SDUs have been delivered by rlc_um_rx_assemble_ooo_sdu() */
+	if(umrx->ooo_deliv && umrx->UM_Window_Size && sdu_assembly_q == &umrx->sdu_assembly_q)
+		rlc_um_rx_drop_ooo_sdu(umrx);
+	
+	if(umrx->deliv_sdu_batch)
+	{
+		/* SDUs are owned by upper from now */
+		while((n = rlc_sdu_dequeue_intact(sdu_assembly_q, sdus, RLC_SDU_BATCH_MAX)) > 0)
+		{
+			ZLOG_DEBUG("deliver %u SDUs to upper: lcid=%d.\n", n, umrx->logical_chan);
+			umrx->deliv_sdu_batch(umrx, sdus, n);
+		}
+		return;
+	}
 	
 	sdu = (rlc_sdu_t *)sdu_assembly_q->next;
 	while((dllist_node_t *)sdu != sdu_assembly_q)
@@ -654,6 +991,7 @@ int rlc_um_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_um_pdu_t *pdu)
 			ZLOG_WARN("SDU is intact, but FI in PDU is RLC_FI_NFIRST_XLAST, sn=%u.\n", pdu->sn);
 			li_idx ++;	//drop this segment
 			li_len += pdu->li_s[0];
+			sdu = NULL;	//and don't touch the intact SDU
 		}
 		else{
 			if(sdu->n_segment < RLC_SDU_SEGMENT_MAX)
@@ -676,6 +1014,7 @@ int rlc_um_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_um_pdu_t *pdu)
 				/* discard sdu */
 				dllist_remove(sdu_assembly_q, (dllist_node_t *)sdu);
 				rlc_sdu_free(sdu);
+				sdu = NULL;
 			}
 			
 			//anyway, move to next LI
@@ -705,14 +1044,161 @@ int rlc_um_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_um_pdu_t *pdu)
 	}
 	
 	/* last LI */
-	if(!is_last)
+	if(!is_last && sdu)
 	{
 		sdu->intact = 0;
 	}
 	
+	/* release reference of reception buffer */
+	rlc_um_pdu_free(pdu);
+	
 	return 0;
 }
 
+/***********************************************************************************/
+/* Function : rlc_um_rx_assemble_ooo_sdu                                           */
+/***********************************************************************************/
+/* Description : - Assemble SDUs which have bytes in the PDU and have all bytes    */
+/*                 received, to umrx->sdu_ooo_q, no matter of VR(UR)               */
+/*               - A SDU may span several SNs: the scan goes back from the PDU     */
+/*                 while its head continues a SDU of previous SN, and forward      */
+/*                 while its tail goes on in next SN, over middle PDUs             */
+/*               - First piece of each delivered SDU is marked in ooo_sent, so     */
+/*                 rlc_um_rx_drop_ooo_sdu() drops it after in-order assembly       */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   umrx               | io | RLC UM Rx entity                                    */
+/*   pdu                | i  | PDU control info pointer                            */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_rx_assemble_ooo_sdu(rlc_entity_um_rx_t *umrx, rlc_um_pdu_t *pdu)
+{
+	rlc_sdu_segment_t piece[RLC_SDU_SEGMENT_MAX];
+	rlc_um_pdu_t *cur, *first_pdu = NULL;
+	rlc_sdu_t *sdu;
+	u32 sn_fs = umrx->sn_max + 1;
+	u32 sn, lo, hi, n, j, li_idx, li_len, first_li = 0, n_piece = 0, size = 0;
+	u32 collecting = 0, has_new = 0;
+	u32 is_first, is_last;
+	
+	/* PDUs are in reception buffer only, an SDU has at most RLC_SDU_SEGMENT_MAX pieces */
+	lo = hi = pdu->sn;
+	cur = pdu;
+	for(n=0; n<RLC_SDU_SEGMENT_MAX && (cur->fi & 0x02); n++)
+	{
+		sn = RLC_MOD(lo + sn_fs - 1, sn_fs);
+		if((cur = umrx->pdu[sn]) == NULL)
+			break;
+		
+		lo = sn;
+		if(cur->fi != 0x03 || cur->n_li != 1)
+			break;
+	}
+	
+	cur = pdu;
+	for(n=0; n<RLC_SDU_SEGMENT_MAX && (cur->fi & 0x01); n++)
+	{
+		sn = RLC_MOD(hi + 1, sn_fs);
+		if((cur = umrx->pdu[sn]) == NULL)
+			break;
+		
+		hi = sn;
+		if(cur->fi != 0x03 || cur->n_li != 1)
+			break;
+	}
+	
+	for(sn=lo; ; sn=RLC_MOD(sn + 1, sn_fs))
+	{
+		cur = umrx->pdu[sn];
+		li_len = 0;
+		
+		for(li_idx=0; li_idx<cur->n_li; li_idx++)
+		{
+			is_first = (li_idx > 0) || !(cur->fi & 0x02);
+			is_last = (li_idx+1 < cur->n_li) || !(cur->fi & 0x01);
+			
+			if(is_first)
+			{
+				collecting = 1;
+				n_piece = 0;
+				size = 0;
+				has_new = 0;
+				first_pdu = cur;
+				first_li = li_idx;
+			}
+			
+			if(collecting && n_piece < RLC_SDU_SEGMENT_MAX)
+			{
+				piece[n_piece].data = cur->data_ptr + li_len;
+				piece[n_piece].length = cur->li_s[li_idx];
+				piece[n_piece].cookie = cur;
+				piece[n_piece].free = rlc_um_rxseg_free;
+				size += cur->li_s[li_idx];
+				has_new |= (cur == pdu);
+				n_piece ++;
+				
+				/* SDUs without bytes in this PDU are delivered before, or wait for it */
+				if(is_last)
+				{
+					collecting = 0;
+					
+					if(has_new && (sdu = rlc_sdu_new()) != NULL)
+					{
+						for(j=0; j<n_piece; j++)
+						{
+							RLC_REF((rlc_um_pdu_t *)piece[j].cookie);
+							sdu->segment[j] = piece[j];
+						}
+						sdu->n_segment = n_piece;
+						sdu->size = size;
+						sdu->intact = 1;
+						dllist_append(&umrx->sdu_ooo_q, (dllist_node_t *)sdu);
+						first_pdu->ooo_sent |= 1u << first_li;
+					}
+				}
+			}
+			else
+				collecting = 0;
+			
+			li_len += cur->li_s[li_idx];
+		}
+		
+		if(sn == hi)
+			break;
+	}
+}
+
+/* drop SDUs delivered out of order from assembly queue, they are known by their first piece */
+void rlc_um_rx_drop_ooo_sdu(rlc_entity_um_rx_t *umrx)
+{
+	rlc_um_pdu_t *pdu;
+	rlc_sdu_t *sdu, *next;
+	u32 li_idx;
+	u8 *data_ptr;
+	
+	sdu = (rlc_sdu_t *)umrx->sdu_assembly_q.next;
+	while(((dllist_node_t *)sdu != &umrx->sdu_assembly_q) && sdu->intact)
+	{
+		next = (rlc_sdu_t *)sdu->node.next;
+		
+		/* LI of first piece in its PDU */
+		pdu = (rlc_um_pdu_t *)sdu->segment[0].cookie;
+		data_ptr = pdu->data_ptr;
+		for(li_idx=0; li_idx<pdu->n_li && data_ptr<sdu->segment[0].data; li_idx++)
+			data_ptr += pdu->li_s[li_idx];
+		
+		if(li_idx < RLC_LI_NUM_MAX && (pdu->ooo_sent & (1u << li_idx)))
+		{
+			dllist_remove(&umrx->sdu_assembly_q, (dllist_node_t *)sdu);
+			rlc_sdu_free(sdu);
+		}
+		
+		sdu = next;
+	}
+}
+
 
 /***********************************************************************************/
 /* Function : rlc_um_init                                                          */
@@ -728,9 +1214,9 @@ int rlc_um_rx_assemble_sdu(dllist_node_t *sdu_assembly_q, rlc_um_pdu_t *pdu)
 /*   t_Reordering       | i  | t_Reodering timer duration                          */
 /*   free_pdu          | i  | function to free pdu                                 */
 /*   free_sdu          | i   | function to free sdu                                */
-/*   Return             |    | N/A                                                 */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
 /***********************************************************************************/
-void rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t_Reordering,
+int rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t_Reordering,
 		void (*free_pdu)(void *, void *), void (*free_sdu)(void *, void *))
 {
 	memset(rlc_um, 0, sizeof(rlc_entity_um_t));
@@ -743,7 +1229,7 @@ void rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t
 	rlc_um->umrx.UM_Window_Size = UM_Window_Size;
 	rlc_um->umrx.t_Reordering.duration = t_Reordering;
 	rlc_um->umrx.t_Reordering.onexpired_func = t_Reordering_um_func;
-	rlc_um->umrx.t_Reordering.param[0] = (u32)&rlc_um->umrx;
+	rlc_um->umrx.t_Reordering.param[0] = (size_t)&rlc_um->umrx;
 	rlc_um->umrx.t_Reordering.param[1] = 0;
 
 	rlc_um->umrx.free_pdu = free_pdu;
@@ -752,7 +1238,121 @@ void rlc_um_init(rlc_entity_um_t *rlc_um, int sn_bits, u32 UM_Window_Size, u32 t
 	rlc_um->umtx.free_sdu = free_sdu;
 	
 	dllist_init(&(rlc_um->umrx.sdu_assembly_q));
+	dllist_init(&(rlc_um->umrx.sdu_ooo_q));
 	dllist_init(&(rlc_um->umtx.sdu_tx_q));
+	
+	/* reception buffer is out of line, PDUs are never reordered without window */
+	if(UM_Window_Size)
+	{
+		rlc_um->umrx.pdu = rlc_window_new(rlc_um->umrx.sn_max + 1);
+		if(rlc_um->umrx.pdu == NULL)
+		{
+			ZLOG_ERR("out of memory: UM reception buffer, sn_bits=%d.\n", sn_bits);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_deinit                                                        */
+/***********************************************************************************/
+/* Description : - Re-establish UM entity and free its reception buffer and SDU    */
+/*                 ingress ring, rlc_um_init() is needed to use it again           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | i  | UM entity                                           */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_deinit(rlc_entity_um_t *rlc_um)
+{
+	if(rlc_um == NULL)
+		return;
+	
+	rlc_um_reestablish(rlc_um);
+	rlc_um_set_sdu_ingress(rlc_um, 0);
+	
+	rlc_window_free(rlc_um->umrx.pdu, rlc_um->umrx.sn_max + 1);
+	rlc_um->umrx.pdu = NULL;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_hibernate                                                     */
+/***********************************************************************************/
+/* Description : - Give back reception buffer of an idle UM entity to the shard,   */
+/*                 only state variables and config are kept                        */
+/*               - Entity is idle if no SDU is queued, no PDU is in reception      */
+/*                 buffer and t-Reordering is stopped. A SDU whose last part is    */
+/*                 lost may stay in assembly queue, it doesn't use the window      */
+/*               - Reception buffer is allocated again on next received PDU, or    */
+/*                 by rlc_um_resume()                                              */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | io | UM entity                                           */
+/*   Return             |    | 0 is success, -1 if entity is not idle              */
+/***********************************************************************************/
+int rlc_um_hibernate(rlc_entity_um_t *rlc_um)
+{
+	rlc_entity_um_rx_t *umrx;
+	rlc_entity_um_tx_t *umtx;
+	
+	if(rlc_um == NULL)
+		return -1;
+	
+	umrx = &rlc_um->umrx;
+	umtx = &rlc_um->umtx;
+	if(umtx->n_sdu || (umtx->sdu_ingress && rlc_ring_count(umtx->sdu_ingress)) ||
+		umrx->VR_UR != umrx->VR_UH || !DLLIST_EMPTY(&umrx->sdu_ooo_q) || 
+		rlc_timer_is_running(&umrx->t_Reordering))
+	{
+		ZLOG_DEBUG("UM entity is not idle: lcid=%d n_sdu=%d VR(UR)=%u VR(UH)=%u.\n", 
+			umrx->logical_chan, umtx->n_sdu, umrx->VR_UR, umrx->VR_UH);
+		return -1;
+	}
+	
+	/* nothing to give back if already hibernated or without window */
+	rlc_window_free(umrx->pdu, umrx->sn_max + 1);
+	umrx->pdu = NULL;
+	
+	return 0;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_resume                                                        */
+/***********************************************************************************/
+/* Description : - Allocate reception buffer of a hibernated UM entity again       */
+/*               - Called by Rx path on next PDU, upper needn't call it            */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | io | UM entity                                           */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
+/***********************************************************************************/
+int rlc_um_resume(rlc_entity_um_t *rlc_um)
+{
+	rlc_entity_um_rx_t *umrx;
+	
+	if(rlc_um == NULL)
+		return -1;
+	
+	umrx = &rlc_um->umrx;
+	if(umrx->pdu || umrx->UM_Window_Size == 0)
+		return 0;
+	
+	umrx->pdu = rlc_window_new(umrx->sn_max + 1);
+	if(umrx->pdu == NULL)
+	{
+		ZLOG_ERR("out of memory: UM reception buffer, lcid=%d.\n", umrx->logical_chan);
+		return -1;
+	}
+	
+	return 0;
 }
 
 /***********************************************************************************/
@@ -774,6 +1374,103 @@ void rlc_um_set_deliv_func(rlc_entity_um_t *rlc_um, void (*deliv_sdu)(struct rlc
 		rlc_um->umrx.deliv_sdu = deliv_sdu;
 }
 
+/***********************************************************************************/
+/* Function : rlc_um_set_deliv_batch_func                                          */
+/***********************************************************************************/
+/* Description : - deliver reassembled SDUs to Upper up to RLC_SDU_BATCH_MAX a call*/
+/*               - same as rlc_am_set_deliv_batch_func()                           */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | i  | UM entity                                           */
+/*   deliv_sdu_batch    | i  | delivery function provided by upper, NULL to unset  */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_set_deliv_batch_func(rlc_entity_um_t *rlc_um, void (*deliv_sdu_batch)(struct rlc_entity_um_rx *, rlc_sdu_t *[], u32))
+{
+	if(rlc_um)
+		rlc_um->umrx.deliv_sdu_batch = deliv_sdu_batch;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_set_ooo_delivery                                              */
+/***********************************************************************************/
+/* Description : - Enable or disable out-of-order SDU delivery                     */
+/*               - If enabled, a SDU wholly carried in one UMD PDU is delivered    */
+/*                 on reception, without waiting for reordering                    */
+/*               - Should be set before any PDU is received                        */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | i  | UM entity                                           */
+/*   enable             | i  | 1: enable; 0: disable                               */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_set_ooo_delivery(rlc_entity_um_t *rlc_um, u32 enable)
+{
+	if(rlc_um)
+		rlc_um->umrx.ooo_deliv = enable;
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_set_aqm                                                       */
+/***********************************************************************************/
+/* Description : - Enable or disable AQM (CoDel) on SDU Tx queue                   */
+/*               - Time is in unit of RLC clock (rlc_timer_push)                   */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | i  | UM entity                                           */
+/*   target             | i  | target sojourn time, 0 to disable AQM               */
+/*   interval           | i  | sliding window of sojourn time above target         */
+/*   Return             |    | N/A                                                 */
+/***********************************************************************************/
+void rlc_um_set_aqm(rlc_entity_um_t *rlc_um, u32 target, u32 interval)
+{
+	if(rlc_um)
+		rlc_aqm_init(&rlc_um->umtx.aqm, target, interval);
+}
+
+/***********************************************************************************/
+/* Function : rlc_um_set_sdu_ingress                                               */
+/***********************************************************************************/
+/* Description : - Enable or disable SDU ingress ring of Tx entity                 */
+/*               - Called before PDCP thread starts posting or after it stops      */
+/*               - SDUs left in old ring are moved to Tx queue                     */
+/*                                                                                 */
+/* Interface :                                                                     */
+/*      Name            | io |       Description                                   */
+/* ---------------------|----|-----------------------------------------------------*/
+/*   rlc_um             | i  | UM entity                                           */
+/*   n                  | i  | max number of SDU in ring, 0 to disable             */
+/*   Return             |    | 0 is success, -1 if out of memory                   */
+/***********************************************************************************/
+int rlc_um_set_sdu_ingress(rlc_entity_um_t *rlc_um, u32 n)
+{
+	rlc_entity_um_tx_t *umtx;
+	
+	if(rlc_um == NULL)
+		return -1;
+	
+	umtx = &rlc_um->umtx;
+	if(umtx->sdu_ingress)
+	{
+		rlc_sdu_ingress_drain(umtx->sdu_ingress, &umtx->sdu_tx_q, umtx->free_sdu, RLC_SDU_INGRESS_ALL, &umtx->n_sdu, &umtx->sdu_total_size);
+		rlc_sdu_ingress_destroy(umtx->sdu_ingress, umtx->free_sdu);
+		umtx->sdu_ingress = NULL;
+	}
+	
+	if(n == 0)
+		return 0;
+	
+	umtx->sdu_ingress = rlc_sdu_ingress_create(n);
+	umtx->ingress_clock = &rlc_shard_cur->clock;
+	return umtx->sdu_ingress ? 0 : -1;
+}
+
 
 /***********************************************************************************/
 /* Function : rlc_um_reestablish                                                   */
@@ -835,6 +1532,8 @@ int rlc_um_reestablish(rlc_entity_um_t *rlcum)
 -	if it is a transmitting UM RLC entity:
 	-	discard all RLC SDUs;
 */
+	if(umtx->sdu_ingress)
+		rlc_sdu_ingress_drain(umtx->sdu_ingress, &umtx->sdu_tx_q, umtx->free_sdu, RLC_SDU_INGRESS_ALL, &umtx->n_sdu, &umtx->sdu_total_size);
 	while(!DLLIST_EMPTY(&umtx->sdu_tx_q))
 	{
 		sdu = (rlc_sdu_t *)(umtx->sdu_tx_q.next);